@@ -0,0 +1,24 @@
+/* Frozen Lua modules */
+
+#ifndef lfrozen_h
+#define lfrozen_h
+
+#include "lua.h"
+
+#include <stddef.h>
+
+/*
+ * A frozen module is a precompiled chunk stored in flash. When it's loaded,
+ * the code and line info vectors of its functions are used in place,
+ * instead of being copied to RAM.
+ */
+typedef struct {
+  const char *name;  /* module name */
+  const char *code;  /* precompiled chunk, 4-byte aligned */
+  size_t size;       /* chunk size */
+} luaR_frozen;
+
+const luaR_frozen *luaR_findfrozen(const char *name);
+int luaR_loadfrozen(lua_State *L, const luaR_frozen *module);
+
+#endif
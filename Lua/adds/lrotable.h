@@ -80,10 +80,16 @@ void luaR_next(lua_State *L, void *data, TValue *key, TValue *val);
 int luaR_isrotable(const void *p);
 LUA_API void lua_pushrotable (lua_State *L, void *p);
 const TValue *luaL_rometatable(const void *data);
+const TValue *luaH_getint_ro (void *t, lua_Integer key);
+const TValue *luaH_getstr_ro (void *t, TString *key);
+const TValue *luaH_get_ro (void *t, const TValue *key);
 int luaH_getn_ro (void *t);
 void luaR_next(lua_State *L, void *data, TValue *key, TValue *val);
 int luaH_next_ro (lua_State *L, void *t, StkId key);
 
+const TValue *luaB_findglobal (const char *name, size_t len);
+int luaB_index (lua_State *L);
+
 int luaR_index(lua_State *L, const void *funcs, const void *consts);
 int luaR_error(lua_State *L);
 LUALIB_API int luaL_newmetarotable (lua_State *L, const char* tname, void *p);
@@ -23,7 +23,42 @@
 	#define luai_threadyield(L) 
 #endif
 
+#if LUA_USE_SAFE_SIGNAL
+	// Signals are queued by _pthread_queue_signal, and processed by the
+	// VM at safe points (backward jumps and calls), see lvm.c
+	extern volatile uint32_t _pthread_signal_pending;
+	void _pthread_process_signal(lua_State *L);
 
+	#define luai_checksignal(L) {if (_pthread_signal_pending) _pthread_process_signal(L);}
+#else
+	#define luai_checksignal(L)
+#endif
+
+
+
+// Numbers are written without snprintf when possible, see lobject.c
+LUAI_FUNC int luaO_int2str (char *buff, size_t sz, lua_Integer n);
+LUAI_FUNC int luaO_flt2str (char *buff, size_t sz, lua_Number n);
+
+// Buffer size for them
+#define LUAI_MAXNUMBER2STR	50
+
+#undef  lua_integer2str
+#define lua_integer2str(s,sz,n)	luaO_int2str((s), (sz), (n))
+
+#undef  lua_number2str
+#define lua_number2str(s,sz,n)	luaO_flt2str((s), (sz), (n))
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+// Exact "%.<p>f" / "%.<p>g" for string.format, -1 if not handled
+LUAI_FUNC int luaO_fmtflt (char *buff, int conv, int prec, lua_Number n);
+
+#define lua_number2fmt(s,c,p,n)	luaO_fmtflt((s), (c), (p), (n))
+
+// The FPU only does single precision, and powf is a long routine, so x^2
+// (as in distances and sensor calibrations) is a multiplication
+#define luai_numpow(L,a,b)	((void)L, ((b) == 2) ? (a)*(a) : l_mathop(pow)(a,b))
+#endif
 
 #undef  LUA_PROMPT
 #define LUA_PROMPT		"> "
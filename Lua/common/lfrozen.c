@@ -0,0 +1,62 @@
+/* Frozen Lua modules */
+
+#include "luartos.h"
+
+#if LUA_USE_FROZEN
+
+#include "lua.h"
+#include "lapi.h"
+#include "lauxlib.h"
+#include "lfrozen.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Frozen modules are generated at build time from the Lua sources in the
+ * Lua/frozen directory, using Lua/frozen/mkfrozen.sh.
+ */
+#include "../frozen/frozen.inc"
+
+const luaR_frozen *luaR_findfrozen(const char *name) {
+	const luaR_frozen *module = lua_frozen;
+
+	while (module->name) {
+		if (strcmp(module->name, name) == 0) {
+			return module;
+		}
+
+		module++;
+	}
+
+	return NULL;
+}
+
+// Reader for the chunk of a frozen module, that is read in one block
+static const char *frozen_reader(lua_State *L, void *ud, size_t *size) {
+	const luaR_frozen **module = (const luaR_frozen **)ud;
+	const char *code;
+
+	(void)L;
+
+	if (!*module) {
+		return NULL;
+	}
+
+	code = (*module)->code;
+	*size = (*module)->size;
+	*module = NULL;
+
+	return code;
+}
+
+int luaR_loadfrozen(lua_State *L, const luaR_frozen *module) {
+	char chunkname[LUA_IDSIZE];
+
+	snprintf(chunkname, sizeof(chunkname), "=%s", module->name);
+
+	// Chunk is in flash, so it can be used in place
+	return luaA_loadinplace(L, frozen_reader, &module, chunkname);
+}
+
+#endif
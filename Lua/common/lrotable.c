@@ -10,6 +10,7 @@
 #include "lobject.h"
 #include "lrotable.h"
 #include "lstring.h"
+#include "lvm.h"
 #include "lua.h"
 #include <string.h>
 
@@ -79,8 +80,8 @@ static const TValue *luaR_auxfind(const luaR_entry *pentry, const char *strkey,
 	int i = 0;
 
 	while (entry->key.id.strkey) {
-		if (((entry->key.type == LUA_TSTRING) && (strcmp(entry->key.id.strkey, strkey) == 0)) ||
-			(((entry->key.type & 0b111) == LUA_TNUMBER) && ((luaR_numkey)entry->key.id.numkey == numkey))) {
+		if ((strkey && (entry->key.type == LUA_TSTRING) && (strcmp(entry->key.id.strkey, strkey) == 0)) ||
+			(!strkey && ((entry->key.type & 0b111) == LUA_TNUMBER) && ((luaR_numkey)entry->key.id.numkey == numkey))) {
 			res = &entry->value;
 			break;
 		}
@@ -117,6 +118,40 @@ const TValue *luaR_findentry(const void *pentry, const char *strkey,
 		return luaR_auxfind(lua_rotable, strkey, numkey, ppos);
 	}
 }
+/*
+ * Raw access to a rotable. These are the counterparts of luaH_getint,
+ * luaH_getstr and luaH_get, used by the VM (see luaV_fastget) when the
+ * indexed value is tagged as LUA_TROTABLE, so that RAM tables never need
+ * to check if they are placed in flash.
+ */
+const TValue *luaH_getint_ro(void *t, lua_Integer key) {
+	return luaR_auxfind((const luaR_entry *) t, NULL, (luaR_numkey) key, NULL);
+}
+
+const TValue *luaH_getstr_ro(void *t, TString *key) {
+	return luaR_auxfind((const luaR_entry *) t, getstr(key), 0, NULL);
+}
+
+const TValue *luaH_get_ro(void *t, const TValue *key) {
+	switch (ttype(key)) {
+		case LUA_TSHRSTR:
+		case LUA_TLNGSTR:
+			return luaH_getstr_ro(t, tsvalue(key));
+		case LUA_TNUMINT:
+			return luaH_getint_ro(t, ivalue(key));
+		case LUA_TNUMFLT: {
+			lua_Integer k;
+
+			if (luaV_tointeger(key, &k, 0))
+				return luaH_getint_ro(t, k);
+
+			return luaO_nilobject;
+		}
+		default:
+			return luaO_nilobject;
+	}
+}
+
 extern uint32_t _rodata_start;
 extern uint32_t _lit4_end;
 extern uint32_t _lua_rtos_rodata_start;
@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+# Lua RTOS, generate frozen Lua modules
+#
+# Compiles each .lua file in this directory into a precompiled chunk, and
+# generates frozen.inc, that is included by Lua/common/lfrozen.c. Frozen
+# modules are found by require before searching the file system, and their
+# code is executed in place from flash.
+#
+# Module name is the file name, with '_' replaced by '.' (for example
+# net_http.lua is required as "net.http").
+#
+# A host luac is built from the Lua RTOS sources with the same number
+# configuration than the target (32-bit integers and single precision floats
+# by default, see NUMBERS), so a C compiler with -m32 support is needed. The
+# host tests freeze modules for the host itself, with an empty HOSTFLAGS.
+#
+# Usage: Lua/frozen/mkfrozen.sh [-s] [src [out]]
+#
+#   -s   strip debug information
+#   src  directory of the .lua files (this directory by default)
+#   out  directory where frozen.inc is generated (src by default)
+#
+
+FROZEN=$(cd $(dirname $0) && pwd)
+ROOT=$(cd $FROZEN/../.. && pwd)
+HOSTCC=${HOSTCC:-gcc}
+HOSTFLAGS=${HOSTFLAGS--m32}
+NUMBERS=${NUMBERS:--DLUA_32BITS}   # -DLUA_C89_NUMBERS for double floats
+STRIP=
+BUILD=$(mktemp -d)
+
+if [ "$1" = "-s" ]; then
+	STRIP=-s
+	shift
+fi
+
+SRC=$(cd ${1:-$FROZEN} && pwd)
+OUT=$(cd ${2:-$SRC} && pwd)/frozen.inc
+
+trap "rm -rf $BUILD" EXIT
+
+# Stubs needed for build Lua RTOS sources on the host
+mkdir -p $BUILD/freertos
+touch $BUILD/freertos/FreeRTOS.h $BUILD/esp_task.h
+echo "#define CONFIG_LUA_RTOS_LUA_USE__G 1" > $BUILD/sdkconfig.h
+echo "#define CONFIG_LUA_RTOS_LUA_USE_FROZEN 1" >> $BUILD/sdkconfig.h
+cat > $BUILD/stubs.c <<STUBS
+#include "lrotable.h"
+const luaR_entry lua_rotable[] = {{LRO_NILKEY, LRO_NILVAL}};
+uint32_t _rodata_start, _lit4_end, _lua_rtos_rodata_start, _lua_rtos_rodata_end;
+STUBS
+
+SRCS=""
+for f in lapi lauxlib lbaselib lcode lctype ldebug ldo ldump lfunc lgc llex lmem \
+         lobject lopcodes lparser lstate lstring ltable ltm lundump lvm lzio luac; do
+	SRCS="$SRCS $ROOT/Lua/src/$f.c"
+done
+
+$HOSTCC $HOSTFLAGS -O1 -w -std=gnu99 $NUMBERS -DLUA_USE_CTYPE \
+	-Dluac_main=main -I$BUILD -I$ROOT -I$ROOT/Lua/adds -I$ROOT/Lua/src -I$ROOT/Lua/common \
+	$SRCS $ROOT/Lua/common/lrotable.c $BUILD/stubs.c -o $BUILD/luac -lm || exit 1
+
+cat > $OUT <<HEADER
+/*
+ * Frozen Lua modules.
+ *
+ * This file is generated by mkfrozen.sh from the .lua files in this
+ * directory. Don't edit.
+ */
+
+HEADER
+
+MODULES=""
+for src in $SRC/*.lua; do
+	[ -f "$src" ] || continue
+
+	file=$(basename $src .lua)
+	name=$(echo $file | tr '_' '.')
+	cname=frozen_$(echo $file | tr -c 'A-Za-z0-9_\n' '_')
+
+	(cd $SRC && $BUILD/luac $STRIP -c $cname -o $BUILD/$file.inc $file.lua) || exit 1
+	cat $BUILD/$file.inc >> $OUT
+	echo >> $OUT
+
+	MODULES="$MODULES  {\"$name\", $cname, sizeof($cname)},\n"
+	echo "$name: $(wc -c < $src) bytes of source"
+done
+
+printf "static const luaR_frozen lua_frozen[] = {\n$MODULES  {NULL, NULL, 0}\n};\n" >> $OUT
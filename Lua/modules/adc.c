@@ -37,6 +37,7 @@
 #include "auxmods.h"
 #include "error.h"
 #include "adc.h"
+#include "array.h"
 #include "modules.h"
 
 #include <stdio.h>
@@ -72,13 +73,32 @@ static int ladc_setup( lua_State* L ) {
 
 static int ladc_read( lua_State* L ) {
     int raw;
-    double mvlots;
+    float mvlots;
 	driver_error_t *error;
     adc_userdata *adc = NULL;
 
     adc = (adc_userdata *)luaL_checkudata(L, 1, "adc.chan");
     luaL_argcheck(L, adc, 1, "adc expected");
 
+#if LUA_USE_ARRAY
+    array_userdata_t *array;
+    size_t i;
+
+    // Capture one sample per element. Integer arrays get raw values, and
+    // float arrays get millivolts.
+    if ((array = luaL_testarray(L, 2))) {
+        for(i = 0; i < array->len; i++) {
+            if ((error = adc_read(adc->adc, adc->chan, &raw, &mvlots))) {
+            	return luaL_driver_error(L, error);
+            }
+
+            array_set(array, i, (array->type == ARRAY_FLOAT32) ? mvlots : raw);
+        }
+
+        return 1;
+    }
+#endif
+
     if ((error = adc_read(adc->adc, adc->chan, &raw, &mvlots))) {
     	return luaL_driver_error(L, error);
     } else {
@@ -0,0 +1,660 @@
+/*
+ * Lua RTOS, Lua typed array module
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if LUA_USE_ARRAY
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "array.h"
+#include "buffer.h"
+#include "modules.h"
+
+#include <math.h>
+#include <string.h>
+
+static const uint8_t array_size[] = {sizeof(int16_t), sizeof(int32_t), sizeof(float)};
+
+// Largest length whose userdata size doesn't overflow a size_t
+#define ARRAY_MAXLEN(type) ((SIZE_MAX - sizeof(array_userdata_t)) / array_size[type])
+
+// Results of a statistics pass over an array
+typedef struct {
+	int64_t isum;    // sum, for integer arrays
+	float   fsum;    // sum, for float arrays
+	float   sumsq;   // sum of squares
+	float   min, max;
+	size_t  imin, imax;
+} array_stats_t;
+
+array_userdata_t *luaL_newarray(lua_State *L, int type, size_t len) {
+	array_userdata_t *array;
+
+	if (len > ARRAY_MAXLEN(type)) {
+		luaL_error(L, "array too large");
+	}
+
+	array = (array_userdata_t *)lua_newuserdata(L, sizeof(array_userdata_t) + len * array_size[type]);
+	array->type = type;
+	array->len = len;
+	array->data = (void *)(array + 1);
+
+	luaL_getmetatable(L, "array.ins");
+	lua_setmetatable(L, -2);
+
+	return array;
+}
+
+array_userdata_t *luaL_testarray(lua_State *L, int idx) {
+	return (array_userdata_t *)luaL_testudata(L, idx, "array.ins");
+}
+
+array_userdata_t *luaL_checkarray(lua_State *L, int idx) {
+	array_userdata_t *array;
+
+	array = (array_userdata_t *)luaL_checkudata(L, idx, "array.ins");
+	luaL_argcheck(L, array, idx, "array expected");
+
+	return array;
+}
+
+// Store a value, rounding and saturating it for integer arrays (NaN is stored as 0)
+void array_set(array_userdata_t *array, size_t i, lua_Number value) {
+	switch (array->type) {
+		case ARRAY_INT16:
+			value = l_mathop(floor)(value + 0.5);
+			if (value != value) ((int16_t *)array->data)[i] = 0;
+			else if (value >= (lua_Number)INT16_MAX) ((int16_t *)array->data)[i] = INT16_MAX;
+			else if (value <= (lua_Number)INT16_MIN) ((int16_t *)array->data)[i] = INT16_MIN;
+			else ((int16_t *)array->data)[i] = (int16_t)value;
+			break;
+
+		case ARRAY_INT32:
+			value = l_mathop(floor)(value + 0.5);
+			if (value != value) ((int32_t *)array->data)[i] = 0;
+			else if (value >= (lua_Number)INT32_MAX) ((int32_t *)array->data)[i] = INT32_MAX;
+			else if (value <= (lua_Number)INT32_MIN) ((int32_t *)array->data)[i] = INT32_MIN;
+			else ((int32_t *)array->data)[i] = (int32_t)value;
+			break;
+
+		default:
+			((float *)array->data)[i] = (float)value;
+	}
+}
+
+float array_get(array_userdata_t *array, size_t i) {
+	switch (array->type) {
+		case ARRAY_INT16: return (float)((int16_t *)array->data)[i];
+		case ARRAY_INT32: return (float)((int32_t *)array->data)[i];
+		default: return ((float *)array->data)[i];
+	}
+}
+
+// Push element i, as an integer for integer arrays
+static void pushelem(lua_State *L, array_userdata_t *array, size_t i) {
+	switch (array->type) {
+		case ARRAY_INT16: lua_pushinteger(L, ((int16_t *)array->data)[i]); break;
+		case ARRAY_INT32: lua_pushinteger(L, ((int32_t *)array->data)[i]); break;
+		default: lua_pushnumber(L, ((float *)array->data)[i]);
+	}
+}
+
+/*
+ * Get the elements of an array as floats. Float arrays are used in place,
+ * other arrays and tables are converted into a scratch userdata that is
+ * left on the stack.
+ */
+static float *tofloat(lua_State *L, int arg, size_t *len) {
+	array_userdata_t *array;
+	float *v;
+	size_t i;
+
+	if ((array = luaL_testarray(L, arg))) {
+		*len = array->len;
+		if (array->type == ARRAY_FLOAT32) {
+			return (float *)array->data;
+		}
+
+		v = (float *)lua_newuserdata(L, (array->len + 1) * sizeof(float));
+		for(i = 0; i < array->len; i++) {
+			v[i] = array_get(array, i);
+		}
+	} else {
+		luaL_checktype(L, arg, LUA_TTABLE);
+
+		*len = lua_rawlen(L, arg);
+		v = (float *)lua_newuserdata(L, (*len + 1) * sizeof(float));
+		for(i = 0; i < *len; i++) {
+			lua_rawgeti(L, arg, i + 1);
+			v[i] = (float)luaL_checknumber(L, -1);
+			lua_pop(L, 1);
+		}
+	}
+
+	return v;
+}
+
+#define STATS_LOOP(ctype, acc) \
+	{ \
+		ctype *p = (ctype *)array->data; \
+		for(i = 0; i < array->len; i++) { \
+			float v = (float)p[i]; \
+			acc += p[i]; \
+			stats->sumsq += v * v; \
+			if (v < stats->min) {stats->min = v; stats->imin = i;} \
+			if (v > stats->max) {stats->max = v; stats->imax = i;} \
+		} \
+	}
+
+static void getstats(array_userdata_t *array, array_stats_t *stats) {
+	size_t i;
+
+	memset(stats, 0, sizeof(array_stats_t));
+	stats->min = HUGE_VALF;
+	stats->max = -HUGE_VALF;
+
+	switch (array->type) {
+		case ARRAY_INT16: STATS_LOOP(int16_t, stats->isum); break;
+		case ARRAY_INT32: STATS_LOOP(int32_t, stats->isum); break;
+		default: STATS_LOOP(float, stats->fsum);
+	}
+}
+
+static int checkelemtype(lua_State *L, int arg) {
+	int type = luaL_checkinteger(L, arg);
+
+	luaL_argcheck(L, (type >= ARRAY_INT16) && (type <= ARRAY_FLOAT32), arg, "invalid type");
+
+	return type;
+}
+
+// Get a 1-based index argument
+static size_t checkindex(lua_State *L, array_userdata_t *array, int arg) {
+	lua_Integer i = luaL_checkinteger(L, arg);
+
+	luaL_argcheck(L, (i >= 1) && ((lua_Unsigned)i <= array->len), arg, "out of range");
+
+	return (size_t)i - 1;
+}
+
+// array.new(type, len [, value]), array.new(type, table) or array.new(type, buffer)
+static int larray_new(lua_State *L) {
+	int type = checkelemtype(L, 1);
+	array_userdata_t *array;
+	size_t i;
+
+#if LUA_USE_BUFFER
+	buffer_userdata_t *buffer;
+
+	// Samples captured into a buffer, in native byte order
+	if ((buffer = luaL_testbuffer(L, 2))) {
+		array = luaL_newarray(L, type, buffer->size / array_size[type]);
+		memcpy(array->data, buffer->data, array->len * array_size[type]);
+
+		return 1;
+	}
+#endif
+
+	if (lua_type(L, 2) == LUA_TTABLE) {
+		size_t len = lua_rawlen(L, 2);
+
+		array = luaL_newarray(L, type, len);
+		for(i = 0; i < len; i++) {
+			lua_rawgeti(L, 2, i + 1);
+			array_set(array, i, luaL_checknumber(L, -1));
+			lua_pop(L, 1);
+		}
+	} else {
+		lua_Integer len = luaL_checkinteger(L, 2);
+		lua_Number value = luaL_optnumber(L, 3, 0);
+
+		luaL_argcheck(L, (len >= 0) && ((lua_Unsigned)len <= ARRAY_MAXLEN(type)), 2, "invalid length");
+
+		array = luaL_newarray(L, type, (size_t)len);
+		if (value == 0) {
+			memset(array->data, 0, array->len * array_size[type]);
+		} else {
+			for(i = 0; i < array->len; i++) {
+				array_set(array, i, value);
+			}
+		}
+	}
+
+	return 1;
+}
+
+static int larray_len(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+
+	lua_pushinteger(L, array->len);
+
+	return 1;
+}
+
+static int larray_get(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+
+	pushelem(L, array, checkindex(L, array, 2));
+
+	return 1;
+}
+
+static int larray_set(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+
+	array_set(array, checkindex(L, array, 2), luaL_checknumber(L, 3));
+
+	return 0;
+}
+
+static int larray_fill(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	lua_Number value = luaL_checknumber(L, 2);
+	size_t i;
+
+	for(i = 0; i < array->len; i++) {
+		array_set(array, i, value);
+	}
+
+	lua_settop(L, 1);
+
+	return 1;
+}
+
+static int larray_totable(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	size_t i;
+
+	lua_createtable(L, array->len, 0);
+	for(i = 0; i < array->len; i++) {
+		pushelem(L, array, i);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
+}
+
+static int larray_sum(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	array_stats_t stats;
+
+	getstats(array, &stats);
+	if (array->type == ARRAY_FLOAT32) {
+		lua_pushnumber(L, stats.fsum);
+	} else if ((stats.isum >= LUA_MININTEGER) && (stats.isum <= LUA_MAXINTEGER)) {
+		lua_pushinteger(L, (lua_Integer)stats.isum);
+	} else {
+		lua_pushnumber(L, (lua_Number)stats.isum);
+	}
+
+	return 1;
+}
+
+static int larray_mean(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	array_stats_t stats;
+
+	luaL_argcheck(L, array->len > 0, 1, "empty array");
+
+	getstats(array, &stats);
+	if (array->type == ARRAY_FLOAT32) {
+		lua_pushnumber(L, stats.fsum / array->len);
+	} else {
+		lua_pushnumber(L, (lua_Number)stats.isum / array->len);
+	}
+
+	return 1;
+}
+
+// Returns the minimum value and its index
+static int larray_min(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	array_stats_t stats;
+
+	luaL_argcheck(L, array->len > 0, 1, "empty array");
+
+	getstats(array, &stats);
+	pushelem(L, array, stats.imin);
+	lua_pushinteger(L, stats.imin + 1);
+
+	return 2;
+}
+
+// Returns the maximum value and its index
+static int larray_max(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	array_stats_t stats;
+
+	luaL_argcheck(L, array->len > 0, 1, "empty array");
+
+	getstats(array, &stats);
+	pushelem(L, array, stats.imax);
+	lua_pushinteger(L, stats.imax + 1);
+
+	return 2;
+}
+
+static int larray_rms(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	array_stats_t stats;
+
+	luaL_argcheck(L, array->len > 0, 1, "empty array");
+
+	getstats(array, &stats);
+	lua_pushnumber(L, sqrtf(stats.sumsq / array->len));
+
+	return 1;
+}
+
+// array:scale(gain [, offset]), in place
+static int larray_scale(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	float gain = (float)luaL_checknumber(L, 2);
+	float offset = (float)luaL_optnumber(L, 3, 0);
+	size_t i;
+
+	if (array->type == ARRAY_FLOAT32) {
+		float *p = (float *)array->data;
+
+		for(i = 0; i < array->len; i++) {
+			p[i] = p[i] * gain + offset;
+		}
+	} else {
+		for(i = 0; i < array->len; i++) {
+			array_set(array, i, array_get(array, i) * gain + offset);
+		}
+	}
+
+	lua_settop(L, 1);
+
+	return 1;
+}
+
+// array:fir(coefficients), returns a float32 array. Samples before the
+// first one are taken as 0.
+static int larray_fir(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	array_userdata_t *out;
+	size_t nx, nb, i, k;
+	const float *x, *b;
+	float *y, acc;
+
+	x = tofloat(L, 1, &nx);
+	b = tofloat(L, 2, &nb);
+
+	out = luaL_newarray(L, ARRAY_FLOAT32, array->len);
+	y = (float *)out->data;
+
+	for(i = 0; i < nx; i++) {
+		acc = 0;
+		for(k = 0; (k < nb) && (k <= i); k++) {
+			acc += b[k] * x[i - k];
+		}
+		y[i] = acc;
+	}
+
+	return 1;
+}
+
+// array:iir(b, a), direct form II transposed, returns a float32 array
+static int larray_iir(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	array_userdata_t *out;
+	size_t nx, nb, na, order, i, k;
+	const float *x, *b, *a;
+	float *y, *z, xi, yi, a0;
+
+	x = tofloat(L, 1, &nx);
+	b = tofloat(L, 2, &nb);
+	a = tofloat(L, 3, &na);
+
+	luaL_argcheck(L, (na > 0) && (a[0] != 0), 3, "a[1] must be non zero");
+
+	order = ((na > nb) ? na : nb) - 1;
+	z = (float *)lua_newuserdata(L, (order + 1) * sizeof(float));
+	memset(z, 0, (order + 1) * sizeof(float));
+
+	out = luaL_newarray(L, ARRAY_FLOAT32, array->len);
+	y = (float *)out->data;
+	a0 = a[0];
+
+	for(i = 0; i < nx; i++) {
+		xi = x[i];
+		yi = ((nb > 0) ? b[0] * xi : 0) / a0 + z[0];
+
+		for(k = 1; k <= order; k++) {
+			z[k - 1] = ((k < order) ? z[k] : 0) +
+					   ((k < nb) ? b[k] * xi : 0) / a0 -
+					   ((k < na) ? a[k] * yi : 0) / a0;
+		}
+
+		y[i] = yi;
+	}
+
+	return 1;
+}
+
+// array:decimate(factor), keeps one of each factor samples
+static int larray_decimate(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	lua_Integer factor = luaL_checkinteger(L, 2);
+	array_userdata_t *out;
+	size_t i, j;
+
+	luaL_argcheck(L, factor > 0, 2, "invalid factor");
+
+	out = luaL_newarray(L, array->type, (array->len + factor - 1) / factor);
+	for(i = 0, j = 0; i < array->len; i += factor, j++) {
+		memcpy((uint8_t *)out->data + j * array_size[array->type],
+			   (uint8_t *)array->data + i * array_size[array->type], array_size[array->type]);
+	}
+
+	return 1;
+}
+
+// In place, iterative radix-2 FFT. n must be a power of 2.
+static void fft(float *re, float *im, size_t n) {
+	size_t i, j, k, m, step;
+	float tr, ti, wr, wi, wpr, wpi, wt, theta;
+
+	// Bit reversal permutation
+	for(i = 0, j = 0; i < n; i++) {
+		if (j > i) {
+			tr = re[j]; re[j] = re[i]; re[i] = tr;
+			ti = im[j]; im[j] = im[i]; im[i] = ti;
+		}
+
+		m = n >> 1;
+		while ((m >= 1) && (j & m)) {
+			j &= ~m;
+			m >>= 1;
+		}
+		j |= m;
+	}
+
+	// Butterflies, with twiddle factors got by recurrence
+	for(step = 1; step < n; step <<= 1) {
+		theta = -3.14159265358979f / step;
+		wt = sinf(0.5f * theta);
+		wpr = -2.0f * wt * wt;
+		wpi = sinf(theta);
+		wr = 1.0f;
+		wi = 0.0f;
+
+		for(k = 0; k < step; k++) {
+			for(i = k; i < n; i += step << 1) {
+				j = i + step;
+				tr = wr * re[j] - wi * im[j];
+				ti = wr * im[j] + wi * re[j];
+				re[j] = re[i] - tr;
+				im[j] = im[i] - ti;
+				re[i] += tr;
+				im[i] += ti;
+			}
+
+			wt = wr;
+			wr += wr * wpr - wi * wpi;
+			wi += wi * wpr + wt * wpi;
+		}
+	}
+}
+
+static array_userdata_t *dofft(lua_State *L, array_userdata_t **im) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	array_userdata_t *re;
+	size_t i;
+
+	luaL_argcheck(L, (array->len > 0) && ((array->len & (array->len - 1)) == 0), 1, "length must be a power of 2");
+
+	re = luaL_newarray(L, ARRAY_FLOAT32, array->len);
+	*im = luaL_newarray(L, ARRAY_FLOAT32, array->len);
+
+	for(i = 0; i < array->len; i++) {
+		((float *)re->data)[i] = array_get(array, i);
+	}
+	memset((*im)->data, 0, array->len * sizeof(float));
+
+	fft((float *)re->data, (float *)(*im)->data, array->len);
+
+	return re;
+}
+
+// array:fft(), returns real and imaginary parts as float32 arrays
+static int larray_fft(lua_State *L) {
+	array_userdata_t *im;
+
+	dofft(L, &im);
+
+	return 2;
+}
+
+// array:spectrum(), returns the magnitude of the first n / 2 + 1 bins
+static int larray_spectrum(lua_State *L) {
+	array_userdata_t *re, *im, *out;
+	size_t i, n;
+
+	re = dofft(L, &im);
+	n = re->len / 2 + 1;
+
+	out = luaL_newarray(L, ARRAY_FLOAT32, n);
+	for(i = 0; i < n; i++) {
+		float r = ((float *)re->data)[i];
+		float m = ((float *)im->data)[i];
+
+		((float *)out->data)[i] = sqrtf(r * r + m * m);
+	}
+
+	return 1;
+}
+
+/*
+ * array:crossings(threshold [, hysteresis]), returns an int32 array with
+ * the index of each sample where the signal crosses threshold, in any
+ * direction. With hysteresis, the signal must go over threshold + hysteresis
+ * or below threshold - hysteresis to count.
+ */
+static int larray_crossings(lua_State *L) {
+	array_userdata_t *array = luaL_checkarray(L, 1);
+	float threshold = (float)luaL_checknumber(L, 2);
+	float hysteresis = (float)luaL_optnumber(L, 3, 0);
+	array_userdata_t *out;
+	size_t i, count, pass;
+	int32_t *idx = NULL;
+	int above;
+	float v;
+
+	luaL_argcheck(L, hysteresis >= 0, 3, "must be positive");
+
+	// First pass counts crossings, second one stores them
+	out = NULL;
+	for(pass = 0; pass < 2; pass++) {
+		count = 0;
+		above = (array->len > 0) && (array_get(array, 0) >= threshold);
+
+		for(i = 1; i < array->len; i++) {
+			v = array_get(array, i);
+			if ((hysteresis == 0) ? ((v >= threshold) != above) :
+				(above ? (v < threshold - hysteresis) : (v > threshold + hysteresis))) {
+				above = !above;
+				if (idx) {
+					idx[count] = i + 1;
+				}
+				count++;
+			}
+		}
+
+		if (!out) {
+			out = luaL_newarray(L, ARRAY_INT32, count);
+			idx = (int32_t *)out->data;
+		}
+	}
+
+	return 1;
+}
+
+static const LUA_REG_TYPE larray_map[] = {
+	{ LSTRKEY( "new"         ),	 LFUNCVAL( larray_new       ) },
+	{ LSTRKEY( "INT16"       ),	 LINTVAL ( ARRAY_INT16      ) },
+	{ LSTRKEY( "INT32"       ),	 LINTVAL ( ARRAY_INT32      ) },
+	{ LSTRKEY( "FLOAT32"     ),	 LINTVAL ( ARRAY_FLOAT32    ) },
+	{ LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE larray_ins_map[] = {
+	{ LSTRKEY( "get"         ),	 LFUNCVAL( larray_get       ) },
+	{ LSTRKEY( "set"         ),	 LFUNCVAL( larray_set       ) },
+	{ LSTRKEY( "fill"        ),	 LFUNCVAL( larray_fill      ) },
+	{ LSTRKEY( "totable"     ),	 LFUNCVAL( larray_totable   ) },
+	{ LSTRKEY( "sum"         ),	 LFUNCVAL( larray_sum       ) },
+	{ LSTRKEY( "mean"        ),	 LFUNCVAL( larray_mean      ) },
+	{ LSTRKEY( "min"         ),	 LFUNCVAL( larray_min       ) },
+	{ LSTRKEY( "max"         ),	 LFUNCVAL( larray_max       ) },
+	{ LSTRKEY( "rms"         ),	 LFUNCVAL( larray_rms       ) },
+	{ LSTRKEY( "scale"       ),	 LFUNCVAL( larray_scale     ) },
+	{ LSTRKEY( "fir"         ),	 LFUNCVAL( larray_fir       ) },
+	{ LSTRKEY( "iir"         ),	 LFUNCVAL( larray_iir       ) },
+	{ LSTRKEY( "decimate"    ),	 LFUNCVAL( larray_decimate  ) },
+	{ LSTRKEY( "fft"         ),	 LFUNCVAL( larray_fft       ) },
+	{ LSTRKEY( "spectrum"    ),	 LFUNCVAL( larray_spectrum  ) },
+	{ LSTRKEY( "crossings"   ),	 LFUNCVAL( larray_crossings ) },
+	{ LSTRKEY( "__len"       ),	 LFUNCVAL( larray_len       ) },
+	{ LSTRKEY( "__metatable" ),	 LROVAL  ( larray_ins_map   ) },
+	{ LSTRKEY( "__index"     ),	 LROVAL  ( larray_ins_map   ) },
+	{ LNILKEY, LNILVAL }
+};
+
+LUALIB_API int luaopen_array( lua_State *L ) {
+	luaL_newmetarotable(L,"array.ins", (void *)larray_ins_map);
+	return 0;
+}
+
+MODULE_REGISTER_MAPPED(ARRAY, array, larray_map, luaopen_array);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Lua RTOS, Lua typed array module
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef LARRAY_H
+#define	LARRAY_H
+
+#include "luartos.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "lua.h"
+
+// Element types
+#define ARRAY_INT16   0
+#define ARRAY_INT32   1
+#define ARRAY_FLOAT32 2
+
+/*
+ * A typed array stores len elements of the same type in contiguous
+ * memory, that follows the header in the same userdata.
+ */
+typedef struct {
+	uint8_t type;
+	size_t  len;
+	void   *data;
+} array_userdata_t;
+
+array_userdata_t *luaL_newarray(lua_State *L, int type, size_t len);
+array_userdata_t *luaL_testarray(lua_State *L, int idx);
+array_userdata_t *luaL_checkarray(lua_State *L, int idx);
+
+void  array_set(array_userdata_t *array, size_t i, lua_Number value);
+float array_get(array_userdata_t *array, size_t i);
+
+#endif	/* LARRAY_H */
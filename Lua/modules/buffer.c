@@ -0,0 +1,344 @@
+/*
+ * Lua RTOS, Lua buffer module
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if LUA_USE_BUFFER
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "buffer.h"
+#include "modules.h"
+
+#include <string.h>
+
+// Layout of a value for get / put
+typedef struct {
+	char kind;     // 'u' unsigned, 'i' signed, 'f' float
+	uint8_t width; // in bytes
+	uint8_t big;   // 1 for big endian
+} buffer_field_t;
+
+buffer_userdata_t *luaL_newbuffer(lua_State *L, size_t size) {
+	buffer_userdata_t *buffer;
+
+	buffer = (buffer_userdata_t *)lua_newuserdata(L, sizeof(buffer_userdata_t) + size);
+	buffer->data = (uint8_t *)(buffer + 1);
+	buffer->size = size;
+
+	luaL_getmetatable(L, "buffer.ins");
+	lua_setmetatable(L, -2);
+
+	return buffer;
+}
+
+buffer_userdata_t *luaL_testbuffer(lua_State *L, int idx) {
+	return (buffer_userdata_t *)luaL_testudata(L, idx, "buffer.ins");
+}
+
+buffer_userdata_t *luaL_checkbuffer(lua_State *L, int idx) {
+	buffer_userdata_t *buffer;
+
+	buffer = (buffer_userdata_t *)luaL_checkudata(L, idx, "buffer.ins");
+	luaL_argcheck(L, buffer, idx, "buffer expected");
+
+	return buffer;
+}
+
+// Translate a relative position (negative means back from end), as string.sub does
+static lua_Integer posrelat(lua_Integer pos, size_t len) {
+	if (pos >= 0) return pos;
+	else if (0u - (lua_Unsigned)pos > len) return 0;
+	else return (lua_Integer)len + pos + 1;
+}
+
+// Get the [i, j] range starting at argument arg, clipped to the buffer
+static size_t getrange(lua_State *L, buffer_userdata_t *buffer, int arg, size_t *start) {
+	lua_Integer i = posrelat(luaL_optinteger(L, arg, 1), buffer->size);
+	lua_Integer j = posrelat(luaL_optinteger(L, arg + 1, -1), buffer->size);
+
+	if (i < 1) i = 1;
+	if (j > (lua_Integer)buffer->size) j = (lua_Integer)buffer->size;
+
+	if (i > j) {
+		*start = 0;
+		return 0;
+	}
+
+	*start = (size_t)i - 1;
+
+	return (size_t)(j - i) + 1;
+}
+
+// Check that len bytes from position pos (1 is the first byte) fit into the buffer
+static int inrange(buffer_userdata_t *buffer, lua_Integer pos, size_t len) {
+	return (pos >= 1) && ((lua_Unsigned)pos - 1 <= buffer->size) && (len <= buffer->size - (size_t)(pos - 1));
+}
+
+static void getfield(lua_State *L, int arg, buffer_field_t *field) {
+	const char *fmt = luaL_checkstring(L, arg);
+
+	field->kind = *fmt++;
+	field->big = 0;
+
+	if (strncmp(fmt, "8", 1) == 0) {
+		field->width = 1;
+		fmt += 1;
+	} else if (strncmp(fmt, "16", 2) == 0) {
+		field->width = 2;
+		fmt += 2;
+	} else if (strncmp(fmt, "32", 2) == 0) {
+		field->width = 4;
+		fmt += 2;
+	} else {
+		field->width = 0;
+	}
+
+	if (strcmp(fmt, "be") == 0) {
+		field->big = 1;
+	} else if ((*fmt != '\0') && (strcmp(fmt, "le") != 0)) {
+		field->width = 0;
+	}
+
+	if (((field->kind != 'u') && (field->kind != 'i') && (field->kind != 'f')) ||
+		(field->width == 0) || ((field->kind == 'f') && (field->width != 4))) {
+		luaL_argerror(L, arg, "invalid type");
+	}
+}
+
+// Get the offset of a field, checking that it fits into the buffer
+static uint8_t *getoffset(lua_State *L, buffer_userdata_t *buffer, int arg, buffer_field_t *field) {
+	lua_Integer pos = luaL_optinteger(L, arg, 1);
+
+	luaL_argcheck(L, inrange(buffer, pos, field->width), arg, "out of range");
+
+	return buffer->data + (size_t)(pos - 1);
+}
+
+// buffer.new(size [, byte]) or buffer.new(string)
+static int lbuffer_new(lua_State *L) {
+	buffer_userdata_t *buffer;
+
+	if (lua_type(L, 1) == LUA_TSTRING) {
+		size_t len;
+		const char *s = lua_tolstring(L, 1, &len);
+
+		buffer = luaL_newbuffer(L, len);
+		memcpy(buffer->data, s, len);
+	} else {
+		lua_Integer size = luaL_checkinteger(L, 1);
+		int value = (int)luaL_optinteger(L, 2, 0);
+
+		luaL_argcheck(L, size >= 0, 1, "invalid size");
+
+		buffer = luaL_newbuffer(L, (size_t)size);
+		memset(buffer->data, value, buffer->size);
+	}
+
+	return 1;
+}
+
+static int lbuffer_size(lua_State *L) {
+	buffer_userdata_t *buffer = luaL_checkbuffer(L, 1);
+
+	lua_pushinteger(L, buffer->size);
+
+	return 1;
+}
+
+// Push a view of len bytes from start of the buffer at idx, sharing its memory
+buffer_userdata_t *luaL_pushslice(lua_State *L, int idx, size_t start, size_t len) {
+	buffer_userdata_t *buffer = luaL_checkbuffer(L, idx);
+	buffer_userdata_t *slice;
+
+	idx = lua_absindex(L, idx);
+
+	slice = (buffer_userdata_t *)lua_newuserdata(L, sizeof(buffer_userdata_t));
+	slice->data = buffer->data + start;
+	slice->size = len;
+
+	luaL_getmetatable(L, "buffer.ins");
+	lua_setmetatable(L, -2);
+
+	// The slice keeps the buffer that owns the memory alive
+	lua_pushvalue(L, idx);
+	lua_setuservalue(L, -2);
+
+	return slice;
+}
+
+// buffer:slice([i [, j]]), a view of bytes i to j sharing its memory
+static int lbuffer_slice(lua_State *L) {
+	buffer_userdata_t *buffer = luaL_checkbuffer(L, 1);
+	size_t start, len;
+
+	len = getrange(L, buffer, 2, &start);
+	luaL_pushslice(L, 1, start, len);
+
+	return 1;
+}
+
+// buffer:get(type [, offset])
+static int lbuffer_get(lua_State *L) {
+	buffer_userdata_t *buffer = luaL_checkbuffer(L, 1);
+	buffer_field_t field;
+	uint32_t value = 0;
+	uint8_t *p;
+	int i;
+
+	getfield(L, 2, &field);
+	p = getoffset(L, buffer, 3, &field);
+
+	for(i = 0; i < field.width; i++) {
+		value |= (uint32_t)p[field.big ? (field.width - 1 - i) : i] << (i * 8);
+	}
+
+	if (field.kind == 'f') {
+		float f;
+
+		memcpy(&f, &value, sizeof(f));
+		lua_pushnumber(L, (lua_Number)f);
+	} else if ((field.kind == 'i') && (field.width < 4) && (value & (1u << (field.width * 8 - 1)))) {
+		lua_pushinteger(L, (lua_Integer)value - ((lua_Integer)1 << (field.width * 8)));
+	} else if (field.kind == 'i') {
+		lua_pushinteger(L, (lua_Integer)(int32_t)value);
+	} else {
+		// With 32-bit integers, u32 values above 0x7fffffff wrap around
+		lua_pushinteger(L, (lua_Integer)value);
+	}
+
+	return 1;
+}
+
+// buffer:put(type, offset, value)
+static int lbuffer_put(lua_State *L) {
+	buffer_userdata_t *buffer = luaL_checkbuffer(L, 1);
+	buffer_field_t field;
+	uint32_t value;
+	uint8_t *p;
+	int i;
+
+	getfield(L, 2, &field);
+	p = getoffset(L, buffer, 3, &field);
+
+	if (field.kind == 'f') {
+		float f = (float)luaL_checknumber(L, 4);
+
+		memcpy(&value, &f, sizeof(value));
+	} else {
+		value = (uint32_t)luaL_checkinteger(L, 4);
+	}
+
+	for(i = 0; i < field.width; i++) {
+		p[field.big ? (field.width - 1 - i) : i] = (uint8_t)(value >> (i * 8));
+	}
+
+	lua_settop(L, 1);
+
+	return 1;
+}
+
+// buffer:fill(byte [, i [, j]])
+static int lbuffer_fill(lua_State *L) {
+	buffer_userdata_t *buffer = luaL_checkbuffer(L, 1);
+	int value = (int)luaL_checkinteger(L, 2);
+	size_t start, len;
+
+	len = getrange(L, buffer, 3, &start);
+	memset(buffer->data + start, value, len);
+
+	lua_settop(L, 1);
+
+	return 1;
+}
+
+// buffer:copy(source [, offset]), source is a string or a buffer
+static int lbuffer_copy(lua_State *L) {
+	buffer_userdata_t *buffer = luaL_checkbuffer(L, 1);
+	buffer_userdata_t *source;
+	const uint8_t *data;
+	lua_Integer pos;
+	size_t len;
+
+	if ((source = luaL_testbuffer(L, 2))) {
+		data = source->data;
+		len = source->size;
+	} else {
+		data = (const uint8_t *)luaL_checklstring(L, 2, &len);
+	}
+
+	pos = luaL_optinteger(L, 3, 1);
+	luaL_argcheck(L, inrange(buffer, pos, len), 3, "out of range");
+
+	// Source and destination can overlap if source is a slice of buffer
+	memmove(buffer->data + (size_t)(pos - 1), data, len);
+
+	lua_settop(L, 1);
+
+	return 1;
+}
+
+// buffer:tostring([i [, j]])
+static int lbuffer_tostring(lua_State *L) {
+	buffer_userdata_t *buffer = luaL_checkbuffer(L, 1);
+	size_t start, len;
+
+	len = getrange(L, buffer, 2, &start);
+	lua_pushlstring(L, (const char *)buffer->data + start, len);
+
+	return 1;
+}
+
+static const LUA_REG_TYPE lbuffer_map[] = {
+	{ LSTRKEY( "new"         ),	 LFUNCVAL( lbuffer_new      ) },
+	{ LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE lbuffer_ins_map[] = {
+	{ LSTRKEY( "size"        ),	 LFUNCVAL( lbuffer_size     ) },
+	{ LSTRKEY( "slice"       ),	 LFUNCVAL( lbuffer_slice    ) },
+	{ LSTRKEY( "get"         ),	 LFUNCVAL( lbuffer_get      ) },
+	{ LSTRKEY( "put"         ),	 LFUNCVAL( lbuffer_put      ) },
+	{ LSTRKEY( "fill"        ),	 LFUNCVAL( lbuffer_fill     ) },
+	{ LSTRKEY( "copy"        ),	 LFUNCVAL( lbuffer_copy     ) },
+	{ LSTRKEY( "tostring"    ),	 LFUNCVAL( lbuffer_tostring ) },
+	{ LSTRKEY( "__len"       ),	 LFUNCVAL( lbuffer_size     ) },
+	{ LSTRKEY( "__metatable" ),	 LROVAL  ( lbuffer_ins_map  ) },
+	{ LSTRKEY( "__index"     ),	 LROVAL  ( lbuffer_ins_map  ) },
+	{ LNILKEY, LNILVAL }
+};
+
+LUALIB_API int luaopen_buffer( lua_State *L ) {
+	luaL_newmetarotable(L,"buffer.ins", (void *)lbuffer_ins_map);
+	return 0;
+}
+
+MODULE_REGISTER_MAPPED(BUFFER, buffer, lbuffer_map, luaopen_buffer);
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Lua RTOS, Lua buffer module
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef LBUFFER_H
+#define	LBUFFER_H
+
+#include "luartos.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "lua.h"
+
+/*
+ * A buffer is a fixed-size block of bytes. Memory for a buffer created
+ * with buffer.new follows the header in the same userdata. A slice has
+ * no memory of its own: data points into the parent buffer, which is
+ * kept alive through the slice's user value.
+ */
+typedef struct {
+	uint8_t *data;
+	size_t   size;
+} buffer_userdata_t;
+
+buffer_userdata_t *luaL_newbuffer(lua_State *L, size_t size);
+buffer_userdata_t *luaL_testbuffer(lua_State *L, int idx);
+buffer_userdata_t *luaL_checkbuffer(lua_State *L, int idx);
+buffer_userdata_t *luaL_pushslice(lua_State *L, int idx, size_t start, size_t len);
+
+#endif	/* LBUFFER_H */
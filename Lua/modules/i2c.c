@@ -36,6 +36,7 @@
 #include "lauxlib.h"
 #include "i2c.h"
 #include "modules.h"
+#include "buffer.h"
 #include "error.h"
 
 #include <drivers/i2c.h>
@@ -139,6 +140,27 @@ static int li2c_read( lua_State* L ) {
 	user_data = (i2c_user_data_t *)luaL_checkudata(L, 1, "i2c.trans");
     luaL_argcheck(L, user_data, 1, "i2c transaction expected");
 
+#if LUA_USE_BUFFER
+    buffer_userdata_t *buffer;
+
+    // Read into a buffer, filling it
+    if ((buffer = luaL_testbuffer(L, 2))) {
+    	if (buffer->size == 0) {
+    		return 1;
+    	}
+
+        if ((error = i2c_read(user_data->unit, &user_data->transaction, (char *)buffer->data, buffer->size))) {
+        	return luaL_driver_error(L, error);
+        }
+
+        if ((error = i2c_flush(user_data->unit, &user_data->transaction, 1))) {
+        	return luaL_driver_error(L, error);
+        }
+
+        return 1;
+    }
+#endif
+
     if ((error = i2c_read(user_data->unit, &user_data->transaction, &data, 1))) {
     	return luaL_driver_error(L, error);
     }
@@ -161,6 +183,28 @@ static int li2c_write(lua_State* L) {
 	user_data = (i2c_user_data_t *)luaL_checkudata(L, 1, "i2c.trans");
     luaL_argcheck(L, user_data, 1, "i2c transaction expected");
 
+#if LUA_USE_BUFFER
+    buffer_userdata_t *buffer;
+
+    // Write a buffer. The driver keeps a reference to the data, not a copy,
+    // so the transaction is flushed while the buffer is still on the stack.
+    if ((buffer = luaL_testbuffer(L, 2))) {
+    	if (buffer->size == 0) {
+    		return 0;
+    	}
+
+        if ((error = i2c_write(user_data->unit, &user_data->transaction, (char *)buffer->data, buffer->size))) {
+        	return luaL_driver_error(L, error);
+        }
+
+        if ((error = i2c_flush(user_data->unit, &user_data->transaction, 1))) {
+        	return luaL_driver_error(L, error);
+        }
+
+        return 0;
+    }
+#endif
+
     char data = (char)(luaL_checkinteger(L, 2) & 0xff);
     
     esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en);
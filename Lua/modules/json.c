@@ -0,0 +1,854 @@
+/*
+ * Lua RTOS, Lua JSON module
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if LUA_USE_JSON
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "json.h"
+#include "modules.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Max nesting of objects / arrays
+#define JSON_MAX_DEPTH 32
+
+// Parser states
+#define JSON_VALUE  0 // Expecting a value
+#define JSON_ARRAY  1 // After '[', expecting a value or ']'
+#define JSON_OBJECT 2 // After '{', expecting a key or '}'
+#define JSON_KEY    3 // After ',' into an object, expecting a key
+#define JSON_COLON  4 // After a key, expecting ':'
+#define JSON_NEXT   5 // After a value into an array / object, expecting ',' or its end
+#define JSON_DONE   6 // Document complete
+
+typedef struct {
+	int callback;      // Stack index of the SAX callback, or 0 for building tables
+	int state;
+	int depth;
+	int items;         // Values under construction, saved between chunks
+	int failed;        // A chunk raised an error, the state is not valid
+	size_t offset;     // Bytes consumed by previous chunks
+	char kind[JSON_MAX_DEPTH];
+	lua_Integer count[JSON_MAX_DEPTH];
+} json_parser_t;
+
+/*
+ * Encoder
+ */
+
+void json_writer_init(lua_State *L, json_writer_t *w, FILE *f) {
+	w->L = L;
+	w->f = f;
+	w->data = w->initb;
+	w->size = sizeof(w->initb);
+	w->len = 0;
+	w->slot = 0;
+
+	if (!f) {
+		// Slot for growing
+		lua_pushnil(L);
+		w->slot = lua_gettop(L);
+	}
+}
+
+int json_flush(json_writer_t *w) {
+	int ok = 1;
+
+	if (w->f && w->len) {
+		ok = (fwrite(w->data, 1, w->len, w->f) == w->len);
+		w->len = 0;
+	}
+
+	return ok;
+}
+
+static void put(json_writer_t *w, const char *s, size_t n) {
+	if (w->len + n > w->size) {
+		if (w->f) {
+			if (!json_flush(w)) {
+				luaL_error(w->L, "%s", strerror(errno));
+			}
+
+			if (n > w->size) {
+				if (fwrite(s, 1, n, w->f) != n) {
+					luaL_error(w->L, "%s", strerror(errno));
+				}
+				return;
+			}
+		} else {
+			size_t size = w->size * 2;
+			char *data;
+
+			if (size < w->len + n) {
+				size = w->len + n;
+			}
+
+			data = (char *)lua_newuserdata(w->L, size);
+			memcpy(data, w->data, w->len);
+			lua_replace(w->L, w->slot);
+
+			w->data = data;
+			w->size = size;
+		}
+	}
+
+	memcpy(w->data + w->len, s, n);
+	w->len += n;
+}
+
+#define putlit(w, s) put(w, s, sizeof(s) - 1)
+
+static void encode_string(json_writer_t *w, const char *s, size_t len) {
+	static const char hex[] = "0123456789abcdef";
+	const char *run = s;
+	const char *end = s + len;
+	char esc[6] = {'\\', 'u', '0', '0'};
+	unsigned char c;
+
+	putlit(w, "\"");
+
+	// Copy runs of characters that don't need escaping at once
+	while (s < end) {
+		c = (unsigned char)*s;
+		if ((c >= 0x20) && (c != '"') && (c != '\\')) {
+			s++;
+			continue;
+		}
+
+		put(w, run, s - run);
+
+		switch (c) {
+			case '"':  putlit(w, "\\\""); break;
+			case '\\': putlit(w, "\\\\"); break;
+			case '\n': putlit(w, "\\n"); break;
+			case '\r': putlit(w, "\\r"); break;
+			case '\t': putlit(w, "\\t"); break;
+			case '\b': putlit(w, "\\b"); break;
+			case '\f': putlit(w, "\\f"); break;
+			default:
+				esc[4] = hex[c >> 4];
+				esc[5] = hex[c & 0x0f];
+				put(w, esc, sizeof(esc));
+		}
+
+		run = ++s;
+	}
+
+	put(w, run, s - run);
+	putlit(w, "\"");
+}
+
+static void encode_number(json_writer_t *w, int idx) {
+	char buff[LUAI_MAXNUMBER2STR];
+	lua_Number n;
+	int len;
+
+	if (lua_isinteger(w->L, idx)) {
+		len = lua_integer2str(buff, sizeof(buff), lua_tointeger(w->L, idx));
+	} else {
+		n = lua_tonumber(w->L, idx);
+		if (isnan(n) || isinf(n)) {
+			// JSON has no representation for them
+			putlit(w, "null");
+			return;
+		}
+
+		len = lua_number2str(buff, sizeof(buff), n);
+	}
+
+	put(w, buff, len);
+}
+
+static void encode(json_writer_t *w, int idx, int depth);
+
+static void encode_table(json_writer_t *w, int idx, int depth) {
+	lua_State *L = w->L;
+	size_t n, count = 0, i;
+	size_t len;
+	const char *s;
+	lua_Integer key;
+	int array = 1;
+
+	if (depth > JSON_MAX_DEPTH) {
+		luaL_error(L, "table nested too deep");
+	}
+
+	luaL_checkstack(L, 3, "table nested too deep");
+
+	// Count keys, and check that all of them are integers in 1..n, to
+	// know if table is an array
+	n = lua_rawlen(L, idx);
+	lua_pushnil(L);
+	while (lua_next(L, idx)) {
+		lua_pop(L, 1);
+		count++;
+
+		if (array) {
+			key = lua_isinteger(L, -1) ? lua_tointeger(L, -1) : 0;
+			array = (key >= 1) && ((lua_Unsigned)key <= n);
+		}
+	}
+
+	if (array && (count == n)) {
+		putlit(w, "[");
+		for(i = 1; i <= n; i++) {
+			if (i > 1) {
+				putlit(w, ",");
+			}
+
+			lua_rawgeti(L, idx, i);
+			encode(w, lua_gettop(L), depth + 1);
+			lua_pop(L, 1);
+		}
+		putlit(w, "]");
+	} else {
+		count = 0;
+
+		putlit(w, "{");
+		lua_pushnil(L);
+		while (lua_next(L, idx)) {
+			if (count++) {
+				putlit(w, ",");
+			}
+
+			switch (lua_type(L, -2)) {
+				case LUA_TSTRING:
+					s = lua_tolstring(L, -2, &len);
+					encode_string(w, s, len);
+					break;
+
+				case LUA_TNUMBER:
+					putlit(w, "\"");
+					encode_number(w, lua_gettop(L) - 1);
+					putlit(w, "\"");
+					break;
+
+				default:
+					luaL_error(L, "unsupported key type %s", luaL_typename(L, -2));
+			}
+
+			putlit(w, ":");
+			encode(w, lua_gettop(L), depth + 1);
+			lua_pop(L, 1);
+		}
+		putlit(w, "}");
+	}
+}
+
+static void encode(json_writer_t *w, int idx, int depth) {
+	lua_State *L = w->L;
+	const char *s;
+	size_t len;
+
+	switch (lua_type(L, idx)) {
+		case LUA_TNIL:
+			putlit(w, "null");
+			break;
+
+		case LUA_TBOOLEAN:
+			if (lua_toboolean(L, idx)) {
+				putlit(w, "true");
+			} else {
+				putlit(w, "false");
+			}
+			break;
+
+		case LUA_TNUMBER:
+			encode_number(w, idx);
+			break;
+
+		case LUA_TSTRING:
+			s = lua_tolstring(L, idx, &len);
+			encode_string(w, s, len);
+			break;
+
+		case LUA_TTABLE:
+			encode_table(w, idx, depth);
+			break;
+
+		case LUA_TLIGHTUSERDATA:
+			// json.null
+			if (lua_touserdata(L, idx) == NULL) {
+				putlit(w, "null");
+				break;
+			}
+
+		default:
+			luaL_error(L, "unsupported type %s", luaL_typename(L, idx));
+	}
+}
+
+void json_encode_value(json_writer_t *w, int idx) {
+	encode(w, lua_absindex(w->L, idx), 0);
+}
+
+/*
+ * Decoder
+ */
+
+static int json_error(lua_State *L, json_parser_t *p, size_t pos) {
+	return luaL_error(L, "invalid json at byte %d", (int)(p->offset + pos + 1));
+}
+
+static int hexval(const char *s) {
+	int i, v = 0;
+
+	for(i = 0; i < 4; i++) {
+		v <<= 4;
+		if ((s[i] >= '0') && (s[i] <= '9')) v |= s[i] - '0';
+		else if ((s[i] >= 'a') && (s[i] <= 'f')) v |= s[i] - 'a' + 10;
+		else if ((s[i] >= 'A') && (s[i] <= 'F')) v |= s[i] - 'A' + 10;
+		else return -1;
+	}
+
+	return v;
+}
+
+// Push the string between s and end, that has escapes
+static int push_escaped(lua_State *L, const char *s, const char *end) {
+	luaL_Buffer b;
+	char utf8[4];
+	int cp, lo, n;
+
+	luaL_buffinit(L, &b);
+
+	while (s < end) {
+		if (*s != '\\') {
+			const char *run = s;
+
+			while ((s < end) && (*s != '\\')) s++;
+			luaL_addlstring(&b, run, s - run);
+			continue;
+		}
+
+		s++;
+		switch (*s++) {
+			case '"':  luaL_addchar(&b, '"'); break;
+			case '\\': luaL_addchar(&b, '\\'); break;
+			case '/':  luaL_addchar(&b, '/'); break;
+			case 'b':  luaL_addchar(&b, '\b'); break;
+			case 'f':  luaL_addchar(&b, '\f'); break;
+			case 'n':  luaL_addchar(&b, '\n'); break;
+			case 'r':  luaL_addchar(&b, '\r'); break;
+			case 't':  luaL_addchar(&b, '\t'); break;
+			case 'u':
+				if ((end - s < 4) || ((cp = hexval(s)) < 0)) {
+					return 0;
+				}
+				s += 4;
+
+				// Surrogate pair
+				if ((cp >= 0xd800) && (cp <= 0xdbff)) {
+					if ((end - s < 6) || (s[0] != '\\') || (s[1] != 'u') ||
+						((lo = hexval(s + 2)) < 0xdc00) || (lo > 0xdfff)) {
+						return 0;
+					}
+					s += 6;
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+				}
+
+				// Encode as UTF-8
+				if (cp < 0x80) {
+					utf8[0] = cp; n = 1;
+				} else if (cp < 0x800) {
+					utf8[0] = 0xc0 | (cp >> 6);
+					utf8[1] = 0x80 | (cp & 0x3f); n = 2;
+				} else if (cp < 0x10000) {
+					utf8[0] = 0xe0 | (cp >> 12);
+					utf8[1] = 0x80 | ((cp >> 6) & 0x3f);
+					utf8[2] = 0x80 | (cp & 0x3f); n = 3;
+				} else {
+					utf8[0] = 0xf0 | (cp >> 18);
+					utf8[1] = 0x80 | ((cp >> 12) & 0x3f);
+					utf8[2] = 0x80 | ((cp >> 6) & 0x3f);
+					utf8[3] = 0x80 | (cp & 0x3f); n = 4;
+				}
+				luaL_addlstring(&b, utf8, n);
+				break;
+
+			default:
+				return 0;
+		}
+	}
+
+	luaL_pushresult(&b);
+
+	return 1;
+}
+
+// Call the SAX callback with an event, and the value on the top of the
+// stack, that is popped
+static void sax(lua_State *L, json_parser_t *p, const char *event, int hasvalue) {
+	lua_pushvalue(L, p->callback);
+	lua_pushstring(L, event);
+	if (hasvalue) {
+		lua_pushvalue(L, -3);
+		lua_call(L, 2, 0);
+		lua_pop(L, 1);
+	} else {
+		lua_call(L, 1, 0);
+	}
+}
+
+// A value is complete. When building tables it's on the top of the stack,
+// and it's stored into its container.
+static void complete(lua_State *L, json_parser_t *p) {
+	if (p->depth == 0) {
+		p->state = JSON_DONE;
+		return;
+	}
+
+	if (!p->callback) {
+		if (p->kind[p->depth - 1] == '[') {
+			lua_rawseti(L, -2, ++p->count[p->depth - 1]);
+		} else {
+			lua_rawset(L, -3);
+		}
+	}
+
+	p->state = JSON_NEXT;
+}
+
+static void scalar(lua_State *L, json_parser_t *p) {
+	if (p->callback) {
+		sax(L, p, "value", 1);
+	}
+
+	complete(L, p);
+}
+
+/*
+ * Parse len bytes of data. Returns the number of bytes consumed, bytes not
+ * consumed are the start of a token that continues in next chunk. If final
+ * is true there is no next chunk.
+ */
+static size_t parse(lua_State *L, json_parser_t *p, const char *data, size_t len, int final) {
+	const char *word;
+	size_t pos = 0, start, wlen;
+	int escaped;
+	char c;
+
+	while (pos < len) {
+		c = data[pos];
+
+		// Skip white spaces
+		if ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r')) {
+			pos++;
+			continue;
+		}
+
+		start = pos;
+
+		switch (p->state) {
+			case JSON_DONE:
+				return json_error(L, p, pos);
+
+			case JSON_COLON:
+				if (c != ':') return json_error(L, p, pos);
+				p->state = JSON_VALUE;
+				pos++;
+				continue;
+
+			case JSON_NEXT:
+				if (c == ',') {
+					p->state = (p->kind[p->depth - 1] == '[') ? JSON_VALUE : JSON_KEY;
+					pos++;
+					continue;
+				}
+				break;
+
+			case JSON_OBJECT:
+			case JSON_KEY:
+				if ((c != '"') && !((c == '}') && (p->state == JSON_OBJECT))) {
+					return json_error(L, p, pos);
+				}
+				break;
+		}
+
+		// End of array / object
+		if ((c == ']') || (c == '}')) {
+			if ((p->depth == 0) || (p->kind[p->depth - 1] != ((c == ']') ? '[' : '{')) ||
+				!((p->state == JSON_NEXT) || (p->state == ((c == ']') ? JSON_ARRAY : JSON_OBJECT)))) {
+				return json_error(L, p, pos);
+			}
+
+			p->depth--;
+			if (p->callback) {
+				sax(L, p, (c == ']') ? "endarray" : "endobject", 0);
+			}
+
+			complete(L, p);
+			pos++;
+			continue;
+		}
+
+		if (p->state == JSON_NEXT) {
+			return json_error(L, p, pos);
+		}
+
+		// Start of array / object
+		if ((c == '[') || (c == '{')) {
+			if (p->depth >= JSON_MAX_DEPTH) {
+				return luaL_error(L, "json nested too deep");
+			}
+
+			if (p->callback) {
+				sax(L, p, (c == '[') ? "array" : "object", 0);
+			} else {
+				luaL_checkstack(L, 3, "json nested too deep");
+				lua_newtable(L);
+			}
+
+			p->kind[p->depth] = c;
+			p->count[p->depth] = 0;
+			p->depth++;
+			p->state = (c == '[') ? JSON_ARRAY : JSON_OBJECT;
+			pos++;
+			continue;
+		}
+
+		// String, or object key
+		if (c == '"') {
+			escaped = 0;
+			for(pos++; (pos < len) && (data[pos] != '"'); pos++) {
+				if ((unsigned char)data[pos] < 0x20) {
+					return json_error(L, p, pos);
+				}
+
+				if (data[pos] == '\\') {
+					escaped = 1;
+					pos++;
+				}
+			}
+
+			if (pos >= len) {
+				if (final) return json_error(L, p, len);
+				return start;
+			}
+
+			if (!escaped) {
+				lua_pushlstring(L, data + start + 1, pos - start - 1);
+			} else if (!push_escaped(L, data + start + 1, data + pos)) {
+				return json_error(L, p, start);
+			}
+			pos++;
+
+			if ((p->state == JSON_OBJECT) || (p->state == JSON_KEY)) {
+				if (p->callback) {
+					sax(L, p, "key", 1);
+				}
+
+				p->state = JSON_COLON;
+			} else {
+				scalar(L, p);
+			}
+			continue;
+		}
+
+		// Number
+		if ((c == '-') || ((c >= '0') && (c <= '9'))) {
+			char buff[64];
+
+			while ((pos < len) && (strchr("0123456789+-.eE", data[pos]) != NULL)) {
+				pos++;
+			}
+
+			if ((pos >= len) && !final) {
+				return start;
+			}
+
+			if ((pos - start >= sizeof(buff)) ) {
+				return json_error(L, p, start);
+			}
+
+			memcpy(buff, data + start, pos - start);
+			buff[pos - start] = '\0';
+
+			if (lua_stringtonumber(L, buff) == 0) {
+				return json_error(L, p, start);
+			}
+
+			scalar(L, p);
+			continue;
+		}
+
+		// true, false, null
+		word = (c == 't') ? "true" : ((c == 'f') ? "false" : ((c == 'n') ? "null" : NULL));
+		if (!word) {
+			return json_error(L, p, pos);
+		}
+
+		wlen = strlen(word);
+		if (len - pos < wlen) {
+			if (final || (memcmp(data + pos, word, len - pos) != 0)) {
+				return json_error(L, p, pos);
+			}
+			return start;
+		}
+
+		if (memcmp(data + pos, word, wlen) != 0) {
+			return json_error(L, p, pos);
+		}
+
+		if (c == 'n') {
+			lua_pushlightuserdata(L, NULL);
+		} else {
+			lua_pushboolean(L, c == 't');
+		}
+
+		pos += wlen;
+		scalar(L, p);
+	}
+
+	return pos;
+}
+
+static void parser_init(json_parser_t *p) {
+	memset(p, 0, sizeof(json_parser_t));
+	p->state = JSON_VALUE;
+}
+
+// Decode len bytes from data, which is a light userdata at index 1
+static int json_decode_raw(lua_State *L) {
+	const char *data = (const char *)lua_touserdata(L, 1);
+	size_t len = (size_t)lua_tointeger(L, 2);
+	json_parser_t p;
+
+	parser_init(&p);
+	lua_settop(L, 2);
+
+	parse(L, &p, data, len, 1);
+	if (p.state != JSON_DONE) {
+		return luaL_error(L, "incomplete json");
+	}
+
+	return 1;
+}
+
+// Decode data in protected mode. Returns LUA_OK with the value on the top
+// of the stack, or an error code with the error message on the top.
+int json_pdecode(lua_State *L, const char *data, size_t len) {
+	lua_pushcfunction(L, json_decode_raw);
+	lua_pushlightuserdata(L, (void *)data);
+	lua_pushinteger(L, len);
+
+	return lua_pcall(L, 2, 1, 0);
+}
+
+/*
+ * Lua functions
+ */
+
+// json.encode(value [, file]). Returns a string, or writes to file.
+static int ljson_encode(lua_State *L) {
+	json_writer_t w;
+	FILE *f = NULL;
+
+	luaL_checkany(L, 1);
+
+	if (!lua_isnoneornil(L, 2)) {
+		luaL_Stream *stream = (luaL_Stream *)luaL_checkudata(L, 2, LUA_FILEHANDLE);
+
+		if (!stream->closef) {
+			return luaL_error(L, "attempt to use a closed file");
+		}
+
+		f = stream->f;
+	}
+
+	json_writer_init(L, &w, f);
+	json_encode_value(&w, 1);
+
+	if (f) {
+		return luaL_fileresult(L, json_flush(&w), NULL);
+	}
+
+	lua_pushlstring(L, w.data, w.len);
+
+	return 1;
+}
+
+static int ljson_decode(lua_State *L) {
+	size_t len;
+	const char *data = luaL_checklstring(L, 1, &len);
+	json_parser_t p;
+
+	parser_init(&p);
+
+	parse(L, &p, data, len, 1);
+	if (p.state != JSON_DONE) {
+		return luaL_error(L, "incomplete json");
+	}
+
+	return 1;
+}
+
+// json.parser([callback]), a parser for data that comes in chunks
+static int ljson_parser(lua_State *L) {
+	json_parser_t *p;
+
+	if (!lua_isnoneornil(L, 1)) {
+		luaL_checktype(L, 1, LUA_TFUNCTION);
+	}
+	lua_settop(L, 1);
+
+	p = (json_parser_t *)lua_newuserdata(L, sizeof(json_parser_t));
+	parser_init(p);
+
+	luaL_getmetatable(L, "json.parser");
+	lua_setmetatable(L, -2);
+
+	// The callback, values under construction and the token split between
+	// chunks are kept here, so they are collected with the parser
+	lua_newtable(L);
+	lua_pushvalue(L, 1);
+	lua_setfield(L, -2, "callback");
+	lua_setuservalue(L, -2);
+
+	return 1;
+}
+
+// Parse a chunk, final is true for the last one. Returns the value if
+// the document is complete, or nil.
+static int feed(lua_State *L, json_parser_t *p, const char *data, size_t len, int final) {
+	size_t used;
+	int uv, base, i;
+
+	if (p->failed) {
+		return luaL_error(L, "json parser failed, create a new one");
+	}
+
+	lua_getuservalue(L, 1);
+	uv = lua_gettop(L);
+
+	lua_getfield(L, uv, "callback");
+	p->callback = lua_isnil(L, -1) ? 0 : uv + 1;
+
+	// Complete the token split between chunks
+	if (lua_getfield(L, uv, "carry") == LUA_TSTRING) {
+		lua_pushlstring(L, data, len);
+		lua_concat(L, 2);
+		data = lua_tolstring(L, -1, &len);
+	}
+
+	// Restore values under construction
+	base = lua_gettop(L);
+	luaL_checkstack(L, p->items, "json nested too deep");
+	for(i = 1; i <= p->items; i++) {
+		lua_rawgeti(L, uv, i);
+	}
+
+	// An error raised by parse, or by the callback, leaves the state half
+	// updated, so the parser is failed until parse returns
+	p->failed = 1;
+	used = parse(L, p, data, len, final);
+	p->failed = 0;
+	p->offset += used;
+
+	// Save values under construction
+	p->items = lua_gettop(L) - base;
+	for(i = p->items; i >= 1; i--) {
+		lua_rawseti(L, uv, i);
+	}
+
+	// Keep the rest for next chunk
+	if (used < len) {
+		lua_pushlstring(L, data + used, len - used);
+	} else {
+		lua_pushnil(L);
+	}
+	lua_setfield(L, uv, "carry");
+
+	if (p->state != JSON_DONE) {
+		return 0;
+	}
+
+	if (p->callback) {
+		lua_pushboolean(L, 1);
+	} else {
+		lua_rawgeti(L, uv, 1);
+	}
+
+	return 1;
+}
+
+// parser:feed(chunk)
+static int ljson_feed(lua_State *L) {
+	json_parser_t *p = (json_parser_t *)luaL_checkudata(L, 1, "json.parser");
+	size_t len;
+	const char *data = luaL_checklstring(L, 2, &len);
+
+	if (!feed(L, p, data, len, 0)) {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+// parser:finish(), there are no more chunks
+static int ljson_finish(lua_State *L) {
+	json_parser_t *p = (json_parser_t *)luaL_checkudata(L, 1, "json.parser");
+
+	if (!feed(L, p, "", 0, 1)) {
+		return luaL_error(L, "incomplete json");
+	}
+
+	return 1;
+}
+
+static const LUA_REG_TYPE ljson_map[] = {
+	{ LSTRKEY( "encode"      ),	 LFUNCVAL( ljson_encode     ) },
+	{ LSTRKEY( "decode"      ),	 LFUNCVAL( ljson_decode     ) },
+	{ LSTRKEY( "parser"      ),	 LFUNCVAL( ljson_parser     ) },
+	{ LSTRKEY( "null"        ),	 LUDATA  ( NULL             ) },
+	{ LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE ljson_parser_map[] = {
+	{ LSTRKEY( "feed"        ),	 LFUNCVAL( ljson_feed       ) },
+	{ LSTRKEY( "finish"      ),	 LFUNCVAL( ljson_finish     ) },
+	{ LSTRKEY( "__metatable" ),	 LROVAL  ( ljson_parser_map ) },
+	{ LSTRKEY( "__index"     ),	 LROVAL  ( ljson_parser_map ) },
+	{ LNILKEY, LNILVAL }
+};
+
+LUALIB_API int luaopen_json( lua_State *L ) {
+	luaL_newmetarotable(L,"json.parser", (void *)ljson_parser_map);
+	return 0;
+}
+
+MODULE_REGISTER_MAPPED(JSON, json, ljson_map, luaopen_json);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Lua RTOS, Lua JSON module
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef LJSON_H
+#define	LJSON_H
+
+#include "luartos.h"
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "lua.h"
+
+// Encoded data goes to initb while it fits
+#define JSON_BUFFER_SIZE 256
+
+/*
+ * Output of the encoder. When f is not NULL data is flushed to f when
+ * it is full. Otherwise data grows into a userdata that is kept at the
+ * slot stack index, so traversing tables doesn't disturb it.
+ */
+typedef struct {
+	lua_State *L;
+	FILE *f;
+	char *data;
+	size_t size;
+	size_t len;
+	int slot;
+	char initb[JSON_BUFFER_SIZE];
+} json_writer_t;
+
+void json_writer_init(lua_State *L, json_writer_t *w, FILE *f);
+void json_encode_value(json_writer_t *w, int idx);
+int  json_flush(json_writer_t *w);
+
+int  json_pdecode(lua_State *L, const char *data, size_t len);
+
+#endif	/* LJSON_H */
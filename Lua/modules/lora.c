@@ -381,6 +381,86 @@ static int llora_tx(lua_State* L) {
     return 0;    
 }
 
+// Lua: lora.queue(port, data), queue a message, to be sent packed with other
+// messages for the same port by lora.flush
+static int llora_queue(lua_State* L) {
+    int port = luaL_checkinteger(L, 1);
+    const char *data = luaL_checkstring(L, 2);
+
+    if ((port < 1) || (port > 223)) {
+        return luaL_error(L, "%d:invalid port number", LORA_ERR_INVALID_ARGUMENT);
+    }
+
+    if (!check_hex_str(data)) {
+        luaL_error(L, "%d:invalid data", LORA_ERR_INVALID_ARGUMENT);
+    }
+
+    driver_error_t *error = lora_queue(port, data);
+    if (error) {
+        return luaL_driver_error(L, error);
+    }
+
+    return 0;
+}
+
+// Lua: frames = lora.flush([confirmed]), send the queued messages
+static int llora_flush(lua_State* L) {
+    int cnf = lua_toboolean(L, 1);
+    int frames;
+
+    driver_error_t *error = lora_flush(cnf, &frames);
+    if (error) {
+        return luaL_driver_error(L, error);
+    }
+
+    lua_pushinteger(L, frames);
+
+    return 1;
+}
+
+// Lua: plan = lora.plan(), uplink plan at the current data rate, times in msecs
+static int llora_plan(lua_State* L) {
+    lora_plan_t plan;
+    int channel, time;
+
+    driver_error_t *error = lora_get_plan(&plan);
+    if (error) {
+        return luaL_driver_error(L, error);
+    }
+
+    lua_createtable(L, 0, 7);
+
+    lua_pushinteger(L, plan.next_tx);
+    lua_setfield(L, -2, "nextTx");
+
+    lua_pushinteger(L, plan.budget);
+    lua_setfield(L, -2, "budget");
+
+    lua_pushinteger(L, plan.max_payload);
+    lua_setfield(L, -2, "maxPayload");
+
+    lua_pushinteger(L, plan.frame_airtime);
+    lua_setfield(L, -2, "frameAirtime");
+
+    lua_pushinteger(L, plan.pending);
+    lua_setfield(L, -2, "pending");
+
+    lua_pushinteger(L, plan.frames);
+    lua_setfield(L, -2, "frames");
+
+    // Time to the earliest transmission on each usable channel
+    lua_newtable(L);
+    for(channel = 0; (time = lora_get_channel_tx(channel)) != -2; channel++) {
+        if (time >= 0) {
+            lua_pushinteger(L, time);
+            lua_rawseti(L, -2, channel);
+        }
+    }
+    lua_setfield(L, -2, "channels");
+
+    return 1;
+}
+
 static int llora_rx(lua_State* L) {
     luaL_checktype(L, 1, LUA_TFUNCTION);
     lua_pushvalue(L, 1); 
@@ -393,6 +473,71 @@ static int llora_rx(lua_State* L) {
     return 0;
 }
 
+// Lua: stats = lora.stats(), scheduler timing accuracy, and simulated radio
+// counters when the simulated radio is used, times in usecs
+static int llora_stats(lua_State* L) {
+    lora_stats_t stats;
+
+    lora_get_stats(&stats);
+
+    lua_createtable(L, 0, 9);
+
+    lua_pushinteger(L, stats.jobs);
+    lua_setfield(L, -2, "jobs");
+
+    lua_pushinteger(L, stats.job_max_late);
+    lua_setfield(L, -2, "jobMaxLate");
+
+    lua_pushinteger(L, stats.job_avg_late);
+    lua_setfield(L, -2, "jobAvgLate");
+
+    lua_pushinteger(L, stats.rx_windows);
+    lua_setfield(L, -2, "rxWindows");
+
+    lua_pushinteger(L, stats.rx_max_late);
+    lua_setfield(L, -2, "rxMaxLate");
+
+    lua_pushinteger(L, stats.rx_avg_late);
+    lua_setfield(L, -2, "rxAvgLate");
+
+    lua_pushinteger(L, stats.irqs);
+    lua_setfield(L, -2, "irqs");
+
+    lua_pushinteger(L, stats.irq_max_late);
+    lua_setfield(L, -2, "irqMaxLate");
+
+    lua_pushinteger(L, stats.irq_avg_late);
+    lua_setfield(L, -2, "irqAvgLate");
+
+#if CONFIG_LUA_RTOS_LMIC_SIM
+    lua_pushinteger(L, stats.sim_uplinks);
+    lua_setfield(L, -2, "simUplinks");
+
+    lua_pushinteger(L, stats.sim_downlinks);
+    lua_setfield(L, -2, "simDownlinks");
+
+    lua_pushinteger(L, stats.sim_missed);
+    lua_setfield(L, -2, "simMissed");
+
+    lua_pushinteger(L, stats.sim_joins);
+    lua_setfield(L, -2, "simJoins");
+
+    lua_pushinteger(L, stats.sim_airtime);
+    lua_setfield(L, -2, "simAirtime");
+
+    lua_pushinteger(L, stats.sim_rx_max_offset);
+    lua_setfield(L, -2, "simRxMaxOffset");
+
+    lua_pushinteger(L, stats.sim_rx_min_offset);
+    lua_setfield(L, -2, "simRxMinOffset");
+
+    lua_pushinteger(L, stats.sim_rx_avg_offset);
+    lua_setfield(L, -2, "simRxAvgOffset");
+#endif
+
+    return 1;
+}
+
 static const LUA_REG_TYPE lora_map[] = {
     { LSTRKEY( "setup" ),        LFUNCVAL( llora_setup ) }, 
     { LSTRKEY( "setDevAddr" ),   LFUNCVAL( llora_set_setDevAddr ) }, 
@@ -413,7 +558,11 @@ static const LUA_REG_TYPE lora_map[] = {
     { LSTRKEY( "getReTx" ),      LFUNCVAL( llora_get_ReTx ) },
     { LSTRKEY( "join" ),         LFUNCVAL( llora_join ) }, 
     { LSTRKEY( "tx" ),           LFUNCVAL( llora_tx ) },
+    { LSTRKEY( "queue" ),        LFUNCVAL( llora_queue ) },
+    { LSTRKEY( "flush" ),        LFUNCVAL( llora_flush ) },
+    { LSTRKEY( "plan" ),         LFUNCVAL( llora_plan ) },
     { LSTRKEY( "whenReceived" ), LFUNCVAL( llora_rx ) },
+    { LSTRKEY( "stats" ),        LFUNCVAL( llora_stats ) },
 	
 	// Constant definitions
     { LSTRKEY( "BAND868" ),		 LINTVAL( 868 ) },
@@ -38,7 +38,9 @@
 #include "lua.h"
 #include "lauxlib.h"
 #include "modules.h"
+#include "buffer.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -148,7 +150,8 @@ static int l_pack(lua_State *L) {
 
     // This variables are for store argument values
     char *luaStringVal;
-    lua_Number luaNumberVal;
+    float luaNumberVal;        // Floats are always packed in single precision,
+                               // so packets don't depend on the Lua float type
     lua_Integer luaIntegerVal;
     int luaBooleanVal;
     
@@ -177,7 +180,7 @@ static int l_pack(lua_State *L) {
                 if (lua_isinteger(L,i)) {
                     argSize += sizeof(lua_Integer);
                 } else {
-                    argSize += sizeof(lua_Number);                    
+                    argSize += sizeof(float);                    
                 }
                 break;
                 
@@ -224,11 +227,11 @@ static int l_pack(lua_State *L) {
                     *cheader = *cheader | PACK_PACK_TYPE(PACK_NUMBER,i);                    
                     
                     // Get value
-                    luaNumberVal = luaL_checknumber(L, i);
+                    luaNumberVal = (float)luaL_checknumber(L, i);
                 
                     // Encode value
-                    val_to_hex_string(pack + data_idx, (char *)&luaNumberVal, sizeof(lua_Number));
-                    data_idx = data_idx + (sizeof(lua_Number) * 2);
+                    val_to_hex_string(pack + data_idx, (char *)&luaNumberVal, sizeof(float));
+                    data_idx = data_idx + (sizeof(float) * 2);
                 }
                 
                 *(pack + data_idx) = 0;                
@@ -292,7 +295,8 @@ static int l_unpack(lua_State *L) {
     
     // This variables are for store argument values
     char *luaStringVal;
-    lua_Number luaNumberVal;
+    float luaNumberVal;        // Floats are always packed in single precision,
+                               // so packets don't depend on the Lua float type
     lua_Integer luaIntegerVal;
     char luaBooleanVal;
 
@@ -336,9 +340,9 @@ static int l_unpack(lua_State *L) {
         switch (ctype) {
             case PACK_NUMBER:
                 // Unpack
-                hex_string_to_val(pack + data_idx, (char *)&luaNumberVal, sizeof(lua_Number));
-                data_idx += sizeof(lua_Number) * 2;                
-                lua_pushnumber(L, luaNumberVal);
+                hex_string_to_val(pack + data_idx, (char *)&luaNumberVal, sizeof(float));
+                data_idx += sizeof(float) * 2;                
+                lua_pushnumber(L, (lua_Number)luaNumberVal);
                 break;
             case PACK_INTEGER:
                 // Unpack
@@ -399,10 +403,454 @@ static int l_unpack(lua_State *L) {
 
 }
 
+/*
+ * MessagePack codec
+ *
+ * Values are encoded with the smallest MessagePack type that holds them.
+ * Tables with keys 1..n are encoded as arrays, other tables as maps. Floats
+ * that fit in single precision are encoded as float 32.
+ *
+ */
+
+// Encoded data goes to initb while it fits, then to a userdata kept at
+// a fixed stack slot, so no malloc is needed per call
+#define PACK_BUFFER_SIZE 128
+
+// Max nesting of tables
+#define PACK_MAX_DEPTH   32
+
+typedef struct {
+    lua_State *L;
+    uint8_t *data;   // Where encoded bytes go
+    size_t size;     // Capacity of data
+    size_t len;      // Number of encoded bytes
+    int slot;        // Stack slot for growing, 0 if data has a fixed size
+    uint8_t initb[PACK_BUFFER_SIZE];
+} pack_writer_t;
+
+typedef struct {
+    lua_State *L;
+    const uint8_t *p;    // Current position
+    const uint8_t *end;  // End of data
+    const uint8_t *data; // Start of data
+    int src;             // Stack index of source if it is a buffer, or 0
+} pack_reader_t;
+
+static void mp_encode(pack_writer_t *w, int idx, int depth);
+
+static uint8_t *mp_reserve(pack_writer_t *w, size_t n) {
+    uint8_t *data;
+    size_t size;
+
+    if (w->len + n > w->size) {
+        if (!w->slot) {
+            luaL_error(w->L, "buffer too small");
+        }
+
+        size = w->size * 2;
+        if (size < w->len + n) {
+            size = w->len + n;
+        }
+
+        data = (uint8_t *)lua_newuserdata(w->L, size);
+        memcpy(data, w->data, w->len);
+        lua_replace(w->L, w->slot);
+
+        w->data = data;
+        w->size = size;
+    }
+
+    data = w->data + w->len;
+    w->len += n;
+
+    return data;
+}
+
+// Write a type byte followed by a big endian value of width bytes
+static void mp_write(pack_writer_t *w, uint8_t type, uint64_t value, int width) {
+    uint8_t *p = mp_reserve(w, 1 + width);
+
+    *p++ = type;
+    while (width--) {
+        *p++ = (uint8_t)(value >> (width * 8));
+    }
+}
+
+static void mp_encode_integer(pack_writer_t *w, int64_t v) {
+    if (v >= 0) {
+        if (v < 128)              mp_write(w, (uint8_t)v, 0, 0);
+        else if (v <= UINT8_MAX)  mp_write(w, 0xcc, v, 1);
+        else if (v <= UINT16_MAX) mp_write(w, 0xcd, v, 2);
+        else if (v <= UINT32_MAX) mp_write(w, 0xce, v, 4);
+        else                      mp_write(w, 0xcf, v, 8);
+    } else {
+        if (v >= -32)             mp_write(w, (uint8_t)v, 0, 0);
+        else if (v >= INT8_MIN)   mp_write(w, 0xd0, (uint8_t)v, 1);
+        else if (v >= INT16_MIN)  mp_write(w, 0xd1, (uint16_t)v, 2);
+        else if (v >= INT32_MIN)  mp_write(w, 0xd2, (uint32_t)v, 4);
+        else                      mp_write(w, 0xd3, (uint64_t)v, 8);
+    }
+}
+
+static void mp_encode_number(pack_writer_t *w, lua_Number n) {
+    float f = (float)n;
+    uint32_t u32;
+
+    if (((lua_Number)f == n) || (n != n)) {
+        memcpy(&u32, &f, sizeof(u32));
+        mp_write(w, 0xca, u32, 4);
+    } else {
+        double d = (double)n;
+        uint64_t u64;
+
+        memcpy(&u64, &d, sizeof(u64));
+        mp_write(w, 0xcb, u64, 8);
+    }
+}
+
+// Encode a str (bin = 0) or bin (bin = 1) header, followed by data
+static void mp_encode_bytes(pack_writer_t *w, const void *data, size_t len, int bin) {
+    if (!bin && (len < 32)) mp_write(w, 0xa0 | len, 0, 0);
+    else if (len <= UINT8_MAX)  mp_write(w, bin ? 0xc4 : 0xd9, len, 1);
+    else if (len <= UINT16_MAX) mp_write(w, bin ? 0xc5 : 0xda, len, 2);
+    else                        mp_write(w, bin ? 0xc6 : 0xdb, len, 4);
+
+    memcpy(mp_reserve(w, len), data, len);
+}
+
+// Encode an array (map = 0) or map (map = 1) header
+static void mp_encode_header(pack_writer_t *w, size_t n, int map) {
+    if (n < 16) mp_write(w, (map ? 0x80 : 0x90) | n, 0, 0);
+    else if (n <= UINT16_MAX) mp_write(w, map ? 0xde : 0xdc, n, 2);
+    else mp_write(w, map ? 0xdf : 0xdd, n, 4);
+}
+
+static void mp_encode_table(pack_writer_t *w, int idx, int depth) {
+    lua_State *L = w->L;
+    size_t n, count = 0, i;
+    lua_Integer key;
+    int seq = 1;
+
+    if (depth > PACK_MAX_DEPTH) {
+        luaL_error(L, "table nested too deep");
+    }
+
+    luaL_checkstack(L, 3, "table nested too deep");
+
+    // Count keys, and check that all of them are integers in 1..n, to
+    // know if table is a sequence
+    n = lua_rawlen(L, idx);
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+        lua_pop(L, 1);
+        count++;
+
+        if (seq) {
+            key = lua_isinteger(L, -1) ? lua_tointeger(L, -1) : 0;
+            seq = (key >= 1) && ((lua_Unsigned)key <= n);
+        }
+    }
+
+    if (seq && (count == n)) {
+        mp_encode_header(w, n, 0);
+        for(i = 1; i <= n; i++) {
+            lua_rawgeti(L, idx, i);
+            mp_encode(w, lua_gettop(L), depth + 1);
+            lua_pop(L, 1);
+        }
+    } else {
+        mp_encode_header(w, count, 1);
+        lua_pushnil(L);
+        while (lua_next(L, idx)) {
+            mp_encode(w, lua_gettop(L) - 1, depth + 1);
+            mp_encode(w, lua_gettop(L), depth + 1);
+            lua_pop(L, 1);
+        }
+    }
+}
+
+static void mp_encode(pack_writer_t *w, int idx, int depth) {
+    lua_State *L = w->L;
+    const char *s;
+    size_t len;
+
+    switch (lua_type(L, idx)) {
+        case LUA_TNIL:
+            mp_write(w, 0xc0, 0, 0);
+            break;
+
+        case LUA_TBOOLEAN:
+            mp_write(w, lua_toboolean(L, idx) ? 0xc3 : 0xc2, 0, 0);
+            break;
+
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, idx)) {
+                mp_encode_integer(w, (int64_t)lua_tointeger(L, idx));
+            } else {
+                mp_encode_number(w, lua_tonumber(L, idx));
+            }
+            break;
+
+        case LUA_TSTRING:
+            s = lua_tolstring(L, idx, &len);
+            mp_encode_bytes(w, s, len, 0);
+            break;
+
+        case LUA_TTABLE:
+            mp_encode_table(w, idx, depth);
+            break;
+
+#if LUA_USE_BUFFER
+        case LUA_TUSERDATA: {
+            buffer_userdata_t *buffer = luaL_testbuffer(L, idx);
+
+            if (buffer) {
+                mp_encode_bytes(w, buffer->data, buffer->size, 1);
+                break;
+            }
+        }
+#endif
+        default:
+            luaL_error(L, "unsupported type %s", luaL_typename(L, idx));
+    }
+}
+
+static const uint8_t *mp_read(pack_reader_t *r, size_t n) {
+    const uint8_t *p = r->p;
+
+    if ((size_t)(r->end - r->p) < n) {
+        luaL_error(r->L, "truncated message");
+    }
+
+    r->p += n;
+
+    return p;
+}
+
+// Read a big endian value of width bytes
+static uint64_t mp_read_uint(pack_reader_t *r, int width) {
+    const uint8_t *p = mp_read(r, width);
+    uint64_t value = 0;
+
+    while (width--) {
+        value = (value << 8) | *p++;
+    }
+
+    return value;
+}
+
+static void mp_push_integer(lua_State *L, int64_t v) {
+    if ((v >= LUA_MININTEGER) && (v <= LUA_MAXINTEGER)) {
+        lua_pushinteger(L, (lua_Integer)v);
+    } else {
+        lua_pushnumber(L, (lua_Number)v);
+    }
+}
+
+static void mp_decode(pack_reader_t *r, int depth);
+
+static void mp_decode_bytes(pack_reader_t *r, size_t len, int bin) {
+    const uint8_t *p = mp_read(r, len);
+
+#if LUA_USE_BUFFER
+    // bin values read from a buffer are views of it, not copies
+    if (bin && r->src) {
+        luaL_pushslice(r->L, r->src, p - r->data, len);
+        return;
+    }
+#endif
+
+    lua_pushlstring(r->L, (const char *)p, len);
+}
+
+static void mp_decode_table(pack_reader_t *r, size_t n, int map, int depth) {
+    lua_State *L = r->L;
+    size_t i;
+
+    if (depth > PACK_MAX_DEPTH) {
+        luaL_error(L, "table nested too deep");
+    }
+
+    // Each element is at least one byte long
+    if (n > (size_t)(r->end - r->p)) {
+        luaL_error(L, "truncated message");
+    }
+
+    luaL_checkstack(L, 3, "table nested too deep");
+
+    if (map) {
+        lua_createtable(L, 0, n);
+        for(i = 0; i < n; i++) {
+            mp_decode(r, depth + 1);
+            mp_decode(r, depth + 1);
+            if (lua_isnil(L, -2)) {
+                luaL_error(L, "invalid map key");
+            }
+            lua_rawset(L, -3);
+        }
+    } else {
+        lua_createtable(L, n, 0);
+        for(i = 1; i <= n; i++) {
+            mp_decode(r, depth + 1);
+            lua_rawseti(L, -2, i);
+        }
+    }
+}
+
+static void mp_decode(pack_reader_t *r, int depth) {
+    lua_State *L = r->L;
+    uint8_t type = *mp_read(r, 1);
+    uint32_t u32;
+    uint64_t u64;
+    float f;
+    double d;
+
+    if (type <= 0x7f) {
+        lua_pushinteger(L, type);
+    } else if (type >= 0xe0) {
+        lua_pushinteger(L, (int8_t)type);
+    } else if ((type & 0xe0) == 0xa0) {
+        mp_decode_bytes(r, type & 0x1f, 0);
+    } else if ((type & 0xf0) == 0x90) {
+        mp_decode_table(r, type & 0x0f, 0, depth);
+    } else if ((type & 0xf0) == 0x80) {
+        mp_decode_table(r, type & 0x0f, 1, depth);
+    } else {
+        switch (type) {
+            case 0xc0: lua_pushnil(L); break;
+            case 0xc2: lua_pushboolean(L, 0); break;
+            case 0xc3: lua_pushboolean(L, 1); break;
+            case 0xc4: mp_decode_bytes(r, mp_read_uint(r, 1), 1); break;
+            case 0xc5: mp_decode_bytes(r, mp_read_uint(r, 2), 1); break;
+            case 0xc6: mp_decode_bytes(r, mp_read_uint(r, 4), 1); break;
+            case 0xca:
+                u32 = mp_read_uint(r, 4);
+                memcpy(&f, &u32, sizeof(f));
+                lua_pushnumber(L, (lua_Number)f);
+                break;
+            case 0xcb:
+                u64 = mp_read_uint(r, 8);
+                memcpy(&d, &u64, sizeof(d));
+                lua_pushnumber(L, (lua_Number)d);
+                break;
+            case 0xcc: lua_pushinteger(L, mp_read_uint(r, 1)); break;
+            case 0xcd: lua_pushinteger(L, mp_read_uint(r, 2)); break;
+            case 0xce: mp_push_integer(L, mp_read_uint(r, 4)); break;
+            case 0xcf:
+                u64 = mp_read_uint(r, 8);
+                if (u64 > INT64_MAX) {
+                    lua_pushnumber(L, (lua_Number)u64);
+                } else {
+                    mp_push_integer(L, (int64_t)u64);
+                }
+                break;
+            case 0xd0: lua_pushinteger(L, (int8_t)mp_read_uint(r, 1)); break;
+            case 0xd1: lua_pushinteger(L, (int16_t)mp_read_uint(r, 2)); break;
+            case 0xd2: mp_push_integer(L, (int32_t)mp_read_uint(r, 4)); break;
+            case 0xd3: mp_push_integer(L, (int64_t)mp_read_uint(r, 8)); break;
+            case 0xd9: mp_decode_bytes(r, mp_read_uint(r, 1), 0); break;
+            case 0xda: mp_decode_bytes(r, mp_read_uint(r, 2), 0); break;
+            case 0xdb: mp_decode_bytes(r, mp_read_uint(r, 4), 0); break;
+            case 0xdc: mp_decode_table(r, mp_read_uint(r, 2), 0, depth); break;
+            case 0xdd: mp_decode_table(r, mp_read_uint(r, 4), 0, depth); break;
+            case 0xde: mp_decode_table(r, mp_read_uint(r, 2), 1, depth); break;
+            case 0xdf: mp_decode_table(r, mp_read_uint(r, 4), 1, depth); break;
+            default:
+                luaL_error(L, "unsupported type %d", type);
+        }
+    }
+}
+
+// pack.encode(...), returns a string with each argument MessagePack encoded
+static int l_encode(lua_State *L) {
+    int total = lua_gettop(L);
+    pack_writer_t w;
+    int i;
+
+    // Slot for the growing buffer, if initb is not enough
+    lua_pushnil(L);
+
+    w.L = L;
+    w.data = w.initb;
+    w.size = sizeof(w.initb);
+    w.len = 0;
+    w.slot = total + 1;
+
+    for(i = 1; i <= total; i++) {
+        mp_encode(&w, i, 0);
+    }
+
+    lua_pushlstring(L, (const char *)w.data, w.len);
+
+    return 1;
+}
+
+#if LUA_USE_BUFFER
+// pack.encodeinto(buffer, ...), encodes into buffer and returns the number
+// of bytes used
+static int l_encodeinto(lua_State *L) {
+    buffer_userdata_t *buffer = luaL_checkbuffer(L, 1);
+    int total = lua_gettop(L);
+    pack_writer_t w;
+    int i;
+
+    w.L = L;
+    w.data = buffer->data;
+    w.size = buffer->size;
+    w.len = 0;
+    w.slot = 0;
+
+    for(i = 2; i <= total; i++) {
+        mp_encode(&w, i, 0);
+    }
+
+    lua_pushinteger(L, w.len);
+
+    return 1;
+}
+#endif
+
+// pack.decode(data), data is a string or a buffer. Returns all the values.
+static int l_decode(lua_State *L) {
+    pack_reader_t r;
+    size_t len;
+    int n = 0;
+
+    r.L = L;
+    r.src = 0;
+
+#if LUA_USE_BUFFER
+    buffer_userdata_t *buffer;
+
+    if ((buffer = luaL_testbuffer(L, 1))) {
+        r.data = buffer->data;
+        len = buffer->size;
+        r.src = 1;
+    } else
+#endif
+    r.data = (const uint8_t *)luaL_checklstring(L, 1, &len);
+
+    r.p = r.data;
+    r.end = r.data + len;
+
+    while (r.p < r.end) {
+        luaL_checkstack(L, 1, "too many values");
+        mp_decode(&r, 0);
+        n++;
+    }
+
+    return n;
+}
+
 static const LUA_REG_TYPE pack_map[] = 
 {
   { LSTRKEY( "pack" ),      LFUNCVAL( l_pack ) },
   { LSTRKEY( "unpack" ),    LFUNCVAL( l_unpack ) },
+  { LSTRKEY( "encode" ),    LFUNCVAL( l_encode ) },
+#if LUA_USE_BUFFER
+  { LSTRKEY( "encodeinto" ),LFUNCVAL( l_encodeinto ) },
+#endif
+  { LSTRKEY( "decode" ),    LFUNCVAL( l_decode ) },
   { LNILKEY, LNILVAL }
 };
 
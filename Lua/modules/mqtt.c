@@ -37,6 +37,10 @@
 #include "modules.h"
 #include "error.h"
 
+#if LUA_USE_JSON
+#include "json.h"
+#endif
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
@@ -73,6 +77,7 @@ static int client_inited = 0;
 typedef struct {
     char *topic;
     int callback;
+    int json;     // Decode payload as JSON before calling callback
     void *next;
 } mqtt_subs_callback;
 
@@ -88,7 +93,7 @@ typedef struct {
     int secure;
 } mqtt_userdata;
 
-static int add_subs_callback(mqtt_userdata *mqtt, const char *topic, int call) {
+static int add_subs_callback(mqtt_userdata *mqtt, const char *topic, int call, int json) {
     mqtt_subs_callback *callback;
     
     // Create and populate callback structure
@@ -108,6 +113,7 @@ static int add_subs_callback(mqtt_userdata *mqtt, const char *topic, int call) {
     strcpy(callback->topic, topic);
     
     callback->callback = call;
+    callback->json = json;
     
     mtx_lock(&mqtt->callback_mtx);
     callback->next = mqtt->callbacks;
@@ -131,8 +137,22 @@ static int messageArrived(void *context, char * topicName, int topicLen, MQTTCli
             if (call != LUA_NOREF) {
                 lua_rawgeti(mqtt->L, LUA_REGISTRYINDEX, call);
                 lua_pushinteger(mqtt->L, m->payloadlen);
-                lua_pushlstring(mqtt->L, m->payload, m->payloadlen);
-                lua_call(mqtt->L, 2, 0);
+#if LUA_USE_JSON
+                if (callback->json) {
+                    // Callback gets the decoded value, or nil and the error
+                    if (json_pdecode(mqtt->L, m->payload, m->payloadlen) == LUA_OK) {
+                        lua_call(mqtt->L, 2, 0);
+                    } else {
+                        lua_pushnil(mqtt->L);
+                        lua_insert(mqtt->L, -2);
+                        lua_call(mqtt->L, 3, 0);
+                    }
+                } else
+#endif
+                {
+                    lua_pushlstring(mqtt->L, m->payload, m->payloadlen);
+                    lua_call(mqtt->L, 2, 0);
+                }
             }
         }
         
@@ -242,6 +262,7 @@ static int lmqtt_subscribe( lua_State* L ) {
     int qos;
     const char *topic;
     int callback = 0;
+    int json = 0;
     
     mqtt_userdata *mqtt = NULL;
     
@@ -253,13 +274,17 @@ static int lmqtt_subscribe( lua_State* L ) {
     
     luaL_checktype(L, 4, LUA_TFUNCTION);
 
+#if LUA_USE_JSON
+    json = lua_toboolean(L, 5);
+#endif
+
     // Copy argument (function) to the top of stack
     lua_pushvalue(L, 4); 
 
     // Copy function reference
     callback = luaL_ref(L, LUA_REGISTRYINDEX);
 
-    add_subs_callback(mqtt, topic, callback);        
+    add_subs_callback(mqtt, topic, callback, json);
     
     rc = MQTTClient_subscribe(mqtt->client, topic, qos);
     if (rc == 0) {
@@ -282,8 +307,21 @@ static int lmqtt_publish( lua_State* L ) {
     luaL_argcheck(L, mqtt, 1, "mqtt expected");
     
     topic = luaL_checkstring( L, 2 );
-    payload = (char *)luaL_checklstring( L, 3, &payload_len );
     qos = luaL_checkinteger( L, 4 );
+
+#if LUA_USE_JSON
+    json_writer_t w;
+
+    if (lua_istable(L, 3)) {
+        // Publish table as JSON, without building an intermediate string
+        json_writer_init(L, &w, NULL);
+        json_encode_value(&w, 3);
+
+        payload = w.data;
+        payload_len = w.len;
+    } else
+#endif
+    payload = (char *)luaL_checklstring( L, 3, &payload_len );
     
     rc = MQTTClient_publish(mqtt->client, topic, payload_len, payload, 
             qos, 0, NULL);
@@ -0,0 +1,1075 @@
+/*
+ * Lua RTOS, Lua sched module
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * This module multiplexes many Lua coroutines (tasks) onto the thread that
+ * calls sched.run. Tasks are cooperative: sched.sleep, sched.wait, event waits
+ * and channel operations yield to the scheduler instead of blocking the thread,
+ * and a count hook preempts tasks that run for more than a quantum of VM
+ * instructions when other tasks are ready.
+ *
+ * The scheduler is also the event loop for I/O: tasks waiting for sockets, ttys
+ * or UART units are waited with a single vfs_poll, with the timeout of the
+ * nearest timer, so one Lua thread can serve many connections and peripherals.
+ *
+ * Each thread has it's own scheduler, so for use more than one core, start
+ * one thread per core and call sched.run from each of them.
+ *
+ */
+
+#include "luartos.h"
+
+#if LUA_USE_SCHED
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "sched.h"
+#include "modules.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <vfs.h>
+
+#define TIME_BEFORE(a, b) ((int32_t)((a) - (b)) < 0)
+
+static pthread_key_t sched_key;
+static pthread_once_t sched_key_once = PTHREAD_ONCE_INIT;
+
+// Milliseconds since boot. The wall clock is not used, as it's moved by
+// sntp, or when the RTC is set, and tv_sec * 1000 overflows a 32 bit time_t.
+static uint32_t sched_now() {
+	return (uint32_t)xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+// Free a scheduler, and the tasks that are still alive
+static void sched_destroy(void *arg) {
+	sched_t *s = (sched_t *)arg;
+	sched_task_t *t;
+
+	while ((t = TAILQ_FIRST(&s->alive))) {
+		// Blocked tasks are linked in the queue of an event, channel, ...
+		if (t->queue) {
+			TAILQ_REMOVE(t->queue, t, link);
+		}
+
+		TAILQ_REMOVE(&s->alive, t, alive_link);
+
+		luaL_unref(s->L, LUA_REGISTRYINDEX, t->ref);
+		free(t);
+	}
+
+	free(s->timers);
+	free(s->pollfds);
+	free(s);
+}
+
+static void sched_key_create() {
+	pthread_key_create(&sched_key, sched_destroy);
+}
+
+// Get the scheduler of the current thread, creating it if required
+static sched_t *sched_get(int create) {
+	sched_t *s;
+
+	pthread_once(&sched_key_once, sched_key_create);
+
+	s = (sched_t *)pthread_getspecific(sched_key);
+	if (!s && create) {
+		s = (sched_t *)calloc(1, sizeof(sched_t));
+		if (!s) {
+			return NULL;
+		}
+
+		TAILQ_INIT(&s->alive);
+		TAILQ_INIT(&s->ready);
+		TAILQ_INIT(&s->io);
+
+		s->quantum = SCHED_QUANTUM;
+		s->next_id = 1;
+
+		pthread_setspecific(sched_key, s);
+	}
+
+	return s;
+}
+
+// Get the running task, raising an error if the caller is not a task
+static sched_task_t *sched_self(lua_State *L) {
+	sched_t *s = sched_get(0);
+
+	if (!s || !s->current || (s->current->L != L)) {
+		luaL_error(L, "not called from a sched task");
+	}
+
+	return s->current;
+}
+
+// Bind an event or channel to the current scheduler, on first use. Objects
+// can only be used by the tasks of one scheduler.
+static sched_t *sched_bind(lua_State *L, sched_t **owner) {
+	sched_t *s = sched_get(1);
+
+	if (!s) {
+		luaL_error(L, "not enough memory");
+	}
+
+	if (!*owner) {
+		*owner = s;
+	} else if (*owner != s) {
+		luaL_error(L, "object belongs to another scheduler");
+	}
+
+	return s;
+}
+
+/*
+ * Timer heap
+ *
+ */
+
+static void timer_swap(sched_t *s, int a, int b) {
+	sched_task_t *tmp = s->timers[a];
+
+	s->timers[a] = s->timers[b];
+	s->timers[b] = tmp;
+
+	s->timers[a]->timer = a;
+	s->timers[b]->timer = b;
+}
+
+static void timer_up(sched_t *s, int i) {
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!TIME_BEFORE(s->timers[i]->deadline, s->timers[parent]->deadline)) {
+			break;
+		}
+
+		timer_swap(s, i, parent);
+		i = parent;
+	}
+}
+
+static void timer_down(sched_t *s, int i) {
+	int child;
+
+	for(;;) {
+		child = 2 * i + 1;
+		if (child >= s->ntimers) {
+			break;
+		}
+
+		if ((child + 1 < s->ntimers) && TIME_BEFORE(s->timers[child + 1]->deadline, s->timers[child]->deadline)) {
+			child++;
+		}
+
+		if (!TIME_BEFORE(s->timers[child]->deadline, s->timers[i]->deadline)) {
+			break;
+		}
+
+		timer_swap(s, i, child);
+		i = child;
+	}
+}
+
+static int timer_add(sched_t *s, sched_task_t *t, uint32_t deadline) {
+	sched_task_t **timers;
+	int size;
+
+	if (s->ntimers == s->maxtimers) {
+		size = (s->maxtimers?(s->maxtimers * 2):8);
+
+		timers = (sched_task_t **)realloc(s->timers, size * sizeof(sched_task_t *));
+		if (!timers) {
+			return -1;
+		}
+
+		s->timers = timers;
+		s->maxtimers = size;
+	}
+
+	t->deadline = deadline;
+	t->timer = s->ntimers++;
+	s->timers[t->timer] = t;
+
+	timer_up(s, t->timer);
+
+	return 0;
+}
+
+static void timer_remove(sched_t *s, sched_task_t *t) {
+	int i = t->timer;
+
+	if (i < 0) {
+		return;
+	}
+
+	t->timer = -1;
+
+	if (i != --s->ntimers) {
+		s->timers[i] = s->timers[s->ntimers];
+		s->timers[i]->timer = i;
+
+		timer_down(s, i);
+		timer_up(s, i);
+	}
+}
+
+/*
+ * Task states
+ *
+ */
+
+// Make a task ready to run, removing it from it's wait queue and timer. Values
+// to return to the task must be pushed on it's stack, and counted in nargs.
+static void sched_wakeup(sched_t *s, sched_task_t *t) {
+	if (t->queue) {
+		TAILQ_REMOVE(t->queue, t, link);
+	}
+
+	timer_remove(s, t);
+
+	t->state = SCHED_TASK_READY;
+	t->queue = &s->ready;
+
+	TAILQ_INSERT_TAIL(&s->ready, t, link);
+}
+
+// Block the running task until it is waked up, or until timeout milliseconds
+// have passed if timeout >= 0. Must be called as return sched_block(...) from a
+// C function, nresults are the values on top of the stack passed to the scheduler.
+// If k is not NULL, it is called as continuation when the task is resumed.
+static int sched_block(lua_State *L, sched_task_t *t, int state, struct sched_queue *queue, int timeout, int nresults,
+					   lua_KContext ctx, lua_KFunction k) {
+	if (timeout >= 0) {
+		if (timer_add(t->sched, t, sched_now() + timeout) < 0) {
+			return luaL_error(L, "not enough memory");
+		}
+	}
+
+	t->state = state;
+	t->nargs = 0;
+	t->queue = queue;
+
+	if (queue) {
+		TAILQ_INSERT_TAIL(queue, t, link);
+	}
+
+	return lua_yieldk(L, nresults, ctx, k);
+}
+
+// Wake up tasks whose timer has expired
+static void sched_expire(sched_t *s, uint32_t now) {
+	sched_task_t *t;
+
+	while (s->ntimers && !TIME_BEFORE(now, s->timers[0]->deadline)) {
+		t = s->timers[0];
+
+		if (t->state != SCHED_TASK_SLEEPING) {
+			// Timeout
+			lua_pushboolean(t->L, 0);
+			t->nargs = 1;
+		}
+
+		sched_wakeup(s, t);
+	}
+}
+
+// Wait until some of the tasks waiting for I/O can continue, or timeout
+// milliseconds have passed (forever if timeout < 0)
+static void sched_poll(sched_t *s, int timeout) {
+	struct vfs_pollfd *fds;
+	sched_task_t *t, *next;
+	int nfds = 0;
+	int size, i;
+
+	// Build the poll set, in the order of the I/O queue
+	TAILQ_FOREACH(t, &s->io, link) {
+		nfds++;
+	}
+
+	if (nfds > s->maxpollfds) {
+		size = ((nfds + 7) & ~7);
+
+		fds = (struct vfs_pollfd *)realloc(s->pollfds, size * sizeof(struct vfs_pollfd));
+		if (!fds) {
+			return;
+		}
+
+		s->pollfds = fds;
+		s->maxpollfds = size;
+	}
+
+	i = 0;
+	TAILQ_FOREACH(t, &s->io, link) {
+		s->pollfds[i].fd = t->fd;
+		s->pollfds[i].events = t->events;
+		s->pollfds[i].revents = 0;
+		i++;
+	}
+
+	s->polls++;
+
+	if (vfs_poll(s->pollfds, nfds, timeout) > 0) {
+		// Wake up ready tasks, passing true. Errors are also reported as ready,
+		// so the task gets the error from the next read / write.
+		i = 0;
+		t = TAILQ_FIRST(&s->io);
+		while (t) {
+			next = TAILQ_NEXT(t, link);
+
+			if (s->pollfds[i].revents) {
+				lua_pushboolean(t->L, 1);
+				t->nargs = 1;
+
+				sched_wakeup(s, t);
+			}
+
+			t = next;
+			i++;
+		}
+	}
+
+	s->last_poll = sched_now();
+}
+
+// Preempt the running task if other tasks can run
+static void sched_hook(lua_State *L, lua_Debug *ar) {
+	sched_t *s = sched_get(0);
+	uint32_t now;
+
+	if (!s || !s->current || (s->current->L != L) || !lua_isyieldable(L)) {
+		return;
+	}
+
+	if (TAILQ_EMPTY(&s->ready) && !s->ntimers && TAILQ_EMPTY(&s->io)) {
+		return;
+	}
+
+	if (TAILQ_EMPTY(&s->ready)) {
+		now = sched_now();
+
+		if ((!s->ntimers || TIME_BEFORE(now, s->timers[0]->deadline)) &&
+			(TAILQ_EMPTY(&s->io) || TIME_BEFORE(now, s->last_poll + SCHED_POLL_INTERVAL))) {
+			return;
+		}
+	}
+
+	s->preemptions++;
+
+	lua_yield(L, 0);
+}
+
+static void sched_free(lua_State *L, sched_t *s, sched_task_t *t) {
+	luaL_unref(L, LUA_REGISTRYINDEX, t->ref);
+
+	TAILQ_REMOVE(&s->alive, t, alive_link);
+	s->tasks--;
+
+	free(t);
+}
+
+// Run a task until it yields or ends
+static void sched_resume(lua_State *L, sched_t *s, sched_task_t *t) {
+	int status, nargs;
+
+	nargs = t->nargs;
+
+	t->nargs = 0;
+	t->state = SCHED_TASK_RUNNING;
+	t->queue = NULL;
+
+	if (s->quantum > 0) {
+		lua_sethook(t->L, sched_hook, LUA_MASKCOUNT, s->quantum);
+	} else {
+		lua_sethook(t->L, NULL, 0, 0);
+	}
+
+	s->current = t;
+	s->switches++;
+
+	status = lua_resume(t->L, L, nargs);
+
+	s->current = NULL;
+
+	if (status == LUA_YIELD) {
+		if (t->state == SCHED_TASK_RUNNING) {
+			// Preempted, or yielded with sched.yield / coroutine.yield
+			lua_settop(t->L, 0);
+
+			t->state = SCHED_TASK_READY;
+			t->queue = &s->ready;
+
+			TAILQ_INSERT_TAIL(&s->ready, t, link);
+		}
+
+		return;
+	}
+
+	if (status != LUA_OK) {
+		const char *msg = lua_tostring(t->L, -1);
+
+		lua_writestringerror("%s\n", msg?msg:"(error object is not a string)");
+	}
+
+	sched_free(L, s, t);
+}
+
+/*
+ * Lua API
+ *
+ */
+
+static int lsched_spawn(lua_State *L) {
+	sched_task_t *t;
+	sched_t *s;
+
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+
+	s = sched_get(1);
+	if (!s) {
+		return luaL_error(L, "not enough memory");
+	}
+
+	t = (sched_task_t *)calloc(1, sizeof(sched_task_t));
+	if (!t) {
+		return luaL_error(L, "not enough memory");
+	}
+
+	if (!s->L) {
+		lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+		s->L = lua_tothread(L, -1);
+		lua_pop(L, 1);
+	}
+
+	// Move function and arguments to a new coroutine
+	t->nargs = lua_gettop(L) - 1;
+	t->L = lua_newthread(L);
+	t->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	lua_xmove(L, t->L, t->nargs + 1);
+
+	t->sched = s;
+	t->timer = -1;
+	t->id = s->next_id++;
+	t->state = SCHED_TASK_READY;
+	t->queue = &s->ready;
+
+	TAILQ_INSERT_TAIL(&s->ready, t, link);
+	TAILQ_INSERT_TAIL(&s->alive, t, alive_link);
+
+	s->tasks++;
+
+	lua_pushinteger(L, t->id);
+
+	return 1;
+}
+
+static int lsched_run(lua_State *L) {
+	sched_task_t *t;
+	uint32_t now;
+	int timeout;
+	sched_t *s;
+
+	s = sched_get(1);
+	if (!s) {
+		return luaL_error(L, "not enough memory");
+	}
+
+	if (s->current) {
+		return luaL_error(L, "the scheduler can't be run from a task");
+	}
+
+	s->quantum = luaL_optinteger(L, 1, SCHED_QUANTUM);
+
+	while (s->tasks > 0) {
+		now = sched_now();
+
+		sched_expire(s, now);
+
+		if (!TAILQ_EMPTY(&s->io) && (TAILQ_EMPTY(&s->ready) || !TIME_BEFORE(now, s->last_poll + SCHED_POLL_INTERVAL))) {
+			if (!TAILQ_EMPTY(&s->ready)) {
+				timeout = 0;
+			} else if (s->ntimers) {
+				timeout = (int32_t)(s->timers[0]->deadline - now);
+				if (timeout < 0) {
+					timeout = 0;
+				}
+			} else {
+				timeout = -1;
+			}
+
+			sched_poll(s, timeout);
+
+			if (TAILQ_EMPTY(&s->ready)) {
+				continue;
+			}
+		}
+
+		if (TAILQ_EMPTY(&s->ready)) {
+			if (!s->ntimers) {
+				// The remaining tasks wait for events or channels that can't be
+				// signaled anymore
+				break;
+			}
+
+			timeout = (int32_t)(s->timers[0]->deadline - now);
+			if (timeout > 0) {
+				usleep(timeout * 1000);
+			}
+
+			continue;
+		}
+
+		t = TAILQ_FIRST(&s->ready);
+		TAILQ_REMOVE(&s->ready, t, link);
+
+		sched_resume(L, s, t);
+	}
+
+	// Return the number of tasks that are blocked forever
+	lua_pushinteger(L, s->tasks);
+
+	return 1;
+}
+
+void sched_release() {
+	sched_t *s;
+
+	pthread_once(&sched_key_once, sched_key_create);
+
+	s = (sched_t *)pthread_getspecific(sched_key);
+	if (s) {
+		pthread_setspecific(sched_key, NULL);
+		sched_destroy(s);
+	}
+}
+
+static int lsched_yield(lua_State *L) {
+	sched_self(L);
+
+	return lua_yield(L, 0);
+}
+
+int sched_in_task(lua_State *L) {
+	sched_t *s = sched_get(0);
+
+	return (s && s->current && (s->current->L == L));
+}
+
+int sched_wait_io(lua_State *L, int fd, int events, int timeout, lua_KContext ctx, lua_KFunction k) {
+	sched_task_t *t = sched_self(L);
+
+	t->fd = fd;
+	t->events = events;
+
+	return sched_block(L, t, SCHED_TASK_IO, &t->sched->io, timeout, 0, ctx, k);
+}
+
+int sched_sleep(lua_State *L, lua_Integer ms) {
+	sched_t *s = sched_get(0);
+
+	if (ms < 0) {
+		ms = 0;
+	}
+
+	// Outside a task, block the thread
+	if (!s || !s->current || (s->current->L != L)) {
+		usleep(ms * 1000);
+		return 0;
+	}
+
+	return sched_block(L, s->current, SCHED_TASK_SLEEPING, NULL, ms, 0, 0, NULL);
+}
+
+static int lsched_sleep(lua_State *L) {
+	return sched_sleep(L, luaL_checkinteger(L, 1) * 1000);
+}
+
+static int lsched_sleepms(lua_State *L) {
+	return sched_sleep(L, luaL_checkinteger(L, 1));
+}
+
+// Get a file descriptor, from a file or an integer
+static int sched_checkfd(lua_State *L, int index) {
+	luaL_Stream *stream;
+	int fd;
+
+	stream = (luaL_Stream *)luaL_testudata(L, index, LUA_FILEHANDLE);
+	if (stream) {
+		if (!stream->f) {
+			luaL_argerror(L, index, "file is closed");
+		}
+
+		fd = fileno(stream->f);
+	} else {
+		fd = luaL_checkinteger(L, index);
+	}
+
+	if (fd < 0) {
+		luaL_argerror(L, index, "invalid file descriptor");
+	}
+
+	return fd;
+}
+
+// Test if a file descriptor is ready for events, without waiting
+static int sched_ready(int fd, int events) {
+	struct vfs_pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+
+	return (vfs_poll(&pfd, 1, 0) > 0);
+}
+
+static int lsched_wait(lua_State *L) {
+	static const char *const modes[] = {"r", "w", "rw", NULL};
+	int fd, mode, timeout;
+
+	sched_self(L);
+
+	fd = sched_checkfd(L, 1);
+	mode = luaL_checkoption(L, 2, "r", modes);
+	timeout = luaL_optinteger(L, 3, -1);
+
+	return sched_wait_io(L, fd, mode + 1, timeout, 0, NULL);
+}
+
+static int lsched_read_k(lua_State *L, int status, lua_KContext ctx);
+
+// Read up to n bytes once the file descriptor is readable
+static int sched_read(lua_State *L) {
+	int fd = sched_checkfd(L, 1);
+	lua_Integer n = luaL_checkinteger(L, 2);
+	int timeout = luaL_optinteger(L, 3, -1);
+	luaL_Buffer b;
+	ssize_t r;
+	char *p;
+
+	luaL_argcheck(L, n > 0, 2, "must be greater than 0");
+
+	if (!sched_ready(fd, VFS_POLLIN)) {
+		return sched_wait_io(L, fd, VFS_POLLIN, timeout, 0, lsched_read_k);
+	}
+
+	p = luaL_buffinitsize(L, &b, n);
+
+	r = read(fd, p, n);
+	if (r < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+			return sched_wait_io(L, fd, VFS_POLLIN, timeout, 0, lsched_read_k);
+		}
+
+		lua_pushnil(L);
+		lua_pushstring(L, strerror(errno));
+
+		return 2;
+	}
+
+	if (r == 0) {
+		// End of file
+		lua_pushnil(L);
+		return 1;
+	}
+
+	luaL_pushresultsize(&b, r);
+
+	return 1;
+}
+
+static int lsched_read_k(lua_State *L, int status, lua_KContext ctx) {
+	if (!lua_toboolean(L, -1)) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "timeout");
+
+		return 2;
+	}
+
+	lua_settop(L, 3);
+
+	return sched_read(L);
+}
+
+static int lsched_read(lua_State *L) {
+	sched_self(L);
+	lua_settop(L, 3);
+
+	return sched_read(L);
+}
+
+static int lsched_write_k(lua_State *L, int status, lua_KContext ctx);
+
+// Write data from offset, waiting for the file descriptor to be writable
+// as many times as needed
+static int sched_write(lua_State *L, size_t offset) {
+	int fd = sched_checkfd(L, 1);
+	int timeout = luaL_optinteger(L, 3, -1);
+	const char *data;
+	size_t len;
+	ssize_t r;
+
+	data = luaL_checklstring(L, 2, &len);
+
+	while (offset < len) {
+		if (!sched_ready(fd, VFS_POLLOUT)) {
+			return sched_wait_io(L, fd, VFS_POLLOUT, timeout, offset, lsched_write_k);
+		}
+
+		r = write(fd, data + offset, len - offset);
+		if (r < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				return sched_wait_io(L, fd, VFS_POLLOUT, timeout, offset, lsched_write_k);
+			}
+
+			lua_pushnil(L);
+			lua_pushstring(L, strerror(errno));
+
+			return 2;
+		}
+
+		offset += r;
+	}
+
+	lua_pushinteger(L, len);
+
+	return 1;
+}
+
+static int lsched_write_k(lua_State *L, int status, lua_KContext ctx) {
+	if (!lua_toboolean(L, -1)) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "timeout");
+		lua_pushinteger(L, ctx);
+
+		return 3;
+	}
+
+	lua_settop(L, 3);
+
+	return sched_write(L, ctx);
+}
+
+static int lsched_write(lua_State *L) {
+	sched_self(L);
+	lua_settop(L, 3);
+
+	return sched_write(L, 0);
+}
+
+static int lsched_id(lua_State *L) {
+	sched_t *s = sched_get(0);
+
+	if (!s || !s->current || (s->current->L != L)) {
+		lua_pushnil(L);
+	} else {
+		lua_pushinteger(L, s->current->id);
+	}
+
+	return 1;
+}
+
+static int lsched_stats(lua_State *L) {
+	sched_task_t *t;
+	sched_t *s;
+	int ready = 0;
+
+	s = sched_get(1);
+	if (!s) {
+		return luaL_error(L, "not enough memory");
+	}
+
+	TAILQ_FOREACH(t, &s->ready, link) {
+		ready++;
+	}
+
+	lua_createtable(L, 0, 6);
+
+	lua_pushinteger(L, s->tasks);
+	lua_setfield(L, -2, "tasks");
+
+	lua_pushinteger(L, ready);
+	lua_setfield(L, -2, "ready");
+
+	lua_pushinteger(L, s->ntimers);
+	lua_setfield(L, -2, "timers");
+
+	lua_pushinteger(L, s->switches);
+	lua_setfield(L, -2, "switches");
+
+	lua_pushinteger(L, s->preemptions);
+	lua_setfield(L, -2, "preemptions");
+
+	lua_pushinteger(L, s->polls);
+	lua_setfield(L, -2, "polls");
+
+	return 1;
+}
+
+/*
+ * Events
+ *
+ */
+
+static int lsched_event(lua_State *L) {
+	sched_event_userdata *udata;
+
+	udata = (sched_event_userdata *)lua_newuserdata(L, sizeof(sched_event_userdata));
+
+	udata->sched = NULL;
+	TAILQ_INIT(&udata->waiting);
+
+	luaL_getmetatable(L, "sched.event");
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+static int lsched_event_wait(lua_State *L) {
+	sched_event_userdata *udata;
+	sched_task_t *t;
+
+	udata = (sched_event_userdata *)luaL_checkudata(L, 1, "sched.event");
+
+	t = sched_self(L);
+	sched_bind(L, &udata->sched);
+
+	return sched_block(L, t, SCHED_TASK_WAITING, &udata->waiting, luaL_optinteger(L, 2, -1), 0, 0, NULL);
+}
+
+static int sched_event_wakeup(lua_State *L, int all) {
+	sched_event_userdata *udata;
+	sched_task_t *t;
+	sched_t *s;
+	int n = 0;
+
+	udata = (sched_event_userdata *)luaL_checkudata(L, 1, "sched.event");
+
+	s = sched_bind(L, &udata->sched);
+
+	while ((t = TAILQ_FIRST(&udata->waiting))) {
+		lua_pushboolean(t->L, 1);
+		t->nargs = 1;
+
+		sched_wakeup(s, t);
+		n++;
+
+		if (!all) {
+			break;
+		}
+	}
+
+	lua_pushinteger(L, n);
+
+	return 1;
+}
+
+static int lsched_event_signal(lua_State *L) {
+	return sched_event_wakeup(L, 0);
+}
+
+static int lsched_event_broadcast(lua_State *L) {
+	return sched_event_wakeup(L, 1);
+}
+
+/*
+ * Channels
+ *
+ * Buffered values are stored in the user value table of the channel. A task
+ * blocked in send keeps the value on top of it's stack, until a receiver
+ * takes it.
+ *
+ */
+
+static int lsched_channel(lua_State *L) {
+	sched_channel_userdata *udata;
+	int capacity;
+
+	capacity = luaL_optinteger(L, 1, 0);
+	luaL_argcheck(L, capacity >= 0, 1, "invalid capacity");
+
+	udata = (sched_channel_userdata *)lua_newuserdata(L, sizeof(sched_channel_userdata));
+
+	udata->sched = NULL;
+	udata->capacity = capacity;
+	udata->count = 0;
+	udata->head = 0;
+
+	TAILQ_INIT(&udata->senders);
+	TAILQ_INIT(&udata->receivers);
+
+	lua_createtable(L, capacity, 0);
+	lua_setuservalue(L, -2);
+
+	luaL_getmetatable(L, "sched.channel");
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+static int lsched_channel_send(lua_State *L) {
+	sched_channel_userdata *udata;
+	sched_task_t *t;
+	sched_t *s;
+
+	udata = (sched_channel_userdata *)luaL_checkudata(L, 1, "sched.channel");
+	luaL_checkany(L, 2);
+	lua_settop(L, 2);
+
+	s = sched_bind(L, &udata->sched);
+
+	// Give the value to a waiting receiver
+	if ((t = TAILQ_FIRST(&udata->receivers))) {
+		lua_xmove(L, t->L, 1);
+		t->nargs = 1;
+
+		sched_wakeup(s, t);
+
+		return 0;
+	}
+
+	// Store the value in the buffer
+	if (udata->count < udata->capacity) {
+		lua_getuservalue(L, 1);
+		lua_pushvalue(L, 2);
+		lua_rawseti(L, -2, ((udata->head + udata->count) % udata->capacity) + 1);
+
+		udata->count++;
+
+		return 0;
+	}
+
+	// Wait for a receiver
+	t = sched_self(L);
+
+	return sched_block(L, t, SCHED_TASK_WAITING, &udata->senders, -1, 1, 0, NULL);
+}
+
+static int lsched_channel_receive(lua_State *L) {
+	sched_channel_userdata *udata;
+	sched_task_t *t;
+	sched_t *s;
+
+	udata = (sched_channel_userdata *)luaL_checkudata(L, 1, "sched.channel");
+
+	s = sched_bind(L, &udata->sched);
+
+	if (udata->count > 0) {
+		// Take the first value from the buffer
+		lua_getuservalue(L, 1);
+		lua_rawgeti(L, -1, udata->head + 1);
+
+		lua_pushnil(L);
+		lua_rawseti(L, -3, udata->head + 1);
+
+		udata->head = (udata->head + 1) % udata->capacity;
+		udata->count--;
+
+		// Move the value of a waiting sender to the buffer
+		if ((t = TAILQ_FIRST(&udata->senders))) {
+			lua_xmove(t->L, L, 1);
+			lua_rawseti(L, -3, ((udata->head + udata->count) % udata->capacity) + 1);
+
+			udata->count++;
+
+			sched_wakeup(s, t);
+		}
+
+		return 1;
+	}
+
+	// Take the value from a waiting sender
+	if ((t = TAILQ_FIRST(&udata->senders))) {
+		lua_xmove(t->L, L, 1);
+
+		sched_wakeup(s, t);
+
+		return 1;
+	}
+
+	// Wait for a sender
+	t = sched_self(L);
+
+	return sched_block(L, t, SCHED_TASK_WAITING, &udata->receivers, -1, 0, 0, NULL);
+}
+
+static const LUA_REG_TYPE sched_map[] = {
+	{ LSTRKEY( "spawn"   ),			LFUNCVAL( lsched_spawn   ) },
+	{ LSTRKEY( "run"     ),			LFUNCVAL( lsched_run     ) },
+	{ LSTRKEY( "yield"   ),			LFUNCVAL( lsched_yield   ) },
+	{ LSTRKEY( "sleep"   ),			LFUNCVAL( lsched_sleep   ) },
+	{ LSTRKEY( "sleepms" ),			LFUNCVAL( lsched_sleepms ) },
+	{ LSTRKEY( "wait"    ),			LFUNCVAL( lsched_wait    ) },
+	{ LSTRKEY( "read"    ),			LFUNCVAL( lsched_read    ) },
+	{ LSTRKEY( "write"   ),			LFUNCVAL( lsched_write   ) },
+	{ LSTRKEY( "id"      ),			LFUNCVAL( lsched_id      ) },
+	{ LSTRKEY( "stats"   ),			LFUNCVAL( lsched_stats   ) },
+	{ LSTRKEY( "event"   ),			LFUNCVAL( lsched_event   ) },
+	{ LSTRKEY( "channel" ),			LFUNCVAL( lsched_channel ) },
+	{ LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE sched_event_map[] = {
+	{ LSTRKEY( "wait"        ),		LFUNCVAL( lsched_event_wait      ) },
+	{ LSTRKEY( "signal"      ),		LFUNCVAL( lsched_event_signal    ) },
+	{ LSTRKEY( "broadcast"   ),		LFUNCVAL( lsched_event_broadcast ) },
+	{ LSTRKEY( "__metatable" ),		LROVAL  ( sched_event_map ) },
+	{ LSTRKEY( "__index"     ),		LROVAL  ( sched_event_map ) },
+	{ LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE sched_channel_map[] = {
+	{ LSTRKEY( "send"        ),		LFUNCVAL( lsched_channel_send    ) },
+	{ LSTRKEY( "receive"     ),		LFUNCVAL( lsched_channel_receive ) },
+	{ LSTRKEY( "__metatable" ),		LROVAL  ( sched_channel_map ) },
+	{ LSTRKEY( "__index"     ),		LROVAL  ( sched_channel_map ) },
+	{ LNILKEY, LNILVAL }
+};
+
+LUALIB_API int luaopen_sched( lua_State *L ) {
+	luaL_newmetarotable(L, "sched.event", (void *)sched_event_map);
+	luaL_newmetarotable(L, "sched.channel", (void *)sched_channel_map);
+
+	return 0;
+}
+
+MODULE_REGISTER_MAPPED(SCHED, sched, sched_map, luaopen_sched);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Lua RTOS, Lua sched module
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef LSCHED_H
+#define	LSCHED_H
+
+#include "lua.h"
+
+#include <stdint.h>
+#include <sys/queue.h>
+
+// Default number of VM instructions that a task can run before the scheduler
+// checks if it must be preempted
+#define SCHED_QUANTUM 1000
+
+// Maximum time, in milliseconds, between I/O polls when there are tasks ready to run
+#define SCHED_POLL_INTERVAL 10
+
+// Task states
+#define SCHED_TASK_READY    0
+#define SCHED_TASK_RUNNING  1
+#define SCHED_TASK_SLEEPING 2
+#define SCHED_TASK_WAITING  3
+#define SCHED_TASK_IO       4
+
+// I/O events
+#define SCHED_IO_READ  (1 << 0)
+#define SCHED_IO_WRITE (1 << 1)
+
+struct sched;
+struct vfs_pollfd;
+
+typedef struct sched_task {
+    lua_State *L;                      // Task coroutine
+    struct sched *sched;               // Scheduler that runs the task
+    struct sched_queue *queue;         // Queue where the task is linked, or NULL
+    TAILQ_ENTRY(sched_task) link;      // Link in queue
+    TAILQ_ENTRY(sched_task) alive_link; // Link in the alive tasks of the scheduler
+    uint32_t deadline;                 // Wake up time, in milliseconds
+    int timer;                         // Position in the timer heap, or -1
+    int ref;                           // Coroutine reference
+    int id;                            // Task id
+    int nargs;                         // Number of values to pass on resume
+    int fd;                            // File descriptor for I/O waits
+    uint8_t events;                    // I/O events for I/O waits
+    uint8_t state;                     // Task state
+} sched_task_t;
+
+TAILQ_HEAD(sched_queue, sched_task);
+
+typedef struct sched {
+    lua_State *L;                      // Main thread, for release the task references
+    struct sched_queue alive;          // Alive tasks
+    struct sched_queue ready;          // Tasks ready to run
+    struct sched_queue io;             // Tasks waiting for I/O
+    sched_task_t **timers;             // Timer heap, ordered by deadline
+    int ntimers;                       // Number of timers in heap
+    int maxtimers;                     // Heap capacity
+    sched_task_t *current;             // Running task, or NULL
+    int tasks;                         // Number of alive tasks
+    int next_id;                       // Id for the next task
+    int quantum;                       // Preemption quantum
+    uint32_t last_poll;                // Time of the last I/O poll
+    struct vfs_pollfd *pollfds;        // Poll set, one entry per task waiting for I/O
+    int maxpollfds;                    // Poll set capacity
+
+    // Statistics
+    uint32_t switches;
+    uint32_t preemptions;
+    uint32_t polls;
+} sched_t;
+
+// Event, tasks wait on it until it is signaled
+typedef struct {
+    sched_t *sched;                    // Owner scheduler
+    struct sched_queue waiting;        // Waiting tasks
+} sched_event_userdata;
+
+// Channel, tasks send values to it and receive values from it
+typedef struct {
+    sched_t *sched;                    // Owner scheduler
+    struct sched_queue senders;        // Tasks waiting to send
+    struct sched_queue receivers;      // Tasks waiting to receive
+    int capacity;                      // Buffer capacity
+    int count;                         // Number of values in buffer
+    int head;                          // First value in buffer
+} sched_channel_userdata;
+
+// Returns 1 if L is the running task of the current thread's scheduler
+int sched_in_task(lua_State *L);
+
+// Block the running task until the file descriptor is ready for events
+// (VFS_POLLIN / VFS_POLLOUT), or until timeout milliseconds have passed if
+// timeout >= 0. Must be called as return sched_wait_io(...) from a C function
+// running in a task. The continuation k finds true on top of the stack if the
+// file descriptor is ready (or has an error), or false on timeout.
+int sched_wait_io(lua_State *L, int fd, int events, int timeout, lua_KContext ctx, lua_KFunction k);
+
+// Sleep for ms milliseconds, yielding to the scheduler if called from a task,
+// or blocking the thread if not. Must be called as return sched_sleep(...).
+int sched_sleep(lua_State *L, lua_Integer ms);
+
+// Free the scheduler of the current thread, and it's tasks. Called when a Lua
+// thread ends in a thread pool worker, as the worker's pthread is reused.
+void sched_release();
+
+#endif	/* LSCHED_H */
@@ -37,11 +37,15 @@
 #include "auxmods.h"
 #include "error.h"
 #include "sensor.h"
+#include "array.h"
 #include "modules.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <sys/delay.h>
+
 #include <drivers/owire.h>
 #include <drivers/sensor.h>
 
@@ -259,6 +263,56 @@ static int lsensor_read( lua_State* L ) {
         }
     }
 
+#if LUA_USE_ARRAY
+    array_userdata_t *array;
+    lua_Integer period;
+    size_t i;
+
+    // Capture one value per element, acquiring the sensor each period ms
+    // (0, the default, is as fast as the sensor can be acquired). Values
+    // that are not available are stored as NaN (0 in integer arrays).
+    if ((array = luaL_testarray(L, 3))) {
+    	period = luaL_optinteger(L, 4, 0);
+    	luaL_argcheck(L, period >= 0, 4, "must be positive");
+
+    	for(i = 0; i < array->len; i++) {
+    		if (i > 0) {
+    			if (period > 0) {
+    				delay(period);
+    			}
+
+    			if ((error = sensor_acquire(udata->instance))) {
+    				return luaL_driver_error(L, error);
+    			}
+    		}
+
+    		if ((error = sensor_read(udata->instance, id, &value))) {
+    			return luaL_driver_error(L, error);
+    		}
+
+    		switch (value->type) {
+    			case SENSOR_DATA_INT:
+    				array_set(array, i, value->integerd.value);
+    				break;
+    			case SENSOR_DATA_FLOAT:
+    				array_set(array, i, value->floatd.value);
+    				break;
+    			case SENSOR_DATA_DOUBLE:
+    				array_set(array, i, value->doubled.value);
+    				break;
+    			default:
+    				array_set(array, i, NAN);
+    				break;
+    		}
+    	}
+
+    	udata->adquired = 0;
+    	lua_settop(L, 3);
+
+    	return 1;
+    }
+#endif
+
     if ((strcmp(id, "all") != 0) && (strcmp(id, "ALL") != 0)) {
 		// Read specified data
 		if ((error = sensor_read(udata->instance, id, &value))) {
@@ -285,8 +339,16 @@ static int lsensor_read( lua_State* L ) {
 		}
     }
     else {
-    	// Read all sensor data
+    	// Read all sensor data. If a table is given, values are stored
+    	// in it (from index 1) instead of being returned, so that a
+    	// sampling loop can reuse the same table for each sample.
     	int idx, numread=0;
+    	int into = lua_istable(L, 3);
+
+    	if (into) {
+    		lua_settop(L, 3);
+    	}
+
     	for(idx=0;idx <  SENSOR_MAX_DATA;idx++) {
     		if (udata->instance->sensor->data[idx].id) {
 				*&value = &udata->instance->data[idx];
@@ -310,12 +372,16 @@ static int lsensor_read( lua_State* L ) {
 					default:
 						return luaL_driver_error(L, driver_operation_error(SENSOR_DRIVER, SENSOR_ERR_NOT_FOUND, NULL));
 				}
+
+				if (into) {
+					lua_rawseti(L, 3, numread);
+				}
     		}
     	}
     	if (numread == 0) return luaL_driver_error(L, driver_operation_error(SENSOR_DRIVER, SENSOR_ERR_NOT_FOUND, NULL));
 
     	udata->adquired = 0;
-    	return numread;
+    	return into ? 1 : numread;
     }
 
 	return 0;
@@ -323,7 +389,7 @@ static int lsensor_read( lua_State* L ) {
 static int lsensor_list( lua_State* L ) {
 	const sensor_t *csensor = sensors;
 
-	uint16_t count = 0, i = 0, idx, len;
+	uint16_t count = 0, i = 0, idx, len, n;
 	uint8_t table = 0;
 	char interface[7];
 	char type[7];
@@ -400,7 +466,11 @@ static int lsensor_list( lua_State* L ) {
 	        lua_pushstring(L, (char *)interface);
 	        lua_setfield (L, -2, "interface");
 
-	        lua_createtable(L, 0, 0);
+	        for(n=0, idx=0; idx < SENSOR_MAX_DATA; idx++) {
+				if (csensor->data[idx].id) n++;
+	        }
+
+	        lua_createtable(L, n, 1);
 	        for(idx=0; idx < SENSOR_MAX_DATA; idx++) {
 				if (csensor->data[idx].id) {
 					lua_pushinteger(L, idx);
@@ -426,7 +496,11 @@ static int lsensor_list( lua_State* L ) {
 			}
 	        lua_setfield (L, -2, "provides");
 
-	        lua_createtable(L, 0, 0);
+	        for(n=0, idx=0; idx < SENSOR_MAX_PROPERTIES; idx++) {
+				if (csensor->properties[idx].id) n++;
+	        }
+
+	        lua_createtable(L, n, 1);
 	        for(idx=0; idx < SENSOR_MAX_PROPERTIES; idx++) {
 				if (csensor->properties[idx].id) {
 					lua_pushinteger(L, idx);
@@ -632,6 +706,13 @@ while true do
 	tmr.delayms(500)
 end
 
+s1 = sensor.setup("TMP36", adc.ADC1, adc.ADC_CH4, 12)
+samples = array.new(array.FLOAT32, 64)
+while true do
+	s1:read("temperature", samples, 10)
+	print("temp "..samples:mean()..", max "..samples:max())
+end
+
 s1 = sensor.setup("DHT11", pio.GPIO4)
 while true do
 	temperature = s1:read("temperature")
@@ -38,6 +38,7 @@
 #include "error.h"
 #include "spi.h"
 #include "modules.h"
+#include "buffer.h"
 
 #include <drivers/spi.h>
 
@@ -142,17 +143,52 @@ static int lspi_rw_helper( lua_State *L, int withread ) {
 	spi = (spi_userdata *)luaL_checkudata(L, 1, "spi.ins");
 	luaL_argcheck(L, spi, 1, "spi expected");
 
-	size_t len, residx = 0;
+#if LUA_USE_BUFFER
+	buffer_userdata_t *buffer;
 
-	if (withread)
-		lua_newtable(L);
+	// A single buffer is transferred in one operation, and read bytes
+	// are stored back into the same buffer
+	if ((total == 2) && (buffer = luaL_testbuffer(L, 2))) {
+		driver_error_t *error;
+
+		if (withread) {
+			error = spi_bulk_rw(spi->spi, buffer->size, buffer->data);
+		} else {
+			error = spi_bulk_write(spi->spi, buffer->size, buffer->data);
+		}
+
+		if (error) {
+			return luaL_driver_error(L, error);
+		}
+
+		return withread ? 1 : 0;
+	}
+#endif
+
+	size_t len, residx = 0, count = 0;
+	unsigned char *rbuf = NULL;
+
+	if (withread) {
+		// Count the bytes to transfer, to build the result table at once
+		for (i = 2; i <= total; i++) {
+			if (lua_isnumber(L, i)) {
+				count++;
+			} else if (lua_isstring(L, i)) {
+				lua_tolstring(L, i, &len);
+				count += len;
+			}
+		}
+
+		// Read bytes go to a buffer that lives on the stack until the
+		// table is filled
+		rbuf = (unsigned char *)lua_newuserdata(L, count);
+	}
 
 	for (i = 2; i <= total; i++) {
 		if(lua_isnumber(L, i)) {
 			spi_transfer(spi->spi, lua_tointeger(L, i), &value);
 			if(withread) {
-				lua_pushinteger(L, value);
-				lua_rawseti(L, -2, residx++);
+				rbuf[residx++] = value;
 			}
 		}
 		else if(lua_isstring( L, i )) {
@@ -160,13 +196,18 @@ static int lspi_rw_helper( lua_State *L, int withread ) {
 			for(j = 0; j < len; j ++) {
 				spi_transfer(spi->spi, sval[j], &value);
 				if (withread) {
-					lua_pushinteger(L, value);
-					lua_rawseti(L, -2, residx++);
+					rbuf[residx++] = value;
 				}
 			}
 		}
 	}
 
+	if (withread) {
+		// Result is indexed from 0, so element 0 goes to the hash part
+		lua_createtable(L, (residx > 0) ? residx - 1 : 0, (residx > 0) ? 1 : 0);
+		lua_setarray(L, -1, 0, rbuf, residx, LUA_ARRAY_BYTE);
+	}
+
 	return withread ? 1 : 0;
 }
 
@@ -37,9 +37,14 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "ldo.h"
+#include "lstring.h"
 #include "thread.h"
 #include "error.h"
 
+#if LUA_USE_SCHED
+#include "sched.h"
+#endif
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -49,6 +54,8 @@
 
 #include <pthread.h>
 
+#include "freertos/adds.h"
+
 #include <drivers/uart.h>
 #include <sys/console.h>
 
@@ -77,6 +84,48 @@ DRIVER_REGISTER_ERROR(THREAD, thread, CannotMonitorAsTable, "you can't monitor t
 // List of threads
 static struct list lthread_list;
 
+// Thread pool
+//
+// Threads started with thread.start are run by worker tasks. When a thread ends, its
+// worker is not deleted, and waits in it's queue for the next thread to run, so the
+// next thread.start don't need to create a new task and allocate a new stack.
+//
+// The stack used by each function is recorded from the high-water mark of the worker that
+// runs it, and new workers for a known function are created with the recorded stack
+// usage plus a margin, instead of the default stack size. As the high-water mark of a
+// task is the maximum since it's creation, the stack usage is only recorded while the
+// worker has run a single function.
+//
+// If there is not an idle worker with the same priority, CPU affinity and enough stack,
+// and the pool is full, the thread is run in a new task, as when the pool is disabled.
+#define LTHREAD_POOL_PROFILES 16
+
+struct lthread_worker {
+    pthread_t thread;     // Worker pthread
+    QueueHandle_t queue;  // Queue for receive the next thread to run
+    int stack;            // Stack size
+    int priority;         // Priority
+    int affinity;         // CPU affinity
+    uint32_t key;         // Key of the last function run
+    uint8_t busy;         // Running a thread?
+    uint8_t mixed;        // Has run more than one function?
+};
+
+struct lthread_profile {
+    uint32_t key;         // Function key
+    int used;             // Maximum stack used
+};
+
+static struct mtx pool_mtx;
+static struct lthread_worker *pool[CONFIG_LUA_RTOS_LUA_THREAD_POOL_SIZE + 1];
+static struct lthread_profile profiles[LTHREAD_POOL_PROFILES];
+static int profiles_next = 0;
+
+// Pool statistics
+static uint32_t pool_created = 0;
+static uint32_t pool_reused = 0;
+static uint32_t pool_fallback = 0;
+
 void thread_terminated(void *args) {
     struct lthread *thread;
 
@@ -118,6 +167,291 @@ void *thread_start_task(void *arg) {
     return NULL;
 }
 
+// Get the key used for record the stack usage of the function at index 1. Closures
+// of the same Lua function share the key. Functions that are not profiled get 0.
+//
+// The key is a hash of the chunk name, the lines where the function is defined and
+// it's code size, instead of the prototype address, because a prototype can be
+// collected while it's profile is kept, and it's address reused by another function.
+//
+// Only functions loaded from files are profiled. The console ("=stdin") and chunks
+// loaded from strings can define different functions with the same name, lines and
+// size, that would share a profile, and a deep one would get the small stack recorded
+// for another one.
+static uint32_t thread_function_key(lua_State *L) {
+    const TValue *o = L->ci->func + 1;
+    const Proto *p;
+    uint32_t key;
+
+    if (!ttisLclosure(o)) {
+        return 0;
+    }
+
+    p = clLvalue(o)->p;
+    if (!p->source || (*getstr(p->source) != '@')) {
+        return 0;
+    }
+
+    key = (uint32_t)p->linedefined ^ ((uint32_t)p->lastlinedefined << 12) ^ ((uint32_t)p->sizecode << 20);
+    key = luaS_hash(getstr(p->source), tsslen(p->source), key);
+
+    return key ? key : 1;
+}
+
+// Get the stack size needed for run a function, or the default stack size
+// if the function has not been profiled yet. Must be called with pool_mtx locked.
+static int thread_pool_stack(uint32_t key) {
+    int stack;
+    int i;
+
+    if (key) {
+        for(i=0;i < LTHREAD_POOL_PROFILES;i++) {
+            if (profiles[i].key == key) {
+                stack = profiles[i].used + CONFIG_LUA_RTOS_LUA_THREAD_POOL_STACK_MARGIN;
+                stack = (stack + 511) & ~511;
+
+                if (stack < PTHREAD_STACK_MIN) {
+                    stack = PTHREAD_STACK_MIN;
+                }
+
+                if (stack < CONFIG_LUA_RTOS_LUA_THREAD_STACK_SIZE) {
+                    return stack;
+                }
+
+                break;
+            }
+        }
+    }
+
+    return CONFIG_LUA_RTOS_LUA_THREAD_STACK_SIZE;
+}
+
+// Record the stack used by a function. Must be called with pool_mtx locked.
+static void thread_pool_profile(uint32_t key, int used) {
+    int i;
+
+    for(i=0;i < LTHREAD_POOL_PROFILES;i++) {
+        if (profiles[i].key == key) {
+            if (used > profiles[i].used) {
+                profiles[i].used = used;
+            }
+
+            return;
+        }
+    }
+
+    // Not found, replace the oldest entry
+    profiles[profiles_next].key = key;
+    profiles[profiles_next].used = used;
+
+    profiles_next = (profiles_next + 1) % LTHREAD_POOL_PROFILES;
+}
+
+// Called by a worker when it's thread ends
+static void thread_pool_done(struct lthread_worker *worker, struct lthread *thread) {
+    int stack, stack_free;
+
+    stack = _pthread_stack(worker->thread);
+    stack_free = _pthread_stack_free(worker->thread);
+
+    luaL_unref(thread->PL, LUA_REGISTRYINDEX, thread->function_ref);
+    luaL_unref(thread->PL, LUA_REGISTRYINDEX, thread->thread_ref);
+
+    list_remove(&lthread_list, thread->thid, 1);
+
+    mtx_lock(&pool_mtx);
+
+    if (worker->key && !worker->mixed && (stack_free >= 0)) {
+        thread_pool_profile(worker->key, stack - stack_free);
+    }
+
+    worker->busy = 0;
+
+    mtx_unlock(&pool_mtx);
+}
+
+static void *thread_pool_worker(void *arg) {
+    struct lthread *thread = (struct lthread *)arg;
+    struct lthread_worker *worker = thread->worker;
+    int status;
+
+    worker->thread = pthread_self();
+
+    for(;;) {
+        thread->thread = worker->thread;
+        uxSetLuaState(thread->L);
+
+        luaL_checktype(thread->L, 1, LUA_TFUNCTION);
+
+        status = lua_pcall(thread->L, 0, 0, 0);
+        if (status != LUA_OK) {
+            const char *msg = lua_tostring(thread->L, -1);
+            lua_writestringerror("%s\n", msg);
+            lua_pop(thread->L, 1);
+        }
+
+#if LUA_USE_SCHED
+        // The worker's pthread is reused, so it's scheduler is not freed by
+        // the pthread key destructor
+        sched_release();
+#endif
+
+        thread_pool_done(worker, thread);
+
+        uxSetLuaState(NULL);
+
+        // Wait for the next thread
+        xQueueReceive(worker->queue, &thread, portMAX_DELAY);
+    }
+
+    return NULL;
+}
+
+// Remove a worker from the pool, when it's thread is stopped
+static void thread_pool_discard(struct lthread_worker *worker) {
+    int i;
+
+    mtx_lock(&pool_mtx);
+
+    for(i=0;i < CONFIG_LUA_RTOS_LUA_THREAD_POOL_SIZE;i++) {
+        if (pool[i] == worker) {
+            pool[i] = NULL;
+            break;
+        }
+    }
+
+    mtx_unlock(&pool_mtx);
+
+    vQueueDelete(worker->queue);
+    free(worker);
+}
+
+// Run a thread in an idle worker of the pool, or in a new worker if there is
+// room in the pool. Returns 0 if the thread is run by the pool, or -1 if the
+// caller must create a task for the thread.
+static int thread_pool_run(struct lthread *thread, int stack, int priority, int affinity) {
+    struct lthread_worker *worker = NULL;
+    pthread_attr_t attr;
+    struct sched_param sched;
+    cpu_set_t cpu_set;
+    pthread_t id;
+    int i, slot = -1;
+
+    mtx_lock(&pool_mtx);
+
+    if (stack == 0) {
+        stack = thread_pool_stack(thread->key);
+    }
+
+    // Find the best idle worker for the thread: a worker that has run the same function,
+    // or the worker with the smallest stack that is enough
+    for(i=0;i < CONFIG_LUA_RTOS_LUA_THREAD_POOL_SIZE;i++) {
+        if (!pool[i]) {
+            if (slot < 0) {
+                slot = i;
+            }
+
+            continue;
+        }
+
+        if (pool[i]->busy || (pool[i]->stack < stack) ||
+            (pool[i]->priority != priority) || (pool[i]->affinity != affinity)) {
+            continue;
+        }
+
+        if (!worker || (pool[i]->key == thread->key) ||
+            ((worker->key != thread->key) && (pool[i]->stack < worker->stack))) {
+            worker = pool[i];
+        }
+    }
+
+    if (worker) {
+        if (worker->key != thread->key) {
+            worker->mixed = 1;
+            worker->key = thread->key;
+        }
+
+        worker->busy = 1;
+        pool_reused++;
+
+        thread->worker = worker;
+        thread->thread = worker->thread;
+        thread->status = LTHREAD_STATUS_RUNNING;
+
+        mtx_unlock(&pool_mtx);
+
+        xQueueSend(worker->queue, &thread, portMAX_DELAY);
+
+        return 0;
+    }
+
+    if (slot < 0) {
+        pool_fallback++;
+        mtx_unlock(&pool_mtx);
+
+        return -1;
+    }
+
+    // Create a new worker
+    worker = (struct lthread_worker *)calloc(1, sizeof(struct lthread_worker));
+    if (!worker) {
+        mtx_unlock(&pool_mtx);
+        return -1;
+    }
+
+    worker->queue = xQueueCreate(1, sizeof(struct lthread *));
+    if (!worker->queue) {
+        mtx_unlock(&pool_mtx);
+        free(worker);
+        return -1;
+    }
+
+    worker->stack = stack;
+    worker->priority = priority;
+    worker->affinity = affinity;
+    worker->key = thread->key;
+    worker->busy = 1;
+
+    pool[slot] = worker;
+
+    mtx_unlock(&pool_mtx);
+
+    thread->worker = worker;
+    thread->status = LTHREAD_STATUS_RUNNING;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack);
+
+    sched.sched_priority = priority;
+    pthread_attr_setschedparam(&attr, &sched);
+
+    cpu_set = affinity;
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpu_set);
+
+    pthread_attr_setinitialstate(&attr, PTHREAD_INITIAL_STATE_RUN);
+
+    if (pthread_create(&id, &attr, thread_pool_worker, thread)) {
+        mtx_lock(&pool_mtx);
+        pool[slot] = NULL;
+        mtx_unlock(&pool_mtx);
+
+        vQueueDelete(worker->queue);
+        free(worker);
+
+        thread->worker = NULL;
+        thread->status = LTHREAD_STATUS_SUSPENDED;
+
+        return -1;
+    }
+
+    mtx_lock(&pool_mtx);
+    worker->thread = id;
+    pool_created++;
+    mtx_unlock(&pool_mtx);
+
+    return 0;
+}
+
 static int thread_suspend_pthreads(lua_State *L, int thid) {
     struct lthread *thread;
     int res, idx;
@@ -213,6 +547,11 @@ static int thread_stop_pthreads(lua_State *L, int thid) {
             _pthread_stop(thread->thread);            
             _pthread_free(thread->thread);
 
+            // The worker that runs the thread is stopped with it
+            if (thread->worker) {
+                thread_pool_discard(thread->worker);
+            }
+
             luaL_unref(L, LUA_REGISTRYINDEX, thread->function_ref);
             luaL_unref(L, LUA_REGISTRYINDEX, thread->thread_ref);
 
@@ -378,6 +717,7 @@ static int new_thread(lua_State* L, int run) {
 
     // Get stack size, priotity and cpu affinity
     int stack = luaL_optinteger(L, 2, CONFIG_LUA_RTOS_LUA_THREAD_STACK_SIZE);
+    int stack_set = !lua_isnoneornil(L, 2);
     int priority = luaL_optinteger(L, 3, CONFIG_LUA_RTOS_LUA_THREAD_PRIORITY);
     int affinity = luaL_optinteger(L, 4, CONFIG_LUA_RTOS_LUA_THREAD_CPU);
 
@@ -408,6 +748,8 @@ static int new_thread(lua_State* L, int run) {
     
     // Check for argument is a function, and store it's reference
     luaL_checktype(L, 1, LUA_TFUNCTION);
+    thread->key = thread_function_key(L);
+    thread->worker = NULL;
     thread->function_ref = luaL_ref(L, LUA_REGISTRYINDEX);
     
     // Create a new state, move function to it and store thread reference
@@ -448,7 +790,15 @@ static int new_thread(lua_State* L, int run) {
     }
     
     thread->thid = idx;
-    
+
+    // Run in the thread pool, if possible
+    if (run && (CONFIG_LUA_RTOS_LUA_THREAD_POOL_SIZE > 0)) {
+        if (thread_pool_run(thread, (stack_set?stack:0), priority, affinity) == 0) {
+            lua_pushinteger(L, idx);
+            return 1;
+        }
+    }
+
     retries = 0;
     
 retry:  
@@ -557,6 +907,67 @@ static int thread_status(lua_State* L) {
     return 1;
 }
 
+// Get the thread pool statistics
+static int thread_pool(lua_State* L) {
+    int workers = 0, idle = 0, stack = 0, saved = 0;
+    int profiled = 0;
+    int i;
+
+    mtx_lock(&pool_mtx);
+
+    for(i=0;i < CONFIG_LUA_RTOS_LUA_THREAD_POOL_SIZE;i++) {
+        if (pool[i]) {
+            workers++;
+
+            if (!pool[i]->busy) {
+                idle++;
+            }
+
+            stack += pool[i]->stack;
+            saved += CONFIG_LUA_RTOS_LUA_THREAD_STACK_SIZE - pool[i]->stack;
+        }
+    }
+
+    for(i=0;i < LTHREAD_POOL_PROFILES;i++) {
+        if (profiles[i].key) {
+            profiled++;
+        }
+    }
+
+    lua_createtable(L, 0, 9);
+
+    lua_pushinteger(L, CONFIG_LUA_RTOS_LUA_THREAD_POOL_SIZE);
+    lua_setfield(L, -2, "size");
+
+    lua_pushinteger(L, workers);
+    lua_setfield(L, -2, "workers");
+
+    lua_pushinteger(L, idle);
+    lua_setfield(L, -2, "idle");
+
+    lua_pushinteger(L, pool_created);
+    lua_setfield(L, -2, "created");
+
+    lua_pushinteger(L, pool_reused);
+    lua_setfield(L, -2, "reused");
+
+    lua_pushinteger(L, pool_fallback);
+    lua_setfield(L, -2, "fallback");
+
+    lua_pushinteger(L, profiled);
+    lua_setfield(L, -2, "profiled");
+
+    lua_pushinteger(L, stack);
+    lua_setfield(L, -2, "stack");
+
+    lua_pushinteger(L, saved);
+    lua_setfield(L, -2, "stackSaved");
+
+    mtx_unlock(&pool_mtx);
+
+    return 1;
+}
+
 #include "modules.h"
 
 extern LUA_REG_TYPE thread_error_map[];
@@ -569,6 +980,7 @@ static const LUA_REG_TYPE thread[] = {
     { LSTRKEY( "resume"  ),			LFUNCVAL( thread_resume  ) },
     { LSTRKEY( "stop"    ),			LFUNCVAL( thread_stop    ) },
     { LSTRKEY( "list"    ),			LFUNCVAL( thread_list    ) },
+    { LSTRKEY( "pool"    ),			LFUNCVAL( thread_pool    ) },
     { LSTRKEY( "sleep"   ),			LFUNCVAL( thread_sleep   ) },
     { LSTRKEY( "sleepms" ),			LFUNCVAL( thread_sleepms ) },
     { LSTRKEY( "sleepus" ),			LFUNCVAL( thread_sleepus ) },
@@ -582,6 +994,7 @@ static const LUA_REG_TYPE thread[] = {
 
 int luaopen_thread(lua_State* L) {
 	list_init(&lthread_list, 1);
+	mtx_init(&pool_mtx, NULL, NULL, 0);
 	
 #if !LUA_USE_ROTABLE
     luaL_newlib(L, thread);
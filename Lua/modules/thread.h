@@ -32,8 +32,11 @@
 
 #include "lstate.h"
 
+#include <stdint.h>
 #include <pthread/pthread.h>
 
+struct lthread_worker;
+
 struct lthread {
     lua_State *PL; // Parent thread
     lua_State *L;  // Thread state
@@ -42,6 +45,8 @@ struct lthread {
     int status;
     int thid;
     pthread_t thread;
+    uint32_t key;                  // Function key used for stack profiling
+    struct lthread_worker *worker; // Pool worker running the thread, or NULL
 };
 
 #endif	/* LTHREAD_H */
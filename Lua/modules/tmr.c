@@ -38,10 +38,21 @@
 #include <unistd.h>
 #include <sys/delay.h>
 
+#if LUA_USE_SCHED
+#include "sched.h"
+#endif
+
 static int tmr_delay( lua_State* L ) {
     unsigned long long period;
 
     period = luaL_checkinteger( L, 1 );
+
+#if LUA_USE_SCHED
+    // Inside a sched task, let the other tasks run meanwhile
+    if (sched_in_task(L)) {
+        return sched_sleep(L, period * 1000);
+    }
+#endif
     
     delay(period * 1000);
     
@@ -53,6 +64,12 @@ static int tmr_delay_ms( lua_State* L ) {
 
     period = luaL_checkinteger( L, 1 );
 
+#if LUA_USE_SCHED
+    if (sched_in_task(L)) {
+        return sched_sleep(L, period);
+    }
+#endif
+
     delay(period);
         
     return 0;
@@ -71,6 +88,13 @@ static int tmr_sleep( lua_State* L ) {
     unsigned long long period;
 
     period = luaL_checkinteger( L, 1 );
+
+#if LUA_USE_SCHED
+    if (sched_in_task(L)) {
+        return sched_sleep(L, period * 1000);
+    }
+#endif
+
     sleep(period);
     return 0;
 }
@@ -79,6 +103,13 @@ static int tmr_sleep_ms( lua_State* L ) {
     unsigned long long period;
 
     period = luaL_checkinteger( L, 1 );
+
+#if LUA_USE_SCHED
+    if (sched_in_task(L)) {
+        return sched_sleep(L, period);
+    }
+#endif
+
     usleep(period * 1000);
     return 0;
 }
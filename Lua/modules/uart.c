@@ -41,11 +41,18 @@
 #include "lauxlib.h"
 #include "uart.h"
 #include "error.h"
+#include "buffer.h"
 
 #include <drivers/gpio.h>
 #include <drivers/cpu.h>
 #include <drivers/uart.h>
 
+#if LUA_USE_SCHED
+#include "sched.h"
+
+#include <vfs.h>
+#endif
+
 static int uart_exists(int id) {
     return ((id >= CPU_FIRST_UART) && (id <= CPU_LAST_UART));
 }
@@ -111,6 +118,9 @@ static int luart_write( lua_State* L ) {
     lua_Integer c;
     const char *s;
     int i;
+#if LUA_USE_BUFFER
+    buffer_userdata_t *buffer;
+#endif
     
     // Some integrity checks
     if (!uart_exists(id)) {
@@ -142,6 +152,14 @@ static int luart_write( lua_State* L ) {
             } else {
                 uart_writes(id, (char *)s);
             }
+#if LUA_USE_BUFFER
+        } else if ((buffer = luaL_testbuffer(L, i))) {
+            if (id == CONSOLE_UART) {
+                fwrite(buffer->data, 1, buffer->size, stdout);
+            } else {
+                uart_writeb(id, buffer->data, buffer->size);
+            }
+#endif
         } else {
             return luaL_error(L, "invalid argument %d", i);  
         }
@@ -150,9 +168,134 @@ static int luart_write( lua_State* L ) {
     return 0;
 } 
 
+#if LUA_USE_SCHED
+static int luart_read_sched( lua_State* L, int id, lua_KContext ctx );
+
+// Continuation of uart.read, when called from a sched task
+static int luart_read_k( lua_State* L, int status, lua_KContext ctx ) {
+    int id = luaL_checkinteger(L, 1);
+
+    if (!lua_toboolean(L, -1)) {
+        // Timeout
+#if LUA_USE_BUFFER
+        if (luaL_testbuffer(L, 2)) {
+            lua_pushinteger(L, ctx);
+
+            return 1;
+        }
+#endif
+        lua_pushnil(L);
+
+        return 1;
+    }
+
+    lua_pop(L, 1);
+
+    return luart_read_sched(L, id, ctx);
+}
+
+// uart.read inside a sched task. The bytes available are read, and the task
+// waits for the next ones with sched_wait_io, so the other tasks run while a
+// line or a buffer arrives. As in the blocking read, the timeout is for each
+// byte. The line read so far is kept at stack index 5, and the bytes read
+// into a buffer in ctx.
+static int luart_read_sched( lua_State* L, int id, lua_KContext ctx ) {
+    const char *format;
+    int timeout, crlf, done, n;
+    char c;
+
+#if LUA_USE_BUFFER
+    buffer_userdata_t *buffer;
+
+    if ((buffer = luaL_testbuffer(L, 2))) {
+        timeout = luaL_optinteger(L, 3, 0xffffffff);
+
+        while ((ctx < buffer->size) && uart_bytes_available(id) && uart_read(id, (char *)&buffer->data[ctx], 0)) {
+            ctx++;
+        }
+
+        if ((ctx < buffer->size) && (timeout != 0)) {
+            return sched_wait_io(L, VFS_POLL_UART(id), VFS_POLLIN, (timeout < 0)?-1:timeout, ctx, luart_read_k);
+        }
+
+        lua_pushinteger(L, ctx);
+
+        return 1;
+    }
+#endif
+
+    format = luaL_checkstring(L, 2);
+
+    if (strcmp("*l", format) == 0) {
+        // Bytes are appended to the line in small chunks, to keep the task
+        // stack small
+        char str[32];
+
+        luaL_checktype(L, 3, LUA_TBOOLEAN);
+        crlf = lua_toboolean( L, 3 );
+
+        timeout = luaL_optinteger(L, 4, 0xffffffff);
+
+        do {
+            done = 0;
+            n = 0;
+
+            while (!done && (n < sizeof(str)) && uart_bytes_available(id) && uart_read(id, &c, 0)) {
+                if ((c == '\0') || (c == '\n') || ((c == '\r') && !crlf)) {
+                    done = 1;
+                } else if (c != '\r') {
+                    str[n++] = c;
+                }
+            }
+
+            // Append to the line read so far
+            if (n > 0) {
+                if (lua_isnil(L, 5)) {
+                    lua_pushlstring(L, str, n);
+                } else {
+                    lua_pushvalue(L, 5);
+                    lua_pushlstring(L, str, n);
+                    lua_concat(L, 2);
+                }
+
+                lua_replace(L, 5);
+            }
+
+            if (done) {
+                if (lua_isnil(L, 5)) {
+                    lua_pushliteral(L, "");
+                } else {
+                    lua_pushvalue(L, 5);
+                }
+
+                return 1;
+            }
+        } while (n == sizeof(str));
+    } else if (strcmp("*c", format) == 0) {
+        timeout = luaL_optinteger(L, 3, 0xffffffff);
+
+        if (uart_bytes_available(id) && uart_read(id, &c, 0)) {
+            lua_pushinteger(L, c & 0x000000ff);
+
+            return 1;
+        }
+    } else {
+        return luaL_error(L, "invalid format");
+    }
+
+    if (timeout != 0) {
+        return sched_wait_io(L, VFS_POLL_UART(id), VFS_POLLIN, (timeout < 0)?-1:timeout, ctx, luart_read_k);
+    }
+
+    lua_pushnil(L);
+
+    return 1;
+}
+#endif
+
 static int luart_read( lua_State* L ) {
     int id = luaL_checkinteger(L, 1);
-    const char  *format = luaL_checkstring(L, 2);
+    const char  *format;
     int timeout, crlf, res, c;
     
     // Some integrity checks
@@ -163,7 +306,43 @@ static int luart_read( lua_State* L ) {
     if (!uart_is_setup(id)) {
         return luaL_error(L, "UART%d is not setup", id);
     }
+
+#if LUA_USE_SCHED
+    // Inside a sched task, wait for each byte without blocking the other
+    // tasks. Index 5 is reserved for the line read so far.
+    if (sched_in_task(L)) {
+        lua_settop(L, 4);
+        lua_pushnil(L);
+
+        return luart_read_sched(L, id, 0);
+    }
+#endif
     
+#if LUA_USE_BUFFER
+    buffer_userdata_t *buffer;
+    size_t len = 0;
+
+    // Read into a buffer until it is full or until timeout, and
+    // return the number of bytes read
+    if ((buffer = luaL_testbuffer(L, 2))) {
+        timeout = luaL_optinteger(L, 3, 0xffffffff);
+
+        if (timeout == 0xffffffff) {
+            timeout = portMAX_DELAY;
+        }
+
+        while ((len < buffer->size) && uart_read(id, (char *)&buffer->data[len], timeout)) {
+            len++;
+        }
+
+        lua_pushinteger(L, len);
+
+        return 1;
+    }
+#endif
+
+    format = luaL_checkstring(L, 2);
+
     // Read ...
     if (strcmp("*l", format) == 0) {
         luaL_checktype(L, 3, LUA_TBOOLEAN);
@@ -398,7 +398,7 @@ LUA_API size_t lua_rawlen (lua_State *L, int idx) {
     case LUA_TUSERDATA: return uvalue(o)->len;
     case LUA_TTABLE: return luaH_getn(hvalue(o));
 #if LUA_USE_ROTABLE
-    case LUA_TROTABLE: return(luaH_getn_ro(hvalue(o)));
+    case LUA_TROTABLE: return(luaH_getn_ro(rvalue(o)));
 #endif
     default: return 0;
   }
@@ -668,8 +668,13 @@ LUA_API int lua_rawget (lua_State *L, int idx) {
   StkId t;
   lua_lock(L);
   t = index2addr(L, idx);
+#if !LUA_USE_ROTABLE
   api_check(L, ttistable(t), "table expected");
   setobj2s(L, L->top - 1, luaH_get(hvalue(t), L->top - 1));
+#else
+  api_check(L, ttistable(t) || ttisrotable(t), "table or rotable expected");
+  setobj2s(L, L->top - 1, ttistable(t)?luaH_get(hvalue(t), L->top - 1):luaH_get_ro(rvalue(t), L->top - 1));
+#endif
   lua_unlock(L);
   return ttnov(L->top - 1);
 }
@@ -679,8 +684,13 @@ LUA_API int lua_rawgeti (lua_State *L, int idx, lua_Integer n) {
   StkId t;
   lua_lock(L);
   t = index2addr(L, idx);
+#if !LUA_USE_ROTABLE
   api_check(L, ttistable(t), "table expected");
   setobj2s(L, L->top, luaH_getint(hvalue(t), n));
+#else
+  api_check(L, ttistable(t) || ttisrotable(t), "table or rotable expected");
+  setobj2s(L, L->top, ttistable(t)?luaH_getint(hvalue(t), n):luaH_getint_ro(rvalue(t), n));
+#endif
   api_incr_top(L);
   lua_unlock(L);
   return ttnov(L->top - 1);
@@ -881,6 +891,74 @@ LUA_API void lua_rawsetp (lua_State *L, int idx, const void *p) {
 }
 
 
+/* t[k] = v[i] (raw), for 'lua_setarray' */
+static void setarrayelem (lua_State *L, Table *t, lua_Integer k,
+                          const void *v, int i, int type) {
+  TValue val;
+  switch (type) {
+    case LUA_ARRAY_BYTE:
+      setivalue(&val, cast(const unsigned char *, v)[i]); break;
+    case LUA_ARRAY_INTEGER:
+      setivalue(&val, cast(const lua_Integer *, v)[i]); break;
+    default:
+      api_check(L, type == LUA_ARRAY_NUMBER, "invalid element type");
+      setfltvalue(&val, cast(const lua_Number *, v)[i]); break;
+  }
+  if (l_castS2U(k) - 1u < t->sizearray)  /* fast track */
+    setobj2t(L, &t->array[k - 1], &val);
+  else
+    luaH_setint(L, t, k, &val);
+}
+
+
+/*
+** Do t[first], ..., t[first + n - 1] = v[0], ..., v[n - 1] (raw), where
+** 't' is the table at 'idx' and 'v' a C array of 'type' elements. The
+** array part grows once to hold the keys from 1 on. Those are stored
+** first, so that the array part is already filled if a key below 1 makes
+** the table rehash.
+*/
+LUA_API void lua_setarray (lua_State *L, int idx, lua_Integer first,
+                           const void *v, int n, int type) {
+  StkId o;
+  Table *t;
+  lua_Unsigned skip, last;
+  int i;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  api_check(L, n >= 0, "negative number of elements");
+  t = hvalue(o);
+  skip = (first < 1) ? 1u - l_castS2U(first) : 0;  /* keys below 1 */
+  if (skip > cast(lua_Unsigned, n))
+    skip = n;
+  last = l_castS2U(first) - 1u + n;
+  if (skip < cast(lua_Unsigned, n) &&
+      l_castS2U(first) - 1u + skip <= t->sizearray &&
+      last > t->sizearray && last <= cast(lua_Unsigned, INT_MAX))
+    luaH_resizearray(L, t, cast(unsigned int, last));
+  for (i = cast_int(skip); i < n; i++)
+    setarrayelem(L, t, first + i, v, i, type);
+  for (i = 0; i < cast_int(skip); i++)
+    setarrayelem(L, t, first + i, v, i, type);
+  /* numbers are not collectable, so no barrier is needed */
+  lua_unlock(L);
+}
+
+
+/*
+** Remove all entries of the table at 'idx', keeping its allocated parts
+*/
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId o;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  luaH_clear(hvalue(o));
+  lua_unlock(L);
+}
+
+
 LUA_API int lua_setmetatable (lua_State *L, int objindex) {
 #if LUA_USE_ROTABLE
     int isrometa = 0;
@@ -1047,14 +1125,14 @@ LUA_API int lua_pcallk (lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 
-LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
-                      const char *chunkname, const char *mode) {
+static int load (lua_State *L, lua_Reader reader, void *data,
+                 const char *chunkname, const char *mode, int inplace) {
   ZIO z;
   int status;
   lua_lock(L);
   if (!chunkname) chunkname = "?";
   luaZ_init(L, &z, reader, data);
-  status = luaD_protectedparser(L, &z, chunkname, mode);
+  status = luaD_protectedparser(L, &z, chunkname, mode, inplace);
   if (status == LUA_OK) {  /* no errors? */
     LClosure *f = clLvalue(L->top - 1);  /* get newly created function */
     if (f->nupvalues >= 1) {  /* does it have an upvalue? */
@@ -1071,6 +1149,28 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
 }
 
 
+LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
+                      const char *chunkname, const char *mode) {
+  if (mode && strchr(mode, 'f')) {  /* in place loading is internal */
+    lua_pushfstring(L, "invalid mode '%s'", mode);
+    return LUA_ERRSYNTAX;
+  }
+  return load(L, reader, data, chunkname, mode, 0);
+}
+
+
+#if LUA_USE_FROZEN
+/*
+** Load a binary chunk that is never freed (a frozen module in flash),
+** using its code and line info vectors in place
+*/
+int luaA_loadinplace (lua_State *L, lua_Reader reader, void *data,
+                      const char *chunkname) {
+  return load(L, reader, data, chunkname, "b", 1);
+}
+#endif
+
+
 LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
   int status;
   TValue *o;
@@ -17,6 +17,11 @@
 #define adjustresults(L,nres) \
     { if ((nres) == LUA_MULTRET && L->ci->top < L->top) L->ci->top = L->top; }
 
+#if LUA_USE_FROZEN
+LUAI_FUNC int luaA_loadinplace (lua_State *L, lua_Reader reader, void *data,
+                                const char *chunkname);
+#endif
+
 #define api_checknelems(L,n)	api_check(L, (n) < (L->top - L->ci->func), \
 				  "not enough elements in the stack")
 
@@ -695,18 +695,237 @@ static int skipcomment (LoadF *lf, int *cp) {
 }
 
 
+#if LUA_USE_BYTECODE_CACHE
+/*
+** Bytecode cache: the first time that a '.lua' file is loaded, the compiled
+** chunk is dumped to a file in LUA_BYTECODE_CACHE_DIR, named after a hash
+** of the absolute name of the source. The cached file starts with a header
+** and the name of the source. Later loads take the chunk from this file,
+** skipping the parser, provided that it belongs to the source and that the
+** source has not changed: size and modification time must match. They
+** identify the source unless the file system does not keep modification
+** times (SPIFFS), the clock was not set, or the source was written less
+** than the resolution of the time stamps (2 s in FAT) before the cache. In
+** these cases the cache is marked for verify, and the source is hashed on
+** each load, until the time stamp can be trusted.
+*/
+
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC	"LRC\x03"
+
+/* modification times before this one are from a clock that was not set */
+#define CACHE_EPOCH	1483228800u  /* 2017-01-01 */
+
+/* resolution of modification times, in seconds */
+#define CACHE_MTIME_RES	2
+
+/* size of a cache file name: dir + '/' + 8 hex digits + ".luac" */
+#define CACHE_NAME_SIZE	(sizeof(LUA_BYTECODE_CACHE_DIR) + 14)
+
+typedef struct CacheHeader {
+  char magic[4];
+  uint32_t size;  /* source size */
+  uint32_t mtime;  /* source modification time */
+  uint32_t hash;  /* source hash (FNV-1a), 0 if not computed yet */
+  uint32_t verify;  /* if not 0, size and mtime don't identify the source */
+  uint32_t namelen;  /* length of the source name that follows */
+} CacheHeader;
+
+
+static uint32_t fnv1a (uint32_t hash, const char *p, size_t n) {
+  while (n--)
+    hash = (hash ^ (unsigned char)*p++) * 16777619u;
+  return hash;
+}
+
+
+/*
+** put into 'key' the absolute name of source file 'filename'; returns its
+** length, or 0 if it is not a source file or its name is too long
+*/
+static size_t cachekey (const char *filename, char *key, size_t size) {
+  size_t l = strlen(filename);
+  size_t d = 0;
+  if (l < 4 || strcmp(filename + l - 4, ".lua") != 0)
+    return 0;  /* not a source file */
+  if (*filename != '/') {
+    if (getcwd(key, size) == NULL)
+      return 0;
+    d = strlen(key);
+    if (d == 0 || key[d - 1] != '/')
+      key[d++] = '/';
+  }
+  if (d + l >= size)
+    return 0;
+  memcpy(key + d, filename, l + 1);
+  return d + l;
+}
+
+
+/*
+** fill the header that a valid cache for 'filename' must have (but the
+** hash) and the name of its cache file; 'buff' is used as scratch
+*/
+static int cacheheader (const char *filename, CacheHeader *h, char *cname,
+                        char *buff) {
+  struct stat st;
+  size_t l = cachekey(filename, buff, BUFSIZ);
+  memset(&st, 0, sizeof(st));  /* file systems may not fill st_mtime */
+  if (l == 0 || stat(filename, &st) != 0)
+    return 0;
+  memcpy(h->magic, CACHE_MAGIC, sizeof(h->magic));
+  h->size = (uint32_t)st.st_size;
+  h->mtime = (uint32_t)st.st_mtime;
+  h->hash = 0;
+  h->verify = 0;
+  h->namelen = (uint32_t)l;
+  snprintf(cname, CACHE_NAME_SIZE, "%s/%08x.luac", LUA_BYTECODE_CACHE_DIR,
+           (unsigned int)fnv1a(2166136261u, buff, l));
+  return 1;
+}
+
+
+/*
+** true if the modification time of the source can be trusted: it was set
+** by a clock that was set, and it's older than the resolution of the time
+** stamps, so that a later change of the source changes it
+*/
+static int cachetimely (CacheHeader *h) {
+  return h->mtime >= CACHE_EPOCH &&
+         (uint32_t)time(NULL) > h->mtime + CACHE_MTIME_RES;
+}
+
+
+/* hash the contents of 'filename'; 'buff' is used as scratch */
+static uint32_t cachehash (const char *filename, char *buff) {
+  uint32_t hash = 2166136261u;
+  size_t n;
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL)
+    return 0;
+  while ((n = fread(buff, 1, BUFSIZ, f)) > 0)
+    hash = fnv1a(hash, buff, n);
+  fclose(f);
+  return hash;
+}
+
+
+/*
+** load chunk from cache file 'cname'; returns -1 if cache is not valid.
+** On entry 'lf->buff' holds the name of the source.
+*/
+static int loadcached (lua_State *L, LoadF *lf, const char *filename,
+                       const char *cname, CacheHeader *h,
+                       const char *chunkname) {
+  CacheHeader ch;
+  uint32_t i;
+  int status;
+  lf->f = fopen(cname, "rb");
+  if (lf->f == NULL)
+    return -1;
+  if (fread(&ch, sizeof(ch), 1, lf->f) != 1 ||
+      memcmp(ch.magic, h->magic, sizeof(ch.magic)) != 0 ||
+      ch.size != h->size || ch.mtime != h->mtime || ch.namelen != h->namelen)
+    goto stale;
+  for (i = 0; i < ch.namelen; i++) {  /* cache of another source? */
+    if (getc(lf->f) != (unsigned char)lf->buff[i])
+      goto stale;
+  }
+  if (ch.verify) {  /* size and mtime are not enough? */
+    h->hash = cachehash(filename, lf->buff);
+    if (h->hash != ch.hash)
+      goto stale;
+    if (cachetimely(h)) {  /* trust them from now on */
+      FILE *f = fopen(cname, "r+b");
+      if (f != NULL) {
+        ch.verify = 0;
+        fwrite(&ch, sizeof(ch), 1, f);
+        fclose(f);
+      }
+    }
+  }
+  lf->n = 0;
+  status = lua_load(L, getF, lf, chunkname, "b");
+  if (ferror(lf->f) && status == LUA_OK) {
+    lua_pop(L, 1);
+    status = LUA_ERRFILE;
+  }
+  fclose(lf->f);
+  if (status != LUA_OK) {
+    lua_pop(L, 1);  /* ignore error; chunk will be loaded from source */
+    return -1;
+  }
+  return LUA_OK;
+ stale:
+  fclose(lf->f);
+  return -1;
+}
+
+
+static int cachewriter (lua_State *L, const void *p, size_t sz, void *ud) {
+  (void)L;
+  return (sz != 0) && (fwrite(p, sz, 1, (FILE *)ud) != 1);
+}
+
+
+/*
+** dump function on the top of the stack to cache file 'cname';
+** 'buff' is used as scratch
+*/
+static void savecache (lua_State *L, const char *filename, const char *cname,
+                       CacheHeader *h, char *buff) {
+  FILE *f;
+  if (h->hash == 0)
+    h->hash = cachehash(filename, buff);
+  h->verify = !cachetimely(h);
+  cachekey(filename, buff, BUFSIZ);
+  mkdir(LUA_BYTECODE_CACHE_DIR, 0755);  /* may exist */
+  f = fopen(cname, "wb");
+  if (f == NULL)
+    return;  /* read-only file system, ... */
+  if (fwrite(h, sizeof(*h), 1, f) != 1 ||
+      fwrite(buff, h->namelen, 1, f) != 1 ||
+      lua_dump(L, cachewriter, f, LUA_BYTECODE_CACHE_STRIP) != 0) {
+    fclose(f);
+    remove(cname);
+    return;
+  }
+  if (fclose(f) != 0)
+    remove(cname);
+}
+#endif
+
+
 LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
                                              const char *mode) {
   LoadF lf;
   int status, readstatus;
   int c;
   int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
+#if LUA_USE_BYTECODE_CACHE
+  char cname[CACHE_NAME_SIZE];
+  CacheHeader h;
+  int cached = 0;
+#endif
   if (filename == NULL) {
     lua_pushliteral(L, "=stdin");
     lf.f = stdin;
   }
   else {
     lua_pushfstring(L, "@%s", filename);
+#if LUA_USE_BYTECODE_CACHE
+    if ((mode == NULL || strchr(mode, 'b') != NULL) &&
+        cacheheader(filename, &h, cname, lf.buff)) {
+      cached = 1;
+      if (loadcached(L, &lf, filename, cname, &h, lua_tostring(L, -1)) == LUA_OK) {
+        lua_remove(L, fnameindex);
+        return LUA_OK;
+      }
+    }
+#endif
     lf.f = fopen(filename, "r");
     if (lf.f == NULL) return errfile(L, "open", fnameindex);
   }
@@ -726,6 +945,10 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
     lua_settop(L, fnameindex);  /* ignore results from 'lua_load' */
     return errfile(L, "read", fnameindex);
   }
+#if LUA_USE_BYTECODE_CACHE
+  if (cached && status == LUA_OK)
+    savecache(L, filename, cname, &h, lf.buff);
+#endif
   lua_remove(L, fnameindex);
   return status;
 }
@@ -352,6 +352,7 @@ static int luaB_load (lua_State *L) {
   const char *s = lua_tolstring(L, 1, &l);
   const char *mode = luaL_optstring(L, 3, "bt");
   int env = (!lua_isnone(L, 4) ? 4 : 0);  /* 'env' index or 0 if no 'env' */
+  luaL_argcheck(L, strchr(mode, 'f') == NULL, 3, "invalid mode");
   if (s != NULL) {  /* loading a string? */
     const char *chunkname = luaL_optstring(L, 2, s);
     status = luaL_loadbufferx(L, s, l, chunkname, mode);
@@ -503,22 +504,35 @@ static const LUA_REG_TYPE base_funcs[] = {
 
 #if LUA_USE_ROTABLE
 
-static int luaB_index (lua_State *L) {
-  int fres;
+/*
+** Find a global that lives in flash: a base function or a library
+** registered in 'lua_rotable'. Returns NULL if not found.
+*/
+const TValue *luaB_findglobal (const char *name, size_t len) {
+  const TValue *res = luaR_findentry(base_funcs, name, 0, NULL);
 
-  if ((fres = luaR_findfunction(L, base_funcs)) != 0)
-    return fres;
+  if (ttislcf(res))
+    return res;
+
+  return luaR_findglobal(name, len);
+}
+
+int luaB_index (lua_State *L) {
+  size_t len;
+  const char *keyname = luaL_checklstring(L, 2, &len);
 
-  const char *keyname = luaL_checkstring(L, 2);
   if (!strcmp(keyname, "_VERSION")) {
     lua_pushliteral(L, LUA_VERSION);
     return 1;
   }
 
-  const TValue *res = luaR_findglobal(keyname, strlen(keyname));
+  const TValue *res = luaB_findglobal(keyname, len);
   if (!res)
     return 0;
-  else {
+  else if (ttislcf(res)) {
+    lua_pushcfunction(L, fvalue(res));
+    return 1;
+  } else {
     lua_pushrotable(L, (void *)rvalue(res));
     return 1;
   }
@@ -953,3 +953,41 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+/*
+** Replace the first instruction of common sequences by a superinstruction,
+** that runs the instruction that follows it without a dispatch (see
+** lvm.c). The second instruction is not changed, so jumps to it and debug
+** information are still valid. Called once the code of a function is
+** complete, both when it's compiled and when it's loaded (dumps have only
+** base opcodes).
+*/
+void luaK_fuse (Proto *f) {
+#if LUA_USE_SUPERINSTRUCTIONS
+  int pc;
+  for (pc = 0; pc + 1 < f->sizecode; pc++) {
+    Instruction *i = &f->code[pc];
+    Instruction next = f->code[pc + 1];
+    switch (GET_OPCODE(*i)) {
+      case OP_GETTABUP: {  /* module field, as in 'string.format' */
+        if (GET_OPCODE(next) == OP_GETTABLE)
+          SET_OPCODE(*i, OP_GETTABUPF);
+        break;
+      }
+      case OP_ADD: {  /* numeric 'for' loop ended by an addition */
+        if (GET_OPCODE(next) == OP_FORLOOP)
+          SET_OPCODE(*i, OP_ADDFORLOOP);
+        break;
+      }
+      case OP_EQ: case OP_LT: case OP_LE: {  /* ORDER OP */
+        if (GET_OPCODE(next) == OP_JMP && GETARG_A(next) == 0)
+          SET_OPCODE(*i, GET_OPCODE(*i) - OP_EQ + OP_EQJ);
+        break;
+      }
+      default: break;
+    }
+  }
+#else
+  (void)f;
+#endif
+}
@@ -15,6 +15,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -25,6 +26,9 @@ typedef struct {
   void *data;
   int strip;
   int status;
+#if LUA_USE_FROZEN
+  size_t pos;  /* bytes dumped so far */
+#endif
 } DumpState;
 
 
@@ -42,10 +46,29 @@ static void DumpBlock (const void *b, size_t size, DumpState *D) {
     lua_unlock(D->L);
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
+#if LUA_USE_FROZEN
+    D->pos += size;
+#endif
   }
 }
 
 
+#if LUA_USE_FROZEN
+/*
+** Pad the dump, so the next vector starts at an offset multiple of 'size'
+** from the beginning of the chunk. If the chunk is stored aligned, this
+** vector can be used in place when the chunk is loaded (see lundump.c).
+*/
+static void DumpAlign (size_t size, DumpState *D) {
+  static const char pad[8] = {0};
+  size_t n = (size - D->pos % size) % size;
+  DumpBlock(pad, n, D);
+}
+#else
+#define DumpAlign(size,D)	((void)0)
+#endif
+
+
 #define DumpVar(x,D)		DumpVector(&x,1,D)
 
 
@@ -88,8 +111,18 @@ static void DumpString (const TString *s, DumpState *D) {
 
 
 static void DumpCode (const Proto *f, DumpState *D) {
+  Instruction buff[32];
+  int pc, n = 0;
   DumpInt(f->sizecode, D);
-  DumpVector(f->code, f->sizecode, D);
+  DumpAlign(sizeof(Instruction), D);
+  for (pc = 0; pc < f->sizecode; pc++) {  /* superinstructions are dumped */
+    buff[n] = f->code[pc];                /* as their base opcode */
+    SET_OPCODE(buff[n], GET_BASEOP(buff[n]));
+    if (++n == 32 || pc == f->sizecode - 1) {
+      DumpVector(buff, n, D);
+      n = 0;
+    }
+  }
 }
 
 
@@ -148,6 +181,7 @@ static void DumpDebug (const Proto *f, DumpState *D) {
   int i, n;
   n = (D->strip) ? 0 : f->sizelineinfo;
   DumpInt(n, D);
+  DumpAlign(sizeof(int), D);
   DumpVector(f->lineinfo, n, D);
   n = (D->strip) ? 0 : f->sizelocvars;
   DumpInt(n, D);
@@ -207,6 +241,9 @@ int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
   D.data = data;
   D.strip = strip;
   D.status = 0;
+#if LUA_USE_FROZEN
+  D.pos = 0;
+#endif
   DumpHeader(&D);
   DumpByte(f->sizeupvalues, &D);
   DumpFunction(f, NULL, &D);
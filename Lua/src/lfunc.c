@@ -105,6 +105,9 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->cache = NULL;
+#if LUA_USE_ROTABLE
+  f->rocache = NULL;
+#endif
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -113,6 +116,9 @@ Proto *luaF_newproto (lua_State *L) {
   f->numparams = 0;
   f->is_vararg = 0;
   f->maxstacksize = 0;
+#if LUA_USE_FROZEN
+  f->frozen = 0;
+#endif
   f->locvars = NULL;
   f->sizelocvars = 0;
   f->linedefined = 0;
@@ -123,12 +129,26 @@ Proto *luaF_newproto (lua_State *L) {
 
 
 void luaF_freeproto (lua_State *L, Proto *f) {
+#if !LUA_USE_FROZEN
   luaM_freearray(L, f->code, f->sizecode);
+#else
+  if (!(f->frozen & FROZEN_CODE))
+    luaM_freearray(L, f->code, f->sizecode);
+#endif
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
+#if !LUA_USE_FROZEN
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+#else
+  if (!(f->frozen & FROZEN_LINEINFO))
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+#endif
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
+#if LUA_USE_ROTABLE
+  if (f->rocache)
+    luaM_freearray(L, f->rocache, f->sizek);
+#endif
   luaM_free(L, f);
 }
 
@@ -47,6 +47,12 @@ struct UpVal {
 #define upisopen(up)	((up)->v != &(up)->u.value)
 
 
+#if LUA_USE_FROZEN
+/* bits in 'Proto.frozen' */
+#define FROZEN_CODE	1	/* 'code' is used in place */
+#define FROZEN_LINEINFO	2	/* 'lineinfo' is used in place */
+#endif
+
 LUAI_FUNC Proto *luaF_newproto (lua_State *L);
 LUAI_FUNC CClosure *luaF_newCclosure (lua_State *L, int nelems);
 LUAI_FUNC LClosure *luaF_newLclosure (lua_State *L, int nelems);
@@ -93,6 +93,16 @@
 */
 #define markobjectN(g,t)	{ if (t) markobject(g,t); }
 
+/*
+** mark a metatable, that can be a rotable (see lua_setmetatable). A
+** rotable is not a collectable object, and lives in read only memory.
+*/
+#if LUA_USE_ROTABLE
+#define markmetatable(g,t)	{ if ((t) && !luaR_isrotable(t)) markobject(g,t); }
+#else
+#define markmetatable(g,t)	markobjectN(g,t)
+#endif
+
 static void reallymarkobject (global_State *g, GCObject *o);
 
 
@@ -250,7 +260,7 @@ static void reallymarkobject (global_State *g, GCObject *o) {
     }
     case LUA_TUSERDATA: {
       TValue uvalue;
-      markobjectN(g, gco2u(o)->metatable);  /* mark its metatable */
+      markmetatable(g, gco2u(o)->metatable);  /* mark its metatable */
       gray2black(o);
       g->GCmemtrav += sizeudata(gco2u(o));
       getuservalue(g->mainthread, gco2u(o), &uvalue);
@@ -292,7 +302,7 @@ static void markmt (global_State *g) {
   int i;
 
   for (i=0; i < LUA_NUMTAGS; i++)
-    markobjectN(g, g->mt[i]);
+    markmetatable(g, g->mt[i]);
 }
 
 
@@ -454,7 +464,7 @@ static void traversestrongtable (global_State *g, Table *h) {
 static lu_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
-  markobjectN(g, h->metatable);
+  markmetatable(g, h->metatable);
   if (mode && ttisstring(mode) &&  /* is there a weak mode? */
       ((weakkey = strchr(svalue(mode), 'k')),
        (weakvalue = strchr(svalue(mode), 'v')),
@@ -492,12 +502,30 @@ static int traverseproto (global_State *g, Proto *f) {
     markobjectN(g, f->p[i]);
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
+#if LUA_USE_FROZEN
+  if (f->frozen)  /* in-place vectors don't use memory */
+    return sizeof(Proto) +
+      ((f->frozen & FROZEN_CODE) ? 0 : sizeof(Instruction) * f->sizecode) +
+      sizeof(Proto *) * f->sizep +
+      sizeof(TValue) * f->sizek +
+      ((f->frozen & FROZEN_LINEINFO) ? 0 : sizeof(int) * f->sizelineinfo) +
+      sizeof(LocVar) * f->sizelocvars +
+      sizeof(Upvaldesc) * f->sizeupvalues
+#if LUA_USE_ROTABLE
+      + (f->rocache ? sizeof(ROCache) * f->sizek : 0)
+#endif
+      ;
+#endif
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
                          sizeof(int) * f->sizelineinfo +
                          sizeof(LocVar) * f->sizelocvars +
-                         sizeof(Upvaldesc) * f->sizeupvalues;
+                         sizeof(Upvaldesc) * f->sizeupvalues
+#if LUA_USE_ROTABLE
+                         + (f->rocache ? sizeof(ROCache) * f->sizek : 0)
+#endif
+                         ;
 }
 
 
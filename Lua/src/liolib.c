@@ -515,6 +515,11 @@ static int g_read (lua_State *L, FILE *f, int first) {
         size_t l = (size_t)luaL_checkinteger(L, n);
         success = (l == 0) ? test_eof(L, f) : read_chars(L, f, l);
       }
+#if LUA_USE_BUFFER
+      else if (lua_type(L, n) == LUA_TUSERDATA) {
+        success = read_buffer(L, f, luaL_checkbuffer(L, n));
+      }
+#endif
       else {
         const char *p = luaL_checkstring(L, n);
         if (*p == '*') p++;  /* skip optional '*' (for compatibility) */
@@ -595,11 +600,18 @@ static int g_write (lua_State *L, FILE *f, int arg) {
   for (; nargs--; arg++) {
     if (lua_type(L, arg) == LUA_TNUMBER) {
       /* optimization: could be done exactly as for strings */
+      char buff[LUAI_MAXNUMBER2STR];
       int len = lua_isinteger(L, arg)
-                ? fprintf(f, LUA_INTEGER_FMT, lua_tointeger(L, arg))
-                : fprintf(f, LUA_NUMBER_FMT, lua_tonumber(L, arg));
-      status = status && (len > 0);
+                ? lua_integer2str(buff, sizeof(buff), lua_tointeger(L, arg))
+                : lua_number2str(buff, sizeof(buff), lua_tonumber(L, arg));
+      status = status && (fwrite(buff, sizeof(char), len, f) == (size_t)len);
     }
+#if LUA_USE_BUFFER
+    else if (lua_type(L, arg) == LUA_TUSERDATA) {
+      buffer_userdata_t *b = luaL_checkbuffer(L, arg);
+      status = status && (fwrite(b->data, sizeof(char), b->size, f) == b->size);
+    }
+#endif
     else {
       size_t l;
       const char *s = luaL_checklstring(L, arg, &l);
@@ -25,6 +25,7 @@
 
 // WHITECAT BEGIN
 #include "lrotable.h"
+#include "lfrozen.h"
 // WHITECAT END
 
 /*
@@ -530,6 +531,23 @@ static int searcher_preload (lua_State *L) {
 }
 
 
+#if LUA_USE_FROZEN
+static int searcher_frozen (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  const luaR_frozen *module = luaR_findfrozen(name);
+  if (module == NULL) {
+    lua_pushfstring(L, "\n\tno frozen module '%s'", name);
+    return 1;
+  }
+  if (luaR_loadfrozen(L, module) != LUA_OK)
+    return luaL_error(L, "error loading frozen module '%s':\n\t%s",
+                         name, lua_tostring(L, -1));
+  lua_pushliteral(L, ":frozen:");  /* will be 2nd argument to module */
+  return 2;
+}
+#endif
+
+
 static void findloader (lua_State *L, const char *name) {
   int i;
   luaL_Buffer msg;  /* to build error message */
@@ -740,8 +758,14 @@ static const luaL_Reg ll_funcs[] = {
 
 
 static void createsearcherstable (lua_State *L) {
+#if !LUA_USE_FROZEN
   static const lua_CFunction searchers[] =
     {searcher_preload, searcher_Lua, searcher_C, searcher_Croot, NULL};
+#else
+  static const lua_CFunction searchers[] =
+    {searcher_preload, searcher_frozen, searcher_Lua, searcher_C, searcher_Croot,
+     NULL};
+#endif
   int i;
   /* create 'searchers' table */
   lua_createtable(L, sizeof(searchers)/sizeof(searchers[0]) - 1, 0);
@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 
+#include <float.h>
 #include <locale.h>
 #include <math.h>
 #include <stdarg.h>
@@ -243,8 +244,109 @@ static lua_Number lua_strx2number (const char *s, char **endptr) {
 /* }====================================================== */
 
 
+/*
+** {==================================================================
+** Fast conversions between decimal numerals and floats
+** ===================================================================
+*/
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT || LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE
+
+#define L_FASTFLT
+
+/* powers of 10 that are exact as doubles */
+static const double pow10tab[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define MAXPOW10	22
+
+/* maximum number of decimal digits that fit in a 'uint64_t' */
+#define MAXU64DIG	19
+
+
+/*
+** Convert 'r * 10^-k' to a float, with correct rounding. 'r' and the
+** power of 10 are exact doubles, so the double result is correctly
+** rounded (Clinger's fast path). With single floats, the double must
+** not fall on a midpoint between two floats, which would round twice.
+** Returns 0 when the conversion cannot be done exactly here.
+*/
+static int decimal2num (uint64_t r, int k, lua_Number *result) {
+  double d;
+  if (r > ((uint64_t)1 << 53) || k > MAXPOW10 || k < -MAXPOW10)
+    return 0;
+  d = (k >= 0) ? (double)r / pow10tab[k] : (double)r * pow10tab[-k];
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+  if (d != 0) {
+    uint64_t bits;
+    if (d < FLT_MIN || d > FLT_MAX)
+      return 0;  /* subnormal or overflow */
+    memcpy(&bits, &d, sizeof(bits));
+    if ((bits & 0x1FFFFFFF) == 0x10000000)  /* float midpoint? */
+      return 0;
+  }
+#endif
+  *result = (lua_Number)d;
+  return 1;
+}
+
+
+/*
+** Read a decimal numeral with up to MAXU64DIG digits and a small
+** exponent without calling 'strtod'. Returns NULL if the numeral is not
+** in that form, leaving it for 'lua_str2number'.
+*/
+static const char *l_str2dfast (const char *s, lua_Number *result) {
+  uint64_t r = 0;
+  int ndig = 0;  /* number of digits */
+  int e = 0;  /* decimal exponent */
+  int neg;
+  while (lisspace(cast_uchar(*s))) s++;  /* skip initial spaces */
+  neg = isneg(&s);
+  for (; lisdigit(cast_uchar(*s)); s++) {
+    if (++ndig > MAXU64DIG) return NULL;
+    r = r * 10 + (*s - '0');
+  }
+  if (*s == '.') {
+    for (s++; lisdigit(cast_uchar(*s)); s++) {
+      if (++ndig > MAXU64DIG) return NULL;
+      r = r * 10 + (*s - '0');
+      e--;
+    }
+  }
+  if (ndig == 0) return NULL;
+  if (*s == 'e' || *s == 'E') {  /* exponent part? */
+    int exp1 = 0;
+    int neg1;
+    s++;
+    neg1 = isneg(&s);
+    if (!lisdigit(cast_uchar(*s))) return NULL;
+    for (; lisdigit(cast_uchar(*s)); s++) {
+      if (exp1 < 1000) exp1 = exp1 * 10 + (*s - '0');
+    }
+    e += (neg1) ? -exp1 : exp1;
+  }
+  while (lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
+  if (*s != '\0' || !decimal2num(r, -e, result))
+    return NULL;
+  if (neg) *result = -*result;
+  return s;
+}
+
+#endif
+
+/* }====================================================== */
+
+
 static const char *l_str2d (const char *s, lua_Number *result) {
   char *endptr;
+#if defined(L_FASTFLT)
+  const char *e;
+  if ((e = l_str2dfast(s, result)) != NULL)
+    return e;
+#endif
   if (strpbrk(s, "nN"))  /* reject 'inf' and 'nan' */
     return NULL;
   else if (strpbrk(s, "xX"))  /* hex? */
@@ -323,6 +425,354 @@ int luaO_utf8esc (char *buff, unsigned long x) {
 #define MAXNUMBER2STR	50
 
 
+/*
+** {==================================================================
+** Fast conversions from numbers to decimal numerals
+** ===================================================================
+*/
+
+/*
+** Write integer 'n' in decimal, as LUA_INTEGER_FMT
+*/
+int luaO_int2str (char *buff, size_t sz, lua_Integer n) {
+  char tmp[3 * sizeof(lua_Integer)];
+  lua_Unsigned u = l_castS2U(n);
+  int i = 0;
+  int len = 0;
+  UNUSED(sz);
+  if (n < 0) {
+    buff[len++] = '-';
+    u = 0u - u;
+  }
+  do {  /* digits come out backwards */
+    tmp[i++] = cast(char, '0' + u % 10);
+    u /= 10;
+  } while (u != 0);
+  while (i > 0)
+    buff[len++] = tmp[--i];
+  buff[len] = '\0';
+  return len;
+}
+
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+/*
+** Write the 'nd' digits in 'd' (d.ddd * 10^x) as '%.<p>g' writes them
+*/
+static int digits2str (char *buff, int neg, const char *d, int nd, int x,
+                       int p) {
+  int len = 0;
+  int i;
+  while (nd > 1 && d[nd - 1] == '0')  /* no trailing zeros */
+    nd--;
+  if (neg) buff[len++] = '-';
+  if (x < -4 || x >= p) {  /* exponent notation */
+    buff[len++] = d[0];
+    if (nd > 1) {
+      buff[len++] = lua_getlocaledecpoint();
+      for (i = 1; i < nd; i++) buff[len++] = d[i];
+    }
+    buff[len++] = 'e';
+    buff[len++] = (x < 0) ? '-' : '+';
+    if (x < 0) x = -x;
+    if (x >= 100) buff[len++] = cast(char, '0' + x / 100);
+    buff[len++] = cast(char, '0' + x / 10 % 10);
+    buff[len++] = cast(char, '0' + x % 10);
+  }
+  else if (x >= 0) {
+    for (i = 0; i <= x; i++)
+      buff[len++] = (i < nd) ? d[i] : '0';
+    if (nd > x + 1) {
+      buff[len++] = lua_getlocaledecpoint();
+      for (; i < nd; i++) buff[len++] = d[i];
+    }
+  }
+  else {
+    buff[len++] = '0';
+    buff[len++] = lua_getlocaledecpoint();
+    for (i = x + 1; i < 0; i++) buff[len++] = '0';
+    for (i = 0; i < nd; i++) buff[len++] = d[i];
+  }
+  buff[len] = '\0';
+  return len;
+}
+
+
+/* 'a * 10^k' in double arithmetic, for any 'k' a float may need */
+static double scale10 (double a, int k) {
+  for (; k > MAXPOW10; k -= MAXPOW10) a *= pow10tab[MAXPOW10];
+  for (; k < -MAXPOW10; k += MAXPOW10) a /= pow10tab[MAXPOW10];
+  return (k >= 0) ? a * pow10tab[k] : a / pow10tab[-k];
+}
+
+
+/*
+** A single precision float needs up to 9 significant digits to be read
+** back exactly, but with 9 digits 0.1 is written as 0.100000001. Use the
+** shortest of "%.7g", "%.8g" and "%.9g" that converts back to the same
+** value. The digits are computed in double arithmetic, which is off by
+** a few units in the 16th digit, so only a float within that distance of
+** a tie between two numerals is written with 'snprintf'.
+*/
+static int tostringflt (char *buff, size_t sz, lua_Number n) {
+  static const char *const fmts[] = {"%.7g", "%.8g", "%.9g"};
+  lua_Number a = (n < 0) ? -n : n;
+  lua_Number back;
+  double d, q, f;
+  uint64_t r, rd;
+  char dig[9];
+  int x, xr, p, i, len;
+  if (n != n || n - n != 0 || n == 0)  /* NaN, infinite or zero? */
+    return l_sprintf(buff, sz, fmts[0], (LUAI_UACNUMBER)n);
+  frexp(a, &x);
+  x = (int)floor((x - 1) * 0.30102999566398);  /* decimal exponent, or 1 less */
+  d = scale10(a, 8 - x);
+  if (d >= 1e9) {
+    x++;
+    d = scale10(a, 8 - x);
+  }
+  for (p = 7; p <= 9; p++) {  /* 'd' has 9 digits before the point */
+    q = d / pow10tab[9 - p];
+    f = floor(q);
+    q -= f;
+    if (q > 0.5 - 1e-6 && q < 0.5 + 1e-6) {  /* too close to a tie? */
+      len = l_sprintf(buff, sz, fmts[p - 7], (LUAI_UACNUMBER)n);
+      back = lua_str2number(buff, NULL);
+      if (n < 0) back = -back;
+    }
+    else {
+      r = (uint64_t)f + (q > 0.5);
+      xr = x;
+      if ((double)r >= pow10tab[p]) {  /* carry (9.99 -> 10.0)? */
+        r /= 10;
+        xr++;
+      }
+      for (i = p - 1, rd = r; i >= 0; i--, rd /= 10)
+        dig[i] = cast(char, '0' + rd % 10);
+      len = digits2str(buff, n < 0, dig, p, xr, p);
+      if (!decimal2num(r, p - 1 - xr, &back))
+        back = (n < 0) ? -lua_str2number(buff, NULL) : lua_str2number(buff, NULL);
+    }
+    if (p == 9 || back == a)
+      break;
+  }
+  return len;
+}
+
+/* significant digits written by 'luaO_flt2str' */
+#define MAXFLTDIG	9
+
+#define l_number2str(s,sz,n)	tostringflt(s,sz,n)
+
+#else
+
+#define MAXFLTDIG	14  /* as LUA_NUMBER_FMT */
+
+#define l_number2str(s,sz,n)	l_sprintf((s), sz, LUA_NUMBER_FMT, (n))
+
+#endif
+
+
+#if defined(L_FASTFLT)
+
+/*
+** Range of magnitudes written by 'luaO_flt2str' without 'snprintf'.
+** Inside it, '%g' uses the fixed notation: the decimal exponent is at
+** least -4 and less than the precision of LUA_NUMBER_FMT (7 with single
+** floats, as "%.8g" and "%.9g" switch later, and 14 with doubles).
+*/
+#define FLTFAST_MIN	1e-4
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+#define FLTFAST_MAX	1e7
+#else
+#define FLTFAST_MAX	1e14
+#endif
+
+
+/* number of digits before the decimal point of 'a' (<= 0 if a < 0.1) */
+static int intdigits (lua_Number a) {
+  int n;
+  if (a >= 1) {
+    for (n = 1; n <= MAXPOW10 && a >= pow10tab[n]; n++) ;
+  }
+  else {
+    for (n = 0; n > -3 && a < 1 / pow10tab[1 - n]; n--) ;
+  }
+  return n;
+}
+
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+/*
+** Compute round(a * 10^k), with ties to even, exactly. 'a' has a 24-bit
+** mantissa, so 'a * 5^k' fits in 64 bits for k <= 17, and only a shift
+** is left. Returns 0 if the result does not fit in 64 bits.
+*/
+static int scaleflt (lua_Number a, int k, uint64_t *r) {
+  static const uint32_t pow5[] = {
+    1, 5, 25, 125, 625, 3125, 15625, 78125, 390625, 1953125, 9765625,
+    48828125, 244140625, 1220703125
+  };
+  uint64_t v;
+  int e;
+  if (k < 0 || k > 17) return 0;
+  v = (uint64_t)l_mathop(ldexp)(l_mathop(frexp)(a, &e), 24);
+  e -= 24;  /* a == v * 2^e */
+  if (k <= 13)
+    v *= pow5[k];
+  else
+    v = v * pow5[13] * pow5[k - 13];
+  e += k;  /* a * 10^k == v * 2^e */
+  if (e >= 0) {
+    if (e >= 64 || v > (UINT64_MAX >> e)) return 0;
+    *r = v << e;
+  }
+  else if (e <= -64)
+    *r = (e == -64 && v > ((uint64_t)1 << 63)) ? 1 : 0;
+  else {
+    uint64_t q = v >> -e;
+    uint64_t rem = v & ((((uint64_t)1) << -e) - 1);
+    uint64_t half = ((uint64_t)1) << (-e - 1);
+    if (rem > half || (rem == half && (q & 1)))
+      q++;
+    *r = q;
+  }
+  return 1;
+}
+#else
+/*
+** Round 'a * 10^k' in double arithmetic. The result may be off by one,
+** which is caught by the round-trip check of 'luaO_flt2str'.
+*/
+static int scaleflt (lua_Number a, int k, uint64_t *r) {
+  if (k < 0 || k > MAXPOW10) return 0;
+  *r = (uint64_t)l_mathop(floor)(a * pow10tab[k] + 0.5);
+  return 1;
+}
+#endif
+
+
+/*
+** Write 'r * 10^-k' in fixed notation; with 'trim', without the
+** trailing zeros of the fraction
+*/
+static int fixed2str (char *buff, uint64_t r, int k, int trim) {
+  char tmp[MAXU64DIG + MAXPOW10 + 2];
+  int i = 0;
+  int len = 0;
+  if (trim) {
+    while (k > 0 && r % 10 == 0) {
+      r /= 10; k--;
+    }
+  }
+  do {  /* digits come out backwards */
+    tmp[i++] = cast(char, '0' + r % 10);
+    r /= 10;
+  } while (r != 0);
+  while (i <= k)  /* at least one digit before the point */
+    tmp[i++] = '0';
+  while (i > k)
+    buff[len++] = tmp[--i];
+  if (k > 0) {
+    buff[len++] = lua_getlocaledecpoint();
+    while (i > 0)
+      buff[len++] = tmp[--i];
+  }
+  buff[len] = '\0';
+  return len;
+}
+
+
+/*
+** Write 'n' with the fewest decimals that convert back to it, which is
+** exactly what '%g' writes for numbers of moderate magnitude. Returns 0
+** if 'n' is out of that range or needs more than MAXFLTDIG digits.
+*/
+static int fastflt2str (char *buff, lua_Number n) {
+  lua_Number a = (n < 0) ? -n : n;
+  int len = 0;
+  if (n == 0) {
+    if (1 / n < 0) buff[len++] = '-';
+    return len + fixed2str(buff + len, 0, 0, 0);
+  }
+  else if (a >= FLTFAST_MIN && a < FLTFAST_MAX) {
+    int kmax = MAXFLTDIG - intdigits(a);
+    int k;
+    if (n < 0) buff[len++] = '-';
+    for (k = 0; k <= kmax; k++) {
+      uint64_t r;
+      lua_Number back;
+      if (scaleflt(a, k, &r) && decimal2num(r, k, &back) && back == a)
+        return len + fixed2str(buff + len, r, k, 0);
+    }
+  }
+  return 0;
+}
+
+#endif
+
+
+/*
+** Write float 'n' with the digits of LUA_NUMBER_FMT (with single
+** floats, the shortest numeral that reads back as 'n'). Numbers of
+** moderate magnitude are written by 'fastflt2str'; the others go
+** through 'snprintf'.
+*/
+int luaO_flt2str (char *buff, size_t sz, lua_Number n) {
+#if defined(L_FASTFLT)
+  int len = fastflt2str(buff, n);
+  if (len > 0)
+    return len;
+#endif
+  return l_number2str(buff, sz, n);
+}
+
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+/*
+** Write float 'n' as snprintf does with "%.<prec>f" ('conv' == 'f') or
+** "%.<prec>g" ('conv' == 'g'), using exact integer arithmetic. Returns
+** -1 for the cases it does not handle (the exponent notation, large
+** numbers and precisions, infinities and NaN).
+*/
+int luaO_fmtflt (char *buff, int conv, int prec, lua_Number n) {
+  lua_Number a = (n < 0) ? -n : n;
+  uint64_t r;
+  int k;
+  int len = 0;
+  if (a != a || a > FLT_MAX || prec > MAXU64DIG)
+    return -1;
+  if (n < 0 || (n == 0 && 1 / n < 0))
+    buff[len++] = '-';
+  if (conv == 'f') {
+    if (!scaleflt(a, prec, &r)) return -1;
+    return len + fixed2str(buff + len, r, prec, 0);
+  }
+  else {  /* 'g' */
+    int x;  /* decimal exponent */
+    if (prec == 0) prec = 1;
+    if (a == 0)
+      x = 0;
+    else if (a >= FLTFAST_MIN && a < 1e9)
+      x = intdigits(a) - 1;
+    else
+      return -1;
+    k = prec - 1 - x;
+    if (!scaleflt(a, k, &r)) return -1;
+    if (prec <= MAXPOW10 && (double)r >= pow10tab[prec]) {  /* carry? */
+      x++; k--;
+      if (!scaleflt(a, k, &r)) return -1;
+    }
+    if (x < -4 || x >= prec)
+      return -1;  /* '%g' uses the exponent notation */
+    return len + fixed2str(buff + len, r, k, 1);
+  }
+}
+#endif
+
+/* }====================================================== */
+
+
 /*
 ** Convert a number object to a string
 */
@@ -412,6 +412,17 @@ typedef struct LocVar {
 } LocVar;
 
 
+#if LUA_USE_ROTABLE
+/*
+** Entry of the inline cache of rotable lookups (see lvm.c)
+*/
+typedef struct ROCache {
+  const void *t;  /* rotable where 'v' was found (NULL for a library global) */
+  const TValue *v;  /* value found, in flash */
+} ROCache;
+#endif
+
+
 /*
 ** Function Prototypes
 */
@@ -420,6 +431,9 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed parameters */
   lu_byte is_vararg;  /* 2: declared vararg; 1: uses vararg */
   lu_byte maxstacksize;  /* number of registers needed by this function */
+#if LUA_USE_FROZEN
+  lu_byte frozen;  /* vectors not owned (in flash), see FROZEN_* in lfunc.h */
+#endif
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
@@ -435,6 +449,9 @@ typedef struct Proto {
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
   struct LClosure *cache;  /* last-created closure with this prototype */
+#if LUA_USE_ROTABLE
+  ROCache *rocache;  /* rotable lookups, one per constant (or NULL) */
+#endif
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -65,6 +65,11 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "GETTABUPF",
+  "ADDFORLOOP",
+  "EQJ",
+  "LTJ",
+  "LEJ",
   NULL
 };
 
@@ -120,5 +125,19 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 1, OpArgU, OpArgK, iABC)		/* OP_GETTABUPF */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADDFORLOOP */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_EQJ */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LTJ */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LEJ */
+};
+
+
+LUAI_DDEF const lu_byte luaP_fusedbase[NUM_OPCODES - FIRST_FUSED] = {
+  OP_GETTABUP,		/* OP_GETTABUPF */
+  OP_ADD,		/* OP_ADDFORLOOP */
+  OP_EQ,		/* OP_EQJ */
+  OP_LT,		/* OP_LTJ */
+  OP_LE			/* OP_LEJ */
 };
 
@@ -228,11 +228,20 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* superinstructions (see luaK_fuse) */
+OP_GETTABUPF,/*	A B C	OP_GETTABUP, then the OP_GETTABLE that follows	*/
+OP_ADDFORLOOP,/* A B C	OP_ADD, then the OP_FORLOOP that follows	*/
+OP_EQJ,/*	A B C	OP_EQ, then the OP_JMP (A == 0) that follows	*/
+OP_LTJ,/*	A B C	OP_LT, then the OP_JMP (A == 0) that follows	*/
+OP_LEJ/*	A B C	OP_LE, then the OP_JMP (A == 0) that follows	*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_LEJ) + 1)
+
+#define FIRST_FUSED	OP_GETTABUPF
 
 
 
@@ -252,6 +261,10 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 
   (*) In OP_LOADKX, the next 'instruction' is always EXTRAARG.
 
+  (*) A superinstruction has the arguments of its first opcode, and the
+  instruction that it runs next is kept after it, so it can still be a
+  jump target or be dumped as is.
+
   (*) For comparisons, A specifies what condition the test should accept
   (true or false).
 
@@ -288,6 +301,15 @@ LUAI_DDEC const lu_byte luaP_opmodes[NUM_OPCODES];
 LUAI_DDEC const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
 
+/* opcode that superinstruction 'o' starts with; 'o' for other opcodes */
+LUAI_DDEC const lu_byte luaP_fusedbase[NUM_OPCODES - FIRST_FUSED];
+
+#define luaP_baseop(o)	((o) < FIRST_FUSED ? (o) : \
+	cast(OpCode, luaP_fusedbase[(o) - FIRST_FUSED]))
+
+#define GET_BASEOP(i)	luaP_baseop(GET_OPCODE(i))
+
+
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
 
@@ -209,10 +209,54 @@ static int str_dump (lua_State *L) {
 #define CAP_POSITION	(-2)
 
 
+/*
+** Size of the compiled pattern cache (0 disables it), and maximum length
+** of a cached pattern (by default, only short strings, which are
+** interned, are cached)
+*/
+#if !defined(LUA_PATCACHE_SIZE)
+#define LUA_PATCACHE_SIZE	8
+#endif
+
+#if !defined(LUA_PATCACHE_MAXLEN)
+#define LUA_PATCACHE_MAXLEN	40
+#endif
+
+
+#define CLASSBYTES	(256 / CHAR_BIT)
+
+#define setclassbit(set,c)	((set)[(c) / CHAR_BIT] |= (1u << ((c) % CHAR_BIT)))
+#define testclassbit(set,c)	((set)[(c) / CHAR_BIT] & (1u << ((c) % CHAR_BIT)))
+
+
+/*
+** Compiled pattern. Offsets are relative to the pattern after the
+** anchor (if any). For each position where a single char class starts,
+** 'end' holds the position of its end (see 'classend'), and 'set' the
+** 1-based index of its character set in 'sets' ('.' and plain
+** characters have no set). 'pre' is the literal prefix that every match
+** starts with, and 'first' the set of characters that can start a match
+** (only valid if 'hasfirst').
+*/
+typedef struct PatProg {
+  unsigned int stamp;  /* last use, for LRU eviction */
+  unsigned char anchor;  /* pattern starts with an anchor */
+  unsigned char hasfirst;
+  unsigned char npre;  /* length of 'pre' */
+  unsigned char first[CLASSBYTES];
+  char pre[LUA_PATCACHE_MAXLEN];
+  unsigned char end[LUA_PATCACHE_MAXLEN];
+  unsigned char set[LUA_PATCACHE_MAXLEN];
+  unsigned char sets[1][CLASSBYTES];  /* variable size */
+} PatProg;
+
+
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end ('\0') of source string */
+  const char *p_init;  /* init of pattern (after the anchor) */
   const char *p_end;  /* end ('\0') of pattern */
+  const PatProg *prog;  /* compiled pattern, or NULL */
   lua_State *L;
   size_t nrep;  /* limit to avoid non-linear complexity */
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
@@ -266,6 +310,8 @@ static int capture_to_close (MatchState *ms) {
 
 
 static const char *classend (MatchState *ms, const char *p) {
+  if (ms->prog)  /* end is precomputed? */
+    return ms->p_init + ms->prog->end[p - ms->p_init];
   switch (*p++) {
     case L_ESC: {
       if (p == ms->p_end)
@@ -332,6 +378,18 @@ static int matchbracketclass (int c, const char *p, const char *ec) {
 }
 
 
+/* match 'c' against the class in [p, ep), using its set when compiled */
+static int matchclass (MatchState *ms, int c, const char *p,
+                       const char *ep) {
+  if (ms->prog && ms->prog->set[p - ms->p_init])
+    return testclassbit(ms->prog->sets[ms->prog->set[p - ms->p_init] - 1], c);
+  else if (*p == '[')
+    return matchbracketclass(c, p, ep-1);
+  else
+    return match_class(c, uchar(*(p+1)));
+}
+
+
 static int singlematch (MatchState *ms, const char *s, const char *p,
                         const char *ep) {
   if (s >= ms->src_end)
@@ -340,8 +398,7 @@ static int singlematch (MatchState *ms, const char *s, const char *p,
     int c = uchar(*s);
     switch (*p) {
       case '.': return 1;  /* matches any char */
-      case L_ESC: return match_class(c, uchar(*(p+1)));
-      case '[': return matchbracketclass(c, p, ep-1);
+      case L_ESC: case '[': return matchclass(ms, c, p, ep);
       default:  return (uchar(*p) == c);
     }
   }
@@ -471,8 +528,8 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
               luaL_error(ms->L, "missing '[' after '%%f' in pattern");
             ep = classend(ms, p);  /* points to what is next */
             previous = (s == ms->src_init) ? '\0' : *(s - 1);
-            if (!matchbracketclass(uchar(previous), p, ep - 1) &&
-               matchbracketclass(uchar(*s), p, ep - 1)) {
+            if (!matchclass(ms, uchar(previous), p, ep) &&
+               matchclass(ms, uchar(*s), p, ep)) {
               p = ep; goto init;  /* return match(ms, s, ep); */
             }
             s = NULL;  /* match failed */
@@ -600,9 +657,256 @@ static int nospecials (const char *p, size_t l) {
 }
 
 
+/*
+** {======================================================
+** Compiled pattern cache
+** =======================================================
+*/
+
+/* key of the cache table in the registry */
+static const char patcachekey = 'p';
+
+static unsigned int patclock = 0;
+
+
+/* end of the bracket class starting at 'p', or NULL if malformed */
+static const char *bracketend (const char *p, const char *p_end) {
+  p++;
+  if (p < p_end && *p == '^') p++;
+  do {  /* look for a ']' */
+    if (p >= p_end)
+      return NULL;
+    if (*(p++) == L_ESC && p < p_end)
+      p++;  /* skip escapes (e.g. '%]') */
+  } while (p >= p_end || *p != ']');
+  return p+1;
+}
+
+
+/*
+** Compile the single char class at 'p' (ending at 'ep') into the next
+** set of 'prog', if it is a bracket or an escaped class.
+*/
+static void compileclass (PatProg *prog, const char *p, size_t i,
+                          const char *ep, int *nsets) {
+  if (*p == '[' || *p == L_ESC) {
+    unsigned char *set = prog->sets[*nsets];
+    int c;
+    memset(set, 0, CLASSBYTES);
+    for (c = 0; c <= UCHAR_MAX; c++) {
+      int res = (*p == '[') ? matchbracketclass(c, p, ep - 1)
+                            : match_class(c, uchar(*(p+1)));
+      if (res) setclassbit(set, c);
+    }
+    prog->set[i] = uchar(++(*nsets));
+  }
+}
+
+
+/*
+** Compile pattern 'p' (already without its anchor) into 'prog'. Walks
+** the items in the same order as 'match' does, so that every position
+** where 'match' looks for a class end has it precomputed. While the
+** pattern still cannot match the empty string, also collects the
+** literal prefix and the set of first characters. Returns 0 if the
+** pattern is malformed (errors are left for 'match' to raise).
+*/
+static int compile (PatProg *prog, const char *p, size_t lp) {
+  const char *p_init = p;
+  const char *p_end = p + lp;
+  int nsets = 0;
+  int ncap = 0;  /* captures started so far */
+  int level = 0;  /* unfinished captures */
+  int head = 1;  /* still in the part that determines the first chars? */
+  while (p < p_end) {
+    const char *ep;
+    int literal;
+    switch (*p) {
+      case '(':
+        if (++ncap > LUA_MAXCAPTURES)
+          head = 0;  /* 'match' raises an error before consuming anything */
+        if (p + 1 < p_end && *(p + 1) == ')')
+          p += 2;  /* position capture */
+        else {
+          level++; p++;
+        }
+        continue;
+      case ')':
+        if (level == 0)
+          head = 0;  /* same for a capture that is not open */
+        else
+          level--;
+        p++;
+        continue;
+      case '$':
+        if (p + 1 == p_end) {
+          head = 0; p++; continue;
+        }
+        break;
+      case L_ESC:
+        if (p + 1 >= p_end)
+          return 0;  /* ends with '%' */
+        if (*(p + 1) == 'b') {
+          if (p + 3 >= p_end)
+            return 0;  /* missing arguments to '%b' */
+          head = 0; p += 4; continue;
+        }
+        else if (*(p + 1) == 'f') {
+          p += 2;
+          if (p >= p_end || *p != '[' || (ep = bracketend(p, p_end)) == NULL)
+            return 0;
+          prog->end[p - p_init] = uchar(ep - p_init);
+          compileclass(prog, p, p - p_init, ep, &nsets);
+          head = 0; p = ep; continue;
+        }
+        else if (isdigit(uchar(*(p + 1)))) {
+          head = 0; p += 2; continue;
+        }
+        break;
+    }
+    /* single char class plus optional suffix */
+    if (*p == '[') {
+      if ((ep = bracketend(p, p_end)) == NULL)
+        return 0;
+    }
+    else
+      ep = p + ((*p == L_ESC) ? 2 : 1);
+    prog->end[p - p_init] = uchar(ep - p_init);
+    compileclass(prog, p, p - p_init, ep, &nsets);
+    literal = (*p == L_ESC) ? !isalnum(uchar(*(p + 1)))
+                            : (*p != '[' && *p != '.');
+    if (head) {
+      int suffix = (ep < p_end) ? *ep : 0;
+      if (suffix == '*' || suffix == '?' || suffix == '-')
+        head = 0;  /* may match the empty string */
+      else if (literal && suffix != '+')
+        prog->pre[prog->npre++] = *(ep - 1);  /* extend literal prefix */
+      else {
+        if (prog->npre == 0) {  /* no prefix? use first class */
+          int c;
+          for (c = 0; c <= UCHAR_MAX; c++) {
+            if (*p == '.' || (literal ? c == uchar(*(ep - 1))
+                                      : testclassbit(prog->sets[nsets - 1], c)))
+              setclassbit(prog->first, c);
+          }
+          prog->hasfirst = 1;
+        }
+        head = 0;
+      }
+    }
+    p = ep;
+    if (p < p_end && *p != '\0' && strchr("*+?-", *p))
+      p++;  /* skip suffix */
+  }
+  return 1;
+}
+
+
+/*
+** Push the compiled program for pattern 'p' (which must be argument 2)
+** and return it, compiling it on a cache miss. Pushes nil and returns
+** NULL if the pattern cannot be compiled. 'anchor' tells whether a
+** leading '^' is an anchor. The program is kept alive by the stack
+** even if a nested match evicts it.
+*/
+static const PatProg *getprog (lua_State *L, const char *p, size_t lp,
+                               int anchor) {
+  PatProg *prog;
+  size_t nsets = 1;
+  size_t i;
+  anchor = anchor && (*p == '^');
+  if (LUA_PATCACHE_SIZE == 0 || lp > LUA_PATCACHE_MAXLEN) {
+    lua_pushnil(L);
+    return NULL;
+  }
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, &patcachekey) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_createtable(L, 0, LUA_PATCACHE_SIZE);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &patcachekey);
+  }
+  lua_pushvalue(L, 2);
+  if (lua_rawget(L, -2) == LUA_TUSERDATA) {  /* cache hit? */
+    prog = (PatProg *)lua_touserdata(L, -1);
+    if (prog->anchor == anchor) {
+      prog->stamp = ++patclock;
+      lua_remove(L, -2);  /* remove cache table */
+      return prog;
+    }
+  }
+  lua_pop(L, 1);
+  /* compile it */
+  for (i = 0; i < lp; i++)  /* bound the number of sets */
+    if (p[i] == '[' || p[i] == L_ESC) nsets++;
+  prog = (PatProg *)lua_newuserdata(L, sizeof(PatProg) +
+                                       (nsets - 1) * CLASSBYTES);
+  memset(prog, 0, sizeof(PatProg));
+  prog->anchor = anchor;
+  if (!compile(prog, p + anchor, lp - anchor)) {
+    lua_pop(L, 2);  /* remove program and cache table */
+    lua_pushnil(L);
+    return NULL;
+  }
+  prog->stamp = ++patclock;
+  /* evict the least recently used program if the cache is full */
+  {
+    int n = 0;
+    unsigned int oldest = 0;
+    lua_pushnil(L);  /* victim key */
+    lua_pushnil(L);
+    while (lua_next(L, -4) != 0) {
+      PatProg *other = (PatProg *)lua_touserdata(L, -1);
+      lua_pop(L, 1);
+      if (n++ == 0 || patclock - other->stamp > oldest) {
+        oldest = patclock - other->stamp;
+        lua_pushvalue(L, -1);
+        lua_replace(L, -3);
+      }
+    }
+    if (n >= LUA_PATCACHE_SIZE) {
+      lua_pushnil(L);
+      lua_rawset(L, -4);
+    }
+    else
+      lua_pop(L, 1);
+  }
+  lua_pushvalue(L, 2);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -4);  /* cache[p] = prog */
+  lua_remove(L, -2);  /* remove cache table */
+  return prog;
+}
+
+
+/*
+** Return the first position from 's' on where a match can start, or
+** NULL if there is none, skipping with 'memchr' to the literal prefix
+** or testing the set of first characters.
+*/
+static const char *nextstart (MatchState *ms, const char *s) {
+  const PatProg *prog = ms->prog;
+  if (prog == NULL)
+    return s;
+  else if (prog->npre > 0)
+    return lmemfind(s, ms->src_end - s, prog->pre, prog->npre);
+  else if (prog->hasfirst) {
+    while (s < ms->src_end && !testclassbit(prog->first, uchar(*s)))
+      s++;
+    return (s < ms->src_end) ? s : NULL;
+  }
+  else
+    return s;
+}
+
+/* }====================================================== */
+
+
 static void prepstate (MatchState *ms, lua_State *L,
-                       const char *s, size_t ls, const char *p, size_t lp) {
+                       const char *s, size_t ls, const char *p, size_t lp,
+                       const PatProg *prog) {
   ms->L = L;
+  ms->prog = prog;
+  ms->p_init = p;
   ms->matchdepth = MAXCCALLS;
   ms->src_init = s;
   ms->src_end = s + ls;
@@ -644,12 +948,15 @@ static int str_find_aux (lua_State *L, int find) {
     MatchState ms;
     const char *s1 = s + init - 1;
     int anchor = (*p == '^');
+    const PatProg *prog = getprog(L, p, lp, 1);
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
-    prepstate(&ms, L, s, ls, p, lp);
+    prepstate(&ms, L, s, ls, p, lp, prog);
     do {
       const char *res;
+      if (!anchor && (s1 = nextstart(&ms, s1)) == NULL)
+        break;  /* cannot match anywhere else */
       reprepstate(&ms);
       if ((res=match(&ms, s1, p)) != NULL) {
         if (find) {
@@ -690,6 +997,8 @@ static int gmatch_aux (lua_State *L) {
   const char *src;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
+    if ((src = nextstart(&gm->ms, src)) == NULL)
+      break;  /* cannot match anywhere else */
     reprepstate(&gm->ms);
     if ((e = match(&gm->ms, src, gm->p)) != NULL) {
       if (e == src)  /* empty match? */
@@ -708,11 +1017,13 @@ static int gmatch (lua_State *L) {
   const char *s = luaL_checklstring(L, 1, &ls);
   const char *p = luaL_checklstring(L, 2, &lp);
   GMatchState *gm;
+  const PatProg *prog;
   lua_settop(L, 2);  /* keep them on closure to avoid being collected */
   gm = (GMatchState *)lua_newuserdata(L, sizeof(GMatchState));
-  prepstate(&gm->ms, L, s, ls, p, lp);
+  prog = getprog(L, p, lp, 0);  /* keep the program on closure, too */
+  prepstate(&gm->ms, L, s, ls, p, lp, prog);
   gm->src = s; gm->p = p;
-  lua_pushcclosure(L, gmatch_aux, 3);
+  lua_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -786,16 +1097,25 @@ static int str_gsub (lua_State *L) {
   lua_Integer n = 0;
   MatchState ms;
   luaL_Buffer b;
+  const PatProg *prog;
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table expected");
+  prog = getprog(L, p, lp, 1);
   luaL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
-  prepstate(&ms, L, src, srcl, p, lp);
+  prepstate(&ms, L, src, srcl, p, lp, prog);
   while (n < max_s) {
     const char *e;
+    if (!anchor) {  /* copy what cannot match at once */
+      const char *next = nextstart(&ms, src);
+      if (next == NULL)
+        break;
+      luaL_addlstring(&b, src, next - src);
+      src = next;
+    }
     reprepstate(&ms);
     if ((e = match(&ms, src, p)) != NULL) {
       n++;
@@ -968,6 +1288,21 @@ static const char *scanformat (lua_State *L, const char *strfrmt, char *form) {
 }
 
 
+/*
+** precision of a format without flags or width (such as '%d' or
+** '%.2f'), 'def' if it has none, or -1 if it is not that simple
+*/
+static int plainprec (const char *form, int def) {
+  const char *p = form + 1;  /* skip '%' */
+  if (*p == '.') {
+    def = 0;
+    for (p++; isdigit(uchar(*p)); p++)
+      def = def * 10 + (*p - '0');
+  }
+  return (*(p + 1) == '\0') ? def : -1;
+}
+
+
 /*
 ** add length modifier into formats
 */
@@ -1009,6 +1344,10 @@ static int str_format (lua_State *L) {
         case 'd': case 'i':
         case 'o': case 'u': case 'x': case 'X': {
           lua_Integer n = luaL_checkinteger(L, arg);
+          if (strcmp(form, "%d") == 0) {
+            nb = lua_integer2str(buff, MAX_ITEM, n);
+            break;
+          }
           addlenmod(form, LUA_INTEGER_FRMLEN);
           nb = l_sprintf(buff, MAX_ITEM, form, n);
           break;
@@ -1020,8 +1359,16 @@ static int str_format (lua_State *L) {
           break;
         case 'e': case 'E': case 'f':
         case 'g': case 'G': {
+          lua_Number n = luaL_checknumber(L, arg);
+#if defined(lua_number2fmt)
+          int conv = strfrmt[-1];
+          int prec = plainprec(form, 6);
+          if ((conv == 'f' || conv == 'g') && prec >= 0 &&
+              (nb = lua_number2fmt(buff, conv, prec, n)) >= 0)
+            break;
+#endif
           addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = l_sprintf(buff, MAX_ITEM, form, luaL_checknumber(L, arg));
+          nb = l_sprintf(buff, MAX_ITEM, form, (LUAI_UACNUMBER)n);
           break;
         }
         case 'q': {
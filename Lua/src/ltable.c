@@ -193,13 +193,6 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
 
 
 int luaH_next (lua_State *L, Table *t, StkId key) {
-#if LUA_USE_ROTABLE
-  if (luaR_isrotable((const void *)t)) {
-  	luaR_next(L, t, key, key+1);
-  	return ttisnil(key) ? 0 : 1;
-  }
-#endif
-
   unsigned int i = findindex(L, t, key);  /* find original element */
   for (; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
@@ -386,6 +379,28 @@ void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
   luaH_resize(L, t, nasize, nsize);
 }
 
+
+/*
+** Remove all entries from 't', but keep its array and hash parts, so
+** that it can be filled again without any rehash
+*/
+void luaH_clear (Table *t) {
+  unsigned int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (!isdummy(t->node)) {
+    unsigned int size = sizenode(t);
+    for (i = 0; i < size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = 0;
+      setnilvalue(wgkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lastfree = gnode(t, size);  /* all positions are free again */
+  }
+  invalidateTMcache(t);
+}
+
 /*
 ** nums[i] = number of keys 'k' where 2^(i - 1) < k <= 2^i
 */
@@ -510,12 +525,6 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
 ** search function for integers
 */
 const TValue *luaH_getint (Table *t, lua_Integer key) {
-#if LUA_USE_ROTABLE
-  if (luaR_isrotable((const void *)t)) {
-	  return luaR_findentry((const void *)t, NULL, key, NULL);
-  }
-#endif
-
   /* (1 <= key && key <= t->sizearray) */
   if (l_castS2U(key) - 1 < t->sizearray)
     return &t->array[key - 1];
@@ -539,14 +548,6 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
   Node *n = hashstr(t, key);
-
-#if LUA_USE_ROTABLE
-  if (luaR_isrotable((const void *)t)) {
-
-	  return luaR_findentry((const void *)t, getstr(key), 0, NULL);
-  }
-#endif
-
   lua_assert(key->tt == LUA_TSHRSTR);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     const TValue *k = gkey(n);
@@ -568,12 +569,6 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 ** which may be in array part, nor for floats with integral values.)
 */
 static const TValue *getgeneric (Table *t, const TValue *key) {
-#if LUA_USE_ROTABLE
-  if (luaR_isrotable((const void *)t)) {
-	  return luaR_findentry((const void *)t, getstr(key), 0, NULL);
-  }
-#endif
-
   Node *n = mainposition(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (luaV_rawequalobj(gkey(n), key)) {
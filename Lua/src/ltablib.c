@@ -223,6 +223,42 @@ static int unpack (lua_State *L) {
 
 
 
+/*
+** {======================================================
+** Preallocation and reuse
+** =======================================================
+*/
+
+/*
+** table.create(narray [, nhash]): new table with room for 'narray'
+** sequence elements and 'nhash' other fields, so that filling it does
+** not rehash
+*/
+static int tcreate (lua_State *L) {
+  lua_Integer na = luaL_checkinteger(L, 1);
+  lua_Integer nh = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, 0 <= na && na <= INT_MAX, 1, "out of range");
+  luaL_argcheck(L, 0 <= nh && nh <= INT_MAX, 2, "out of range");
+  lua_createtable(L, (int)na, (int)nh);
+  return 1;
+}
+
+
+/*
+** table.clear(t): remove all fields of 't', keeping the memory it has
+** allocated for them, so that it can be refilled without allocations
+*/
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  lua_settop(L, 1);
+  return 1;  /* return the table */
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Quicksort
@@ -426,6 +462,8 @@ static int sort (lua_State *L) {
 
 static const LUA_REG_TYPE tab_funcs[] = {
   { LSTRKEY( "concat" ),		LFUNCVAL( tconcat ) },
+  { LSTRKEY( "create" ),		LFUNCVAL( tcreate ) },
+  { LSTRKEY( "clear" ),			LFUNCVAL( tclear ) },
 #if defined(LUA_COMPAT_MAXN)
   { LSTRKEY( "maxn" ),			LFUNCVAL( maxn ) },
 #endif
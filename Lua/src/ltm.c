@@ -79,17 +79,42 @@ const TValue *luaT_gettm (Table *events, TMS event, TString *ename) {
   else return tm;
 }
 #else
+/*
+** get a field of a metatable, that can be a rotable when it was set
+** with a rotable (see lua_setmetatable)
+*/
+static const TValue *getmtfield (Table *mt, TString *ename) {
+  if (luaR_isrotable(mt))
+    return luaH_getstr_ro(mt, ename);
+  return luaH_getshortstr(mt, ename);
+}
+
 const TValue *luaT_gettm (Table *events, TMS event, TString *ename) {
-  const TValue *tm = luaH_getshortstr(events, ename);
+  const TValue *tm;
   lua_assert(event <= TM_EQ);
+  if (luaR_isrotable(events)) {  /* flags can't be cached in a rotable */
+    tm = luaH_getstr_ro(events, ename);
+    return ttisnil(tm) ? NULL : tm;
+  }
+  tm = luaH_getshortstr(events, ename);
   if (ttisnil(tm)) {  /* no tag method? */
-	if (!luaR_isrotable(events)) {
-		events->flags |= cast_byte(1u<<event);  /* cache this fact */
-	}
+    events->flags |= cast_byte(1u<<event);  /* cache this fact */
     return NULL;
   }
   else return tm;
 }
+
+
+/*
+** get a tag method of a rotable, through its '__metatable' entry
+*/
+const TValue *luaT_gettmro (lua_State *L, void *t, TMS event) {
+  void *mt = (void *)luaL_rometatable(t);
+  const TValue *tm;
+  if (mt == NULL) return NULL;  /* no metatable */
+  tm = luaH_getstr_ro(mt, G(L)->tmname[event]);
+  return ttisnil(tm) ? NULL : tm;
+}
 #endif
 
 const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o, TMS event) {
@@ -109,7 +134,11 @@ const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o, TMS event) {
     default:
       mt = G(L)->mt[ttnov(o)];
   }
+#if !LUA_USE_ROTABLE
   return (mt ? luaH_getshortstr(mt, G(L)->tmname[event]) : luaO_nilobject);
+#else
+  return (mt ? getmtfield(mt, G(L)->tmname[event]) : luaO_nilobject);
+#endif
 }
 
 
@@ -57,6 +57,9 @@ LUAI_DDEC const char *const luaT_typenames_[LUA_TOTALTAGS];
 
 
 LUAI_FUNC const TValue *luaT_gettm (Table *events, TMS event, TString *ename);
+#if LUA_USE_ROTABLE
+LUAI_FUNC const TValue *luaT_gettmro (lua_State *L, void *t, TMS event);
+#endif
 LUAI_FUNC const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o,
                                                        TMS event);
 LUAI_FUNC void luaT_init (lua_State *L);
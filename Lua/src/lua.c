@@ -121,8 +121,10 @@ static void lstop (lua_State *L, lua_Debug *ar) {
 ** interpreter.
 */
 static void laction (int i) {
+#if !LUA_USE_SAFE_SIGNAL
 	// TO DO: review this. Code dumps if removed.
 	delay(100);
+#endif
 
 	signal(i, SIG_DFL); /* if another SIGINT happens, terminate process */
 
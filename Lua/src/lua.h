@@ -267,6 +267,15 @@ LUA_API void  (lua_rawsetp) (lua_State *L, int idx, const void *p);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API void  (lua_setuservalue) (lua_State *L, int idx);
 
+/* element types for 'lua_setarray' */
+#define LUA_ARRAY_BYTE		0	/* unsigned char */
+#define LUA_ARRAY_INTEGER	1	/* lua_Integer */
+#define LUA_ARRAY_NUMBER	2	/* lua_Number */
+
+LUA_API void  (lua_setarray) (lua_State *L, int idx, lua_Integer first,
+                              const void *v, int n, int type);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
+
 
 /*
 ** 'load' and 'call' functions (load and run Lua code)
@@ -31,6 +31,7 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static const char* cname=NULL;		/* dump as C array named 'cname'? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -56,6 +57,7 @@ static void usage(const char* message)
  fprintf(stderr,
   "usage: %s [options] [filenames]\n"
   "Available options are:\n"
+  "  -c name  dump as a C array 'name' (for frozen modules)\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
   "  -p       parse only\n"
@@ -86,6 +88,11 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-c"))			/* dump as C array */
+  {
+   cname=argv[++i];
+   if (cname==NULL || *cname==0) usage("'-c' needs argument");
+  }
   else if (IS("-l"))			/* list */
    ++listing;
   else if (IS("-o"))			/* output file */
@@ -162,6 +169,18 @@ static int writer(lua_State* L, const void* p, size_t size, void* u)
  return (fwrite(p,size,1,(FILE*)u)!=1) && (size!=0);
 }
 
+static int cwriter(lua_State* L, const void* p, size_t size, void* u)
+{
+ static size_t n=0;
+ const unsigned char* b=(const unsigned char*)p;
+ UNUSED(L);
+ while (size--)
+ {
+  if (fprintf((FILE*)u,"%s0x%02x,",(n++%16==0) ? "\n " : "",*b++)<0) return 1;
+ }
+ return 0;
+}
+
 static int pmain(lua_State* L)
 {
  int argc=(int)lua_tointeger(L,1);
@@ -181,7 +200,15 @@ static int pmain(lua_State* L)
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
   lua_lock(L);
-  luaU_dump(L,f,writer,D,stripping);
+  if (cname==NULL)
+   luaU_dump(L,f,writer,D,stripping);
+  else
+  {
+   /* chunk must be aligned, so code can be used in place (see lundump.c) */
+   fprintf(D,"static const char %s[] __attribute__((aligned(4))) = {",cname);
+   luaU_dump(L,f,cwriter,D,stripping);
+   fprintf(D,"\n};\n");
+  }
   lua_unlock(L);
   if (ferror(D)) cannot("write");
   if (fclose(D)) cannot("close");
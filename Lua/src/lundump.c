@@ -14,6 +14,7 @@
 
 #include "lua.h"
 
+#include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -33,6 +34,10 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+#if LUA_USE_FROZEN
+  size_t pos;  /* bytes loaded so far */
+  int inplace;  /* chunk outlives its functions, vectors can be used in place */
+#endif
 } LoadState;
 
 
@@ -51,9 +56,40 @@ static l_noret error(LoadState *S, const char *why) {
 static void LoadBlock (LoadState *S, void *b, size_t size) {
   if (luaZ_read(S->Z, b, size) != 0)
     error(S, "truncated");
+#if LUA_USE_FROZEN
+  S->pos += size;
+#endif
+}
+
+
+#if LUA_USE_FROZEN
+/* skip padding added by DumpAlign */
+static void LoadAlign (LoadState *S, size_t size) {
+  char pad[8];
+  LoadBlock(S, pad, (size - S->pos % size) % size);
 }
 
 
+/*
+** Get a vector of 'size' bytes in place, without copying it, if the
+** chunk allows it and the vector is in the current buffer and aligned.
+** Returns NULL otherwise.
+*/
+static void *LoadInPlace (LoadState *S, size_t size, size_t align) {
+  ZIO *Z = S->Z;
+  void *b;
+  if (!S->inplace || size == 0 || Z->n < size ||
+      ((size_t)Z->p % align) != 0)
+    return NULL;
+  b = (void *)Z->p;
+  Z->p += size;
+  Z->n -= size;
+  S->pos += size;
+  return b;
+}
+#endif
+
+
 #define LoadVar(S,x)		LoadVector(S,&x,1)
 
 
@@ -106,9 +142,20 @@ static TString *LoadString (LoadState *S) {
 
 static void LoadCode (LoadState *S, Proto *f) {
   int n = LoadInt(S);
+#if LUA_USE_FROZEN
+  LoadAlign(S, sizeof(Instruction));
+  f->code = (Instruction *)LoadInPlace(S, n * sizeof(Instruction),
+                                       sizeof(Instruction));
+  if (f->code != NULL) {
+    f->sizecode = n;
+    f->frozen |= FROZEN_CODE;
+    return;
+  }
+#endif
   f->code = luaM_newvector(S->L, n, Instruction);
   f->sizecode = n;
   LoadVector(S, f->code, n);
+  luaK_fuse(f);
 }
 
 
@@ -180,9 +227,20 @@ static void LoadUpvalues (LoadState *S, Proto *f) {
 static void LoadDebug (LoadState *S, Proto *f) {
   int i, n;
   n = LoadInt(S);
-  f->lineinfo = luaM_newvector(S->L, n, int);
-  f->sizelineinfo = n;
-  LoadVector(S, f->lineinfo, n);
+#if LUA_USE_FROZEN
+  LoadAlign(S, sizeof(int));
+  f->lineinfo = (int *)LoadInPlace(S, n * sizeof(int), sizeof(int));
+  if (f->lineinfo != NULL) {
+    f->sizelineinfo = n;
+    f->frozen |= FROZEN_LINEINFO;
+  }
+  else
+#endif
+  {
+    f->lineinfo = luaM_newvector(S->L, n, int);
+    f->sizelineinfo = n;
+    LoadVector(S, f->lineinfo, n);
+  }
   n = LoadInt(S);
   f->locvars = luaM_newvector(S->L, n, LocVar);
   f->sizelocvars = n;
@@ -255,7 +313,7 @@ static void checkHeader (LoadState *S) {
 /*
 ** load precompiled chunk
 */
-LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
+LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name, int inplace) {
   LoadState S;
   LClosure *cl;
   if (*name == '@' || *name == '=')
@@ -266,6 +324,12 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+#if LUA_USE_FROZEN
+  S.pos = 1;  /* 1st char already read */
+  S.inplace = inplace;
+#else
+  (void)inplace;
+#endif
   checkHeader(&S);
   cl = luaF_newLclosure(L, LoadByte(&S));
   setclLvalue(L, L->top, cl);
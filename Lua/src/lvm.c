@@ -211,7 +211,10 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
     }
     else {  /* 't' is a table */
       lua_assert(ttisnil(slot));
-      tm = fasttm(L, ttistable(t)?hvalue(t)->metatable:(Table*)luaL_rometatable(rvalue(t)), TM_INDEX);  /* table's metamethod */
+      if (ttistable(t))
+        tm = fasttm(L, hvalue(t)->metatable, TM_INDEX);  /* table's metamethod */
+      else
+        tm = luaT_gettmro(L, rvalue(t), TM_INDEX);  /* rotable's metamethod */
       if (tm == NULL) {  /* no metamethod? */
        setnilvalue(val);  /* result is nil */
         return;
@@ -286,7 +289,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
       lua_assert(ttisnil(slot));  /* old value must be nil */
       tm = fasttm(L, ttistable(t)?h->metatable:(Table*)luaL_rometatable(rvalue(t)), TM_NEWINDEX);  /* get metamethod */
       if (tm == NULL) {  /* no metamethod? */
-    	if (luaR_findglobal(svalue(key), strlen(svalue(key)))) {
+    	if (ttisstring(key) && luaR_findglobal(svalue(key), vslen(key))) {
     		luaG_runerror(L, "attempt to index a rotable value (global 'lora')", svalue(key));
     		return;
     	}
@@ -748,7 +751,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->u.l.base;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = GET_BASEOP(inst);
   switch (op) {  /* finish its execution */
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV:
     case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
@@ -831,8 +834,19 @@ void luaV_finishOp (lua_State *L) {
     if (a != 0) luaF_close(L, ci->u.l.base + a - 1); \
     ci->u.l.savedpc += GETARG_sBx(i) + e; }
 
-/* for test instructions, execute the jump instruction that follows it */
-#define donextjump(ci)	{ i = *ci->u.l.savedpc; dojump(ci, i, 1); }
+/*
+** for test instructions, execute the jump instruction that follows it (a
+** backward jump closes a loop, so it's a safe point for signals too)
+*/
+#define donextjump(ci)	{ i = *ci->u.l.savedpc; dojump(ci, i, 1); \
+  if (GETARG_sBx(i) < 0) checksignal(L); }
+
+/*
+** skip the following jump when 'res' does not match A; otherwise take it
+*/
+#define condjump(res)	{ \
+  if ((res) != GETARG_A(i)) ci->u.l.savedpc++; \
+  else donextjump(ci); }
 
 
 #define Protect(x)	{ {x;}; base = ci->u.l.base; }
@@ -843,6 +857,50 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); }
 
 
+/*
+** check for queued signals at a safe point (see LUA_USE_SAFE_SIGNAL)
+*/
+#define checksignal(L)	Protect(luai_checksignal(L))
+
+
+/*
+** fetch an instruction and prepare its execution
+*/
+#define vmfetch()	{ \
+  i = *(ci->u.l.savedpc++); \
+  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) \
+    Protect(luaG_traceexec(L)); \
+  ra = RA(i); /* WARNING: any stack reallocation invalidates 'ra' */ \
+  lua_assert(base == ci->u.l.base); \
+  lua_assert(base <= L->top && L->top < L->stack + L->stacksize); \
+}
+
+/*
+** superinstructions (see luaK_fuse): fetch the instruction that follows,
+** to run it in place, unless hooks must see it through 'vmfetch'
+*/
+#define fusedfetch()	(!(L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) && \
+  (i = *(ci->u.l.savedpc++), ra = RA(i), 1))
+
+/* run the OP_JMP that follows a fused comparison; it closes no upvalues */
+#define fusedjump(res)	{ \
+  if ((res) != GETARG_A(i)) ci->u.l.savedpc++; \
+  else { int offset = GETARG_sBx(*ci->u.l.savedpc); \
+    ci->u.l.savedpc += offset + 1; \
+    if (offset < 0) checksignal(L); } }
+
+/* step of an integer numeric 'for' loop */
+#define intforloop(ra)	{ \
+  lua_Integer step = ivalue(ra + 2); \
+  lua_Integer idx = intop(+, ivalue(ra), step); /* increment index */ \
+  lua_Integer limit = ivalue(ra + 1); \
+  if ((0 < step) ? (idx <= limit) : (limit <= idx)) { \
+    ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */ \
+    chgivalue(ra, idx);  /* update internal index... */ \
+    setivalue(ra + 3, idx);  /* ...and external index */ \
+    checksignal(L); \
+  } }
+
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l: //printf("%s\r\n",luaP_opnames[l]);
 #define vmbreak		break
@@ -863,28 +921,116 @@ void luaV_finishOp (lua_State *L) {
     Protect(luaV_finishset(L,t,k,v,slot)); }
 
 
+#if LUA_USE_ROTABLE
+/*
+** Inline cache for rotable lookups by a constant key.
+**
+** Libraries live in flash, and are reached through the '__index'
+** metamethod of the global table (luaB_index), that scans 'lua_rotable'
+** on every access. Fields of a rotable are found by a linear scan, too.
+** As the key is a constant of the running function, and rotables are
+** read-only, the entry found can be remembered in a per-constant slot of
+** the prototype. A global defined in RAM shadows a library just by being
+** found first by the raw access to the global table, so a cached library
+** entry never needs to be invalidated; it is only used while the
+** '__index' metamethod of the table is still 'luaB_index'.
+**
+** For a rotable receiver the cache is probed before any scan, so a hit
+** costs no scan at all and a miss scans only once.
+*/
+static ROCache *rocacheslot (lua_State *L, Proto *p, int idx) {
+  if (p->rocache == NULL) {
+    /* call the allocator directly: no emergency collection can move the
+       stack here, and if there is no memory just don't cache */
+    global_State *g = G(L);
+    size_t size = sizeof(ROCache) * p->sizek;
+    p->rocache = cast(ROCache *, (*g->frealloc)(g->ud, NULL, 0, size));
+    if (p->rocache == NULL)
+      return NULL;
+    memset(p->rocache, 0, size);
+    g->GCdebt += size;
+  }
+  return &p->rocache[idx];
+}
+
+
+/*
+** Look up constant 'idx' of 'p' in rotable 'ro', or in the libraries
+** if 'ro' is NULL. Returns NULL if the key is not found.
+*/
+static const TValue *rocacheget (lua_State *L, Proto *p, const void *ro,
+                                 int idx) {
+  const TValue *v;
+  ROCache *c = rocacheslot(L, p, idx);
+  if (c != NULL && c->v != NULL && c->t == ro)
+    return c->v;  /* cache hit */
+  if (ro == NULL)
+    v = luaB_findglobal(svalue(&p->k[idx]), vslen(&p->k[idx]));
+  else {
+    v = luaH_getstr_ro((void *)ro, tsvalue(&p->k[idx]));
+    if (ttisnil(v))
+      v = NULL;
+  }
+  if (v != NULL && c != NULL) {
+    c->t = ro;
+    c->v = v;
+  }
+  return v;
+}
+
+
+/* true if table 't' is indexed by 'luaB_index' (the global table) */
+static int indexedbyglobals (lua_State *L, const TValue *t) {
+  const TValue *tm;
+  lua_assert(ttistable(t));
+  tm = fasttm(L, hvalue(t)->metatable, TM_INDEX);
+  return (tm != NULL && ttislcf(tm) && fvalue(tm) == luaB_index);
+}
+
+
+/*
+** 'gettableProtected' for OP_GETTABUP, OP_GETTABLE and OP_SELF, with a
+** constant string key 'k' (RK index 'rk'): rotables are looked up
+** through the inline cache, and a raw miss on the global table is
+** resolved through it too
+*/
+#define gettableCached(L,t,k,rk,v)  { const TValue *aux, *ro; \
+  if (ttisrotable(t) && ISK(rk) && ttisstring(k)) { \
+    if ((ro = rocacheget(L, cl->p, rvalue(t), INDEXK(rk))) != NULL) \
+      { setobj2s(L, v, ro); } \
+    else {Protect(luaV_finishget(L,t,k,v,luaO_nilobject));} } \
+  else if (luaV_fastget(L,t,k,aux,luaH_get)) { setobj2s(L, v, aux); } \
+  else if (aux != NULL && ISK(rk) && ttisstring(k) && \
+           indexedbyglobals(L, t) && \
+           (ro = rocacheget(L, cl->p, NULL, INDEXK(rk))) != NULL) \
+    { setobj2s(L, v, ro); } \
+  else {Protect(luaV_finishget(L,t,k,v,aux));} }
+#else
+#define gettableCached(L,t,k,rk,v)  gettableProtected(L,t,k,v)
+#endif
+
+
 
 void luaV_execute (lua_State *L) {
   CallInfo *ci = L->ci;
   LClosure *cl;
   TValue *k;
   StkId base;
+  Instruction i;
+  StkId ra;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
   cl = clLvalue(ci->func);  /* local reference to function's closure */
   k = cl->p->k;  /* local reference to function's constant table */
   base = ci->u.l.base;  /* local copy of function's base */
+  checksignal(L);
   /* main loop of interpreter */
   for (;;) {
-    Instruction i = *(ci->u.l.savedpc++);
-    StkId ra;
-    if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))
-      Protect(luaG_traceexec(L));
-    /* WARNING: several calls may realloc the stack and invalidate 'ra' */
-    ra = RA(i);
-    lua_assert(base == ci->u.l.base);
-    lua_assert(base <= L->top && L->top < L->stack + L->stacksize);
+    vmfetch();
     vmdispatch (GET_OPCODE(i)) {
       vmcase(OP_MOVE) {
         setobjs2s(L, ra, RB(i));
@@ -922,13 +1068,13 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_GETTABUP) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v;
         TValue *rc = RKC(i);
-        gettableProtected(L, upval, rc, ra);
+        gettableCached(L, upval, rc, GETARG_C(i), ra);
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
         StkId rb = RB(i);
         TValue *rc = RKC(i);
-        gettableProtected(L, rb, rc, ra);
+        gettableCached(L, rb, rc, GETARG_C(i), ra);
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -962,13 +1108,31 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_SELF) {
         const TValue *aux;
+#if LUA_USE_ROTABLE
+        const TValue *ro;
+#endif
         StkId rb = RB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rc);  /* key must be a string */
         setobjs2s(L, ra + 1, rb);
+#if LUA_USE_ROTABLE
+        if (ttisrotable(rb) && ISK(GETARG_C(i))) {
+          if ((ro = rocacheget(L, cl->p, rvalue(rb), INDEXK(GETARG_C(i)))) != NULL) {
+            setobj2s(L, ra, ro);
+          }
+          else Protect(luaV_finishget(L, rb, rc, ra, luaO_nilobject));
+        }
+        else
+#endif
         if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
           setobj2s(L, ra, aux);
         }
+#if LUA_USE_ROTABLE
+        else if (aux != NULL && ISK(GETARG_C(i)) && indexedbyglobals(L, rb) &&
+                 (ro = rocacheget(L, cl->p, NULL, INDEXK(GETARG_C(i)))) != NULL) {
+          setobj2s(L, ra, ro);
+        }
+#endif
         else Protect(luaV_finishget(L, rb, rc, ra, aux));
         vmbreak;
       }
@@ -1165,35 +1329,43 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_JMP) {
         dojump(ci, i, 0);
+        if (GETARG_sBx(i) < 0)  /* backward jump? */
+          checksignal(L);
         vmbreak;
       }
       vmcase(OP_EQ) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        Protect(
-          if (luaV_equalobj(L, rb, rc) != GETARG_A(i))
-            ci->u.l.savedpc++;
-          else
-            donextjump(ci);
-        )
+        int res;
+        if (ttisinteger(rb) && ttisinteger(rc))  /* fast track for loops */
+          res = (ivalue(rb) == ivalue(rc));
+        else if (ttisfloat(rb) && ttisfloat(rc))
+          res = luai_numeq(fltvalue(rb), fltvalue(rc));
+        else
+          Protect(res = luaV_equalobj(L, rb, rc));
+        condjump(res);
         vmbreak;
       }
       vmcase(OP_LT) {
-        Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) != GETARG_A(i))
-            ci->u.l.savedpc++;
-          else
-            donextjump(ci);
-        )
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        int res;
+        if (ttisnumber(rb) && ttisnumber(rc))  /* no call for numbers */
+          res = LTnum(rb, rc);
+        else
+          Protect(res = luaV_lessthan(L, rb, rc));
+        condjump(res);
         vmbreak;
       }
       vmcase(OP_LE) {
-        Protect(
-          if (luaV_lessequal(L, RKB(i), RKC(i)) != GETARG_A(i))
-            ci->u.l.savedpc++;
-          else
-            donextjump(ci);
-        )
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        int res;
+        if (ttisnumber(rb) && ttisnumber(rc))
+          res = LEnum(rb, rc);
+        else
+          Protect(res = luaV_lessequal(L, rb, rc));
+        condjump(res);
         vmbreak;
       }
       vmcase(OP_TEST) {
@@ -1275,14 +1447,7 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_FORLOOP) {
         if (ttisinteger(ra)) {  /* integer loop? */
-          lua_Integer step = ivalue(ra + 2);
-          lua_Integer idx = intop(+, ivalue(ra), step); /* increment index */
-          lua_Integer limit = ivalue(ra + 1);
-          if ((0 < step) ? (idx <= limit) : (limit <= idx)) {
-            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
-            chgivalue(ra, idx);  /* update internal index... */
-            setivalue(ra + 3, idx);  /* ...and external index */
-          }
+          intforloop(ra);
         }
         else {  /* floating loop */
           lua_Number step = fltvalue(ra + 2);
@@ -1293,6 +1458,7 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgfltvalue(ra, idx);  /* update internal index... */
             setfltvalue(ra + 3, idx);  /* ...and external index */
+            checksignal(L);
           }
         }
         vmbreak;
@@ -1343,6 +1509,7 @@ void luaV_execute (lua_State *L) {
         if (!ttisnil(ra + 1)) {  /* continue loop? */
           setobjs2s(L, ra, ra + 1);  /* save control variable */
            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+           checksignal(L);
         }
         vmbreak;
       }
@@ -1400,6 +1567,76 @@ void luaV_execute (lua_State *L) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_GETTABUPF) {
+        TValue *upval = cl->upvals[GETARG_B(i)]->v;
+        TValue *rc = RKC(i);
+        gettableCached(L, upval, rc, GETARG_C(i), ra);
+        if (fusedfetch()) {  /* OP_GETTABLE */
+          StkId rb = RB(i);
+          rc = RKC(i);
+          gettableCached(L, rb, rc, GETARG_C(i), ra);
+        }
+        vmbreak;
+      }
+      vmcase(OP_ADDFORLOOP) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        lua_Number nb; lua_Number nc;
+        if (ttisinteger(rb) && ttisinteger(rc)) {
+          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
+          setivalue(ra, intop(+, ib, ic));
+        }
+        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
+          setfltvalue(ra, luai_numadd(L, nb, nc));
+        }
+        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_ADD)); }
+        if (fusedfetch()) {  /* OP_FORLOOP */
+          if (ttisinteger(ra))
+            intforloop(ra)
+          else
+            ci->u.l.savedpc--;  /* floating loop: dispatch it */
+        }
+        vmbreak;
+      }
+      vmcase(OP_EQJ) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        int res;
+        if (ttisinteger(rb) && ttisinteger(rc))
+          res = (ivalue(rb) == ivalue(rc));
+        else if (ttisfloat(rb) && ttisfloat(rc))
+          res = luai_numeq(fltvalue(rb), fltvalue(rc));
+        else
+          Protect(res = luaV_equalobj(L, rb, rc));
+        fusedjump(res);
+        vmbreak;
+      }
+      vmcase(OP_LTJ) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        int res;
+        if (ttisinteger(rb) && ttisinteger(rc))
+          res = (ivalue(rb) < ivalue(rc));
+        else if (ttisnumber(rb) && ttisnumber(rc))
+          res = LTnum(rb, rc);
+        else
+          Protect(res = luaV_lessthan(L, rb, rc));
+        fusedjump(res);
+        vmbreak;
+      }
+      vmcase(OP_LEJ) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        int res;
+        if (ttisinteger(rb) && ttisinteger(rc))
+          res = (ivalue(rb) <= ivalue(rc));
+        else if (ttisnumber(rb) && ttisnumber(rc))
+          res = LEnum(rb, rc);
+        else
+          Protect(res = luaV_lessequal(L, rb, rc));
+        fusedjump(res);
+        vmbreak;
+      }
     }
   }
 }
@@ -12,6 +12,10 @@
 #include "lobject.h"
 #include "ltm.h"
 
+#if LUA_USE_ROTABLE
+#include "lrotable.h"
+#endif
+
 
 #if !defined(LUA_NOCVTN2S)
 #define cvt2str(o)	ttisnumber(o)
@@ -61,11 +65,20 @@
    : (slot = f(hvalue(t), k),  /* else, do raw access */  \
       !ttisnil(slot)))  /* result not nil? */
 #else
+/*
+** Rotables have their own tag, so they are dispatched here to the
+** 'f##_ro' counterpart of the raw access function (luaH_get_ro,
+** luaH_getstr_ro, luaH_getint_ro), and RAM tables never pay for
+** checking if they live in flash.
+*/
 #define luaV_fastget(L,t,k,slot,f) \
-  (!(ttistable(t) || ttisrotable(t))  \
-   ? (slot = NULL, 0)  /* not a table; 'slot' is NULL and result is 0 */  \
-   : (slot = f(hvalue(t), k),  /* else, do raw access */  \
-      !ttisnil(slot)))  /* result not nil? */
+  (ttistable(t)  \
+   ? (slot = f(hvalue(t), k),  /* table, do raw access */  \
+      !ttisnil(slot))  /* result not nil? */  \
+   : ttisrotable(t)  \
+   ? (slot = f##_ro(rvalue(t), k),  /* rotable, do raw access */  \
+      !ttisnil(slot))  /* result not nil? */  \
+   : (slot = NULL, 0))  /* not a table; 'slot' is NULL and result is 0 */
 #endif
 
 /*
@@ -148,7 +148,7 @@ driver_error_t *adc_setup(int8_t unit, int8_t channel, uint16_t vref, uint8_t re
 	return NULL;
 }
 
-driver_error_t *adc_read(uint8_t unit, uint8_t channel, int *raw, double *mvols) {
+driver_error_t *adc_read(uint8_t unit, uint8_t channel, int *raw, float *mvols) {
 	switch (unit) {
 		case 1:
 			adc_internal_read(unit, channel, raw);
@@ -175,8 +175,8 @@ driver_error_t *adc_read(uint8_t unit, uint8_t channel, int *raw, double *mvols)
 		}
 	}
 
-	// Convert raw value to millivolts
-	*mvols = ((double)(*raw) * (double)adc_unit[unit].channel[channel].vref) / (double)max_val;
+	// Convert raw value to millivolts, in single precision, that is done by the FPU
+	*mvols = ((float)(*raw) * (float)adc_unit[unit].channel[channel].vref) / (float)max_val;
 
 	return NULL;
 }
@@ -67,6 +67,6 @@ typedef struct {
 
 driver_error_t *adc_device(int8_t unit, int8_t channel, uint8_t *device);
 driver_error_t *adc_setup(int8_t unit, int8_t channel, uint16_t vref, uint8_t resolution);
-driver_error_t *adc_read(uint8_t unit, uint8_t channel, int *raw, double *mvols);
+driver_error_t *adc_read(uint8_t unit, uint8_t channel, int *raw, float *mvols);
 
 #endif	/* ADC_H */
@@ -35,13 +35,14 @@
 #include "lmic.h"
 
 #include "freertos/FreeRTOS.h"
-#include "freertos/timers.h"
-#include "freertos/event_groups.h"
+#include "freertos/task.h"
 
 #include "esp_system.h"
 #include "esp_attr.h"
 #include "soc/gpio_reg.h"
 #include "soc/rtc_cntl_reg.h"
+#include "soc/timer_group_struct.h"
+#include "driver/timer.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -56,8 +57,24 @@
 #include <drivers/lora.h>
 #include <drivers/power_bus.h>
 
+#if CONFIG_LUA_RTOS_LMIC_SIM
+#include <drivers/lmic_sim.h>
+#endif
+
 extern unsigned port_interruptNesting[portNUM_PROCESSORS];
 
+// Task handle for LMIC run loop
+extern TaskHandle_t xRunLoop;
+
+// Hardware timer used for wake up os_runloop at next deadline (timer 0 of group 1),
+// 1 usec resolution
+#define LMIC_TIMER_GROUP TIMER_GROUP_1
+#define LMIC_TIMER_IDX   TIMER_0
+#define LMIC_TIMER_DEV   TIMERG1
+
+// Ticks busy-waited before a target time, to absorb wake up latency
+#define LMIC_SPIN_TICKS  us2osticks(100)
+
 #define DIO_MASK ((1ULL << CONFIG_LUA_RTOS_LMIC_DIO0) | (1ULL << CONFIG_LUA_RTOS_LMIC_DIO1) | (1ULL << CONFIG_LUA_RTOS_LMIC_DIO2))
 #define DIO_MASK_L (DIO_MASK & 0xffffffff)
 #define DIO_MASK_H (DIO_MASK >> 32)
@@ -68,11 +85,7 @@ extern unsigned port_interruptNesting[portNUM_PROCESSORS];
 static struct mtx lmic_hal_mtx;
 
 /*
- * This variables are for doing things only one time.
- *
  * nested is for enable / disable interrupts once.
- * sleeped is for sleep os_runloop once.
- * resumed is for resume os_runloop once.
  *
  * For example, enable / disable interrupts are done as follows:
  *
@@ -80,26 +93,31 @@ static struct mtx lmic_hal_mtx;
  *
  */
 static int nested  = 0;
-static int sleeped = 0;
-static int resumed = 0;
 
 // DIO lines interrupt handler
 static gpio_isr_handle_t dio_handle;
 
- /*
-  * This is an event group handler for sleep / resume os_runloop.
-  * When os_runloop has nothing to do waits for an event.
-  */
- #define evLMIC_SLEEP ( 1 << 0 )
+// DIO edge pending to be handled by os_runloop, and the time it happened
+static portMUX_TYPE dio_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile u1_t dio_pending = 0;
+static volatile u8_t dio_time;
+
+/*
+ * This is the LMIC timer interrupt handler. The timer is armed as a one-shot
+ * alarm for the next deadline, when os_runloop sleeps.
+ */
+static void IRAM_ATTR timer_intr_handler(void *args) {
+	LMIC_TIMER_DEV.int_clr_timers.t0 = 1;
 
- EventGroupHandle_t lmicSleepEvent;
+	hal_resume();
+}
 
 /*
  * This is the LMIC interrupt handler. This interrupt is attached to the transceiver
  * DIO lines. LMIC uses only DIO0, DIO1 and DIO2 lines.
  *
- * When an interrupt is triggered we queue it's processing, setting an LMIC callback, which
- * will be executed in the next iteration of the os_runloop routine.
+ * The interrupt only takes the edge time, and notifies os_runloop, that reads the
+ * transceiver irq flags and the FIFO in hal_io_check, outside of the interrupt.
  *
  */
 static void IRAM_ATTR dio_intr_handler(void *args) {
@@ -114,7 +132,15 @@ static void IRAM_ATTR dio_intr_handler(void *args) {
 	WRITE_PERI_REG(GPIO_STATUS1_W1TC_REG, status_h & DIO_MASK_H);
 
 	if (status_l | status_h) {
-		radio_irq_handler(0);
+		u8_t now = hal_ticks();
+
+		portENTER_CRITICAL_ISR(&dio_mux);
+		if (!dio_pending) {
+			dio_time = now;
+			dio_pending = 1;
+		}
+		portEXIT_CRITICAL_ISR(&dio_mux);
+
 		hal_resume();
 	}
 }
@@ -154,6 +180,12 @@ driver_error_t *lmic_lock_resources(int unit, void *resources) {
 }
 
 driver_error_t *hal_init (void) {
+#if CONFIG_LUA_RTOS_LMIC_SIM
+	// No transceiver, SPI and DIO pins are not used
+	lmic_sim_init();
+
+	syslog(LOG_INFO, "lmic is simulated");
+#else
 	driver_error_t *error;
 
 	// Init SPI bus
@@ -202,13 +234,26 @@ driver_error_t *hal_init (void) {
 		gpio_pin_input(CONFIG_LUA_RTOS_LMIC_DIO2);
 		gpio_set_intr_type(CONFIG_LUA_RTOS_LMIC_DIO2, GPIO_INTR_POSEDGE);
 	#endif
+#endif
+
+	// Init wake up timer, counting usecs from the 80 Mhz APB clock
+	timer_config_t config = {
+		.alarm_en = 0,
+		.counter_en = 0,
+		.intr_type = TIMER_INTR_LEVEL,
+		.counter_dir = TIMER_COUNT_UP,
+		.auto_reload = 0,
+		.divider = 80
+	};
 
-	// Create lmicSleepEvent
-	lmicSleepEvent = xEventGroupCreate();
+	timer_init(LMIC_TIMER_GROUP, LMIC_TIMER_IDX, &config);
+	timer_enable_intr(LMIC_TIMER_GROUP, LMIC_TIMER_IDX);
+	timer_isr_register(LMIC_TIMER_GROUP, LMIC_TIMER_IDX, &timer_intr_handler, NULL, ESP_INTR_FLAG_IRAM, NULL);
 
 	// Create mutex
     mtx_init(&lmic_hal_mtx, NULL, NULL, 0);
 
+#if !CONFIG_LUA_RTOS_LMIC_SIM
 	// Enable DIO interrupts
 	#if CONFIG_LUA_RTOS_LMIC_DIO0
 		gpio_intr_enable(CONFIG_LUA_RTOS_LMIC_DIO0);
@@ -221,6 +266,7 @@ driver_error_t *hal_init (void) {
 	#if CONFIG_LUA_RTOS_LMIC_DIO2
 		gpio_intr_enable(CONFIG_LUA_RTOS_LMIC_DIO2);
 	#endif
+#endif
 
     return NULL;
 }
@@ -229,6 +275,11 @@ driver_error_t *hal_init (void) {
  * drive radio NSS pin (0=low, 1=high).
  */
 void IRAM_ATTR hal_pin_nss (u1_t val) {
+#if CONFIG_LUA_RTOS_LMIC_SIM
+	lmic_sim_nss(val);
+	return;
+#endif
+
     spi_set_cspin(CONFIG_LUA_RTOS_LMIC_SPI, CONFIG_LUA_RTOS_LMIC_CS);
 
     if (!val) {
@@ -249,7 +300,9 @@ void hal_pin_rxtx (u1_t val) {
  * control radio RST pin (0=low, 1=high, 2=floating)
  */
 void hal_pin_rst (u1_t val) {
-	#if CONFIG_LUA_RTOS_USE_POWER_BUS
+	#if CONFIG_LUA_RTOS_LMIC_SIM
+		// The simulated transceiver has nothing to reset
+	#elif CONFIG_LUA_RTOS_USE_POWER_BUS
 		if (val == 1) {
 			esp_intr_disable((intr_handle_t)dio_handle);
 			pwbus_off();
@@ -284,11 +337,72 @@ void hal_pin_rst (u1_t val) {
  *   - read byte and return value
  */
 u1_t IRAM_ATTR hal_spi (u1_t outval) {
+#if CONFIG_LUA_RTOS_LMIC_SIM
+	return lmic_sim_spi(outval);
+#else
 	u1_t readed;
 
 	spi_transfer(CONFIG_LUA_RTOS_LMIC_SPI, outval, &readed);
 
 	return readed;
+#endif
+}
+
+/*
+ * perform a burst SPI transaction with radio, selecting it only once.
+ */
+void IRAM_ATTR hal_spi_write (u1_t addr, const u1_t *buf, u1_t len) {
+#if CONFIG_LUA_RTOS_LMIC_SIM
+	lmic_sim_nss(0);
+	lmic_sim_spi(addr);
+	while (len--) {
+		lmic_sim_spi(*buf++);
+	}
+	lmic_sim_nss(1);
+#else
+	u1_t readed;
+
+	hal_pin_nss(0);
+	spi_transfer(CONFIG_LUA_RTOS_LMIC_SPI, addr, &readed);
+	spi_bulk_write(CONFIG_LUA_RTOS_LMIC_SPI, len, (unsigned char *)buf);
+	hal_pin_nss(1);
+#endif
+}
+
+void IRAM_ATTR hal_spi_read (u1_t addr, u1_t *buf, u1_t len) {
+#if CONFIG_LUA_RTOS_LMIC_SIM
+	lmic_sim_nss(0);
+	lmic_sim_spi(addr);
+	while (len--) {
+		*buf++ = lmic_sim_spi(0x00);
+	}
+	lmic_sim_nss(1);
+#else
+	u1_t readed;
+
+	hal_pin_nss(0);
+	spi_transfer(CONFIG_LUA_RTOS_LMIC_SPI, addr, &readed);
+	spi_bulk_read(CONFIG_LUA_RTOS_LMIC_SPI, len, buf);
+	hal_pin_nss(1);
+#endif
+}
+
+/*
+ * Handle a DIO edge signaled by dio_intr_handler, in the os_runloop task.
+ */
+void hal_io_check (void) {
+	u8_t time;
+
+	if (!dio_pending) {
+		return;
+	}
+
+	portENTER_CRITICAL(&dio_mux);
+	time = dio_time;
+	dio_pending = 0;
+	portEXIT_CRITICAL(&dio_mux);
+
+	radio_irq_handler(0, time);
 }
 
 void IRAM_ATTR hal_disableIRQs (void) {
@@ -323,49 +437,45 @@ void IRAM_ATTR hal_enableIRQs (void) {
 	}
 }
 
+/*
+ * Wake up os_runloop, that is notified through it's task notification value.
+ */
 void IRAM_ATTR hal_resume (void) {
-	int resume = 0;
-
-	mtx_lock(&lmic_hal_mtx);
-
-	if (resumed == 0) {
-		resumed = 1;
-		resume  = 1;
+	if (!xRunLoop) {
+		return;
 	}
 
-	mtx_unlock(&lmic_hal_mtx);
-
-	if (resume) {
+	if (port_interruptNesting[xPortGetCoreID()] != 0) {
 		BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
-		if (port_interruptNesting[xPortGetCoreID()] != 0) {
-			xEventGroupSetBitsFromISR(lmicSleepEvent, evLMIC_SLEEP, &xHigherPriorityTaskWoken);
-		} else {
-			xEventGroupSetBits(lmicSleepEvent, evLMIC_SLEEP);
+		vTaskNotifyGiveFromISR(xRunLoop, &xHigherPriorityTaskWoken);
+		if (xHigherPriorityTaskWoken) {
+			portYIELD_FROM_ISR();
 		}
+	} else {
+		xTaskNotifyGive(xRunLoop);
 	}
 }
 
 void hal_sleep (void) {
-	int sleep = 0;
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
 
-	mtx_lock(&lmic_hal_mtx);
+void hal_sleepUntil (u8_t time) {
+	s8_t delta = (s8_t)(time - hal_ticks());
 
-	if (sleeped == 0) {
-		sleeped = 1;
-		sleep   = 1;
+	if (delta <= 0) {
+		return;
 	}
 
-	mtx_unlock(&lmic_hal_mtx);
+	// Arm a one-shot alarm for target time
+	timer_pause(LMIC_TIMER_GROUP, LMIC_TIMER_IDX);
+	timer_set_counter_value(LMIC_TIMER_GROUP, LMIC_TIMER_IDX, 0);
+	timer_set_alarm_value(LMIC_TIMER_GROUP, LMIC_TIMER_IDX, delta * US_PER_OSTICK);
+	timer_set_alarm(LMIC_TIMER_GROUP, LMIC_TIMER_IDX, TIMER_ALARM_EN);
+	timer_start(LMIC_TIMER_GROUP, LMIC_TIMER_IDX);
 
-	if (sleep) {
-		xEventGroupWaitBits(lmicSleepEvent, evLMIC_SLEEP, pdTRUE, pdFALSE, portMAX_DELAY);
-
-		mtx_lock(&lmic_hal_mtx);
-		sleeped = 0;
-		resumed = 0;
-		mtx_unlock(&lmic_hal_mtx);
-	}
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 }
 
 /*
@@ -406,12 +516,19 @@ static u1_t is_close(u8_t target) {
 }
 
 /*
- * busy-wait until specified timestamp (in ticks) is reached.
+ * wait until specified timestamp (in ticks) is reached.
+ *
+ * os_runloop sleeps until LMIC_SPIN_TICKS before target time, and then
+ * busy-waits. Other tasks only busy-wait.
  */
 void hal_waitUntil (u8_t time) {
-    while (!is_close(time)) {
-    	udelay(1);
-    }
+	if (xTaskGetCurrentTaskHandle() == xRunLoop) {
+		while ((s8_t)(time - hal_ticks()) > LMIC_SPIN_TICKS) {
+			hal_sleepUntil(time - LMIC_SPIN_TICKS);
+		}
+	}
+
+    while (!is_close(time));
 }
 
 /*
@@ -429,7 +546,7 @@ u1_t hal_checkTimer (u8_t targettime) {
  *   - action could be HALT or reboot
  */
 void hal_failed (char *file, int line) {
-	syslog(LOG_ERR, "%lu: assert at %s, line %s\n", (u4_t)os_getTime(), file, line);
+	syslog(LOG_ERR, "%lu: assert at %s, line %d\n", (u4_t)os_getTime(), file, line);
 
 	for(;;);
 }
@@ -0,0 +1,800 @@
+/*
+ * Lua RTOS, LMIC simulated SX127x radio
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * This is a simulated SX1276 / SX1272 LoRa transceiver, attached to the LMIC
+ * stack instead of the SPI bus and the DIO lines, and a simulated network
+ * server, that answers to the frames sent by the transceiver. It allows to
+ * run the LoRa WAN MAC (join, rx windows timing, confirmed uplinks, duty
+ * cycle, ...) without a transceiver.
+ *
+ * The transceiver is modeled at the register level: register file, FIFO,
+ * operating modes, and irq flags. Transmissions and receptions take the
+ * time on air computed by calcAirTime, and raise the irq flags as a real
+ * transceiver does. Irqs are delivered as LMIC jobs, in the LMIC task, with
+ * the time the DIO edge would have happened.
+ *
+ * The network server answers join requests with a join accept, and confirmed
+ * uplinks with an ACK, in the RX1 window, or in the RX2 window if configured
+ * with lmic_sim_config. A downlink is received only if the rx window is open
+ * at the right frequency and spreading factor when the downlink preamble
+ * arrives. The network server keeps its own state, as a real one: it derives
+ * the session keys from the join, and tracks the uplink frame counter, so
+ * retransmissions are answered again and replays are rejected. Uplinks and
+ * downlinks can be lost on purpose, to make the device retransmit. It has
+ * its own AES and CMAC, so it doesn't agree with the device by sharing code.
+ *
+ * Only the LoRa modem is simulated.
+ */
+
+#include "luartos.h"
+
+#if LUA_USE_LORA
+#if CONFIG_LUA_RTOS_USE_LMIC
+#if CONFIG_LUA_RTOS_LMIC_SIM
+
+#include "lmic.h"
+#include "lmic_sim.h"
+
+#include <string.h>
+
+#include <sys/syslog.h>
+
+// Registers, as in radio.c
+#define RegFifo                  0x00
+#define RegOpMode                0x01
+#define RegFrfMsb                0x06
+#define RegFrfMid                0x07
+#define RegFrfLsb                0x08
+#define LORARegFifoAddrPtr       0x0D
+#define LORARegFifoTxBaseAddr    0x0E
+#define LORARegFifoRxBaseAddr    0x0F
+#define LORARegFifoRxCurrentAddr 0x10
+#define LORARegIrqFlagsMask      0x11
+#define LORARegIrqFlags          0x12
+#define LORARegRxNbBytes         0x13
+#define LORARegPktSnrValue       0x19
+#define LORARegPktRssiValue      0x1A
+#define LORARegRssiValue         0x1B
+#define LORARegModemConfig1      0x1D
+#define LORARegModemConfig2      0x1E
+#define LORARegSymbTimeoutLsb    0x1F
+#define LORARegPayloadLength     0x22
+#define LORARegRssiWideband      0x2C
+#define RegVersion               0x42
+
+#define OPMODE_LORA      0x80
+#define OPMODE_MASK      0x07
+#define OPMODE_SLEEP     0x00
+#define OPMODE_STANDBY   0x01
+#define OPMODE_TX        0x03
+#define OPMODE_RX        0x05
+#define OPMODE_RX_SINGLE 0x06
+
+#define IRQ_LORA_RXTOUT_MASK 0x80
+#define IRQ_LORA_RXDONE_MASK 0x40
+#define IRQ_LORA_TXDONE_MASK 0x08
+
+// Symbols of the downlink preamble that the receiver needs to lock
+#define SIM_PREAMBLE_LOCK 4
+
+// Length of the MIC field
+#define SIM_MIC_LEN 4
+
+static struct {
+	u1_t regs[128];
+	u1_t fifo[256];
+
+	// Current SPI transaction
+	u1_t addr;
+	u1_t write;
+	u1_t first;
+
+	u4_t rand;
+
+	// Pending transceiver irq, delivered by job
+	osjob_t job;
+	u1_t irq;
+
+	// Network server
+	u1_t dl[MAX_LEN_FRAME];
+	u1_t dllen;
+	ostime_t dldue;      // time the downlink preamble starts
+	u4_t dlfreq;
+	rps_t dlrps;
+	u1_t nwkskey[16];
+	u1_t appskey[16];
+	u4_t devaddr;
+	u4_t fcntup;         // last uplink counter accepted
+	u1_t fcntupvalid;    // an uplink was accepted in this session
+	u4_t fcntdown;
+	u4_t dlcount;        // downlinks sent, to choose the RX2 and lost ones
+	u4_t ulcount;        // uplinks received, to choose the lost ones
+
+	lmic_sim_config_t config;
+	lmic_sim_stats_t stats;
+} sim;
+
+static u1_t sbox[256];
+static u1_t isbox[256];
+
+/*
+ * Utility functions
+ */
+
+static u1_t sim_rand() {
+	// xorshift
+	sim.rand ^= sim.rand << 13;
+	sim.rand ^= sim.rand >> 17;
+	sim.rand ^= sim.rand << 5;
+
+	return (u1_t)sim.rand;
+}
+
+static u1_t xtime(u1_t x) {
+	return (x << 1) ^ ((x & 0x80) ? 0x1b : 0x00);
+}
+
+static u1_t gmul(u1_t a, u1_t b) {
+	u1_t r = 0;
+
+	while (b) {
+		if (b & 1) r ^= a;
+		a = xtime(a);
+		b >>= 1;
+	}
+
+	return r;
+}
+
+// Build the AES S-box and it's inverse
+static void sim_aes_init() {
+	u1_t p = 1, q = 1, x;
+
+	do {
+		// Multiply p by 3, divide q by 3
+		p = p ^ xtime(p);
+		q ^= q << 1;
+		q ^= q << 2;
+		q ^= q << 4;
+		if (q & 0x80) q ^= 0x09;
+
+		x = q ^ ((q << 1) | (q >> 7)) ^ ((q << 2) | (q >> 6)) ^ ((q << 3) | (q >> 5)) ^ ((q << 4) | (q >> 4));
+		sbox[p] = x ^ 0x63;
+	} while (p != 1);
+
+	sbox[0] = 0x63;
+
+	for(x = 0;; x++) {
+		isbox[sbox[x]] = x;
+		if (x == 255) break;
+	}
+}
+
+// AES key expansion
+static void sim_aes_keys(xref2cu1_t key, u1_t *rk) {
+	u1_t t[4];
+	u1_t rcon = 1;
+	int i, j;
+
+	memcpy(rk, key, 16);
+	for(i = 16; i < 176; i += 4) {
+		memcpy(t, rk + i - 4, 4);
+		if (i % 16 == 0) {
+			u1_t t0 = t[0];
+
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[t0];
+			rcon = xtime(rcon);
+		}
+
+		for(j = 0; j < 4; j++) {
+			rk[i + j] = rk[i - 16 + j] ^ t[j];
+		}
+	}
+}
+
+// AES encryption of one block, for the session keys and the MICs
+static void sim_aes_encrypt(xref2cu1_t key, xref2u1_t b) {
+	u1_t rk[176];
+	u1_t t[16];
+	int i, round;
+
+	sim_aes_keys(key, rk);
+
+	for(i = 0; i < 16; i++) {
+		b[i] ^= rk[i];
+	}
+
+	for(round = 1; round <= 10; round++) {
+		// Sub bytes and shift rows
+		for(i = 0; i < 16; i++) {
+			t[i] = sbox[b[(i & 3) + 4 * (((i >> 2) + (i & 3)) & 3)]];
+		}
+
+		if (round < 10) {
+			// Mix columns
+			for(i = 0; i < 16; i += 4) {
+				b[i + 0] = xtime(t[i]) ^ xtime(t[i + 1]) ^ t[i + 1] ^ t[i + 2] ^ t[i + 3];
+				b[i + 1] = t[i] ^ xtime(t[i + 1]) ^ xtime(t[i + 2]) ^ t[i + 2] ^ t[i + 3];
+				b[i + 2] = t[i] ^ t[i + 1] ^ xtime(t[i + 2]) ^ xtime(t[i + 3]) ^ t[i + 3];
+				b[i + 3] = xtime(t[i]) ^ t[i] ^ t[i + 1] ^ t[i + 2] ^ xtime(t[i + 3]);
+			}
+		} else {
+			memcpy(b, t, 16);
+		}
+
+		for(i = 0; i < 16; i++) {
+			b[i] ^= rk[round * 16 + i];
+		}
+	}
+}
+
+/*
+ * AES decryption of one block. The network server encrypts join accepts
+ * with AES decrypt, so the end-device only needs AES encrypt.
+ */
+static void sim_aes_decrypt(xref2cu1_t key, xref2u1_t b) {
+	u1_t rk[176];
+	u1_t t[16];
+	int i, round;
+
+	sim_aes_keys(key, rk);
+
+	for(i = 0; i < 16; i++) {
+		b[i] ^= rk[160 + i];
+	}
+
+	for(round = 9; round >= 0; round--) {
+		// Inverse shift rows and sub bytes
+		for(i = 0; i < 16; i++) {
+			t[(i & 3) + 4 * (((i >> 2) + (i & 3)) & 3)] = isbox[b[i]];
+		}
+
+		for(i = 0; i < 16; i++) {
+			b[i] = t[i] ^ rk[round * 16 + i];
+		}
+
+		if (round > 0) {
+			// Inverse mix columns
+			for(i = 0; i < 16; i += 4) {
+				memcpy(t, b + i, 4);
+				b[i + 0] = gmul(t[0], 14) ^ gmul(t[1], 11) ^ gmul(t[2], 13) ^ gmul(t[3], 9);
+				b[i + 1] = gmul(t[0], 9) ^ gmul(t[1], 14) ^ gmul(t[2], 11) ^ gmul(t[3], 13);
+				b[i + 2] = gmul(t[0], 13) ^ gmul(t[1], 9) ^ gmul(t[2], 14) ^ gmul(t[3], 11);
+				b[i + 3] = gmul(t[0], 11) ^ gmul(t[1], 13) ^ gmul(t[2], 9) ^ gmul(t[3], 14);
+			}
+		}
+	}
+}
+
+// CMAC subkey, k = l << 1, xored with Rb if the msb of l is set
+static void sim_cmac_subkey(u1_t *k, const u1_t *l) {
+	int i;
+
+	for(i = 0; i < 16; i++) {
+		k[i] = (l[i] << 1) | ((i < 15) ? (l[i + 1] >> 7) : 0);
+	}
+
+	if (l[0] & 0x80) {
+		k[15] ^= 0x87;
+	}
+}
+
+// AES-CMAC (RFC 4493) of b0 (if not NULL) followed by len bytes of buf,
+// first 4 bytes in MSBF
+static u4_t sim_cmac(xref2cu1_t key, xref2cu1_t b0, xref2cu1_t buf, int len) {
+	u1_t msg[32 + MAX_LEN_FRAME];
+	u1_t k1[16], k2[16], x[16];
+	int i, n, last;
+
+	n = 0;
+	if (b0) {
+		memcpy(msg, b0, 16);
+		n = 16;
+	}
+
+	memcpy(msg + n, buf, len);
+	n += len;
+
+	// Subkeys
+	memset(x, 0, sizeof(x));
+	sim_aes_encrypt(key, x);
+	sim_cmac_subkey(k1, x);
+	sim_cmac_subkey(k2, k1);
+
+	// Last block, xored with K1 if complete, padded and xored with K2 if not
+	last = (n > 0) ? (n - 1) & ~15 : 0;
+	if ((n > 0) && (n % 16 == 0)) {
+		for(i = 0; i < 16; i++) {
+			msg[last + i] ^= k1[i];
+		}
+	} else {
+		msg[n] = 0x80;
+		for(i = n + 1; i < last + 16; i++) {
+			msg[i] = 0;
+		}
+
+		for(i = 0; i < 16; i++) {
+			msg[last + i] ^= k2[i];
+		}
+	}
+
+	memset(x, 0, sizeof(x));
+	for(n = 0; n <= last; n += 16) {
+		for(i = 0; i < 16; i++) {
+			x[i] ^= msg[n + i];
+		}
+
+		sim_aes_encrypt(key, x);
+	}
+
+	return os_rmsbf4(x);
+}
+
+// MIC of a data frame
+static u4_t sim_mic(xref2cu1_t key, int dndir, u4_t devaddr, u4_t fcnt, xref2cu1_t buf, int len) {
+	u1_t b0[16];
+
+	memset(b0, 0, sizeof(b0));
+	b0[0] = 0x49;
+	b0[5] = dndir ? 1 : 0;
+	os_wlsbf4(b0 + 6, devaddr);
+	os_wlsbf4(b0 + 10, fcnt);
+	b0[15] = len;
+
+	return sim_cmac(key, b0, buf, len);
+}
+
+/*
+ * Transceiver state, as set in registers
+ */
+
+static u4_t sim_freq() {
+	u4_t frf = (sim.regs[RegFrfMsb] << 16) | (sim.regs[RegFrfMid] << 8) | sim.regs[RegFrfLsb];
+
+	return (u4_t)(((uint64_t)frf * 32000000) >> 19);
+}
+
+// Frequency as the radio tunes it, on the synthesizer grid
+static u4_t sim_grid(u4_t freq) {
+	u4_t frf = (u4_t)(((uint64_t)freq << 19) / 32000000);
+
+	return (u4_t)(((uint64_t)frf * 32000000) >> 19);
+}
+
+static rps_t sim_rps() {
+	sf_t sf = (sf_t)((sim.regs[LORARegModemConfig2] >> 4) - 6);
+	bw_t bw;
+
+#ifdef CFG_sx1276_radio
+	bw = (bw_t)((sim.regs[LORARegModemConfig1] >> 4) - 7);
+#else
+	bw = (bw_t)(sim.regs[LORARegModemConfig1] >> 6);
+#endif
+
+	return makeRps(sf, bw, CR_4_5, 0, 0);
+}
+
+// Symbol time in ticks
+static ostime_t sim_symbol(rps_t rps) {
+	static const u4_t bws[] = {125000, 250000, 500000, 500000};
+
+	return us2osticks(((u8_t)1000000 << (getSf(rps) + 6)) / bws[getBw(rps)]);
+}
+
+// Raise irq flags at given time
+static void sim_irq(osjob_t *job);
+
+static void sim_raise(ostime_t time, u1_t irq) {
+	sim.irq = irq;
+	os_setTimedCallback(&sim.job, time, sim_irq);
+}
+
+static void sim_irq(osjob_t *job) {
+	sim.regs[LORARegIrqFlags] |= sim.irq;
+	sim.regs[RegOpMode] = (sim.regs[RegOpMode] & ~OPMODE_MASK) | OPMODE_STANDBY;
+
+	if (sim.irq & ~sim.regs[LORARegIrqFlagsMask]) {
+		// The DIO edge happened at the job deadline
+		radio_irq_handler((sim.irq & IRQ_LORA_RXTOUT_MASK) ? 1 : 0, job->deadline);
+	}
+}
+
+/*
+ * Network server
+ */
+
+// Send a downlink in the RX1 window, or in RX2 every config.rx2 downlinks.
+// Every config.dnloss downlinks one is lost.
+static void ns_downlink(xref2cu1_t frame, int len, ostime_t rx1, u4_t freq, rps_t rps) {
+	sim.dlcount++;
+
+	if (sim.config.dnloss && (sim.dlcount % sim.config.dnloss == 0)) {
+		sim.stats.lost++;
+		return;
+	}
+
+	memcpy(sim.dl, frame, len);
+	sim.dllen = len;
+
+	if (sim.config.rx2 && (sim.dlcount % sim.config.rx2 == 0)) {
+		// RX2, at a fixed frequency and data rate, one second after RX1
+		sim.dldue = rx1 + sec2osticks(DELAY_EXTDNW2);
+		sim.dlfreq = sim_grid(FREQ_DNW2);
+		sim.dlrps = setNocrc(dndr2rps(DR_DNW2), 1);
+		sim.stats.rx2++;
+
+		return;
+	}
+
+	sim.dldue = rx1;
+
+#if CFG_us915
+	// RX1 is at 500 Khz downlink channel (uplink channel % 8)
+	int chnl;
+
+	if (getBw(rps) == BW500) {
+		chnl = (freq - US915_500kHz_UPFBASE) / US915_500kHz_UPFSTEP;
+		rps = setSf(rps, SF7);
+	} else {
+		chnl = (freq - US915_125kHz_UPFBASE) / US915_125kHz_UPFSTEP;
+	}
+
+	freq = US915_500kHz_DNFBASE + (chnl % 8) * US915_500kHz_DNFSTEP;
+	rps = setBw(rps, BW500);
+#endif
+
+	sim.dlfreq = freq;
+	sim.dlrps = setNocrc(rps, 1);
+}
+
+static void ns_join(xref2cu1_t frame, int len, ostime_t end, u4_t freq, rps_t rps) {
+	u1_t appkey[16];
+	u1_t jacc[LEN_JA];
+	int i;
+
+	os_getDevKey(appkey);
+
+	if ((len != LEN_JR) || (sim_cmac(appkey, NULL, frame, OFF_JR_MIC) != os_rmsbf4(frame + OFF_JR_MIC))) {
+		sim.stats.badmic++;
+		return;
+	}
+
+	// Build join accept, that assigns a new device address, with the RX2
+	// data rate of the network server
+	memset(jacc, 0, sizeof(jacc));
+	jacc[OFF_JA_HDR] = HDR_FTYPE_JACC | HDR_MAJOR_V1;
+	for(i = 0; i < LEN_ARTNONCE; i++) {
+		jacc[OFF_JA_ARTNONCE + i] = sim_rand();
+	}
+	os_wlsbf4(jacc + OFF_JA_NETID, 0x000013);
+	sim.devaddr = 0x26000000 | (sim.rand & 0xffff);
+	os_wlsbf4(jacc + OFF_JA_DEVADDR, sim.devaddr);
+	jacc[OFF_JA_DLSET] = DR_DNW2;
+	jacc[OFF_JA_RXDLY] = DELAY_DNW1;
+
+	// Session keys, from AppNonce, NetID and DevNonce
+	memset(sim.nwkskey, 0, 16);
+	sim.nwkskey[0] = 0x01;
+	memcpy(sim.nwkskey + 1, jacc + OFF_JA_ARTNONCE, LEN_ARTNONCE + LEN_NETID);
+	memcpy(sim.nwkskey + 1 + LEN_ARTNONCE + LEN_NETID, frame + OFF_JR_DEVNONCE, 2);
+	memcpy(sim.appskey, sim.nwkskey, 16);
+	sim.appskey[0] = 0x02;
+
+	sim_aes_encrypt(appkey, sim.nwkskey);
+	sim_aes_encrypt(appkey, sim.appskey);
+
+	os_wmsbf4(jacc + LEN_JA - SIM_MIC_LEN, sim_cmac(appkey, NULL, jacc, LEN_JA - SIM_MIC_LEN));
+
+	// Encrypted with AES decrypt
+	sim_aes_decrypt(appkey, jacc + 1);
+
+	// Frame counters start again with the new session
+	sim.fcntup = 0;
+	sim.fcntupvalid = 0;
+	sim.fcntdown = 0;
+	sim.stats.joins++;
+
+	ns_downlink(jacc, LEN_JA, end + sec2osticks(DELAY_JACC1), freq, rps);
+}
+
+static void ns_data(xref2cu1_t frame, int len, ostime_t end, u4_t freq, rps_t rps) {
+	u1_t dn[OFF_DAT_OPTS + SIM_MIC_LEN];
+	u4_t devaddr;
+	u4_t fcnt;
+	u1_t ftype = frame[OFF_DAT_HDR] & HDR_FTYPE;
+
+	if (len < OFF_DAT_OPTS + SIM_MIC_LEN) {
+		sim.stats.badmic++;
+		return;
+	}
+
+	devaddr = os_rlsbf4(frame + OFF_DAT_ADDR);
+	if (devaddr != sim.devaddr) {
+		sim.stats.badmic++;
+		return;
+	}
+
+	// Only the lower 16 bits of the counter are sent. The upper ones are the
+	// ones of the last counter accepted, or the next ones if it rolled over.
+	fcnt = (sim.fcntup & 0xffff0000) | os_rlsbf2(frame + OFF_DAT_SEQNO);
+	if (sim.fcntupvalid && ((s4_t)(fcnt - sim.fcntup) < 0)) {
+		fcnt += 0x10000;
+	}
+
+	if (sim_mic(sim.nwkskey, 0, devaddr, fcnt, frame, len - SIM_MIC_LEN) != os_rmsbf4(frame + len - SIM_MIC_LEN)) {
+		sim.stats.badmic++;
+		return;
+	}
+
+	if (sim.fcntupvalid && (fcnt == sim.fcntup)) {
+		// Retransmission, confirmed uplinks are answered again
+		sim.stats.retries++;
+	} else if (sim.fcntupvalid && ((s4_t)(fcnt - sim.fcntup) < 0)) {
+		sim.stats.badfcnt++;
+		return;
+	}
+
+	sim.fcntup = fcnt;
+	sim.fcntupvalid = 1;
+
+	// Answer confirmed uplinks and ADR ACK requests
+	if ((ftype != HDR_FTYPE_DCUP) && !(frame[OFF_DAT_FCT] & FCT_ADRARQ)) {
+		return;
+	}
+
+	dn[OFF_DAT_HDR] = HDR_FTYPE_DADN | HDR_MAJOR_V1;
+	os_wlsbf4(dn + OFF_DAT_ADDR, devaddr);
+	dn[OFF_DAT_FCT] = (ftype == HDR_FTYPE_DCUP) ? FCT_ACK : 0;
+	os_wlsbf2(dn + OFF_DAT_SEQNO, sim.fcntdown);
+	os_wmsbf4(dn + OFF_DAT_OPTS, sim_mic(sim.nwkskey, 1, devaddr, sim.fcntdown, dn, OFF_DAT_OPTS));
+	sim.fcntdown++;
+
+	ns_downlink(dn, sizeof(dn), end + sec2osticks(DELAY_DNW1), freq, rps);
+}
+
+// Every config.ulloss uplinks one is not received by the network server
+static void ns_uplink(xref2cu1_t frame, int len, ostime_t end, u4_t freq, rps_t rps) {
+	sim.ulcount++;
+
+	if (sim.config.ulloss && (sim.ulcount % sim.config.ulloss == 0)) {
+		sim.stats.lost++;
+		return;
+	}
+
+	switch (frame[0] & HDR_FTYPE) {
+		case HDR_FTYPE_JREQ:
+			ns_join(frame, len, end, freq, rps);
+			break;
+
+		case HDR_FTYPE_DAUP:
+		case HDR_FTYPE_DCUP:
+			ns_data(frame, len, end, freq, rps);
+			break;
+	}
+}
+
+/*
+ * Transceiver operations
+ */
+
+static void sim_tx(ostime_t now) {
+	u1_t len = sim.regs[LORARegPayloadLength];
+	u1_t *frame = sim.fifo + sim.regs[LORARegFifoTxBaseAddr];
+	rps_t rps = sim_rps();
+	ostime_t air = calcAirTime(rps, len);
+
+	sim.stats.uplinks++;
+	sim.stats.airtime += air;
+
+	ns_uplink(frame, len, now + air, sim_freq(), rps);
+
+	sim_raise(now + air, IRQ_LORA_TXDONE_MASK);
+}
+
+static void sim_rx(ostime_t now) {
+	rps_t rps = sim_rps();
+	ostime_t sym = sim_symbol(rps);
+	ostime_t timeout = now + (sim.regs[LORARegSymbTimeoutLsb] | ((sim.regs[LORARegModemConfig2] & 0x03) << 8)) * sym;
+	u1_t base = sim.regs[LORARegFifoRxBaseAddr];
+	s4_t offset;
+
+	if (sim.dllen) {
+		// Receiver must be listening before the end of the preamble lock,
+		// at the downlink frequency and data rate
+		if ((sim.dlfreq == sim_freq()) &&
+			(getSf(sim.dlrps) == getSf(rps)) && (getBw(sim.dlrps) == getBw(rps)) &&
+			((s8_t)(now - (sim.dldue + SIM_PREAMBLE_LOCK * sym)) <= 0) && ((s8_t)(timeout - sim.dldue) >= 0)) {
+
+			memcpy(sim.fifo + base, sim.dl, sim.dllen);
+			sim.regs[LORARegFifoRxCurrentAddr] = base;
+			sim.regs[LORARegRxNbBytes] = sim.dllen;
+			sim.regs[LORARegPktSnrValue] = 8 * 4;
+			sim.regs[LORARegPktRssiValue] = 125 - 64 - 60;
+
+			offset = (s4_t)(now - sim.dldue);
+			if (!sim.stats.downlinks || (offset > sim.stats.rxmaxoffset)) {
+				sim.stats.rxmaxoffset = offset;
+			}
+			if (!sim.stats.downlinks || (offset < sim.stats.rxminoffset)) {
+				sim.stats.rxminoffset = offset;
+			}
+			sim.stats.rxsumoffset += offset;
+			sim.stats.downlinks++;
+
+			sim_raise(sim.dldue + calcAirTime(sim.dlrps, sim.dllen), IRQ_LORA_RXDONE_MASK);
+			sim.dllen = 0;
+			return;
+		}
+
+		if ((s8_t)(timeout - sim.dldue) >= 0) {
+			// This was the window for the downlink
+			syslog(LOG_DEBUG, "lmic sim: downlink missed, window opened %ld ticks before downlink\n", (long)(sim.dldue - now));
+			sim.stats.missed++;
+			sim.dllen = 0;
+		}
+	}
+
+	sim_raise(timeout, IRQ_LORA_RXTOUT_MASK);
+}
+
+static void sim_opmode(u1_t mode) {
+	u1_t old = sim.regs[RegOpMode];
+
+	sim.regs[RegOpMode] = mode;
+
+	if (!(mode & OPMODE_LORA) || ((old & OPMODE_MASK) == (mode & OPMODE_MASK))) {
+		return;
+	}
+
+	switch (mode & OPMODE_MASK) {
+		case OPMODE_TX:
+			sim_tx(os_getTime());
+			break;
+
+		case OPMODE_RX_SINGLE:
+			sim_rx(os_getTime());
+			break;
+
+		case OPMODE_SLEEP:
+		case OPMODE_STANDBY:
+			// Abort current operation
+			os_clearCallback(&sim.job);
+			break;
+	}
+}
+
+static u1_t sim_read(u1_t addr) {
+	switch (addr) {
+		case RegFifo:
+			return sim.fifo[sim.regs[LORARegFifoAddrPtr]++];
+
+		case LORARegRssiWideband:
+			return sim_rand();
+
+		case LORARegRssiValue:
+			return 40 + (sim_rand() & 0x07);
+
+		default:
+			return sim.regs[addr];
+	}
+}
+
+static void sim_write(u1_t addr, u1_t val) {
+	switch (addr) {
+		case RegFifo:
+			sim.fifo[sim.regs[LORARegFifoAddrPtr]++] = val;
+			break;
+
+		case RegOpMode:
+			sim_opmode(val);
+			break;
+
+		case LORARegIrqFlags:
+			// Write 1 to clear
+			sim.regs[addr] &= ~val;
+			break;
+
+		case RegVersion:
+			break;
+
+		default:
+			sim.regs[addr] = val;
+	}
+}
+
+/*
+ * HAL interface
+ */
+
+void lmic_sim_init() {
+	memset(&sim, 0, sizeof(sim));
+
+#ifdef CFG_sx1276_radio
+	sim.regs[RegVersion] = 0x12;
+#else
+	sim.regs[RegVersion] = 0x22;
+#endif
+	sim.regs[LORARegIrqFlagsMask] = 0xff;
+	sim.rand = 0x2545f491;
+
+	sim_aes_init();
+}
+
+void lmic_sim_nss(u1_t val) {
+	if (!val) {
+		// Start of transaction, first byte is the address
+		sim.first = 1;
+	}
+}
+
+u1_t lmic_sim_spi(u1_t outval) {
+	u1_t res = 0;
+
+	if (sim.first) {
+		sim.first = 0;
+		sim.addr = outval & 0x7f;
+		sim.write = outval & 0x80;
+
+		return 0;
+	}
+
+	if (sim.write) {
+		sim_write(sim.addr, outval);
+	} else {
+		res = sim_read(sim.addr);
+	}
+
+	// Burst access, FIFO address doesn't increment
+	if (sim.addr != RegFifo) {
+		sim.addr = (sim.addr + 1) & 0x7f;
+	}
+
+	return res;
+}
+
+void lmic_sim_config(const lmic_sim_config_t *config) {
+	hal_disableIRQs();
+	sim.config = *config;
+	hal_enableIRQs();
+}
+
+void lmic_sim_get_stats(lmic_sim_stats_t *stats) {
+	hal_disableIRQs();
+	*stats = sim.stats;
+	hal_enableIRQs();
+}
+
+#endif
+#endif
+#endif
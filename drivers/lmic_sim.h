@@ -0,0 +1,76 @@
+/*
+ * Lua RTOS, LMIC simulated SX127x radio
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+#ifndef LMIC_SIM_H
+#define LMIC_SIM_H
+
+#include "luartos.h"
+
+#if LUA_USE_LORA
+#if CONFIG_LUA_RTOS_USE_LMIC
+#if CONFIG_LUA_RTOS_LMIC_SIM
+
+#include "lmic.h"
+
+// Simulated radio and network server statistics
+typedef struct {
+	u4_t     uplinks;      // frames transmitted
+	u4_t     joins;        // join requests accepted
+	u4_t     downlinks;    // frames received in a rx window
+	u4_t     missed;       // downlinks lost, rx window not open when expected
+	u4_t     rx2;          // downlinks sent in the RX2 window
+	u4_t     lost;         // uplinks and downlinks lost on purpose
+	u4_t     retries;      // uplinks received again, with the last frame counter
+	u4_t     badmic;       // uplinks with a wrong MIC or device address
+	u4_t     badfcnt;      // uplinks with an old frame counter
+	ostime_t airtime;      // total uplink time on air
+	s4_t     rxmaxoffset;  // max time from the downlink start to the rx window open,
+	s4_t     rxminoffset;  // negative if the window opened before the downlink
+	s8_t     rxsumoffset;
+} lmic_sim_stats_t;
+
+// Network server behaviour, 0 disables each one
+typedef struct {
+	u4_t     rx2;          // answer in the RX2 window every rx2 downlinks
+	u4_t     ulloss;       // lose one of every ulloss uplinks
+	u4_t     dnloss;       // lose one of every dnloss downlinks
+} lmic_sim_config_t;
+
+void lmic_sim_init(void);
+void lmic_sim_config(const lmic_sim_config_t *config);
+void lmic_sim_nss(u1_t val);
+u1_t lmic_sim_spi(u1_t outval);
+void lmic_sim_get_stats(lmic_sim_stats_t *stats);
+
+#endif
+#endif
+#endif
+
+#endif /* LMIC_SIM_H */
@@ -49,6 +49,7 @@
 #define LORA_ERR_CANT_SETUP				            (DRIVER_EXCEPTION_BASE(LORA_DRIVER_ID) |  7)
 #define LORA_ERR_TRANSMISSION_FAIL_ACK_NOT_RECEIVED (DRIVER_EXCEPTION_BASE(LORA_DRIVER_ID) |  8)
 #define LORA_ERR_INVALID_ARGUMENT                   (DRIVER_EXCEPTION_BASE(LORA_DRIVER_ID) |  9)
+#define LORA_ERR_QUEUE_FULL                         (DRIVER_EXCEPTION_BASE(LORA_DRIVER_ID) | 10)
 
 // Lora Mac set commands
 #define LORA_MAC_SET_DEVADDR		0
@@ -73,13 +74,51 @@
 
 typedef void (lora_rx)(int port, char *payload);
 
+// Lora stack timing statistics, times in usecs
+typedef struct {
+	uint32_t jobs;          // scheduled jobs run
+	uint32_t job_max_late;  // max delay from deadline to job start
+	uint32_t job_avg_late;
+	uint32_t rx_windows;    // rx windows opened
+	uint32_t rx_max_late;   // max delay from rx time to rx start
+	uint32_t rx_avg_late;
+	uint32_t irqs;          // radio irqs handled
+	uint32_t irq_max_late;  // max delay from DIO edge to MAC callback queued
+	uint32_t irq_avg_late;
+#if CONFIG_LUA_RTOS_LMIC_SIM
+	uint32_t sim_uplinks;   // simulated radio, frames transmitted
+	uint32_t sim_downlinks; // frames received in a rx window
+	uint32_t sim_missed;    // downlinks lost, rx window not open in time
+	uint32_t sim_joins;
+	uint32_t sim_airtime;   // total uplink time on air, in msecs
+	int32_t  sim_rx_max_offset; // rx window open time from downlink start
+	int32_t  sim_rx_min_offset;
+	int32_t  sim_rx_avg_offset;
+#endif
+} lora_stats_t;
+
+// Uplink plan, at the current data rate, times in msecs
+typedef struct {
+	int32_t  next_tx;       // time to the earliest transmission, -1 if no channel can be used
+	uint32_t budget;        // transmission time the duty cycle allows in the next hour
+	uint32_t frame_airtime; // time on air of a frame with max payload
+	uint8_t  max_payload;   // max payload of a frame
+	uint8_t  pending;       // queued messages
+	uint8_t  frames;        // frames needed to send the queued messages
+} lora_plan_t;
+
 driver_error_t *lora_setup(int band);
 driver_error_t *lora_mac_set(const char command, const char *value);
 driver_error_t *lora_mac_get(const char command, char **value);
 driver_error_t *lora_join();
 driver_error_t *lora_tx(int cnf, int port, const char *data);
+driver_error_t *lora_queue(int port, const char *data);
+driver_error_t *lora_flush(int cnf, int *frames);
+driver_error_t *lora_get_plan(lora_plan_t *plan);
+int lora_get_channel_tx(int channel);
 
 void lora_set_rx_callback(lora_rx *callback);
+void lora_get_stats(lora_stats_t *stats);
 void _lora_init();
 
 #endif
@@ -54,6 +54,11 @@
 #include <drivers/lora.h>
  
 #include "lmic.h"
+#include "lora_plan.h"
+
+#if CONFIG_LUA_RTOS_LMIC_SIM
+#include <drivers/lmic_sim.h>
+#endif
 
 // Driver message errors
 DRIVER_REGISTER_ERROR(LORA, lora, KeysNotConfigured, "keys are not configured", LORA_ERR_KEYS_NOT_CONFIGURED);
@@ -66,6 +71,7 @@ DRIVER_REGISTER_ERROR(LORA, lora, ABPExpected, "ABP expected", LORA_ERR_ABP_EXPE
 DRIVER_REGISTER_ERROR(LORA, lora, CannotSetup, "can't setup", LORA_ERR_CANT_SETUP);
 DRIVER_REGISTER_ERROR(LORA, lora, TransmissionFail, "transmission fail, ack not received", LORA_ERR_TRANSMISSION_FAIL_ACK_NOT_RECEIVED);
 DRIVER_REGISTER_ERROR(LORA, lora, InvalidArgument, "invalid argument", LORA_ERR_INVALID_ARGUMENT);
+DRIVER_REGISTER_ERROR(LORA, lora, QueueFull, "message queue is full", LORA_ERR_QUEUE_FULL);
 
 #define evLORA_INITED 	       	 ( 1 << 0 )
 #define evLORA_JOINED  	       	 ( 1 << 1 )
@@ -597,30 +603,22 @@ driver_error_t *lora_join() {
 	return driver_operation_error(LORA_DRIVER, LORA_ERR_UNEXPECTED_RESPONSE, NULL);
 }
 
-driver_error_t *lora_tx(int cnf, int port, const char *data) {
-	uint8_t *payload;
-	uint8_t payload_len;
-	
-    mtx_lock(&lora_mtx);
-
+// Check that a frame can be sent, lora_mtx must be locked
+static driver_error_t *lora_tx_ready() {
     if (!setup) {
-        mtx_unlock(&lora_mtx);
         return driver_operation_error(LORA_DRIVER, LORA_ERR_NOT_SETUP, NULL);
     }
 
     if (lora_must_join()) {
     	if (lora_can_participate_otaa()) {
             if (!joined) {
-                mtx_unlock(&lora_mtx);
                 return driver_operation_error(LORA_DRIVER, LORA_ERR_NOT_JOINED, NULL);
             }
     	} else {
-            mtx_unlock(&lora_mtx);
             return driver_operation_error(LORA_DRIVER, LORA_ERR_KEYS_NOT_CONFIGURED, NULL);
     	}
     } else {
     	if (!lora_can_participate_abp()) {
-            mtx_unlock(&lora_mtx);
             return driver_operation_error(LORA_DRIVER, LORA_ERR_KEYS_NOT_CONFIGURED, NULL);
     	} else {
     		if (!session_init) {
@@ -633,6 +631,49 @@ driver_error_t *lora_tx(int cnf, int port, const char *data) {
     		}
     	}
     }
+
+    // Set DR
+    if (!adr) {
+    	LMIC_setDrTxpow(current_dr, 14);
+    }
+
+    return NULL;
+}
+
+// Send a frame and wait for the transmission end, lora_mtx must be locked
+static driver_error_t *lora_tx_frame(int cnf, int port, uint8_t *payload, uint8_t payload_len) {
+	// Put message id
+	msgid++;
+
+	LMIC.seqnoUp = msgid;
+
+	// Send 
+    LMIC_setTxData2(port, payload, payload_len, cnf);
+
+	// Wait for one of the expected events
+    EventBits_t uxBits = xEventGroupWaitBits(loraEvent, evLORA_TX_COMPLETE | evLORA_ACK_NOT_RECEIVED, pdTRUE, pdFALSE, portMAX_DELAY);
+    if (uxBits & (evLORA_TX_COMPLETE)) {
+		return NULL;
+    }
+
+    if (uxBits & (evLORA_ACK_NOT_RECEIVED)) {
+        return driver_operation_error(LORA_DRIVER, LORA_ERR_TRANSMISSION_FAIL_ACK_NOT_RECEIVED, NULL);
+    }
+	
+    return driver_operation_error(LORA_DRIVER, LORA_ERR_UNEXPECTED_RESPONSE, NULL);
+}
+
+driver_error_t *lora_tx(int cnf, int port, const char *data) {
+	driver_error_t *error;
+	uint8_t *payload;
+	uint8_t payload_len;
+	
+    mtx_lock(&lora_mtx);
+
+    if ((error = lora_tx_ready())) {
+        mtx_unlock(&lora_mtx);
+        return error;
+    }
 	
 	payload_len = strlen(data) / 2;
 
@@ -646,37 +687,128 @@ driver_error_t *lora_tx(int cnf, int port, const char *data) {
 	// Convert input payload (coded in hex string) into a byte buffer
 	hex_string_to_val((char *)data, (char *)payload, payload_len, 0);
 
-	// Put message id
-	msgid++;
+	error = lora_tx_frame(cnf, port, payload, payload_len);
 
-	LMIC.seqnoUp = msgid;
-	payload[payload_len] = msgid;
+    free(payload);
 
-	// Set DR
-	if (!adr) {
-		LMIC_setDrTxpow(current_dr, 14);
+    mtx_unlock(&lora_mtx);
+
+    return error;
+}
+
+driver_error_t *lora_queue(int port, const char *data) {
+	uint8_t payload[MAX_LEN_PAYLOAD];
+	int payload_len = strlen(data) / 2;
+	int res;
+
+	// A message must fit in a frame, with it's length
+	if (payload_len > MAX_LEN_PAYLOAD - 2) {
+		return driver_operation_error(LORA_DRIVER, LORA_ERR_INVALID_ARGUMENT, "message too long");
 	}
 
-	// Send 
-    LMIC_setTxData2(port, payload, payload_len, cnf);
-		
-    free(payload);
+	hex_string_to_val((char *)data, (char *)payload, payload_len, 0);
 
-	// Wait for one of the expected events
-    EventBits_t uxBits = xEventGroupWaitBits(loraEvent, evLORA_TX_COMPLETE | evLORA_ACK_NOT_RECEIVED, pdTRUE, pdFALSE, portMAX_DELAY);
-    if (uxBits & (evLORA_TX_COMPLETE)) {
-	    mtx_unlock(&lora_mtx);   
-		return NULL;
-    }
+    mtx_lock(&lora_mtx);
+	res = lora_plan_add(port, payload, payload_len);
+    mtx_unlock(&lora_mtx);
 
-    if (uxBits & (evLORA_ACK_NOT_RECEIVED)) {
+	if (res == -1) {
+		return driver_operation_error(LORA_DRIVER, LORA_ERR_QUEUE_FULL, NULL);
+	} else if (res < 0) {
+		return driver_operation_error(LORA_DRIVER, LORA_ERR_NO_MEM, NULL);
+	}
+
+	return NULL;
+}
+
+driver_error_t *lora_flush(int cnf, int *frames) {
+	driver_error_t *error;
+	uint8_t payload[MAX_LEN_PAYLOAD];
+	uint8_t port;
+	int len;
+
+	*frames = 0;
+
+    mtx_lock(&lora_mtx);
+
+	while (lora_plan_pending()) {
+	    if ((error = lora_tx_ready())) {
+	        mtx_unlock(&lora_mtx);
+	        return error;
+	    }
+
+		// Pack for the data rate of this frame, that can be changed by ADR
+		len = lora_plan_next(LMIC_maxPayload(), &port, payload);
+		if (!len) {
+	        mtx_unlock(&lora_mtx);
+			return driver_operation_error(LORA_DRIVER, LORA_ERR_INVALID_ARGUMENT, "message too long for data rate");
+		}
+
+		if ((error = lora_tx_frame(cnf, port, payload, len))) {
+	        mtx_unlock(&lora_mtx);
+			return error;
+		}
+
+		(*frames)++;
+	}
+
+    mtx_unlock(&lora_mtx);
+
+	return NULL;
+}
+
+static int32_t lora_ms_from_now(ostime_t time) {
+	s8_t delta = (s8_t)(time - os_getTime());
+
+	return (delta > 0) ? osticks2ms(delta) : 0;
+}
+
+driver_error_t *lora_get_plan(lora_plan_t *plan) {
+	ostime_t time;
+	uint8_t max;
+
+    mtx_lock(&lora_mtx);
+
+    if (!setup) {
         mtx_unlock(&lora_mtx);
-        return driver_operation_error(LORA_DRIVER, LORA_ERR_TRANSMISSION_FAIL_ACK_NOT_RECEIVED, NULL);
+        return driver_operation_error(LORA_DRIVER, LORA_ERR_NOT_SETUP, NULL);
     }
-	
+
+	// Data rate of the next frame
+	if (!adr) {
+		LMIC_setDrTxpow(current_dr, 14);
+	}
+
+	max = LMIC_maxPayload();
+
+	plan->next_tx = LMIC_nextTxTime(&time) ? lora_ms_from_now(time) : -1;
+	plan->budget = osticks2ms(LMIC_airtimeBudget(sec2osticks(3600)));
+	plan->max_payload = max;
+	plan->pending = lora_plan_pending();
+	plan->frames = lora_plan_frames(max);
+	plan->frame_airtime = osticks2ms(LMIC_txAirtime(max));
+
     mtx_unlock(&lora_mtx);
 
-    return driver_operation_error(LORA_DRIVER, LORA_ERR_UNEXPECTED_RESPONSE, NULL);
+	return NULL;
+}
+
+/*
+ * Time in msecs to the earliest transmission on channel, -1 if channel can't
+ * be used at the current data rate, -2 if channel doesn't exist.
+ */
+int lora_get_channel_tx(int channel) {
+	ostime_t time;
+
+	if ((channel < 0) || (channel >= MAX_TXCHANNELS)) {
+		return -2;
+	}
+
+	if (!LMIC_queryChannel(channel, &time)) {
+		return -1;
+	}
+
+	return lora_ms_from_now(time);
 }
 
 void lora_set_rx_callback(lora_rx *callback) {
@@ -687,6 +819,39 @@ void lora_set_rx_callback(lora_rx *callback) {
 	mtx_unlock(&lora_mtx);
 }
 
+void lora_get_stats(lora_stats_t *stats) {
+	osstats_t os;
+
+	os_getStats(&os);
+
+	stats->jobs = os.jobs;
+	stats->job_max_late = os.jobmaxlate * US_PER_OSTICK;
+	stats->job_avg_late = os.jobs ? (os.jobsumlate * US_PER_OSTICK) / os.jobs : 0;
+
+	stats->rx_windows = os.rxwindows;
+	stats->rx_max_late = os.rxmaxlate * US_PER_OSTICK;
+	stats->rx_avg_late = os.rxwindows ? (os.rxsumlate * US_PER_OSTICK) / os.rxwindows : 0;
+
+	stats->irqs = os.irqs;
+	stats->irq_max_late = os.irqmaxlate * US_PER_OSTICK;
+	stats->irq_avg_late = os.irqs ? (os.irqsumlate * US_PER_OSTICK) / os.irqs : 0;
+
+#if CONFIG_LUA_RTOS_LMIC_SIM
+	lmic_sim_stats_t sim;
+
+	lmic_sim_get_stats(&sim);
+
+	stats->sim_uplinks = sim.uplinks;
+	stats->sim_downlinks = sim.downlinks;
+	stats->sim_missed = sim.missed;
+	stats->sim_joins = sim.joins;
+	stats->sim_airtime = osticks2ms(sim.airtime);
+	stats->sim_rx_max_offset = sim.rxmaxoffset * US_PER_OSTICK;
+	stats->sim_rx_min_offset = sim.rxminoffset * US_PER_OSTICK;
+	stats->sim_rx_avg_offset = sim.downlinks ? (sim.rxsumoffset * US_PER_OSTICK) / (s8_t)sim.downlinks : 0;
+#endif
+}
+
 // This functions are needed for the LMIC stack for pass
 // connection data
 void os_getArtEui (u1_t* buf) { 
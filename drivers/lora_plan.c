@@ -0,0 +1,185 @@
+/*
+ * Lua RTOS, LoRa WAN uplink planner
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * Frame packing is a first fit decreasing bin packing, done one frame at a
+ * time: the messages for the port of the oldest message are taken from the
+ * largest to the smallest, and each one that still fits goes into the frame.
+ * This gives the same frames that first fit decreasing, and follows data
+ * rate changes between frames.
+ */
+
+#include "luartos.h"
+
+#if LUA_USE_LORA
+#if CONFIG_LUA_RTOS_USE_LMIC
+
+#include "lora_plan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	uint8_t port;
+	uint8_t len;
+	uint8_t *data;
+} lora_plan_msg_t;
+
+// Pending messages, in arrival order
+static lora_plan_msg_t msgs[LORA_PLAN_MAX_MSGS];
+static int nmsgs = 0;
+
+/*
+ * Select the messages of the next frame, setting taken[i] for each one.
+ * Returns the frame length, or 0 if no message fits.
+ */
+static int select_frame(uint8_t maxlen, uint8_t *taken) {
+	int len = 0;
+	int port = -1;
+	int i, best;
+
+	// Port of the oldest message that fits in a frame
+	for(i = 0; i < nmsgs; i++) {
+		if (!taken[i] && (msgs[i].len + 1 <= maxlen)) {
+			port = msgs[i].port;
+			break;
+		}
+	}
+
+	if (port < 0) {
+		return 0;
+	}
+
+	for(;;) {
+		// Largest message for the port that fits, oldest first on ties
+		best = -1;
+		for(i = 0; i < nmsgs; i++) {
+			if (!taken[i] && (msgs[i].port == port) && (len + msgs[i].len + 1 <= maxlen) &&
+				((best < 0) || (msgs[i].len > msgs[best].len))) {
+				best = i;
+			}
+		}
+
+		if (best < 0) {
+			break;
+		}
+
+		taken[best] = 1;
+		len += msgs[best].len + 1;
+	}
+
+	return len;
+}
+
+int lora_plan_add(uint8_t port, const uint8_t *data, uint8_t len) {
+	uint8_t *copy;
+
+	if (nmsgs == LORA_PLAN_MAX_MSGS) {
+		return -1;
+	}
+
+	copy = (uint8_t *)malloc(len ? len : 1);
+	if (!copy) {
+		return -2;
+	}
+
+	memcpy(copy, data, len);
+
+	msgs[nmsgs].port = port;
+	msgs[nmsgs].len = len;
+	msgs[nmsgs].data = copy;
+	nmsgs++;
+
+	return 0;
+}
+
+int lora_plan_pending() {
+	return nmsgs;
+}
+
+/*
+ * Number of frames needed to send all the pending messages, if all frames
+ * have a max payload of maxlen bytes. Messages that doesn't fit in maxlen
+ * are not counted.
+ */
+int lora_plan_frames(uint8_t maxlen) {
+	uint8_t taken[LORA_PLAN_MAX_MSGS];
+	int frames = 0;
+
+	memset(taken, 0, sizeof(taken));
+
+	while (select_frame(maxlen, taken)) {
+		frames++;
+	}
+
+	return frames;
+}
+
+/*
+ * Pack the next frame, with a max payload of maxlen bytes, into frame, and
+ * remove the packed messages. Returns the frame length, or 0 if no message
+ * fits in maxlen.
+ */
+int lora_plan_next(uint8_t maxlen, uint8_t *port, uint8_t *frame) {
+	uint8_t taken[LORA_PLAN_MAX_MSGS];
+	int len, i, j;
+
+	memset(taken, 0, sizeof(taken));
+
+	len = select_frame(maxlen, taken);
+	if (!len) {
+		return 0;
+	}
+
+	for(i = 0, j = 0; i < nmsgs; i++) {
+		if (taken[i]) {
+			*port = msgs[i].port;
+			*frame++ = msgs[i].len;
+			memcpy(frame, msgs[i].data, msgs[i].len);
+			frame += msgs[i].len;
+
+			free(msgs[i].data);
+		} else {
+			msgs[j++] = msgs[i];
+		}
+	}
+
+	nmsgs = j;
+
+	return len;
+}
+
+void lora_plan_clear() {
+	while (nmsgs > 0) {
+		free(msgs[--nmsgs].data);
+	}
+}
+
+#endif
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Lua RTOS, LoRa WAN uplink planner
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+#ifndef LORA_PLAN_H
+#define LORA_PLAN_H
+
+#include <stdint.h>
+
+// Max number of messages pending to be sent
+#define LORA_PLAN_MAX_MSGS 16
+
+/*
+ * Application messages are queued, and packed into as few frames as possible
+ * when sent. Only messages for the same port are packed together. In a frame
+ * each message is preceded by it's length, in one byte.
+ *
+ * Functions are not thread safe, caller must serialize them.
+ */
+int lora_plan_add(uint8_t port, const uint8_t *data, uint8_t len);
+int lora_plan_pending();
+int lora_plan_frames(uint8_t maxlen);
+int lora_plan_next(uint8_t maxlen, uint8_t *port, uint8_t *frame);
+void lora_plan_clear();
+
+#endif /* LORA_PLAN_H */
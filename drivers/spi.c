@@ -710,15 +710,11 @@ driver_error_t *spi_bulk_rw(int unit, unsigned int nbytes, unsigned char *data)
 		return driver_operation_error(SPI_DRIVER, SPI_ERR_INVALID_UNIT, NULL);
 	}
 
-	unsigned char *read = (unsigned char *)malloc(nbytes);
-	if (read) {
-	    taskDISABLE_INTERRUPTS();
-	    spi_master_op(unit, 1, nbytes, data, read);
-	    taskENABLE_INTERRUPTS();
-	}
-
-	memcpy(data, read, nbytes);
-	free(read);
+	// spi_master_op consumes each chunk of data before storing the read
+	// chunk, so the transfer can be done in place
+    taskDISABLE_INTERRUPTS();
+    spi_master_op(unit, 1, nbytes, data, data);
+    taskENABLE_INTERRUPTS();
 
     return NULL;
 }
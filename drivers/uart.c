@@ -54,6 +54,7 @@
 #include "luartos.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/timers.h"
 #include "freertos/xtensa_api.h"
 
@@ -107,6 +108,10 @@ struct uart {
     pthread_mutex_t  mtx;		// Mutex
 };
 
+// Signaled by the RX interrupt when bytes are queued in any unit, used by
+// vfs_poll to wait for UART data without polling the queues
+static SemaphoreHandle_t rx_sem = NULL;
+
 static struct uart uart[NUART] = {
     {
         0, NULL, 0, 115200, PTHREAD_MUTEX_INITIALIZER
@@ -285,6 +290,10 @@ void IRAM_ATTR uart_rx_intr_handler(void *para) {
 					if (queue_byte(unit, byte, &status, &signal)) {
 			            // Put byte to UART queue
 			            xQueueSendFromISR(uart[unit].q, &byte, &xHigherPriorityTaskWoken);
+
+			            if (rx_sem) {
+			            	xSemaphoreGiveFromISR(rx_sem, &xHigherPriorityTaskWoken);
+			            }
 					} else {
 						if (signal) {
 							 xTimerPendFunctionCallFromISR(process_signal,
@@ -309,6 +318,10 @@ void IRAM_ATTR uart_rx_intr_handler(void *para) {
 					if (queue_byte(unit, byte, &status, &signal)) {
 			            // Put byte to UART queue
 			            xQueueSendFromISR(uart[unit].q, &byte, &xHigherPriorityTaskWoken);
+
+			            if (rx_sem) {
+			            	xSemaphoreGiveFromISR(rx_sem, &xHigherPriorityTaskWoken);
+			            }
 					} else {
 						if (signal) {
 							 xTimerPendFunctionCallFromISR(process_signal,
@@ -422,6 +435,11 @@ driver_error_t *uart_init(int8_t unit, uint32_t brg, uint8_t databits, uint8_t p
 		}
 	}
 
+    // Create RX signal, if needed
+    if (!rx_sem) {
+    	rx_sem = xSemaphoreCreateBinary();
+    }
+
     // Init mutex, if needed
     if (uart[unit].mtx == PTHREAD_MUTEX_INITIALIZER) {
         pthread_mutexattr_t attr;
@@ -506,6 +524,21 @@ void IRAM_ATTR uart_writes(int8_t unit, char *s) {
    }
 }
 
+// Writes len bytes to the UART, filling all the free room of the TX FIFO
+// at each time
+void IRAM_ATTR uart_writeb(int8_t unit, const uint8_t *data, size_t len) {
+    uint32_t used;
+
+    while (len > 0) {
+        used = (READ_PERI_REG(UART_STATUS_REG(unit)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT;
+        while ((used < 126) && (len > 0)) {
+            WRITE_PERI_REG(UART_FIFO_REG(unit), *data++);
+            used++;
+            len--;
+        }
+    }
+}
+
 // Reads a byte from uart
 uint8_t IRAM_ATTR uart_read(int8_t unit, char *c, uint32_t timeout) {
     if (timeout != portMAX_DELAY) {
@@ -519,6 +552,29 @@ uint8_t IRAM_ATTR uart_read(int8_t unit, char *c, uint32_t timeout) {
     }
 }
 
+// Get the number of received bytes that can be read without blocking
+int uart_bytes_available(int8_t unit) {
+	if (!uart[unit].q) {
+		return 0;
+	}
+
+	return (int)uxQueueMessagesWaiting(uart[unit].q);
+}
+
+// Wait until bytes are received in any unit, or until timeout (in milliseconds)
+void uart_wait_rx(uint32_t timeout) {
+    if (timeout != portMAX_DELAY) {
+        timeout = (timeout + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+    }
+
+	if (!rx_sem) {
+		vTaskDelay(timeout?timeout:1);
+		return;
+	}
+
+	xSemaphoreTake(rx_sem, (TickType_t)timeout);
+}
+
 // Consume all received bytes, and do not nothing with them
 void uart_consume(int8_t unit) {
     char tmp;
@@ -90,11 +90,14 @@ driver_error_t *uart_init(int8_t unit, uint32_t brg, uint8_t databits, uint8_t p
 driver_error_t *uart_setup_interrupts(int8_t unit);
 void     uart_write(int8_t unit, char byte);
 void     uart_writes(int8_t unit, char *s);
+void     uart_writeb(int8_t unit, const uint8_t *data, size_t len);
 uint8_t uart_read(int8_t unit, char *c, uint32_t timeout);
 uint8_t  uart_reads(int8_t unit, char *buff, uint8_t crlf, uint32_t timeout);
 uint8_t  uart_wait_response(int8_t unit, char *command, uint8_t echo, char *ret, uint8_t substring, uint32_t timeout, int nargs, ...);
 uint8_t  uart_send_command(int8_t unit, char *command, uint8_t echo, uint8_t crlf, char *ret, uint8_t substring, uint32_t timeout, int nargs, ...);
 void     uart_consume(int8_t unit);
+int      uart_bytes_available(int8_t unit);
+void     uart_wait_rx(uint32_t timeout);
 const char  *uart_name(int8_t unit);
 int      uart_get_br(int unit);
 int      uart_is_setup(int unit);
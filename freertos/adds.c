@@ -127,11 +127,25 @@ void IRAM_ATTR uxSetSignaled(TaskHandle_t h, int s) {
 
 	// Get Lua RTOS specific TCB parts for current task
 	if ((lua_rtos_tcb = pvTaskGetThreadLocalStoragePointer(h, THREAD_LOCAL_STORAGE_POINTER_ID))) {
-		// Store current signaled mask into Lua RTOS specific TCB parts
-		lua_rtos_tcb->signaled = s;		
+		// Add signal to the signaled mask into Lua RTOS specific TCB parts. This
+		// is lock-free, so it can be called from any context.
+		__sync_fetch_and_or(&lua_rtos_tcb->signaled, (1 << s));
 	}
 }
 
+uint32_t IRAM_ATTR uxClearSignaled(TaskHandle_t h) {
+	lua_rtos_tcb_t *lua_rtos_tcb;
+	uint32_t signaled = 0;
+
+	// Get Lua RTOS specific TCB parts for current task
+	if ((lua_rtos_tcb = pvTaskGetThreadLocalStoragePointer(h, THREAD_LOCAL_STORAGE_POINTER_ID))) {
+		// Get and clear the signaled mask from Lua RTOS specific TCB parts
+		signaled = __sync_fetch_and_and(&lua_rtos_tcb->signaled, 0);
+	}
+
+	return signaled;
+}
+
 uint8_t uxGetCoreID(TaskHandle_t h) {
 	lua_rtos_tcb_t *lua_rtos_tcb;
 	int coreid = 0;
@@ -177,3 +191,30 @@ void uxSetStack(int stack) {
 		lua_rtos_tcb->stack = stack;
 	}
 }
+
+void *IRAM_ATTR pvGetThreadSpecific(TaskHandle_t h, int key) {
+	lua_rtos_tcb_t *lua_rtos_tcb;
+	void *value = NULL;
+
+	// Get Lua RTOS specific TCB parts for task
+	if ((lua_rtos_tcb = pvTaskGetThreadLocalStoragePointer(h, THREAD_LOCAL_STORAGE_POINTER_ID))) {
+		// Get thread-specific value from Lua RTOS specific TCB parts
+		value = (void *)lua_rtos_tcb->specific[key];
+	}
+
+	return value;
+}
+
+int IRAM_ATTR uxSetThreadSpecific(TaskHandle_t h, int key, const void *value) {
+	lua_rtos_tcb_t *lua_rtos_tcb;
+
+	// Get Lua RTOS specific TCB parts for task
+	if ((lua_rtos_tcb = pvTaskGetThreadLocalStoragePointer(h, THREAD_LOCAL_STORAGE_POINTER_ID))) {
+		// Store thread-specific value into Lua RTOS specific TCB parts
+		lua_rtos_tcb->specific[key] = value;
+
+		return 1;
+	}
+
+	return 0;
+}
@@ -1,3 +1,5 @@
+#include "luartos.h"
+
 #include "lua.h"
 
 #include "freertos/FreeRTOS.h"
@@ -9,8 +11,9 @@ typedef struct {
 	uint32_t   stack;
 	uint32_t   coreid;
 	int32_t    threadid;
- 	uint32_t   signaled;	
+ 	volatile uint32_t signaled;
   	lua_State *L;
+  	const void *specific[PTHREAD_NKEYS];
 } lua_rtos_tcb_t;
 
 // This macro is not present in all FreeRTOS ports. In Lua RTOS is used in some places
@@ -33,8 +36,11 @@ void uxSetLuaState(lua_State* L);
 lua_State* pvGetLuaState();
 void uxSetSignaled(TaskHandle_t h, int s);
 uint32_t uxGetSignaled(TaskHandle_t h);
+uint32_t uxClearSignaled(TaskHandle_t h);
 TaskHandle_t xGetCurrentTask();
 uint8_t uxGetCoreID(TaskHandle_t h);
 void uxSetCoreID(int core);
 int uxGetStack(TaskHandle_t h);
 void uxSetStack(int stack);
+void *pvGetThreadSpecific(TaskHandle_t h, int key);
+int uxSetThreadSpecific(TaskHandle_t h, int key, const void *value);
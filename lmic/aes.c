@@ -32,7 +32,9 @@
 
 #include "oslmic.h"
 
-#define AES_MICSUB 0x30 // internal use only
+#if CONFIG_LUA_RTOS_LMIC_HW_AES
+#include "hwcrypto/aes.h"
+#endif
 
 static const u4_t AES_RCON[10] = { 
     0x01000000, 0x02000000, 0x04000000, 0x08000000, 0x10000000, 
@@ -220,21 +222,42 @@ static const u4_t AES_E4[256] = {
                                    a ^= (AES_S[u1(r2>> 8)]<< 8); \
                                    a ^=  AES_S[u1(r3)    ]
 
-// global area for passing parameters (aux, key) and for storing round keys
+// global area for passing parameters (aux, key)
 u4_t AESAUX[16/sizeof(u4_t)];
 u4_t AESKEY[11*16/sizeof(u4_t)];
 
+// Number of expanded keys kept. LoRaWAN uses the same few keys (NwkSKey,
+// AppSKey, AppKey) for every frame, so the key schedule and the CMAC
+// subkeys are computed once per key instead of once per frame.
+#define AES_KEY_CACHE 3
+
+typedef struct {
+    u1_t key[16];           // key, as given
+#if CONFIG_LUA_RTOS_LMIC_HW_AES
+    esp_aes_context ctx;    // key loaded for the AES peripheral
+#else
+    u4_t rk[44];            // 1+10 roundkeys, MSBF
+#endif
+    u4_t k1[4];             // CMAC subkeys, MSBF
+    u4_t k2[4];
+} aes_sched_t;
+
+static aes_sched_t aes_cache[AES_KEY_CACHE];
+static u1_t aes_cache_used = 0;
+static u1_t aes_cache_next = 0;
+
+#if !CONFIG_LUA_RTOS_LMIC_HW_AES
 // generate 1+10 roundkeys for encryption with 128-bit key
-// read 128-bit key from AESKEY in MSBF, generate roundkey words in place
-static void aesroundkeys () {
+// read 128-bit key in MSBF, generate roundkey words into rk
+static void aesroundkeys (u4_t *rk, xref2cu1_t key) {
     int i;
     u4_t b;
 
     for( i=0; i<4; i++) {
-        AESKEY[i] = swapmsbf(AESKEY[i]);
+        rk[i] = msbf4_read(key+4*i);
     }
-    
-    b = AESKEY[3];
+
+    b = rk[3];
     for( ; i<44; i++ ) {
         if( i%4==0 ) {
             // b = SubWord(RotWord(b)) xor Rcon[i/4]
@@ -244,149 +267,216 @@ static void aesroundkeys () {
                 (AES_S[   b >> 24 ]      ) ^
                  AES_RCON[(i-4)/4];
         }
-        AESKEY[i] = b ^= AESKEY[i-4];
+        rk[i] = b ^= rk[i-4];
     }
 }
+#endif
 
-u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
-        
-        aesroundkeys();
-
-        if( mode & AES_MICNOAUX ) {
-            AESAUX[0] = AESAUX[1] = AESAUX[2] = AESAUX[3] = 0;
-        } else {
-            AESAUX[0] = swapmsbf(AESAUX[0]);
-            AESAUX[1] = swapmsbf(AESAUX[1]);
-            AESAUX[2] = swapmsbf(AESAUX[2]);
-            AESAUX[3] = swapmsbf(AESAUX[3]);
+// perform AES encryption on block in a[0..3] (MSBF words), in place
+static void aesblock (const aes_sched_t *s, u4_t *a) {
+#if CONFIG_LUA_RTOS_LMIC_HW_AES
+    u1_t b[16];
+    int i;
+
+    for( i=0; i<4; i++ ) {
+        msbf4_write(b+4*i, a[i]);
+    }
+
+    esp_aes_crypt_ecb((esp_aes_context *)&s->ctx, ESP_AES_ENCRYPT, b, b);
+
+    for( i=0; i<4; i++ ) {
+        a[i] = msbf4_read(b+4*i);
+    }
+#else
+    const u4_t *ki, *ke;
+    u4_t a0, a1, a2, a3;
+    u4_t t0, t1, t2, t3;
+
+    ki = s->rk;
+    ke = ki + 8*4;
+    a0 = a[0] ^ ki[0];
+    a1 = a[1] ^ ki[1];
+    a2 = a[2] ^ ki[2];
+    a3 = a[3] ^ ki[3];
+    do {
+        AES_key4 (t1,t2,t3,t0,4);
+        AES_expr4(t1,t2,t3,t0,a0);
+        AES_expr4(t2,t3,t0,t1,a1);
+        AES_expr4(t3,t0,t1,t2,a2);
+        AES_expr4(t0,t1,t2,t3,a3);
+
+        AES_key4 (a1,a2,a3,a0,8);
+        AES_expr4(a1,a2,a3,a0,t0);
+        AES_expr4(a2,a3,a0,a1,t1);
+        AES_expr4(a3,a0,a1,a2,t2);
+        AES_expr4(a0,a1,a2,a3,t3);
+    } while( (ki+=8) < ke );
+
+    AES_key4 (t1,t2,t3,t0,4);
+    AES_expr4(t1,t2,t3,t0,a0);
+    AES_expr4(t2,t3,t0,t1,a1);
+    AES_expr4(t3,t0,t1,t2,a2);
+    AES_expr4(t0,t1,t2,t3,a3);
+
+    AES_expr(a[0],t0,t1,t2,t3,8);
+    AES_expr(a[1],t1,t2,t3,t0,9);
+    AES_expr(a[2],t2,t3,t0,t1,10);
+    AES_expr(a[3],t3,t0,t1,t2,11);
+#endif
+}
+
+// compute CMAC subkey: shift left by one bit, xor Rb if MSB was set
+static void aessubkey (u4_t *d, const u4_t *s) {
+    u4_t msb = s[0] >> 31;
+
+    d[0] = (s[0] << 1) | (s[1] >> 31);
+    d[1] = (s[1] << 1) | (s[2] >> 31);
+    d[2] = (s[2] << 1) | (s[3] >> 31);
+    d[3] = (s[3] << 1);
+    if( msb ) d[3] ^= 0x87;
+}
+
+// get the expanded key, expanding it in place of the oldest one if
+// it's not in the cache
+static const aes_sched_t *aesschedule (xref2cu1_t key) {
+    aes_sched_t *s;
+    u4_t l[4] = {0, 0, 0, 0};
+    int i;
+
+    for( i=0; i<aes_cache_used; i++ ) {
+        if( memcmp(aes_cache[i].key, key, 16) == 0 ) {
+            return &aes_cache[i];
         }
+    }
+
+    s = &aes_cache[aes_cache_next];
+    aes_cache_next = (aes_cache_next + 1) % AES_KEY_CACHE;
+    if( aes_cache_used < AES_KEY_CACHE ) {
+        aes_cache_used++;
+    }
 
-        while( (signed char)len > 0 ) {
-            u4_t a0, a1, a2, a3;
-            u4_t t0, t1, t2, t3;
-            u4_t *ki, *ke;
+    os_copyMem(s->key, key, 16);
+#if CONFIG_LUA_RTOS_LMIC_HW_AES
+    esp_aes_init(&s->ctx);
+    esp_aes_setkey(&s->ctx, key, 128);
+#else
+    aesroundkeys(s->rk, key);
+#endif
 
-            t0 = t1 = t2 = t3 = 0;
-            a0 = a1 = a2 = a3 = 0;
+    // L = AES(K, 0), K1 = L << 1, K2 = K1 << 1
+    aesblock(s, l);
+    aessubkey(s->k1, l);
+    aessubkey(s->k2, s->k1);
 
-            // load input block
-            if( (mode & AES_CTR) || ((mode & AES_MIC) && (mode & AES_MICNOAUX)==0) ) { // load CTR block or first MIC block
-                a0 = AESAUX[0];
-                a1 = AESAUX[1];
-                a2 = AESAUX[2];
-                a3 = AESAUX[3];
-            }
-            else if( (mode & AES_MIC) && len <= 16 ) { // last MIC block
-                a0 = a1 = a2 = a3 = 0; // load null block
-                mode |= ((len == 16) ? 1 : 2) << 4; // set MICSUB: CMAC subkey K1 or K2
-            } else
-        LOADDATA: { // load data block (partially)
-                for(t0=0; t0<16; t0++) {
-                    t1 = (t1<<8) | ((t0<len) ? buf[t0] : (t0==len) ? 0x80 : 0x00);
-                    if((t0&3)==3) {
-                        a0 = a1;
-                        a1 = a2;
-                        a2 = a3;
-                        a3 = t1;
-                    }
-                } 
-                if( mode & AES_MIC ) {
-                    a0 ^= AESAUX[0];
-                    a1 ^= AESAUX[1];
-                    a2 ^= AESAUX[2];
-                    a3 ^= AESAUX[3];
-                }
-            }
+    return s;
+}
 
-            // perform AES encryption on block in a0-a3
-            ki = AESKEY;
-            ke = ki + 8*4;
-            a0 ^= ki[0];
-            a1 ^= ki[1];
-            a2 ^= ki[2];
-            a3 ^= ki[3];
-            do {
-                AES_key4 (t1,t2,t3,t0,4);
-                AES_expr4(t1,t2,t3,t0,a0);
-                AES_expr4(t2,t3,t0,t1,a1);
-                AES_expr4(t3,t0,t1,t2,a2);
-                AES_expr4(t0,t1,t2,t3,a3);
-
-                AES_key4 (a1,a2,a3,a0,8);
-                AES_expr4(a1,a2,a3,a0,t0);
-                AES_expr4(a2,a3,a0,a1,t1);
-                AES_expr4(a3,a0,a1,a2,t2);
-                AES_expr4(a0,a1,a2,a3,t3);
-            } while( (ki+=8) < ke );
-
-            AES_key4 (t1,t2,t3,t0,4);
-            AES_expr4(t1,t2,t3,t0,a0);
-            AES_expr4(t2,t3,t0,t1,a1);
-            AES_expr4(t3,t0,t1,t2,a2);
-            AES_expr4(t0,t1,t2,t3,a3);
-
-            AES_expr(a0,t0,t1,t2,t3,8);
-            AES_expr(a1,t1,t2,t3,t0,9);
-            AES_expr(a2,t2,t3,t0,t1,10);
-            AES_expr(a3,t3,t0,t1,t2,11);
-            // result of AES encryption in a0-a3
-
-            if( mode & AES_MIC ) {
-                if( (t1 = (mode & AES_MICSUB) >> 4) != 0 ) { // last block
-                    do {
-                        // compute CMAC subkey K1 and K2
-                        t0 = a0 >> 31; // save MSB
-                        a0 = (a0 << 1) | (a1 >> 31);
-                        a1 = (a1 << 1) | (a2 >> 31);
-                        a2 = (a2 << 1) | (a3 >> 31);
-                        a3 = (a3 << 1);
-                        if( t0 ) a3 ^= 0x87;
-                    } while( --t1 );
-
-                    AESAUX[0] ^= a0;
-                    AESAUX[1] ^= a1;
-                    AESAUX[2] ^= a2;
-                    AESAUX[3] ^= a3;
-                    mode &= ~AES_MICSUB;
-                    goto LOADDATA;
-                } else {
-                    // save cipher block as new iv
-                    AESAUX[0] = a0;
-                    AESAUX[1] = a1;
-                    AESAUX[2] = a2;
-                    AESAUX[3] = a3;
-                }
-            } else { // CIPHER
-                if( mode & AES_CTR ) { // xor block (partially)
-                    t0 = (len > 16) ? 16: len;
-                    for(t1=0; t1<t0; t1++) {
-                        buf[t1] ^= (a0>>24);
-                        a0 <<= 8;
-                        if((t1&3)==3) {
-                            a0 = a1;
-                            a1 = a2;
-                            a2 = a3;
-                        }
-                    }
-                    // update counter
-                    AESAUX[3]++;
-                } else { // ECB
-                    // store block
-                    msbf4_write(buf+0,  a0);
-                    msbf4_write(buf+4,  a1);
-                    msbf4_write(buf+8,  a2);
-                    msbf4_write(buf+12, a3);
-                }
+void os_aes_ctr (xref2cu1_t key, xref2cu1_t ctr, xref2u1_t buf, u2_t len) {
+    const aes_sched_t *s = aesschedule(key);
+    u4_t c[4], a[4];
+    int i, n;
+
+    for( i=0; i<4; i++ ) {
+        c[i] = msbf4_read(ctr+4*i);
+    }
+
+    while( len > 0 ) {
+        a[0] = c[0];
+        a[1] = c[1];
+        a[2] = c[2];
+        a[3] = c[3];
+        aesblock(s, a);
+
+        // xor block (partially)
+        n = (len > 16) ? 16 : len;
+        for( i=0; i<n; i++ ) {
+            buf[i] ^= u1(a[i>>2] >> (24 - 8*(i&3)));
+        }
+
+        // update counter
+        c[3]++;
+        buf += n;
+        len -= n;
+    }
+}
+
+u4_t os_aes_cmac (xref2cu1_t key, xref2cu1_t b0, xref2cu1_t buf, u2_t len) {
+    const aes_sched_t *s = aesschedule(key);
+    u4_t x[4] = {0, 0, 0, 0};
+    const u4_t *k;
+    u1_t last[16];
+    int i;
+
+    if( b0 && len == 0 ) {
+        // B0 is the only, complete, block
+        buf = b0;
+        len = 16;
+        b0 = NULL;
+    }
+
+    if( b0 ) {
+        for( i=0; i<4; i++ ) {
+            x[i] = msbf4_read(b0+4*i);
+        }
+        aesblock(s, x);
+    }
+
+    while( len > 16 ) {
+        for( i=0; i<4; i++ ) {
+            x[i] ^= msbf4_read(buf+4*i);
+        }
+        aesblock(s, x);
+        buf += 16;
+        len -= 16;
+    }
+
+    // last block, xored with K1 if complete, padded and xored with K2 if not
+    k = s->k1;
+    if( len < 16 ) {
+        os_clearMem(last, 16);
+        os_copyMem(last, buf, len);
+        last[len] = 0x80;
+        buf = last;
+        k = s->k2;
+    }
+
+    for( i=0; i<4; i++ ) {
+        x[i] ^= msbf4_read(buf+4*i) ^ k[i];
+    }
+    aesblock(s, x);
+
+    return x[0];
+}
+
+u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
+        const aes_sched_t *s;
+        u4_t a[4] = {0, 0, 0, 0};
+        int i;
+
+        if( mode & AES_MIC ) {
+            return os_aes_cmac(AESkey, (mode & AES_MICNOAUX) ? NULL : AESaux, buf, len);
+        }
+
+        if( mode & AES_CTR ) {
+            os_aes_ctr(AESkey, AESaux, buf, len);
+            return 0;
+        }
+
+        // ECB
+        s = aesschedule(AESkey);
+        for( ; len >= 16; buf += 16, len -= 16 ) {
+            for( i=0; i<4; i++ ) {
+                a[i] = msbf4_read(buf+4*i);
             }
 
-            // update block state
-            if( (mode & AES_MIC)==0 || (mode & AES_MICNOAUX) ) {
-                buf += 16;
-                len -= 16;
+            aesblock(s, a);
+
+            for( i=0; i<4; i++ ) {
+                msbf4_write(buf+4*i, a[i]);
             }
-            mode |= AES_MICNOAUX;
         }
-        return AESAUX[0];
+
+        return a[0];
 }
 
 #endif
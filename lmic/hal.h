@@ -50,6 +50,21 @@ void hal_pin_rst (u1_t val);
  */
 u1_t hal_spi (u1_t outval);
 
+/*
+ * perform a burst SPI transaction with radio, in a single NSS cycle.
+ *   - write address byte 'addr'
+ *   - write 'len' bytes from 'buf' (hal_spi_write), or read 'len' bytes
+ *     into 'buf' (hal_spi_read)
+ */
+void hal_spi_write (u1_t addr, const u1_t *buf, u1_t len);
+void hal_spi_read (u1_t addr, u1_t *buf, u1_t len);
+
+/*
+ * handle the radio DIO edges signaled by the DIO interrupt, in the run
+ * loop context. Called by os_runloop on each iteration.
+ */
+void hal_io_check (void);
+
 /*
  * disable all CPU interrupts.
  *   - might be invoked nested
@@ -72,13 +87,19 @@ void hal_resume(void);
  */
 void hal_sleep (void);
 
+/*
+ * sleep until specified timestamp (in ticks) is reached, or until resumed.
+ */
+void hal_sleepUntil (u8_t time);
+
 /*
  * return 32-bit system time in ticks.
  */
 u8_t hal_ticks (void);
 
 /*
- * busy-wait until specified timestamp (in ticks) is reached.
+ * wait until specified timestamp (in ticks) is reached, sleeping if it's far
+ * and busy-waiting the last ticks.
  */
 void hal_waitUntil (u8_t time);
 
@@ -241,16 +241,14 @@ static void micB0 (u4_t devaddr, u4_t seqno, int dndir, int len) {
 
 static int aes_verifyMic (xref2cu1_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t pdu, int len) {
     micB0(devaddr, seqno, dndir, len);
-    os_copyMem(AESkey,key,16);
-    return os_aes(AES_MIC, pdu, len) == os_rmsbf4(pdu+len);
+    return os_aes_cmac(key, AESaux, pdu, len) == os_rmsbf4(pdu+len);
 }
 
 
 static void aes_appendMic (xref2cu1_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t pdu, int len) {
     micB0(devaddr, seqno, dndir, len);
-    os_copyMem(AESkey,key,16);
     // MSB because of internal structure of AES
-    os_wmsbf4(pdu+len, os_aes(AES_MIC, pdu, len));
+    os_wmsbf4(pdu+len, os_aes_cmac(key, AESaux, pdu, len));
 }
 
 
@@ -280,8 +278,7 @@ static void aes_cipher (xref2cu1_t key, u4_t devaddr, u4_t seqno, int dndir, xre
     AESaux[5] = dndir?1:0;
     os_wlsbf4(AESaux+ 6,devaddr);
     os_wlsbf4(AESaux+10,seqno);
-    os_copyMem(AESkey,key,16);
-    os_aes(AES_CTR, payload, len);
+    os_aes_ctr(key, AESaux, payload, len);
 }
 
 
@@ -569,7 +566,7 @@ static ostime_t rndDelay (u1_t secSpan) {
 
 static void txDelay (ostime_t reftime, u1_t secSpan) {
     reftime += rndDelay(secSpan);
-    if( LMIC.globalDutyRate == 0  ||  (reftime - LMIC.globalDutyAvail) > 0 ) {
+    if( LMIC.globalDutyRate == 0  ||  (s8_t)(reftime - LMIC.globalDutyAvail) > 0 ) {
         LMIC.globalDutyAvail = reftime;
         LMIC.opmode |= OP_RNDTX;
     }
@@ -740,7 +737,7 @@ static ostime_t nextTx (ostime_t now) {
         ostime_t mintime = now + /*8h*/sec2osticks(28800);
         u1_t band=0;
         for( u1_t bi=0; bi<4; bi++ ) {
-        	if( (bmap & (1<<bi)) && mintime - LMIC.bands[bi].avail > 0 )
+        	if( (bmap & (1<<bi)) && (s8_t)(mintime - LMIC.bands[bi].avail) > 0 )
                 mintime = LMIC.bands[band = bi].avail;
         }
 
@@ -764,6 +761,40 @@ static ostime_t nextTx (ostime_t now) {
     } while(1);
 }
 
+// earliest time the duty cycle of its band allows a TX on channel chnl,
+// returns 0 if channel is disabled or doesn't support the current DR
+static bit_t chnlAvail (u1_t chnl, ostime_t* time) {
+    if( chnl >= MAX_CHANNELS ||
+        (LMIC.channelMap & (1<<chnl)) == 0 ||
+        (LMIC.channelDrMap[chnl] & (1<<(LMIC.datarate&0xF))) == 0 )
+        return 0;
+    *time = LMIC.bands[LMIC.channelFreq[chnl] & 0x3].avail;
+    return 1;
+}
+
+// TX airtime the band duty cycles allow between now and now+window
+static ostime_t bandBudget (ostime_t now, ostime_t window) {
+    ostime_t budget = 0;
+    ostime_t t;
+    u1_t bmap = 0;
+
+    // bands with a usable channel
+    for( u1_t ci=0; ci<MAX_CHANNELS; ci++ ) {
+        if( chnlAvail(ci, &t) )
+            bmap |= 1 << (LMIC.channelFreq[ci] & 0x3);
+    }
+    for( u1_t bi=0; bi<MAX_BANDS; bi++ ) {
+        if( (bmap & (1<<bi)) == 0 )
+            continue;
+        // each TX blocks the band for airtime*txcap
+        s8_t wait = (s8_t)(LMIC.bands[bi].avail - now);
+        s8_t free = (s8_t)window - (wait > 0 ? wait : 0);
+        if( free > 0 )
+            budget += free / (LMIC.bands[bi].txcap ? LMIC.bands[bi].txcap : 1);
+    }
+    return budget;
+}
+
 
 #if !defined(DISABLE_BEACONS)
 static void setBcnRxParams (void) {
@@ -955,6 +986,27 @@ static void _nextTx (void) {
     // No feasible channel  found! Keep old one.
 }
 
+// US does not have duty cycling - a channel is available now if it's
+// enabled and supports the current DR
+static bit_t chnlAvail (u1_t chnl, ostime_t* time) {
+    if( chnl >= MAX_TXCHANNELS ||
+        (LMIC.channelMap[chnl >> 4] & (1<<(chnl & 0xF))) == 0 )
+        return 0;
+    if( chnl < 64 ) {
+        if( LMIC.datarate >= DR_SF8C )
+            return 0;
+    } else if( chnl < 64+8 ) {
+        if( LMIC.datarate != DR_SF8C )
+            return 0;
+    } else if( (LMIC.xchDrMap[chnl-72] & (1<<(LMIC.datarate&0xF))) == 0 ) {
+        return 0;
+    }
+    *time = os_getTime();
+    return 1;
+}
+
+#define bandBudget(now,window) (window)
+
 #if !defined(DISABLE_BEACONS)
 static void setBcnRxParams (void) {
     LMIC.dataLen = 0;
@@ -1704,6 +1756,40 @@ static void updataDone (xref2osjob_t osjob) {
 // ========================================
 
 
+// length of the MAC options that buildDataFrame will piggyback
+static u1_t pendOptsLen (void) {
+    u1_t len = 0;
+#if !defined(DISABLE_PING)
+    if( (LMIC.opmode & (OP_TRACK|OP_PINGABLE)) == (OP_TRACK|OP_PINGABLE) )
+        len += 2;
+#endif // !DISABLE_PING
+#if !defined(DISABLE_MCMD_DCAP_REQ)
+    if( LMIC.dutyCapAns )
+        len += 1;
+#endif // !DISABLE_MCMD_DCAP_REQ
+#if !defined(DISABLE_MCMD_DN2P_SET)
+    if( LMIC.dn2Ans )
+        len += 2;
+#endif // !DISABLE_MCMD_DN2P_SET
+    if( LMIC.devsAns )
+        len += 3;
+    if( LMIC.ladrAns )
+        len += 2;
+#if !defined(DISABLE_BEACONS)
+    if( LMIC.bcninfoTries > 0 )
+        len += 1;
+#endif // !DISABLE_BEACONS
+#if !defined(DISABLE_MCMD_PING_SET) && !defined(DISABLE_PING)
+    if( LMIC.pingSetAns != 0 )
+        len += 2;
+#endif // !DISABLE_MCMD_PING_SET && !DISABLE_PING
+#if !defined(DISABLE_MCMD_SNCH_REQ)
+    if( LMIC.snchAns )
+        len += 2;
+#endif // !DISABLE_MCMD_SNCH_REQ
+    return len;
+}
+
 static void buildDataFrame (void) {
     bit_t txdata = ((LMIC.opmode & (OP_TXDATA|OP_POLL)) != OP_POLL);
     u1_t dlen = txdata ? LMIC.pendTxLen : 0;
@@ -2301,6 +2387,9 @@ void LMIC_shutdown (void) {
 
 
 void LMIC_reset (void) {
+    // Retransmission attempts are a device setting, not session state
+    u1_t txAttempts = LMIC.txAttempts;
+
     EV(devCond, INFO, (e_.reason = EV::devCond_t::LMIC_EV,
                        e_.eui    = MAIN::CDEV->getEui(),
                        e_.info   = EV_RESET));
@@ -2308,6 +2397,7 @@ void LMIC_reset (void) {
     os_clearCallback(&LMIC.osjob);
 
     os_clearMem((xref2u1_t)&LMIC,SIZEOFEXPR(LMIC));
+    LMIC.txAttempts   =  txAttempts;
     LMIC.devaddr      =  0;
     LMIC.devNonce     =  os_getRndU2();
     LMIC.opmode       =  OP_NONE;
@@ -2375,6 +2465,67 @@ int LMIC_setTxData2 (u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed) {
 }
 
 
+// Earliest time a frame can be sent on channel chnl, at the current DR.
+// Returns 0 if the channel can't be used at the current DR.
+bit_t LMIC_queryChannel (u1_t chnl, ostime_t* time) {
+    ostime_t now = os_getTime();
+    ostime_t t;
+
+    if( !chnlAvail(chnl, &t) )
+        return 0;
+    if( LMIC.globalDutyRate != 0 && (s8_t)(LMIC.globalDutyAvail - t) > 0 )
+        t = LMIC.globalDutyAvail;
+    *time = (s8_t)(t - now) > 0 ? t : now;
+    return 1;
+}
+
+// Earliest time a frame can be sent on any channel, at the current DR.
+// Returns 0 if no channel can be used at the current DR.
+bit_t LMIC_nextTxTime (ostime_t* time) {
+    bit_t found = 0;
+    ostime_t t;
+
+    for( u1_t chnl=0; chnl<MAX_TXCHANNELS; chnl++ ) {
+        if( LMIC_queryChannel(chnl, &t) && (!found || (s8_t)(t - *time) < 0) ) {
+            *time = t;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+// Max application payload length of a frame at the current DR,
+// taking into account the MAC options pending to be sent
+u1_t LMIC_maxPayload (void) {
+    int len = maxFrameLen(LMIC.datarate);
+
+    if( len > MAX_LEN_FRAME )
+        len = MAX_LEN_FRAME;
+    len -= OFF_DAT_OPTS + pendOptsLen() + 1 + 4; // port, MIC
+    return len > 0 ? len : 0;
+}
+
+// Airtime of a frame with an application payload of dlen bytes, at the current DR
+ostime_t LMIC_txAirtime (u1_t dlen) {
+    return calcAirTime(updr2rps(LMIC.datarate), OFF_DAT_OPTS + pendOptsLen() + 1 + dlen + 4);
+}
+
+// TX airtime the duty cycle limits allow between now and now+window
+ostime_t LMIC_airtimeBudget (ostime_t window) {
+    ostime_t now = os_getTime();
+    ostime_t budget = bandBudget(now, window);
+
+    if( LMIC.globalDutyRate != 0 ) {
+        s8_t wait = (s8_t)(LMIC.globalDutyAvail - now);
+        s8_t free = (s8_t)window - (wait > 0 ? wait : 0);
+        ostime_t global = free > 0 ? (ostime_t)free >> LMIC.globalDutyRate : 0;
+        if( global < budget )
+            budget = global;
+    }
+    return budget;
+}
+
+
 // Send a payload-less message to signal device is alive
 void LMIC_sendAlive (void) {
     LMIC.opmode |= OP_POLL;
@@ -54,6 +54,7 @@ enum { MAX_CHANNELS = 16 };      //!< Max supported channels
 enum { MAX_BANDS    =  4 };
 
 enum { LIMIT_CHANNELS = (1<<4) };   // EU868 will never have more channels
+enum { MAX_TXCHANNELS = MAX_CHANNELS };
 //! \internal
 struct band_t {
     u2_t     txcap;     // duty cycle limitation: 1/txcap
@@ -66,6 +67,7 @@ TYPEDEF_xref2band_t; //!< \internal
 #elif defined(CFG_us915)  // US915 spectrum =================================================
 
 enum { MAX_XCHANNELS = 2 };      // extra channels in RAM, channels 0-71 are immutable
+enum { MAX_TXCHANNELS = 72+MAX_XCHANNELS };
 enum { MAX_TXPOW_125kHz = 30 };
 
 #endif // ==========================================================================
@@ -296,6 +298,13 @@ void  LMIC_setTxData    (void);
 int   LMIC_setTxData2   (u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed);
 void  LMIC_sendAlive    (void);
 
+// Uplink planning, at the current DR
+bit_t    LMIC_queryChannel  (u1_t chnl, ostime_t* time); // earliest TX time on channel
+bit_t    LMIC_nextTxTime    (ostime_t* time);            // earliest TX time on any channel
+u1_t     LMIC_maxPayload    (void);                      // max application payload
+ostime_t LMIC_txAirtime     (u1_t dlen);                 // airtime of dlen bytes payload
+ostime_t LMIC_airtimeBudget (ostime_t window);           // TX airtime allowed within window
+
 #if !defined(DISABLE_BEACONS)
 bit_t LMIC_enableTracking  (u1_t tryBcnInfo);
 void  LMIC_disableTracking (void);
@@ -22,6 +22,8 @@
 
 #include "esp_attr.h"
 
+#include <stdlib.h>
+#include <string.h>
 #include <sys/syslog.h>
 #include <sys/driver.h>
 
@@ -35,16 +37,38 @@ void *os_runloop(void *pvParameters);
 // Task handle for LMIC run loop
 TaskHandle_t xRunLoop = NULL;
 
+// Timed jobs that fit in the heap before it has to grow
+#define OS_TIMED_JOBS 16
+
+// Deadline a is before deadline b (cmp diff, not abs!)
+#define before(a, b) ((s8_t)((a) - (b)) < 0)
+
+// Initial storage of the timed jobs heap
+static osjob_t* initialjobs[OS_TIMED_JOBS];
+
 // RUNTIME STATE
 static struct {
-    osjob_t* scheduledjobs;
-    osjob_t* runnablejobs;
-} OS;
+    osjob_t** scheduledjobs; // min-heap by deadline
+    u2_t     nscheduled;
+    u2_t     maxscheduled;   // heap size, doubled when it's full
+    osjob_t* runnablejobs;   // FIFO
+    osjob_t* lastrunnable;
+    osstats_t stats;
+} OS = {
+    .scheduledjobs = initialjobs,
+    .maxscheduled = OS_TIMED_JOBS
+};
 
 driver_error_t *os_init () {
 	driver_error_t *error;
 
+    if (OS.scheduledjobs != initialjobs) {
+        free(OS.scheduledjobs);
+    }
+
     memset(&OS, 0x00, sizeof(OS));
+    OS.scheduledjobs = initialjobs;
+    OS.maxscheduled = OS_TIMED_JOBS;
 
     if ((error = hal_init())) {
     	return error;
@@ -85,10 +109,91 @@ driver_error_t *os_init () {
     return NULL;
 }
 
-static u1_t unlinkjob (osjob_t** pnext, osjob_t* job) {
-    for( ; *pnext; pnext = &((*pnext)->next)) {
-        if(*pnext == job) { // unlink
-            *pnext = job->next;
+// place job at heap position idx
+static inline void IRAM_ATTR heapset (u2_t idx, osjob_t* job) {
+    OS.scheduledjobs[idx] = job;
+    job->heapidx = idx;
+}
+
+// move job at heap position idx up or down until heap is ordered again
+static void IRAM_ATTR heapfix (u2_t idx) {
+    osjob_t* job = OS.scheduledjobs[idx];
+    u2_t child;
+
+    while( idx > 0 && before(job->deadline, OS.scheduledjobs[(idx - 1) / 2]->deadline) ) {
+        heapset(idx, OS.scheduledjobs[(idx - 1) / 2]);
+        idx = (idx - 1) / 2;
+    }
+
+    while( (child = 2 * idx + 1) < OS.nscheduled ) {
+        if( child + 1 < OS.nscheduled &&
+            before(OS.scheduledjobs[child + 1]->deadline, OS.scheduledjobs[child]->deadline) ) {
+            child++;
+        }
+        if( !before(OS.scheduledjobs[child]->deadline, job->deadline) ) {
+            break;
+        }
+        heapset(idx, OS.scheduledjobs[child]);
+        idx = child;
+    }
+
+    heapset(idx, job);
+}
+
+// remove job at heap position idx
+static void IRAM_ATTR heapremove (u2_t idx) {
+    if( idx != --OS.nscheduled ) {
+        heapset(idx, OS.scheduledjobs[OS.nscheduled]);
+        heapfix(idx);
+    }
+}
+
+// double the heap size, called with IRQs disabled, that are enabled while
+// memory is allocated and freed
+static void heapgrow (void) {
+    u2_t max = OS.maxscheduled * 2;
+    osjob_t** jobs;
+
+    hal_enableIRQs();
+    jobs = (osjob_t**)malloc(max * sizeof(osjob_t*));
+    if( !jobs ) {
+        hal_failed(__FILE__, __LINE__);
+    }
+    hal_disableIRQs();
+
+    // the heap may have grown meanwhile
+    if( OS.maxscheduled < max ) {
+        memcpy(jobs, OS.scheduledjobs, OS.nscheduled * sizeof(osjob_t*));
+        if( OS.scheduledjobs != initialjobs ) {
+            osjob_t** old = OS.scheduledjobs;
+            OS.scheduledjobs = jobs;
+            jobs = old;
+        } else {
+            OS.scheduledjobs = jobs;
+            jobs = NULL;
+        }
+        OS.maxscheduled = max;
+    }
+
+    hal_enableIRQs();
+    free(jobs);
+    hal_disableIRQs();
+}
+
+static u1_t IRAM_ATTR unlinkjob (osjob_t* job) {
+    osjob_t* prev = NULL;
+    osjob_t* cur;
+
+    for( cur = OS.runnablejobs; cur; prev = cur, cur = cur->next ) {
+        if( cur == job ) { // unlink
+            if( prev ) {
+                prev->next = job->next;
+            } else {
+                OS.runnablejobs = job->next;
+            }
+            if( OS.lastrunnable == job ) {
+                OS.lastrunnable = prev;
+            }
             return 1;
         }
     }
@@ -98,14 +203,16 @@ static u1_t unlinkjob (osjob_t** pnext, osjob_t* job) {
 // clear scheduled job
 void IRAM_ATTR os_clearCallback (osjob_t* job) {
     hal_disableIRQs();
-    unlinkjob(&OS.scheduledjobs, job);
-	unlinkjob(&OS.runnablejobs, job);
+    if( job->heapidx < OS.nscheduled && OS.scheduledjobs[job->heapidx] == job ) {
+        heapremove(job->heapidx);
+    } else {
+        unlinkjob(job);
+    }
     hal_enableIRQs();
 }
 
 // schedule immediately runnable job
 void IRAM_ATTR os_setCallback (osjob_t* job, osjobcb_t cb) {
-    osjob_t** pnext;
     hal_disableIRQs();
     // remove if job was already queued
     os_clearCallback(job);
@@ -113,16 +220,23 @@ void IRAM_ATTR os_setCallback (osjob_t* job, osjobcb_t cb) {
     job->func = cb;
     job->next = NULL;
     // add to end of run queue
-    for(pnext=&OS.runnablejobs; *pnext; pnext=&((*pnext)->next));
-    *pnext = job;
+    if( OS.lastrunnable ) {
+        OS.lastrunnable->next = job;
+    } else {
+        OS.runnablejobs = job;
+    }
+    OS.lastrunnable = job;
     hal_enableIRQs();
     hal_resume();
 }
 
 // schedule timed job
 void os_setTimedCallback (osjob_t* job, ostime_t time, osjobcb_t cb) {
-    osjob_t** pnext;
     hal_disableIRQs();
+    // make room for one more job
+    while( OS.nscheduled >= OS.maxscheduled ) {
+        heapgrow();
+    }
     // remove if job was already queued
     os_clearCallback(job);
     // fill-in job
@@ -130,43 +244,91 @@ void os_setTimedCallback (osjob_t* job, ostime_t time, osjobcb_t cb) {
     job->func = cb;
     job->next = NULL;
     // insert into schedule
-    for(pnext=&OS.scheduledjobs; *pnext; pnext=&((*pnext)->next)) {
-        if((*pnext)->deadline - time > 0) { // (cmp diff, not abs!)
-            // enqueue before next element and stop
-            job->next = *pnext;
-            break;
-        }
+    heapset(OS.nscheduled, job);
+    heapfix(OS.nscheduled++);
+    hal_enableIRQs();
+    // run loop may be sleeping until a later deadline
+    hal_resume();
+}
+
+// account an rx window started now, that was due at rxtime
+void os_rxStarted (ostime_t rxtime) {
+    ostime_t late = os_getTime() - rxtime;
+
+    OS.stats.rxwindows++;
+    OS.stats.rxsumlate += late;
+    if( late > OS.stats.rxmaxlate ) {
+        OS.stats.rxmaxlate = late;
     }
-    *pnext = job;
+}
+
+// account a radio irq, signaled by a DIO edge at tref, handled now
+void os_irqDone (ostime_t tref) {
+    ostime_t late = os_getTime() - tref;
+
+    OS.stats.irqs++;
+    OS.stats.irqsumlate += late;
+    if( late > OS.stats.irqmaxlate ) {
+        OS.stats.irqmaxlate = late;
+    }
+}
+
+void os_getStats (osstats_t *stats) {
+    hal_disableIRQs();
+    *stats = OS.stats;
     hal_enableIRQs();
-	hal_resume();
 }
 
 // LMIC run loop, as a FreeRTOS task
 void *os_runloop(void *pvParameters) {
+	osjob_t *j;
+	ostime_t now, late, next = 0;
+	u1_t timed;
+
+	xRunLoop = xTaskGetCurrentTaskHandle();
+
 	for(;;) {
-	    osjob_t *j = NULL;
+	    j = NULL;
+
+	    // handle radio irqs, the MAC callback is queued as a runnable job
+	    hal_io_check();
 
 	    hal_disableIRQs();
 
 	    // check for runnable jobs
-		j = NULL;
 	    if(OS.runnablejobs) {
 	        j = OS.runnablejobs;
 	        OS.runnablejobs = j->next;
-	    } else if(OS.scheduledjobs && hal_checkTimer(OS.scheduledjobs->deadline)) { // check for expired timed jobs
-	        j = OS.scheduledjobs;
-	        OS.scheduledjobs = j->next;
+	        if (!OS.runnablejobs) {
+	            OS.lastrunnable = NULL;
+	        }
+	    } else if(OS.nscheduled) { // check for expired timed jobs
+	        now = os_getTime();
+	        next = OS.scheduledjobs[0]->deadline;
+	        if (!before(now, next)) {
+	            j = OS.scheduledjobs[0];
+	            heapremove(0);
+
+	            late = now - j->deadline;
+	            OS.stats.jobs++;
+	            OS.stats.jobsumlate += late;
+	            if (late > OS.stats.jobmaxlate) {
+	                OS.stats.jobmaxlate = late;
+	            }
+	        }
 	    }
 
+	    timed = OS.nscheduled;
+
 	    hal_enableIRQs();
 
 	    if (j) { // run job callback
 	        j->func(j);
+	    } else if (timed) {
+	        // sleep until next deadline, or until a job is scheduled
+	        hal_sleepUntil(next);
 	    } else {
-	    	if (!OS.scheduledjobs) {
-	    		hal_sleep();
-	    	}
+	        hal_sleep();
 	    }
 	}
 
@@ -89,7 +89,6 @@ u1_t radio_rand1 (void);
 #define DECLARE_LMIC extern struct lmic_t LMIC
 
 int  radio_init (void);
-void radio_irq_handler (u1_t dio);
 driver_error_t *os_init (void);
 void *os_runloop(void * pvParameters);
 
@@ -131,9 +130,23 @@ struct osjob_t {
     struct osjob_t* next;
     ostime_t deadline;
     osjobcb_t  func;
+    u2_t heapidx;  // position in the timed jobs heap, only valid while scheduled
 };
 TYPEDEF_xref2osjob_t;
 
+// Scheduler timing statistics, in ticks
+typedef struct {
+    u4_t     jobs;        // timed jobs run
+    ostime_t jobmaxlate;  // max delay from deadline to job start
+    ostime_t jobsumlate;
+    u4_t     rxwindows;   // rx windows opened
+    ostime_t rxmaxlate;   // max delay from rx time to rx start
+    ostime_t rxsumlate;
+    u4_t     irqs;        // radio irqs handled
+    ostime_t irqmaxlate;  // max delay from DIO edge to MAC callback queued
+    ostime_t irqsumlate;
+} osstats_t;
+
 
 #ifndef HAS_os_calls
 
@@ -155,6 +168,16 @@ void os_setTimedCallback (xref2osjob_t job, ostime_t time, osjobcb_t cb);
 #ifndef os_clearCallback
 void os_clearCallback (xref2osjob_t job);
 #endif
+#ifndef os_rxStarted
+void os_rxStarted (ostime_t rxtime);
+#endif
+#ifndef os_irqDone
+void os_irqDone (ostime_t tref);
+#endif
+void radio_irq_handler (u1_t dio, ostime_t tref);
+#ifndef os_getStats
+void os_getStats (osstats_t *stats);
+#endif
 #ifndef os_getTime
 #define os_getTime() hal_ticks()
 #endif
@@ -283,6 +306,14 @@ extern xref2u1_t AESaux;
 #ifndef os_aes
 u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len);
 #endif
+#ifndef os_aes_ctr
+// encrypt / decrypt len bytes of buf in place, ctr is the first counter block
+void os_aes_ctr (xref2cu1_t key, xref2cu1_t ctr, xref2u1_t buf, u2_t len);
+#endif
+#ifndef os_aes_cmac
+// CMAC of b0 (if not NULL) followed by len bytes of buf, first 4 bytes in MSBF
+u4_t os_aes_cmac (xref2cu1_t key, xref2cu1_t b0, xref2cu1_t buf, u2_t len);
+#endif
 
 #ifdef __cplusplus
 } // extern "C"
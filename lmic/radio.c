@@ -284,21 +284,11 @@ static u1_t IRAM_ATTR readReg (u1_t addr) {
 }
 
 static void writeBuf (u1_t addr, xref2u1_t buf, u1_t len) {
-    hal_pin_nss(0);
-    hal_spi(addr | 0x80);
-    for (u1_t i=0; i<len; i++) {
-        hal_spi(buf[i]);
-    }
-    hal_pin_nss(1);
+    hal_spi_write(addr | 0x80, buf, len);
 }
 
 static void IRAM_ATTR readBuf (u1_t addr, xref2u1_t buf, u1_t len) {
-    hal_pin_nss(0);
-    hal_spi(addr & 0x7F);
-    for (u1_t i=0; i<len; i++) {
-        buf[i] = hal_spi(0x00);
-    }
-    hal_pin_nss(1);
+    hal_spi_read(addr & 0x7F, buf, len);
 }
 
 static void IRAM_ATTR opmode (u1_t mode) {
@@ -348,14 +338,14 @@ static void configLoraModem () {
             mc1 |= SX1276_MC1_IMPLICIT_HEADER_MODE_ON;
             writeReg(LORARegPayloadLength, getIh(LMIC.rps)); // required length
         }
-        // set ModemConfig1
-        writeReg(LORARegModemConfig1, mc1);
-
         mc2 = (SX1272_MC2_SF7 + ((sf-1)<<4));
         if (getNocrc(LMIC.rps) == 0) {
             mc2 |= SX1276_MC2_RX_PAYLOAD_CRCON;
         }
-        writeReg(LORARegModemConfig2, mc2);
+
+        // set ModemConfig1, ModemConfig2
+        u1_t mc[2] = {mc1, mc2};
+        writeBuf(LORARegModemConfig1, mc, 2);
 
         mc3 = SX1276_MC3_AGCAUTO;
         if ((sf == SF11 || sf == SF12) && getBw(LMIC.rps) == BW125) {
@@ -384,11 +374,9 @@ static void configLoraModem () {
             mc1 |= SX1272_MC1_IMPLICIT_HEADER_MODE_ON;
             writeReg(LORARegPayloadLength, getIh(LMIC.rps)); // required length
         }
-        // set ModemConfig1
-        writeReg(LORARegModemConfig1, mc1);
-
-        // set ModemConfig2 (sf, AgcAutoOn=1 SymbTimeoutHi=00)
-        writeReg(LORARegModemConfig2, (SX1272_MC2_SF7 + ((sf-1)<<4)) | 0x04);
+        // set ModemConfig1, ModemConfig2 (sf, AgcAutoOn=1 SymbTimeoutHi=00)
+        u1_t mc[2] = {mc1, (SX1272_MC2_SF7 + ((sf-1)<<4)) | 0x04};
+        writeBuf(LORARegModemConfig1, mc, 2);
 #else
 #error Missing CFG_sx1272_radio/CFG_sx1276_radio
 #endif /* CFG_sx1272_radio */
@@ -397,9 +385,10 @@ static void configLoraModem () {
 static void configChannel () {
     // set frequency: FQ = (FRF * 32 Mhz) / (2 ^ 19)
     uint64_t frf = ((uint64_t)LMIC.freq << 19) / 32000000;
-    writeReg(RegFrfMsb, (u1_t)(frf>>16));
-    writeReg(RegFrfMid, (u1_t)(frf>> 8));
-    writeReg(RegFrfLsb, (u1_t)(frf>> 0));
+    u1_t regs[3] = {(u1_t)(frf>>16), (u1_t)(frf>> 8), (u1_t)(frf>> 0)};
+
+    // RegFrfMsb, RegFrfMid, RegFrfLsb
+    writeBuf(RegFrfMsb, regs, 3);
 }
 
 
@@ -494,14 +483,14 @@ static void txlora () {
 
     // set the IRQ mapping DIO0=TxDone DIO1=NOP DIO2=NOP
     writeReg(RegDioMapping1, MAP_DIO0_LORA_TXDONE|MAP_DIO1_LORA_NOP|MAP_DIO2_LORA_NOP);
-    // clear all radio IRQ flags
-    writeReg(LORARegIrqFlags, 0xFF);
-    // mask all IRQs but TxDone
-    writeReg(LORARegIrqFlagsMask, ~IRQ_LORA_TXDONE_MASK);
+    // mask all IRQs but TxDone, clear all radio IRQ flags
+    u1_t irq[2] = {(u1_t)~IRQ_LORA_TXDONE_MASK, 0xFF};
+    writeBuf(LORARegIrqFlagsMask, irq, 2);
 
     // initialize the payload size and address pointers
-    writeReg(LORARegFifoTxBaseAddr, 0x00);
-    writeReg(LORARegFifoAddrPtr, 0x00);
+    // (LORARegFifoAddrPtr, LORARegFifoTxBaseAddr)
+    u1_t ptr[2] = {0x00, 0x00};
+    writeBuf(LORARegFifoAddrPtr, ptr, 2);
     writeReg(LORARegPayloadLength, LMIC.dataLen);
 
     // download buffer to the radio FIFO
@@ -578,18 +567,18 @@ static void rxlora (u1_t rxmode) {
 
     // configure DIO mapping DIO0=RxDone DIO1=RxTout DIO2=NOP
     writeReg(RegDioMapping1, MAP_DIO0_LORA_RXDONE|MAP_DIO1_LORA_RXTOUT|MAP_DIO2_LORA_NOP);
-    // clear all radio IRQ flags
-    writeReg(LORARegIrqFlags, 0xFF);
-    // enable required radio IRQs
-    writeReg(LORARegIrqFlagsMask, ~TABLE_GET_U1(rxlorairqmask, rxmode));
+    // enable required radio IRQs, clear all radio IRQ flags
+    u1_t irq[2] = {(u1_t)~TABLE_GET_U1(rxlorairqmask, rxmode), 0xFF};
+    writeBuf(LORARegIrqFlagsMask, irq, 2);
 
     // enable antenna switch for RX
     hal_pin_rxtx(0);
 
     // now instruct the radio to receive
     if (rxmode == RXMODE_SINGLE) { // single rx
-        hal_waitUntil(LMIC.rxtime); // busy wait until exact rx time
+        hal_waitUntil(LMIC.rxtime); // wait until exact rx time
         opmode(OPMODE_RX_SINGLE);
+        os_rxStarted(LMIC.rxtime);
     } else { // continous rx (scan or rssi)
         opmode(OPMODE_RX);
     }
@@ -660,8 +649,9 @@ static void rxfsk (u1_t rxmode) {
     hal_pin_rxtx(0);
 
     // now instruct the radio to receive
-    hal_waitUntil(LMIC.rxtime); // busy wait until exact rx time
+    hal_waitUntil(LMIC.rxtime); // wait until exact rx time
     opmode(OPMODE_RX); // no single rx mode available in FSK
+    os_rxStarted(LMIC.rxtime);
 }
 
 static void startrx (u1_t rxmode) {
@@ -775,12 +765,15 @@ static CONST_TABLE(u2_t, LORA_RXDONE_FIXUP)[] = {
     [SF12] = us2osticks(31189), // (1022 ticks)
 };
 
-// called by hal ext IRQ handler
+// called by hal in the run loop, for a DIO edge signaled at time tref
 // (radio goes to stanby mode after tx/rx operations)
-void radio_irq_handler (u1_t dio) {
-    ostime_t now = os_getTime();
+void radio_irq_handler (u1_t dio, ostime_t tref) {
+    ostime_t now = tref;
     if( (readReg(RegOpMode) & OPMODE_LORA) != 0) { // LORA modem
-        u1_t flags = readReg(LORARegIrqFlags);
+        // LORARegFifoRxCurrentAddr, LORARegIrqFlagsMask, LORARegIrqFlags, LORARegRxNbBytes
+        u1_t regs[4];
+        readBuf(LORARegFifoRxCurrentAddr, regs, 4);
+        u1_t flags = regs[2];
         if( flags & IRQ_LORA_TXDONE_MASK ) {
             // save exact tx time
             LMIC.txend = now - us2osticks(43); // TXDONE FIXUP
@@ -792,22 +785,22 @@ void radio_irq_handler (u1_t dio) {
             LMIC.rxtime = now;
             // read the PDU and inform the MAC that we received something
             LMIC.dataLen = (readReg(LORARegModemConfig1) & SX1272_MC1_IMPLICIT_HEADER_MODE_ON) ?
-                readReg(LORARegPayloadLength) : readReg(LORARegRxNbBytes);
+                readReg(LORARegPayloadLength) : regs[3];
             // set FIFO read address pointer
-            writeReg(LORARegFifoAddrPtr, readReg(LORARegFifoRxCurrentAddr));
+            writeReg(LORARegFifoAddrPtr, regs[0]);
             // now read the FIFO
             readBuf(RegFifo, LMIC.frame, LMIC.dataLen);
-            // read rx quality parameters
-            LMIC.snr  = readReg(LORARegPktSnrValue); // SNR [dB] * 4
-            LMIC.rssi = readReg(LORARegPktRssiValue) - 125 + 64; // RSSI [dBm] (-196...+63)
+            // read rx quality parameters (LORARegPktSnrValue, LORARegPktRssiValue)
+            readBuf(LORARegPktSnrValue, regs, 2);
+            LMIC.snr  = regs[0]; // SNR [dB] * 4
+            LMIC.rssi = regs[1] - 125 + 64; // RSSI [dBm] (-196...+63)
         } else if( flags & IRQ_LORA_RXTOUT_MASK ) {
             // indicate timeout
             LMIC.dataLen = 0;
         }
-        // mask all radio IRQs
-        writeReg(LORARegIrqFlagsMask, 0xFF);
-        // clear radio IRQ flags
-        writeReg(LORARegIrqFlags, 0xFF);
+        // mask all radio IRQs, clear radio IRQ flags
+        u1_t irq[2] = {0xFF, 0xFF};
+        writeBuf(LORARegIrqFlagsMask, irq, 2);
     } else { // FSK modem
         u1_t flags1 = readReg(FSKRegIrqFlags1);
         u1_t flags2 = readReg(FSKRegIrqFlags2);
@@ -835,6 +828,7 @@ void radio_irq_handler (u1_t dio) {
     opmode(OPMODE_SLEEP);
     // run os job (use preset func ptr)
     os_setCallback(&LMIC.osjob, LMIC.osjob.func);
+    os_irqDone(tref);
 }
 
 void os_radio (u1_t mode) {
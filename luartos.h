@@ -44,6 +44,7 @@
 #define LUA_USE_I2C CONFIG_LUA_RTOS_LUA_USE_I2C
 
 #define LUA_USE_THREAD CONFIG_LUA_RTOS_LUA_USE_THREAD
+#define LUA_USE_SCHED CONFIG_LUA_RTOS_LUA_USE_SCHED
 #define LUA_USE_NVS CONFIG_LUA_RTOS_LUA_USE_NVS
 #define LUA_USE_PACK CONFIG_LUA_RTOS_LUA_USE_PACK
 #define LUA_USE_PIO CONFIG_LUA_RTOS_LUA_USE_PIO
@@ -71,6 +72,10 @@
 #define LUA_USE_SERVO 1
 #define USE_SERVO LUA_USE_SERVO
 
+#define LUA_USE_BUFFER 1
+#define LUA_USE_ARRAY 1
+#define LUA_USE_JSON 1
+
 #define USE_NET_VFS USE_NET
 
 #if CONFIG_LUA_RTOS_USE_HTTP_SERVER
@@ -84,6 +89,42 @@
  */
 #define LUA_TASK_PRIORITY  CONFIG_LUA_RTOS_LUA_TASK_PRIORITY
 #define LUA_USE_ROTABLE	   1
+#if CONFIG_LUA_RTOS_LUA_USE_FROZEN
+#define LUA_USE_FROZEN	   1
+#else
+#define LUA_USE_FROZEN	   0
+#endif
+
+/* Threaded-code dispatch in the VM needs GCC's labels as values */
+#if defined(__GNUC__)
+#define LUA_USE_JUMPTABLE  1
+#else
+#define LUA_USE_JUMPTABLE  0
+#endif
+
+/* Superinstructions for common sequences of opcodes (see luaK_fuse) */
+#ifndef LUA_USE_SUPERINSTRUCTIONS
+#define LUA_USE_SUPERINSTRUCTIONS 1
+#endif
+
+#if CONFIG_LUA_RTOS_LUA_SAFE_SIGNAL
+#define LUA_USE_SAFE_SIGNAL 1
+#else
+#define LUA_USE_SAFE_SIGNAL 0
+#endif
+
+#if CONFIG_LUA_RTOS_LUA_BYTECODE_CACHE
+#define LUA_USE_BYTECODE_CACHE 1
+#define LUA_BYTECODE_CACHE_DIR CONFIG_LUA_RTOS_LUA_BYTECODE_CACHE_DIR
+#else
+#define LUA_USE_BYTECODE_CACHE 0
+#endif
+
+#if CONFIG_LUA_RTOS_LUA_BYTECODE_CACHE_STRIP
+#define LUA_BYTECODE_CACHE_STRIP 1
+#else
+#define LUA_BYTECODE_CACHE_STRIP 0
+#endif
 
 
 #if CONFIG_LUA_RTOS_USE_LED_ACT
@@ -232,4 +273,7 @@
 
 #define THREAD_LOCAL_STORAGE_POINTER_ID 1
 
+// Number of thread-specific data keys, stored in the Lua RTOS specific TCB parts
+#define PTHREAD_NKEYS 8
+
 #endif
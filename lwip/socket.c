@@ -50,6 +50,8 @@
 #include <stdint.h>
 #include <errno.h>
 
+#include <vfs.h>
+
 #if USE_NET_VFS
 #define fd_to_socket(fd) (fd & ((1 << CONFIG_MAX_FD_BITS) - 1))
 #else
@@ -258,3 +260,88 @@ int __wrap_lwip_socket(int domain, int type, int protocol) {
 
 	return s;
 }
+
+// Wait for the sockets marked with VFS_POLLSOCKET in a vfs_poll set, with a
+// single lwip select. Returns the number of ready sockets.
+int lwip_poll_sockets(struct vfs_pollfd *fds, int nfds, int timeout) {
+	fd_set rfds, wfds, efds;
+	struct timeval tv;
+	int i, s, res;
+	int maxs = -1;
+	int ready = 0;
+
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	FD_ZERO(&efds);
+
+	for(i=0;i < nfds;i++) {
+		if (!(fds[i].revents & VFS_POLLSOCKET)) {
+			continue;
+		}
+
+		s = fd_to_socket(fds[i].fd);
+		if (s >= FD_SETSIZE) {
+			fds[i].revents = VFS_POLLERR;
+			ready++;
+			continue;
+		}
+
+		if (fds[i].events & VFS_POLLIN) {
+			FD_SET(s, &rfds);
+		}
+
+		if (fds[i].events & VFS_POLLOUT) {
+			FD_SET(s, &wfds);
+		}
+
+		FD_SET(s, &efds);
+
+		if (s > maxs) {
+			maxs = s;
+		}
+	}
+
+	if (maxs < 0) {
+		return ready;
+	}
+
+	if (timeout >= 0) {
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+	}
+
+	// Sockets are already translated, so call lwip directly
+	res = __real_lwip_select(maxs + 1, &rfds, &wfds, &efds, (timeout >= 0)?&tv:NULL);
+
+	for(i=0;i < nfds;i++) {
+		if (!(fds[i].revents & VFS_POLLSOCKET)) {
+			continue;
+		}
+
+		s = fd_to_socket(fds[i].fd);
+
+		fds[i].revents = 0;
+
+		if (res < 0) {
+			fds[i].revents = VFS_POLLERR;
+		} else if (res > 0) {
+			if (FD_ISSET(s, &rfds)) {
+				fds[i].revents |= VFS_POLLIN;
+			}
+
+			if (FD_ISSET(s, &wfds)) {
+				fds[i].revents |= VFS_POLLOUT;
+			}
+
+			if (FD_ISSET(s, &efds)) {
+				fds[i].revents |= VFS_POLLERR;
+			}
+		}
+
+		if (fds[i].revents) {
+			ready++;
+		}
+	}
+
+	return ready;
+}
@@ -27,105 +27,134 @@
  * this software.
  */
 
+#include "luartos.h"
+
+#include "esp_attr.h"
+
 #include <errno.h>
 #include <stdlib.h>
 #include <pthread/pthread.h>
 
-extern struct list key_list;
+#include "freertos/adds.h"
+
+extern struct list thread_list;
+extern struct mtx key_mtx;
+
+// Keys are indexes of the thread-specific array in the Lua RTOS specific
+// TCB parts, so get / set are a direct access to the current task's TCB
+static struct pthread_key keys[PTHREAD_NKEYS];
 
 int pthread_key_create(pthread_key_t *k, void (*destructor)(void*)) {
-    struct pthread_key *key;
-    int res;
-    
-    // Allocate space for the key
-    key = (struct pthread_key *)malloc(sizeof(struct pthread_key));
-    if (!key) {
-        errno = ENOMEM;
-        return ENOMEM;
-    }
-    
-    // Init key
-    key->destructor = destructor;
-    
-    list_init(&key->specific,1);
-    
-    // Add key to key list
-    res = list_add(&key_list, key, k);
-    if (res) {
-        free(key);
-        errno = res;
-        return res;
+    int i;
+
+    mtx_lock(&key_mtx);
+
+    // Find a free slot
+    for(i=0;i < PTHREAD_NKEYS;i++) {
+        if (!keys[i].used) {
+            keys[i].used = 1;
+            keys[i].destructor = destructor;
+
+            mtx_unlock(&key_mtx);
+
+            *k = i;
+
+            return 0;
+        }
     }
-    
-    return 0;
+
+    mtx_unlock(&key_mtx);
+
+    errno = EAGAIN;
+    return EAGAIN;
 }
 
-int pthread_setspecific(pthread_key_t k, const void *value) {
-    struct pthread_key_specific *specific;
-    struct pthread_key *key;    
-    int res;
-    
-    // Get key
-    res = list_get(&key_list, k, (void **)&key);
-    if (res) {
-        return res;
+int IRAM_ATTR pthread_setspecific(pthread_key_t k, const void *value) {
+    if ((k < 0) || (k >= PTHREAD_NKEYS) || !keys[k].used) {
+        errno = EINVAL;
+        return EINVAL;
     }
 
-    // Allocate space for specific
-    specific = (struct pthread_key_specific *)malloc(sizeof(struct pthread_key_specific));
-    if (!specific) {
-        errno = ENOMEM;
-        return ENOMEM;
+    if (!uxSetThreadSpecific(NULL, k, value)) {
+        // Current task is not a thread
+        errno = EINVAL;
+        return EINVAL;
     }
-    
-    specific->thread = pthread_self();
-    specific->value = value;
-    
+
     return 0;
 }
 
-void *pthread_getspecific(pthread_key_t k) {
-    struct pthread_key_specific *specific;
-    struct pthread_key *key;
-    pthread_t thread;
-    int res;
-    int index;
-    
-    // Get key
-    res = list_get(&key_list, k, (void **)&key);
-    if (res) {
+void *IRAM_ATTR pthread_getspecific(pthread_key_t k) {
+    if ((k < 0) || (k >= PTHREAD_NKEYS)) {
         return NULL;
     }
-    
-    // Get specific value
-    thread = pthread_self();
-
-    index = list_first(&key->specific);
-    while (index >= 0) {
-        list_get(&key->specific, index, (void **)&specific);
-                
-        if (specific->thread == thread) {
-            return (void *)specific->value;
-        }
-        
-        index = list_next(&key->specific, index);
+
+    return pvGetThreadSpecific(NULL, k);
+}
+
+// Clear the value of a key in a thread
+static void key_clear(void *item, void *arg) {
+    struct pthread *thread = (struct pthread *)item;
+
+    if (thread->task) {
+        uxSetThreadSpecific(thread->task, *(pthread_key_t *)arg, NULL);
     }
-    
-    return NULL;
 }
 
 int pthread_key_delete(pthread_key_t k) {
-    struct pthread_key *key;
-    int res;
-
-    // Get key
-    res = list_get(&key_list, k, (void **)&key);
-    if (res) {
-        errno = res;
-        return res;
+    if ((k < 0) || (k >= PTHREAD_NKEYS)) {
+        errno = EINVAL;
+        return EINVAL;
+    }
+
+    mtx_lock(&key_mtx);
+
+    if (!keys[k].used) {
+        mtx_unlock(&key_mtx);
+
+        errno = EINVAL;
+        return EINVAL;
     }
-    
-    list_remove(&key_list, k, 1);
+
+    // Clear the values of the key in all threads, so the slot can be
+    // reused by a new key. The thread list is locked during the walk, so
+    // a thread that ends can't free its TCB while its value is cleared.
+    list_foreach(&thread_list, key_clear, &k);
+
+    keys[k].used = 0;
+    keys[k].destructor = NULL;
+
+    mtx_unlock(&key_mtx);
 
     return 0;
 }
+
+// Call the destructors of the current thread's specific values. This is
+// called by the thread before it ends.
+void _pthread_key_exit() {
+    void (*destructor)(void*);
+    void *value;
+    int i, iter, pending;
+
+    for(iter = 0;iter < PTHREAD_DESTRUCTOR_ITERATIONS;iter++) {
+        pending = 0;
+
+        for(i=0;i < PTHREAD_NKEYS;i++) {
+            value = pvGetThreadSpecific(NULL, i);
+            destructor = keys[i].destructor;
+
+            if (value && keys[i].used) {
+                uxSetThreadSpecific(NULL, i, NULL);
+
+                if (destructor) {
+                    destructor(value);
+                    pending = 1;
+                }
+            }
+        }
+
+        if (!pending) {
+            break;
+        }
+    }
+}
@@ -32,6 +32,7 @@
 #include "esp_attr.h"
 
 #include "lua.h"
+#include "ldo.h"
 #include "thread.h"
 
 #include <errno.h>
@@ -46,12 +47,31 @@
 
 #include "lauxlib.h"
 
-struct list key_list;
 struct list mutex_list;
 struct list thread_list;
 
 struct mtx once_mtx;
 struct mtx cond_mtx;
+struct mtx key_mtx;
+
+// Signal delivery
+//
+// Each signal has a bitmap of the threads that have a handler for it (bit n
+// is for thread id n), and each thread has a pending-signal word in its Lua RTOS
+// specific TCB parts. This allows to post a signal in O(1) from any context,
+// without taking the thread list mutex.
+//
+// Only threads with an id lower than PTHREAD_SIG_MAX_THREADS can receive signals,
+// and signals are only delivered to the threads in PTHREAD_SIG_RECEIVERS (the
+// Lua interpreter thread).
+#define PTHREAD_SIG_MAX_THREADS 32
+#define PTHREAD_SIG_RECEIVERS   (1 << 1)
+
+static volatile uint32_t sig_subscribers[PTHREAD_NSIG];
+static struct pthread *sig_threads[PTHREAD_SIG_MAX_THREADS];
+
+// Bitmap of threads with pending signals, checked by the Lua VM at safe points
+volatile uint32_t _pthread_signal_pending = 0;
 
 struct pthreadTaskArg {
     void *(*pthread_function) (void *);
@@ -67,11 +87,33 @@ void _pthread_init() {
     // Create mutexes
     mtx_init(&once_mtx, NULL, NULL, 0);
     mtx_init(&cond_mtx, NULL, NULL, 0);
+    mtx_init(&key_mtx, NULL, NULL, 0);
     
     // Init lists
     list_init(&thread_list, 1);
     list_init(&mutex_list, 1);
-    list_init(&key_list, 1);
+}
+
+// Update the signal subscribers bitmaps with the handlers of a thread
+static void _pthread_signal_subscribe(struct pthread *thread, int subscribe) {
+    uint32_t mask;
+    int s;
+
+    if ((thread->thread <= 0) || (thread->thread >= PTHREAD_SIG_MAX_THREADS)) {
+        return;
+    }
+
+    mask = (1 << thread->thread);
+
+    for(s=0;s < PTHREAD_NSIG;s++) {
+        if (subscribe && (thread->signals[s] != SIG_DFL) && (thread->signals[s] != SIG_IGN)) {
+            __sync_fetch_and_or(&sig_subscribers[s], mask);
+        } else {
+            __sync_fetch_and_and(&sig_subscribers[s], ~mask);
+        }
+    }
+
+    sig_threads[thread->thread] = (subscribe?thread:NULL);
 }
 
 int _pthread_create(pthread_t *id, int priority, int stacksize, int cpu, int initial_state,
@@ -103,6 +145,8 @@ int _pthread_create(pthread_t *id, int priority, int stacksize, int cpu, int ini
         return EAGAIN;
     }
     
+    thread->task = NULL;
+
     for(i=0; i < PTHREAD_NSIG; i++) {
         thread->signals[i] = SIG_DFL;
     }
@@ -178,6 +222,9 @@ int _pthread_create(pthread_t *id, int priority, int stacksize, int cpu, int ini
     
     thread->task = xCreatedTask;
 
+    // Subscribe thread to the signals inherited from parent
+    _pthread_signal_subscribe(thread, 1);
+
     return 0;
 }
 
@@ -238,6 +285,9 @@ int _pthread_free(pthread_t id) {
         return res;
     }
 
+    // Unsubscribe thread from signals
+    _pthread_signal_subscribe(thread, 0);
+
     // Free join list
     list_destroy(&thread->join_list, 1);
 
@@ -256,83 +306,142 @@ sig_t _pthread_signal(int s, sig_t h) {
     struct pthread *thread; // Current thread
     sig_t prev_h;           // Previous handler
     
-    if (s > PTHREAD_NSIG) {
+    if (s >= PTHREAD_NSIG) {
         errno = EINVAL;
         return SIG_ERR;
     }
     
     // Get thread
-    list_get(&thread_list, pthread_self(), (void **)&thread);
+    if (list_get(&thread_list, pthread_self(), (void **)&thread)) {
+        return NULL;
+    }
     
-    if (thread) {
-        // Add handler
-        prev_h = thread->signals[s];
-        thread->signals[s] = h;
+    // Add handler
+    prev_h = thread->signals[s];
+    thread->signals[s] = h;
 
-        return prev_h;
-    }
+    _pthread_signal_subscribe(thread, 1);
 
-    return NULL;
+    return prev_h;
 }
 
 void IRAM_ATTR _pthread_queue_signal(int s) {
-    struct pthread *thread; // Current thread
-    int index;
-    
-    index = list_first(&thread_list);
-    while (index >= 0) {
-        list_get(&thread_list, index, (void **)&thread);
-        
-        if (thread->thread == 1) {
-            if ((thread->signals[s] != SIG_DFL) && (thread->signals[s] != SIG_IGN)) {
-				#if LUA_USE_SAFE_SIGNAL
-            	uxSetSignaled(thread->task, s);
-				#else
-            	thread->signals[s](s);
-				#endif
-            }         
+    struct pthread *thread;
+    uint32_t subscribers;
+    int id;
+
+    if ((s < 0) || (s >= PTHREAD_NSIG)) {
+        return;
+    }
+
+    subscribers = sig_subscribers[s] & PTHREAD_SIG_RECEIVERS;
+    while (subscribers) {
+        id = __builtin_ctz(subscribers);
+        subscribers &= ~(1 << id);
+
+        thread = sig_threads[id];
+        if (!thread || !thread->task) {
+            continue;
         }
-        
-        index = list_next(&thread_list, index);
+
+		#if LUA_USE_SAFE_SIGNAL
+        // Mark signal as pending, it will be processed by the thread
+        uxSetSignaled(thread->task, s);
+        __sync_fetch_and_or(&_pthread_signal_pending, (1 << id));
+		#else
+        sig_t h = thread->signals[s];
+
+        if ((h != SIG_DFL) && (h != SIG_IGN)) {
+            h(s);
+        }
+		#endif
     }
 }
 
 #if LUA_USE_SAFE_SIGNAL
-void _pthread_process_signal(void) {
-    struct pthread *thread; // Current thread
-    uint32_t s;
-    
-    list_get(&thread_list, pthread_self(), (void **)&thread);
-    
-    for(s=0;s < 32;s++) {
-    	if (uxGetSignaled(thread->task) & (1 << s)) {
-	        if ((thread->signals[s] != SIG_DFL) && (thread->signals[s] != SIG_IGN)) {
-    			thread->signals[s](s);
-	        }
-	        uxSetSignaled(thread->task, 0);
-    	}
+struct pthread_sig_run {
+    struct pthread *thread;
+    uint32_t pending;
+};
+
+// Run the handlers of the pending signals, called in protected mode
+static void _pthread_run_handlers(lua_State *L, void *ud) {
+    struct pthread_sig_run *run = (struct pthread_sig_run *)ud;
+    int s;
+    sig_t h;
+
+    (void)L;
+
+    while (run->pending) {
+        s = __builtin_ctz(run->pending);
+        run->pending &= ~(1 << s);
+
+        h = run->thread->signals[s];
+        if ((h != SIG_DFL) && (h != SIG_IGN)) {
+            h(s);
+        }
     }
 }
-#endif
 
-int IRAM_ATTR _pthread_has_signal(int s) {
+// Called by the Lua VM at a safe point of L, in the current thread
+void _pthread_process_signal(lua_State *L) {
     struct pthread *thread; // Current thread
-    int index;
-    
-    index = list_first(&thread_list);
-    while (index >= 0) {
-        list_get(&thread_list, index, (void **)&thread);
-        
-        if (thread->thread == 1) {
-            if ((thread->signals[s] != SIG_DFL) && (thread->signals[s] != SIG_IGN)) {
-                return 1;
+    struct pthread_sig_run run;
+    lua_State *prev_L;
+    int id, s, status;
+
+    id = pthread_self();
+    if ((id <= 0) || (id >= PTHREAD_SIG_MAX_THREADS)) {
+        return;
+    }
+
+    if (!(_pthread_signal_pending & (1 << id))) {
+        // Pending signals are for other threads
+        return;
+    }
+
+    __sync_fetch_and_and(&_pthread_signal_pending, ~(1 << id));
+
+    thread = sig_threads[id];
+    if (!thread) {
+        return;
+    }
+
+    // Handlers that stop the interpreter raise an error in the running state,
+    // so it's the Lua state of the task while they run
+    prev_L = pvGetLuaState();
+    uxSetLuaState(L);
+
+    run.thread = thread;
+    run.pending = uxClearSignaled(thread->task);
+    status = luaD_rawrunprotected(L, _pthread_run_handlers, &run);
+
+    uxSetLuaState(prev_L);
+
+    if (status != LUA_OK) {
+        // Signals left by a handler that raised an error are processed at
+        // the next safe point
+        if (run.pending) {
+            for(s=0;s < PTHREAD_NSIG;s++) {
+                if (run.pending & (1 << s)) {
+                    uxSetSignaled(thread->task, s);
+                }
             }
+
+            __sync_fetch_and_or(&_pthread_signal_pending, (1 << id));
         }
-        
-        index = list_next(&thread_list, index);
-    }    
 
-    return 0;
+        luaD_throw(L, status);
+    }
+}
+#endif
+
+int IRAM_ATTR _pthread_has_signal(int s) {
+    if ((s < 0) || (s >= PTHREAD_NSIG)) {
+        return 0;
+    }
+
+    return ((sig_subscribers[s] & PTHREAD_SIG_RECEIVERS) != 0);
 }
 
 int _pthread_stop(pthread_t id) {
@@ -521,6 +630,9 @@ void pthreadTask(void *taskArgs) {
         
         index = list_next(&thread->clean_list, index);
     }
+
+    // Call destructors of thread-specific values
+    _pthread_key_exit();
     
     // Free thread structures
     _pthread_free(args->id);
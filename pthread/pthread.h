@@ -118,16 +118,17 @@ struct pthread_once {
 
 typedef struct pthread_once pthread_once_t;
 
-struct pthread_key_specific {
-    pthread_t thread;
-    const void *value;
-};
-
+// Thread-specific values are stored in a fixed-slot array in the Lua RTOS
+// specific TCB parts, indexed by key, so only the destructor is stored here
 struct pthread_key {
-    struct list specific;
+    int used;
     void (*destructor)(void*);
 };
 
+// Number of times that destructors are called at thread exit, while there
+// are non-NULL thread-specific values
+#define PTHREAD_DESTRUCTOR_ITERATIONS 4
+
 struct pthread_join {
     QueueHandle_t queue;
 };
@@ -161,6 +162,8 @@ typedef int cpu_set_t;
 
 typedef struct pthread_attr pthread_attr_t;
 
+struct lua_State;
+
 // Helper functions, only for internal use
 void  _pthread_init();
 int   _pthread_create(pthread_t *id, int priority, int stacksize, int cpu, int initial_state, void *(*start_routine)(void *), void *args);
@@ -168,7 +171,7 @@ int   _pthread_join(pthread_t id);
 int   _pthread_free(pthread_t id);
 sig_t _pthread_signal(int s, sig_t h);
 void  _pthread_queue_signal(int s);
-void  _pthread_process_signal();
+void  _pthread_process_signal(struct lua_State *L);
 int   _pthread_has_signal(int s);
 int   _pthread_stop(pthread_t id);
 int   _pthread_suspend(pthread_t id);
@@ -179,6 +182,7 @@ sig_t _pthread_signal(int s, sig_t h);
 int   _pthread_get_prio();
 int   _pthread_stack_free(pthread_t id);
 int   _pthread_stack(pthread_t id);
+void  _pthread_key_exit();
 
 // API functions
 int  pthread_attr_init(pthread_attr_t *attr);
@@ -212,6 +216,7 @@ int  pthread_setcancelstate(int state, int *oldstate);
 int  pthread_key_create(pthread_key_t *k, void (*destructor)(void*));
 int  pthread_setspecific(pthread_key_t k, const void *value);
 void *pthread_getspecific(pthread_key_t k);
+int  pthread_key_delete(pthread_key_t k);
 int  pthread_join(pthread_t thread, void **value_ptr);
 
 pthread_t pthread_self(void);
@@ -68,17 +68,17 @@ driver_error_t *s2y0a21_setup(sensor_instance_t *unit) {
 driver_error_t *s2y0a21_acquire(sensor_instance_t *unit, sensor_value_t *values) {
 	driver_error_t *error;
 	int raw = 0;
-	double mvolts = 0;
+	float mvolts = 0;
 
 	// Read value
 	if ((error = adc_read(unit->setup.adc.channel, &raw, &mvolts))) {
 		return error;
 	}
 
-	mvolts = mvolts * 3.6;
+	mvolts = mvolts * 3.6f;
 
 	// Calculate distance
-	values->floatd.value = 29.988 * pow(mvolts / 1000.0, -1.173);
+	values->floatd.value = 29.988f * powf(mvolts / 1000.0f, -1.173f);
 
 	return NULL;
 }
@@ -57,7 +57,7 @@ driver_error_t *tmp36_setup(sensor_instance_t *unit) {
 driver_error_t *tmp36_acquire(sensor_instance_t *unit, sensor_value_t *values) {
 	driver_error_t *error;
 	int raw = 0;
-	double mvolts = 0;
+	float mvolts = 0;
 
 	// Read value
 	if ((error = adc_read(unit->setup.adc.unit, unit->setup.adc.channel, &raw, &mvolts))) {
@@ -66,7 +66,7 @@ driver_error_t *tmp36_acquire(sensor_instance_t *unit, sensor_value_t *values) {
 
 	// Calculate temperature
 	// TMP36 has a resolution of 0.5 ºC, so round to 1 decimal place
-	values->floatd.value = floor(10.0 * (((float)mvolts - 500) / 10)) / 10.0;
+	values->floatd.value = floorf(10.0f * ((mvolts - 500.0f) / 10.0f)) / 10.0f;
 
 	return NULL;
 }
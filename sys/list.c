@@ -231,6 +231,22 @@ int IRAM_ATTR list_next(struct list *list, int index) {
     return res;
 }
 
+// Call fn for each item, with the list locked, so no item can be removed
+// until the walk ends. fn can't call other functions on the same list.
+void list_foreach(struct list *list, void (*fn)(void *item, void *arg), void *arg) {
+    int index;
+
+    mtx_lock(&list->mutex);
+
+    for(index=0;index < list->indexes;index++) {
+        if (!list->index[index].deleted) {
+            fn(list->index[index].item, arg);
+        }
+    }
+
+    mtx_unlock(&list->mutex);
+}
+
 void list_destroy(struct list *list, int items) {
     int index;
     
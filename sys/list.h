@@ -54,6 +54,7 @@ int list_get(struct list *list, int index, void **item);
 int list_remove(struct list *list, int index, int destroy);
 int list_first(struct list *list);
 int list_next(struct list *list, int index);
+void list_foreach(struct list *list, void (*fn)(void *item, void *arg), void *arg);
 void list_destroy(struct list *list, int items);
 
 #endif	/* LIST_H */
@@ -30,7 +30,10 @@
 
 #include "luartos.h"
 
+#include "freertos/FreeRTOS.h"
+
 #include <stddef.h>
+#include <stdint.h>
 #include <limits.h>
 #include <string.h>
 #include <stdlib.h>
@@ -39,6 +42,8 @@
 
 char *getcwd(char *buf, size_t size);
 
+extern char currdir[];
+
 // Mount device structure
 struct mountd {
     const char *device;
@@ -68,6 +73,28 @@ static const struct mountp mountps[] = {
     {NULL, NULL, NULL, NULL, NULL}
 };
 
+// Number of entries in the resolution cache
+#define MOUNT_CACHE_ENTRIES 8
+
+// Number of bytes of the path stored in a resolution cache entry
+#define MOUNT_CACHE_PREFIX 16
+
+// Resolution cache entry. Only absolute paths (current working directory +
+// path) that are already normalized are cached. As mount points are only
+// allowed in the root directory, the device only depends on the first
+// element of the path, which must fit into prefix.
+struct mountc {
+    uint32_t hash;                   // hash of the absolute path
+    uint16_t len;                    // length of the absolute path
+    uint16_t skip;                   // length of the mount point to remove
+    const char *device;              // device where path is mounted
+    char prefix[MOUNT_CACHE_PREFIX]; // first bytes of the absolute path
+};
+
+static struct mountc mountcs[MOUNT_CACHE_ENTRIES];
+static int mountc_next = 0;
+static portMUX_TYPE mount_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
 // Current mounted devices
 struct mountd mountds[] = {
 #if USE_SPIFFS
@@ -198,6 +225,11 @@ void mount_set_mounted(const char *device, unsigned int mounted) {
 
         cmountd++;
     }
+
+    // Default device can change, so invalidate the resolution cache
+    portENTER_CRITICAL(&mount_spinlock);
+    memset(mountcs, 0, sizeof(mountcs));
+    portEXIT_CRITICAL(&mount_spinlock);
 }
 
 // Get the default mounted device. This device is the first mounted
@@ -237,8 +269,10 @@ const char *mount_default_device() {
 //    example:
 //
 //		if path = "/./autorun.lua" normalized path is "/autorun.lua"
-char *mount_normalize_path(const char *path) {
-    char *rpath;
+//
+// Normalization is done in place into buf, that must have space for
+// size bytes. If path is an absolute path, it can be buf itself. Returns 0 on success, or -1 and errno on error.
+int mount_normalize_path_r(const char *path, char *buf, size_t size) {
     char *cpath;
     char *tpath;
     char *last;
@@ -246,37 +280,37 @@ char *mount_normalize_path(const char *path) {
     int maybe_is_dot_dot = 0;
     int is_dot = 0;
     int is_dot_dot = 0;
-    int plen = 0;
-
-    rpath = malloc(PATH_MAX + 1);
-    if (!rpath) {
-        errno = ENOMEM;
-        return NULL;
-    }
+    size_t plen = 0;
 
     // If it's a relative path preappend current working directory
     if (*path != '/') {
-        if (!getcwd(rpath, PATH_MAX)) {
-            free(rpath);
-            return NULL;
+        if (!getcwd(buf, size)) {
+            return -1;
         }
 
-        if (*(rpath + strlen(rpath) - 1) != '/') {
-            rpath = strncat(rpath, "/", PATH_MAX);
+        plen = strlen(buf);
+        if ((plen == 0) || (buf[plen - 1] != '/')) {
+            buf[plen++] = '/';
         }
+    }
+
+    // Copy path, and ensure that it ends with /
+    while (*path && (plen < size - 2)) {
+        buf[plen++] = *path++;
+    }
 
-        rpath = strncat(rpath, path, PATH_MAX);
-    } else {
-        strncpy(rpath, path, PATH_MAX);
+    if (*path) {
+        errno = ENAMETOOLONG;
+        return -1;
     }
 
-    plen = strlen(rpath);
-    if (*(rpath + plen - 1) != '/') {
-        rpath = strncat(rpath, "/", PATH_MAX);
-        plen++;
+    if ((plen == 0) || (buf[plen - 1] != '/')) {
+        buf[plen++] = '/';
     }
 
-    cpath = rpath;
+    buf[plen] = '\0';
+
+    cpath = buf;
     while (*cpath) {
         if (*cpath == '.') {
             if (maybe_is_dot) {
@@ -298,8 +332,8 @@ char *mount_normalize_path(const char *path) {
         if (is_dot_dot) {
             last = cpath + 1;
 
-            while (*--cpath != '/');
-            while (*--cpath != '/');
+            while ((cpath > buf) && (*--cpath != '/'));
+            while ((cpath > buf) && (*--cpath != '/'));
 
             tpath = ++cpath;
             while (*last) {
@@ -317,7 +351,7 @@ char *mount_normalize_path(const char *path) {
         if (is_dot) {
             last = cpath + 1;
 
-            while (*--cpath != '/');
+            while ((cpath > buf) && (*--cpath != '/'));
 
             tpath = ++cpath;
             while (*last) {
@@ -336,10 +370,27 @@ char *mount_normalize_path(const char *path) {
     }
 
     cpath--;
-    if ((cpath != rpath) && (*cpath == '/')) {
+    if ((cpath != buf) && (*cpath == '/')) {
         *cpath = '\0';
     }
 
+    return 0;
+}
+
+char *mount_normalize_path(const char *path) {
+    char *rpath;
+
+    rpath = malloc(PATH_MAX + 1);
+    if (!rpath) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (mount_normalize_path_r(path, rpath, PATH_MAX + 1) < 0) {
+        free(rpath);
+        return NULL;
+    }
+
     return rpath;
 }
 
@@ -379,13 +430,17 @@ char *mount_readdir(const char *dev, const char*path, int idx, char *buf) {
     return NULL;
 }
 
-// Get the device name where path is mounted. Path is an absolute path.
-const char *mount_device(const char *path) {
+// Get the mount point where path is mounted. Path is an absolute path.
+//
+// If more than one mount point matches, the longest one is returned. If
+// rpath is not NULL, the remaining part of the path is returned in it.
+static const struct mountp *mount_lookup(const char *path, const char **rpath) {
     const struct mountp *cmount = &mountps[0];
-    const char *device = NULL;
+    const struct mountp *found = NULL;
     const char *cpath;
     const char *cfpath;
-    
+    const char *rest = path;
+
     while (cmount->path) {
         cpath = path;
         cfpath = cmount->fpath;
@@ -394,55 +449,111 @@ const char *mount_device(const char *path) {
             cpath++;
             cfpath++;
         }
-        
-        if (!*cfpath) {
-            if ((!*cpath) || (*cpath == '/')) {
-                device = cmount->ddev;
-                break;
+
+        if (!*cfpath && ((!*cpath) || (*cpath == '/'))) {
+            if (!found || (cpath - path > rest - path)) {
+                found = cmount;
+                rest = cpath;
             }
         }
-        
+
         cmount++;
     }
 
-    if (!device) {
-        device = mount_default_device();
+    if (rpath) {
+        *rpath = rest;
+    }
+
+    return found;
+}
+
+// Get the device name where path is mounted. Path is an absolute path.
+const char *mount_device(const char *path) {
+    const struct mountp *cmount = mount_lookup(path, NULL);
+
+    if (cmount) {
+        return cmount->ddev;
     }
 
-    return device;    
+    return mount_default_device();
 }
 
 // Get the mount path where path is mounted. Path is an absolute path.
 const char *mount_path(const char *path) {
-    const struct mountp *cmount = &mountps[0];
-    const char *device = NULL;
-    const char *cpath;
-    const char *cfpath;
+    const struct mountp *cmount = mount_lookup(path, NULL);
 
-    while (cmount->path) {
-        cpath = path;
-        cfpath = cmount->fpath;
+    if (cmount) {
+        return cmount->fpath;
+    }
 
-        while (*cpath && *cfpath && (*cpath == *cfpath)) {
-            cpath++;
-            cfpath++;
+    return mount_default_device();
+}
+
+// Hash a path for the resolution cache (FNV-1a)
+static uint32_t mount_hash(const char *path, size_t len) {
+    uint32_t hash = 2166136261u;
+
+    while (len--) {
+        hash = (hash ^ (uint8_t)*path++) * 16777619u;
+    }
+
+    return hash;
+}
+
+// Test if an absolute path is normalized, this is, it hasn't empty, "." or
+// ".." elements, and it doesn't end with /
+static int mount_is_normalized(const char *path) {
+    const char *element;
+
+    if (!path[1]) {
+        return 1;
+    }
+
+    while (*path == '/') {
+        element = ++path;
+        while (*path && (*path != '/')) {
+            path++;
         }
 
-        if (!*cfpath) {
-            if ((!*cpath) || (*cpath == '/')) {
-                device = cmount->fpath;
-                break;
-            }
+        if ((path == element) ||
+            ((*element == '.') && ((path == element + 1) || ((path == element + 2) && (element[1] == '.'))))) {
+            return 0;
         }
+    }
 
-        cmount++;
+    return 1;
+}
+
+// Get the size of the buffer needed by mount_resolve_to_physical_r to
+// resolve path, that is never greater than PATH_MAX + 1. Callers use it
+// to size their buffer on the stack, so that it's bounded to the real
+// length of the path instead of to PATH_MAX.
+size_t mount_physical_size(const char *path) {
+    struct mountd *cmountd = &mountds[0];
+    size_t size, dlen;
+
+    // Path + trailing / added by normalization + NULL
+    size = strlen(path) + 2;
+    if (*path != '/') {
+        size += strlen(currdir) + 2;
+    }
+
+    // / + device + [/]
+    dlen = 0;
+    while (cmountd->device) {
+        if (strlen(cmountd->device) > dlen) {
+            dlen = strlen(cmountd->device);
+        }
+        cmountd++;
     }
 
-    if (!device) {
-        device = mount_default_device();
+    size += dlen + 2;
+
+    if (size > PATH_MAX + 1) {
+        size = PATH_MAX + 1;
     }
 
-    return device;
+    return size;
 }
 
 // Resolve a path (supposed to be a logical path) to a physical path.
@@ -452,49 +563,135 @@ const char *mount_path(const char *path) {
 // Example:
 //
 // If path is /sd/examples/lua/.., function returns /fat/examples
-char *mount_resolve_to_physical(const char *path) {
-	const char*device;
-
-	char *npath;
-	char *rpath;
-	char *ppath;
+//
+// Physical path is builded into buf, that must have space for size bytes
+// (see mount_physical_size), so no memory is allocated. The device of
+// recently resolved paths is cached. Returns 0 on success, or -1 and
+// errno on error.
+int mount_resolve_to_physical_r(const char *path, char *buf, size_t size) {
+	const struct mountp *cmount;
+	const char *device;
+	const char *rpath;
+	struct mountc entry;
+	uint32_t hash;
+	size_t len, dlen, rlen;
+	int normalized;
+	int sep;
+	int i;
+
+	// Build the absolute path
+	len = 0;
+	if (*path != '/') {
+		if (!getcwd(buf, size)) {
+			return -1;
+		}
 
-	// Normalize path
-	npath = mount_normalize_path(path);
+		len = strlen(buf);
+		if ((len == 0) || (buf[len - 1] != '/')) {
+			buf[len++] = '/';
+		}
+	}
 
-	// Get the device where path is mounted
-	if ((device = mount_device(npath))) {
-		// Remove mount device from path, if any
-		mount_get_mount_from_path(npath, &rpath);
+	rlen = strlen(path);
+	if (len + rlen + 2 > size) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
 
-		// Allocate space for physical path, and build it
-		ppath = (char *)malloc(PATH_MAX + 1);
-		if (!ppath) {
-			free(npath);
-			return NULL;
+	memcpy(buf + len, path, rlen + 1);
+	len += rlen;
+
+	// Lookup into cache. Entry is copied inside the critical section, and
+	// checked outside it.
+	device = NULL;
+	rpath = buf;
+	hash = 0;
+
+	normalized = mount_is_normalized(buf);
+	if (normalized) {
+		hash = mount_hash(buf, len);
+
+		entry.device = NULL;
+		portENTER_CRITICAL(&mount_spinlock);
+		for(i = 0;i < MOUNT_CACHE_ENTRIES;i++) {
+			if ((mountcs[i].hash == hash) && (mountcs[i].len == len) && mountcs[i].device) {
+				entry = mountcs[i];
+				break;
+			}
 		}
+		portEXIT_CRITICAL(&mount_spinlock);
 
-		strncpy(ppath,"/", PATH_MAX);
+		if (entry.device && (strncmp(entry.prefix, buf, MOUNT_CACHE_PREFIX) == 0)) {
+			device = entry.device;
+			rpath = buf + entry.skip;
+		}
+	}
 
-		ppath = strncat(ppath,device, PATH_MAX);
+	if (!device) {
+		// Normalize path
+		if (!normalized) {
+			if (mount_normalize_path_r(buf, buf, size) < 0) {
+				return -1;
+			}
+		}
 
-		if (*rpath != '/') {
-			ppath = strncat(ppath,"/", PATH_MAX);
+		// Get the device where path is mounted, and remove mount point from path
+		if ((cmount = mount_lookup(buf, &rpath))) {
+			device = cmount->ddev;
+		} else {
+			device = mount_default_device();
+			rpath = buf;
 		}
 
-		ppath = strncat(ppath,rpath, PATH_MAX);
-	} else {
-		// Allocate space for physical path, and build it
-		ppath = (char *)malloc(PATH_MAX + 1);
-		if (!ppath) {
-			free(npath);
-			return NULL;
+		// Update cache, if the first element of the path fits into the prefix
+		if (normalized && (len <= UINT16_MAX) && (strcspn(buf + 1, "/") < MOUNT_CACHE_PREFIX - 1)) {
+			entry.hash = hash;
+			entry.len = len;
+			entry.skip = rpath - buf;
+			entry.device = device;
+			strncpy(entry.prefix, buf, MOUNT_CACHE_PREFIX);
+
+			portENTER_CRITICAL(&mount_spinlock);
+			mountcs[mountc_next] = entry;
+			mountc_next = (mountc_next + 1) % MOUNT_CACHE_ENTRIES;
+			portEXIT_CRITICAL(&mount_spinlock);
 		}
+	}
 
-		strncpy(ppath, npath, PATH_MAX);
+	// Build physical path in place: / + device + [/] + rpath
+	sep = (*rpath != '/');
+	dlen = strlen(device) + 1 + sep;
+	rlen = strlen(rpath);
+
+	if (dlen + rlen + 1 > size) {
+		errno = ENAMETOOLONG;
+		return -1;
 	}
 
-	free(npath);
+	memmove(buf + dlen, rpath, rlen + 1);
+
+	*buf = '/';
+	memcpy(buf + 1, device, strlen(device));
+	if (sep) {
+		buf[dlen - 1] = '/';
+	}
+
+	return 0;
+}
+
+char *mount_resolve_to_physical(const char *path) {
+	char *ppath;
+
+	ppath = (char *)malloc(PATH_MAX + 1);
+	if (!ppath) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (mount_resolve_to_physical_r(path, ppath, PATH_MAX + 1) < 0) {
+		free(ppath);
+		return NULL;
+	}
 
 	return ppath;
 }
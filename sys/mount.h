@@ -31,7 +31,10 @@
 #ifndef _SYSCALLS_MOUNT_H
 #define	_SYSCALLS_MOUNT_H
 
+#include <stddef.h>
+
 char *mount_normalize_path(const char *path);
+int mount_normalize_path_r(const char *path, char *buf, size_t size);
 char *mount_readdir(const char *dev, const char*path, int idx, char *buf);
 const char *mount_device(const char *path);
 const char *mount_path(const char *path);
@@ -39,6 +42,8 @@ void mount_set_mounted(const char *device, unsigned int mounted);
 int mount_is_mounted(const char *device);
 const char *mount_default_device();
 char *mount_resolve_to_physical(const char *path);
+int mount_resolve_to_physical_r(const char *path, char *buf, size_t size);
+size_t mount_physical_size(const char *path);
 char *mount_resolve_to_logical(const char *path);
 const char *mount_get_device_from_path(const char *path, char **rpath);
 const char *mount_get_mount_from_path(const char *path, char **rpath);
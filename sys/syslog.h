@@ -36,6 +36,7 @@
 #define _PATH_LOG   "/dev/log"
 
 #include <stdarg.h>
+#include <stdint.h>
 
 /*
  * priorities/facilities are encoded into a single 32-bit quantity, where the
@@ -173,3 +174,4 @@ void openlog(const char *, int, int);
 int  setlogmask(int);
 void syslog(int, const char *, ...);
 void vsyslog(int, const char *, va_list);
+int  syslog_dmesg(uint32_t *seq, char *buf, int size);
@@ -5,23 +5,21 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #include <sys/mount.h>
 
 extern int __real__rename_r(struct _reent *r, const char *src, const char *dst);
 
 int IRAM_ATTR __wrap__rename_r(struct _reent *r, const char *src, const char *dst) {
-	char *ppath_src;
-	char *ppath_dst;
-	int res;
+	char ppath_src[mount_physical_size(src)];
+	char ppath_dst[mount_physical_size(dst)];
 
-	ppath_src = mount_resolve_to_physical(src);
-	ppath_dst = mount_resolve_to_physical(dst);
+	if ((mount_resolve_to_physical_r(src, ppath_src, sizeof(ppath_src)) < 0) ||
+		(mount_resolve_to_physical_r(dst, ppath_dst, sizeof(ppath_dst)) < 0)) {
+		r->_errno = errno;
+		return -1;
+	}
 
-	res = __real__rename_r(r, ppath_src, ppath_dst);
-
-	free(ppath_src);
-	free(ppath_dst);
-
-	return res;
+	return __real__rename_r(r, ppath_src, ppath_dst);
 }
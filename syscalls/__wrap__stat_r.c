@@ -12,15 +12,16 @@
 extern int __real__stat_r(struct _reent *r, const char *path, int flags, int mode);
 
 int IRAM_ATTR __wrap__stat_r(struct _reent *r, const char *path, int flags, int mode) {
-	char *ppath;
-	int res;
+	char ppath[mount_physical_size(path)];
 
-	if ((strncmp(path,"/dev/uart/",10) == 0) || (strncmp(path,"/dev/tty/",9) == 0) || (strncmp(path,"/dev/socket/",12) == 0)) {
+	if ((strncmp(path,"/dev/",5) == 0) && ((strncmp(path + 5,"uart/",5) == 0) || (strncmp(path + 5,"tty/",4) == 0) || (strncmp(path + 5,"socket/",7) == 0))) {
 		return __real__stat_r(r, path, flags, mode);
 	} else {
-		ppath = mount_resolve_to_physical(path);
-		res = __real__stat_r(r, ppath, flags, mode);
-		free(ppath);
-		return res;
+		if (mount_resolve_to_physical_r(path, ppath, sizeof(ppath)) < 0) {
+			r->_errno = errno;
+			return -1;
+		}
+
+		return __real__stat_r(r, ppath, flags, mode);
 	}
 }
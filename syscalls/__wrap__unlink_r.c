@@ -5,19 +5,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #include <sys/mount.h>
 
 extern int __real__unlink_r(struct _reent *r, const char *path);
 
 int IRAM_ATTR __wrap__unlink_r(struct _reent *r, const char *path) {
-	char *ppath;
-	int res;
+	char ppath[mount_physical_size(path)];
 
-	ppath = mount_resolve_to_physical(path);
-	res = __real__unlink_r(r, ppath);
+	if (mount_resolve_to_physical_r(path, ppath, sizeof(ppath)) < 0) {
+		r->_errno = errno;
+		return -1;
+	}
 
-	free(ppath);
-
-	return res;
+	return __real__unlink_r(r, ppath);
 }
@@ -12,13 +12,11 @@
 extern int __real_mkdir(const char* name, mode_t mode);
 
 int __wrap_mkdir(const char* name, mode_t mode) {
-	char *ppath;
-	int res;
+	char ppath[mount_physical_size(name)];
 
-	ppath = mount_resolve_to_physical(name);
-	res = __real_mkdir(ppath, mode);
+	if (mount_resolve_to_physical_r(name, ppath, sizeof(ppath)) < 0) {
+		return -1;
+	}
 
-	free(ppath);
-
-	return res;
+	return __real_mkdir(ppath, mode);
 }
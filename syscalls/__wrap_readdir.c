@@ -14,13 +14,11 @@
 DIR* __real_readdir(const char* name);
 
 DIR* __wrap_readdir(const char* name) {
-	char *ppath;
-	DIR *dir;
+	char ppath[mount_physical_size(name)];
 
-	ppath = mount_resolve_to_physical(name);
-	dir = __real_readdir(ppath);
+	if (mount_resolve_to_physical_r(name, ppath, sizeof(ppath)) < 0) {
+		return NULL;
+	}
 
-	free(ppath);
-
-	return dir;
+	return __real_readdir(ppath);
 }
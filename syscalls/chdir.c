@@ -42,7 +42,7 @@ char currdir[PATH_MAX + 1] = "";
 
 int chdir(const char *path) {
     struct stat statb;
-    char *ppath;
+    char ppath[mount_physical_size(path)];
     char *lpath;
 	int fd;
 
@@ -51,17 +51,18 @@ int chdir(const char *path) {
         return -1;
     }
 
-    ppath = mount_resolve_to_physical(path);
+    if (mount_resolve_to_physical_r(path, ppath, sizeof(ppath)) < 0) {
+        return -1;
+    }
+
     // Check for path existence
     if ((fd = open(ppath, O_RDONLY)) == -1) {
     	errno = ENOTDIR;
-    	free(ppath);
         return -1;
     }
 
     // Check that path is a directory
     if (fstat(fd, &statb) || !S_ISDIR(statb.st_mode)) {
-    		free(ppath);
             errno = ENOTDIR;
             close(fd);
             return -1;
@@ -70,15 +71,13 @@ int chdir(const char *path) {
     lpath = mount_resolve_to_logical(ppath);
     if (!lpath) {
     	errno = ENOTDIR;
-    	free(lpath);
-    	free(ppath);
+    	close(fd);
     	return -1;
     }
 
     strncpy(currdir, lpath, PATH_MAX);
 
     free(lpath);
-	free(ppath);
 
 	close(fd);
 
@@ -0,0 +1,272 @@
+/*
+ * Lua RTOS, LMIC AES, host test
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * lmic/lmic.c is included, so its AES helpers (aes_appendMic0, aes_encrypt,
+ * aes_sessKeys, aes_appendMic, aes_cipher) are checked against known answers:
+ *
+ * - FIPS-197 C.1 for a block, and the four RFC 4493 AES-CMAC examples
+ * - LoRaWAN 1.0.x: join request MIC, join accept decryption and MIC, session
+ *   key derivation, and the MIC and FRMPayload encryption of a 51 byte and a
+ *   222 byte uplink, the last one with a 32 bit FCnt
+ *
+ * The LoRaWAN answers were computed with OpenSSL (AES-128-ECB and CMAC), from
+ * the frames built as the LoRaWAN 1.0.2 specification says, with the AppKey
+ * of lmic_host.c (the RFC 4493 key), so they don't depend on lmic/aes.c.
+ *
+ * Then the cycles per byte of the MIC and encryption of the 51 and 222 byte
+ * frames are reported.
+ *
+ */
+
+#include "lmic/lmic.c"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#endif
+
+#define FRAMES 100000
+
+// FIPS-197 C.1
+static const char *fips_key = "000102030405060708090a0b0c0d0e0f";
+static const char *fips_in  = "00112233445566778899aabbccddeeff";
+static const char *fips_out = "69c4e0d86a7b0430d8cdb78070b4c55a";
+
+// RFC 4493, section 4, with the first 4 bytes of the tag
+static const char *rfc_key = "2b7e151628aed2a6abf7158809cf4f3c";
+static const char *rfc_msg =
+	"6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+	"30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+
+static const struct {
+	int len;
+	u4_t mic;
+} rfc[] = {
+	{ 0, 0xbb1d6929}, {16, 0x070a16b4}, {40, 0xdfa66747}, {64, 0x51f0bebf}
+};
+
+// LoRaWAN, DevEUI 0102030405060708, AppEUI 0807060504030201, DevNonce 0x1234
+static const char *join_request = "00010203040506070808070605040302013412" "0f9ba1e4";
+
+// Join accept, AppNonce 112233, NetID 445566, DevAddr 0x26011234, as sent,
+// and decrypted
+static const char *join_accept_enc   = "209bd214875ef86a16e3d762f6082daf21";
+static const char *join_accept_plain = "20112233445566341201260001e9df80f0";
+
+static const char *nwkskey = "16d0eb21aababfca2695066c48504519";
+static const char *appskey = "beb29684e2fe9d5604b43abbf84cea52";
+
+#define DEVADDR 0x26011234
+
+// Uplinks on FPort 1, with payload byte i = i * 7 + 3
+static const struct {
+	int len;
+	u4_t fcnt;
+	const char *enc;
+	u4_t mic;
+} frames[] = {
+	{ 51, 1,
+		"df91dedc9df3700bd42437af90bd107febe1eacd2c363d5e2278247f19f5438d"
+		"2ea301caf2d6cc02ebccf38adf52c6f90cef6c",
+		0x7e4f861e },
+	{ 222, 0x10002,
+		"b302f9f373ca043e840a4c54f486fde71f383a8ce00357488e951730a3119f5b"
+		"52090463077baf5c76c6d45ea34fb501f91d491f32358fd64c7be59291c40add"
+		"189712602c64fc97f0e3102ca8a8a9d462c27fce663343ffebf6f29f26e5eb34"
+		"173416920cbc6e6a90f15f4361b199d2ec5b5594f497f1ce076840a887557857"
+		"44bedf610d5fbc8ac9617f0e235f3dd9d61d371eec6837be95f15eda81cde47a"
+		"c5c8ecdc2fa090b2a80e44a2ab9fcb5acb7ccc5777afea368354952af8049c32"
+		"742157efe21bf80a4c3466734be0cada07d16804af03cde511ea4faff2c8",
+		0x03ec0050 },
+};
+
+static int failed = 0;
+
+void onEvent(ev_t ev) {
+}
+
+static int hex(u1_t *buf, const char *str) {
+	int len = 0;
+	unsigned int b;
+
+	while (*str && (sscanf(str, "%2x", &b) == 1)) {
+		buf[len++] = b;
+		str += 2;
+	}
+
+	return len;
+}
+
+static void check(const char *what, const u1_t *got, const u1_t *expected, int len) {
+	int i;
+
+	if (memcmp(got, expected, len) != 0) {
+		printf("FAIL: %s\n      got      ", what);
+		for(i = 0; i < len; i++) {
+			printf("%02x", got[i]);
+		}
+
+		printf("\n      expected ");
+		for(i = 0; i < len; i++) {
+			printf("%02x", expected[i]);
+		}
+
+		printf("\n");
+		failed = 1;
+	}
+}
+
+// Build an uplink with an encrypted payload and MIC, as engineUpdate does
+static int uplink(u1_t *pdu, xref2cu1_t nwk, xref2cu1_t app, int len, u4_t fcnt) {
+	int i;
+
+	pdu[OFF_DAT_HDR] = HDR_FTYPE_DAUP | HDR_MAJOR_V1;
+	os_wlsbf4(pdu + OFF_DAT_ADDR, DEVADDR);
+	pdu[OFF_DAT_FCT] = 0;
+	os_wlsbf2(pdu + OFF_DAT_SEQNO, fcnt);
+	pdu[OFF_DAT_OPTS] = 1;
+
+	for(i = 0; i < len; i++) {
+		pdu[OFF_DAT_OPTS + 1 + i] = i * 7 + 3;
+	}
+
+	aes_cipher(app, DEVADDR, fcnt, 0, pdu + OFF_DAT_OPTS + 1, len);
+	aes_appendMic(nwk, DEVADDR, fcnt, 0, pdu, OFF_DAT_OPTS + 1 + len);
+
+	return OFF_DAT_OPTS + 1 + len + 4;
+}
+
+int main(int argc, char **argv) {
+	u1_t key[16], in[64], out[64], expected[256], pdu[256];
+	u1_t nwk[16], app[16];
+	double t0, t1;
+	int i, j, len;
+
+	// FIPS-197
+	hex(key, fips_key);
+	hex(in, fips_in);
+	hex(expected, fips_out);
+
+	memcpy(AESkey, key, 16);
+	os_aes(AES_ENC, in, 16);
+	check("FIPS-197 C.1", in, expected, 16);
+
+	// RFC 4493
+	hex(key, rfc_key);
+	hex(in, rfc_msg);
+
+	for(i = 0; i < sizeof(rfc) / sizeof(rfc[0]); i++) {
+		os_wmsbf4(out, os_aes_cmac(key, NULL, in, rfc[i].len));
+		os_wmsbf4(expected, rfc[i].mic);
+		check("RFC 4493 AES-CMAC", out, expected, 4);
+	}
+
+	// Join request MIC
+	len = hex(expected, join_request);
+	memcpy(pdu, expected, len - 4);
+	aes_appendMic0(pdu, len - 4);
+	check("join request MIC", pdu, expected, len);
+
+	// Join accept, decrypted with AES encrypt, and its MIC
+	len = hex(pdu, join_accept_enc);
+	hex(expected, join_accept_plain);
+	aes_encrypt(pdu + 1, len - 1);
+	check("join accept decryption", pdu, expected, len);
+
+	if (!aes_verifyMic0(pdu, len - 4)) {
+		printf("FAIL: join accept MIC\n");
+		failed = 1;
+	}
+
+	// Session keys
+	aes_sessKeys(0x1234, pdu + OFF_JA_ARTNONCE, nwk, app);
+	hex(expected, nwkskey);
+	check("NwkSKey", nwk, expected, 16);
+	hex(expected, appskey);
+	check("AppSKey", app, expected, 16);
+
+	// Uplinks
+	for(i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+		len = uplink(pdu, nwk, app, frames[i].len, frames[i].fcnt);
+
+		hex(expected, frames[i].enc);
+		check("FRMPayload encryption", pdu + OFF_DAT_OPTS + 1, expected, frames[i].len);
+
+		os_wmsbf4(expected, frames[i].mic);
+		check("uplink MIC", pdu + len - 4, expected, 4);
+
+		if (!aes_verifyMic(nwk, DEVADDR, frames[i].fcnt, 0, pdu, len - 4)) {
+			printf("FAIL: uplink MIC verification\n");
+			failed = 1;
+		}
+
+		// Decrypt
+		aes_cipher(app, DEVADDR, frames[i].fcnt, 0, pdu + OFF_DAT_OPTS + 1, frames[i].len);
+		for(j = 0; j < frames[i].len; j++) {
+			expected[j] = j * 7 + 3;
+		}
+
+		check("FRMPayload decryption", pdu + OFF_DAT_OPTS + 1, expected, frames[i].len);
+	}
+
+	// Benchmark, MIC and encryption of a frame
+	for(i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+		struct timespec ts;
+#ifdef CYCLES
+		unsigned long long c0, c1;
+
+		c0 = CYCLES();
+#endif
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		t0 = ts.tv_sec + ts.tv_nsec / 1e9;
+
+		for(j = 0; j < FRAMES; j++) {
+			uplink(pdu, nwk, app, frames[i].len, j);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		t1 = ts.tv_sec + ts.tv_nsec / 1e9;
+
+#ifdef CYCLES
+		c1 = CYCLES();
+		printf("%3d bytes: %.1f cycles/byte, %.1f ns/byte\n", frames[i].len,
+			(double)(c1 - c0) / FRAMES / frames[i].len, (t1 - t0) * 1e9 / FRAMES / frames[i].len);
+#else
+		printf("%3d bytes: %.1f ns/byte\n", frames[i].len, (t1 - t0) * 1e9 / FRAMES / frames[i].len);
+#endif
+	}
+
+	return failed;
+}
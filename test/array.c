@@ -0,0 +1,324 @@
+/*
+ * Lua RTOS, host test and benchmark of typed arrays
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * First, the kernels of the array module are checked against the same
+ * computations written in Lua over tables: statistics, scale, FIR, IIR,
+ * decimation, FFT and spectrum, and threshold crossings, with samples
+ * captured into a buffer as the ADC does.
+ *
+ * Then a processing pass as the ADC and accelerometer scripts do it (take
+ * SAMPLES samples from a capture buffer, and get the mean, rms, min, max,
+ * a 16-tap FIR and the spectrum) is timed with the array module, and in
+ * Lua over tables.
+ *
+ */
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RUNS 5
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+// Computations over tables, used by the checks and the benchmark
+static const char *lua_dsp =
+	"ref = {} "
+
+	"function ref.capture(n) "
+	"  local buf = buffer.new(2 * n) "
+	"  for i = 1, n do "
+	"    local v = math.floor(1000 * math.sin(2 * math.pi * 8 * i / n) + 300 * math.sin(2 * math.pi * 50 * i / n) + (i * 7919) % 97) "
+	"    buf:put('i16', 2 * i - 1, v) "
+	"  end "
+	"  return buf "
+	"end "
+
+	"function ref.totable(buf) "
+	"  local t = {} "
+	"  for i = 1, #buf // 2 do t[i] = buf:get('i16', 2 * i - 1) end "
+	"  return t "
+	"end "
+
+	"function ref.stats(t) "
+	"  local s, sq, mn, imn, mx, imx = 0, 0, math.huge, 0, -math.huge, 0 "
+	"  for i = 1, #t do "
+	"    local v = t[i] "
+	"    s = s + v sq = sq + v * v "
+	"    if v < mn then mn, imn = v, i end "
+	"    if v > mx then mx, imx = v, i end "
+	"  end "
+	"  return s, s / #t, mn, imn, mx, imx, math.sqrt(sq / #t) "
+	"end "
+
+	"function ref.fir(x, b) "
+	"  local y = {} "
+	"  for i = 1, #x do "
+	"    local acc = 0 "
+	"    for k = 1, math.min(#b, i) do acc = acc + b[k] * x[i - k + 1] end "
+	"    y[i] = acc "
+	"  end "
+	"  return y "
+	"end "
+
+	"function ref.iir(x, b, a) "
+	"  local y = {} "
+	"  for n = 1, #x do "
+	"    local acc = 0 "
+	"    for k = 1, #b do if n - k + 1 >= 1 then acc = acc + b[k] * x[n - k + 1] end end "
+	"    for k = 2, #a do if n - k + 1 >= 1 then acc = acc - a[k] * y[n - k + 1] end end "
+	"    y[n] = acc / a[1] "
+	"  end "
+	"  return y "
+	"end "
+
+	"function ref.fft(x) "
+	"  local n, re, im = #x, {}, {} "
+	"  local j = 0 "
+	"  for i = 0, n - 1 do "
+	"    re[j + 1], im[j + 1] = x[i + 1], 0 "
+	"    local m = n // 2 "
+	"    while m >= 1 and j & m ~= 0 do j = j & ~m m = m // 2 end "
+	"    j = j | m "
+	"  end "
+	"  local step = 1 "
+	"  while step < n do "
+	"    for k = 0, step - 1 do "
+	"      local wr, wi = math.cos(-math.pi * k / step), math.sin(-math.pi * k / step) "
+	"      for i = k + 1, n, 2 * step do "
+	"        local j = i + step "
+	"        local tr = wr * re[j] - wi * im[j] "
+	"        local ti = wr * im[j] + wi * re[j] "
+	"        re[j], im[j] = re[i] - tr, im[i] - ti "
+	"        re[i], im[i] = re[i] + tr, im[i] + ti "
+	"      end "
+	"    end "
+	"    step = 2 * step "
+	"  end "
+	"  return re, im "
+	"end "
+
+	"function ref.spectrum(x) "
+	"  local re, im = ref.fft(x) "
+	"  local s = {} "
+	"  for i = 1, #x // 2 + 1 do s[i] = math.sqrt(re[i] * re[i] + im[i] * im[i]) end "
+	"  return s "
+	"end "
+
+	"function ref.crossings(x, th, h) "
+	"  local c, above = {}, x[1] >= th "
+	"  for i = 2, #x do "
+	"    local v = x[i] "
+	"    if (h == 0 and (v >= th) ~= above) or (h > 0 and ((above and v < th - h) or (not above and v > th + h))) then "
+	"      above = not above c[#c + 1] = i "
+	"    end "
+	"  end "
+	"  return c "
+	"end "
+
+	// 16-tap moving average
+	"taps = {} for i = 1, 16 do taps[i] = 1 / 16 end ";
+
+static const char *checks[] = {
+	// Samples captured into a buffer
+	"local buf = ref.capture(256) "
+	"local a, t = array.new(array.INT16, buf), ref.totable(buf) "
+	"if #a ~= 256 then return false end "
+	"for i = 1, #t do if a:get(i) ~= t[i] then return false end end "
+	"return true",
+
+	// Statistics of integer and float arrays
+	"local t = ref.totable(ref.capture(256)) "
+	"local s, mean, mn, imn, mx, imx, rms = ref.stats(t) "
+	"for _, type in ipairs({array.INT16, array.INT32, array.FLOAT32}) do "
+	"  local a = array.new(type, t) "
+	"  local amn, aimn = a:min() "
+	"  local amx, aimx = a:max() "
+	"  if a:sum() ~= s or math.abs(a:mean() - mean) > 1e-3 or "
+	"     amn ~= mn or aimn ~= imn or amx ~= mx or aimx ~= imx or "
+	"     math.abs(a:rms() - rms) > 1e-3 * rms then return false end "
+	"end "
+	"return true",
+
+	// Integer stores round to nearest and saturate
+	"local a = array.new(array.INT16, {1.4, 1.6, -1.6, 40000, -40000, 0 / 0}) "
+	"a:scale(1) "
+	"local b = array.new(array.INT16, {100, -100}):scale(1000, 5) "
+	"return a:get(1) == 1 and a:get(2) == 2 and a:get(3) == -2 and a:get(4) == 32767 and "
+	"  a:get(5) == -32768 and a:get(6) == 0 and b:get(1) == 32767 and b:get(2) == -32768",
+
+	// FIR and IIR
+	"local t = ref.totable(ref.capture(256)) "
+	"local a = array.new(array.INT16, t) "
+	"local y, ry = a:fir(taps), ref.fir(t, taps) "
+	"for i = 1, #t do if math.abs(y:get(i) - ry[i]) > 1e-2 then return false end end "
+	"local b, c = {0.2, 0.3}, {1, -0.5} "
+	"y, ry = a:iir(b, c), ref.iir(t, b, c) "
+	"for i = 1, #t do if math.abs(y:get(i) - ry[i]) > 1e-2 * (1 + math.abs(ry[i])) then return false end end "
+	"return true",
+
+	// Decimation
+	"local a = array.new(array.INT32, {1, 2, 3, 4, 5, 6, 7}):decimate(3) "
+	"return #a == 3 and a:get(1) == 1 and a:get(2) == 4 and a:get(3) == 7",
+
+	// FFT and spectrum, the tones of the capture are found in their bins
+	"local t = ref.totable(ref.capture(256)) "
+	"local a = array.new(array.INT16, t) "
+	"local re, im = a:fft() "
+	"local rre, rim = ref.fft(t) "
+	"for i = 1, #t do "
+	"  if math.abs(re:get(i) - rre[i]) > 1 or math.abs(im:get(i) - rim[i]) > 1 then return false end "
+	"end "
+	"local s = a:spectrum() "
+	"if #s ~= 129 then return false end "
+	"local m1, i1 = 0, 0 "
+	"for i = 2, #s do if s:get(i) > m1 then m1, i1 = s:get(i), i end end "
+	"local m2, i2 = 0, 0 "
+	"for i = 2, #s do if i ~= i1 and s:get(i) > m2 then m2, i2 = s:get(i), i end end "
+	"return i1 == 9 and i2 == 51",
+
+	// Threshold crossings, with and without hysteresis
+	"local t = ref.totable(ref.capture(256)) "
+	"local a = array.new(array.INT16, t) "
+	"for _, h in ipairs({0, 500}) do "
+	"  local c, rc = a:crossings(0, h), ref.crossings(t, 0, h) "
+	"  if #c ~= #rc then return false end "
+	"  for i = 1, #rc do if c:get(i) ~= rc[i] then return false end end "
+	"end "
+	"return #a:crossings(0, 500) < #a:crossings(0)",
+
+	NULL
+};
+
+// A processing pass over a capture, with the array module and in Lua
+static const struct {
+	const char *name;
+	const char *script;
+} benchs[] = {
+	{"array",
+	 "local buf = ref.capture(1024) "
+	 "for r = 1, 200 do "
+	 "  local a = array.new(array.INT16, buf) "
+	 "  local mean, rms, mn, mx = a:mean(), a:rms(), a:min(), a:max() "
+	 "  local y = a:fir(taps) "
+	 "  local s = a:spectrum() "
+	 "end "
+	 "return true"},
+
+	{"lua",
+	 "local buf = ref.capture(1024) "
+	 "for r = 1, 200 do "
+	 "  local t = ref.totable(buf) "
+	 "  local s, mean, mn, imn, mx, imx, rms = ref.stats(t) "
+	 "  local y = ref.fir(t, taps) "
+	 "  local s = ref.spectrum(t) "
+	 "end "
+	 "return true"},
+
+	{NULL, NULL}
+};
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static lua_State *newstate() {
+	lua_State *L = luaL_newstate();
+
+	luaL_openlibs(L);
+	if (luaL_dostring(L, lua_dsp) != LUA_OK) {
+		printf("FAIL: %s\n", lua_tostring(L, -1));
+		exit(1);
+	}
+
+	return L;
+}
+
+int main() {
+	double start, elapsed, best;
+	const char **check;
+	lua_State *L;
+	int i, j, failed = 0;
+
+	for(check = checks; *check; check++) {
+		L = newstate();
+
+		if ((luaL_dostring(L, *check) != LUA_OK) || !lua_toboolean(L, -1)) {
+			printf("FAIL: %s\n      %s\n", *check, lua_isstring(L, -1) ? lua_tostring(L, -1) : "false");
+			failed = 1;
+		}
+
+		lua_close(L);
+	}
+
+	if (failed) {
+		return 1;
+	}
+
+	for(i = 0; benchs[i].name; i++) {
+		best = 0;
+
+		for(j = 0; j < RUNS; j++) {
+			L = newstate();
+
+			start = now();
+			if (luaL_dostring(L, benchs[i].script) != LUA_OK) {
+				printf("FAIL: %s: %s\n", benchs[i].name, lua_tostring(L, -1));
+				return 1;
+			}
+			elapsed = now() - start;
+
+			lua_close(L);
+
+			if ((j == 0) || (elapsed < best)) {
+				best = elapsed;
+			}
+		}
+
+		printf("%-6s %7.3f s\n", benchs[i].name, best);
+	}
+
+	return 0;
+}
@@ -0,0 +1,348 @@
+/*
+ * Lua RTOS, host test and benchmark of the bytecode cache
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * Lua/src/lauxlib.c is included, with fopen and time replaced, so the
+ * sources read, and the clock, are under control of the test.
+ *
+ * A boot loads MODULES generated .lua files with luaL_loadfilex, as
+ * require and dofile do, and runs them. First, the cache is checked:
+ *
+ * - the first boot parses the sources, and writes the caches
+ * - while the sources are as recent as the resolution of the time stamps,
+ *   the caches are verified with a hash, and a source changed without
+ *   changing its size or modification time is parsed again
+ * - later, the caches are trusted, and no source is read on a hit
+ * - a source with another size is parsed again
+ * - a source without a modification time (as in SPIFFS) is always hashed
+ *
+ * Then the time of a boot, the bytes of the sources read, and the peak
+ * heap used to load a module (over the heap in use before the load, after
+ * a full collection) are reported, from the sources, with caches that are
+ * verified, and with caches that are trusted.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+static FILE *cache_fopen(const char *name, const char *mode);
+static time_t cache_time(time_t *t);
+
+#define fopen cache_fopen
+#define time cache_time
+#include "Lua/src/lauxlib.c"
+#undef fopen
+#undef time
+
+#include "lualib.h"
+
+#define MODULES   8
+#define FUNCTIONS 150
+#define BOOTS     20
+
+#define SRC_DIR "build/cache-src"
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+static int sources = 0;  // Sources opened
+static size_t read_bytes = 0;  // Bytes of the sources opened
+static time_t skew = 0;  // Seconds added to the clock
+
+static FILE *cache_fopen(const char *name, const char *mode) {
+	size_t len = strlen(name);
+
+	struct stat st;
+
+	if ((len > 4) && (strcmp(name + len - 4, ".lua") == 0)) {
+		sources++;
+		if (stat(name, &st) == 0) {
+			read_bytes += st.st_size;
+		}
+	}
+
+	return fopen(name, mode);
+}
+
+static time_t cache_time(time_t *t) {
+	time_t now = time(NULL) + skew;
+
+	if (t) {
+		*t = now;
+	}
+
+	return now;
+}
+
+static size_t heap = 0, peak = 0;
+static size_t load_peak = 0;  // Peak heap used to load a module
+
+// Allocator that records the peak heap
+static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	size_t old = ptr ? osize : 0;
+
+	if (nsize == 0) {
+		free(ptr);
+		heap -= old;
+		return NULL;
+	}
+
+	ptr = realloc(ptr, nsize);
+	if (ptr) {
+		heap += nsize - old;
+		if (heap > peak) {
+			peak = heap;
+		}
+	}
+
+	return ptr;
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void module_name(int i, char *name) {
+	sprintf(name, SRC_DIR "/mod%d.lua", i);
+}
+
+// Write module i, that returns version and the sum of its functions
+static void module_write(int i, char version) {
+	char name[64];
+	FILE *f;
+	int j;
+
+	module_name(i, name);
+	f = fopen(name, "w");
+
+	fprintf(f, "-- generated module %d\nlocal M = {version = '%c'}\n", i, version);
+	for(j = 0; j < FUNCTIONS; j++) {
+		fprintf(f, "function M.f%03d(a, b)\n  local t = {a, b, %d}\n  if a > b then return t[1] - t[3] end\n"
+			"  for k = 1, #t do t[k] = t[k] * 2 end\n  return t[2] + t[3]\nend\n", j, j);
+	}
+	fprintf(f, "local s = 0\nfor k, f in pairs(M) do if type(f) == 'function' then s = s + f(1, 2) end end\n"
+		"return M.version, s\n");
+	fclose(f);
+}
+
+static void set_mtime(int i, time_t mtime) {
+	struct utimbuf t = {mtime, mtime};
+	char name[64];
+
+	module_name(i, name);
+	utime(name, &t);
+}
+
+static void clean(const char *path) {
+	char name[PATH_MAX];
+	struct dirent *ent;
+	DIR *dir = opendir(path);
+
+	if (!dir) {
+		return;
+	}
+
+	while ((ent = readdir(dir))) {
+		if (ent->d_name[0] != '.') {
+			snprintf(name, sizeof(name), "%s/%s", path, ent->d_name);
+			unlink(name);
+		}
+	}
+
+	closedir(dir);
+}
+
+// Load and run the modules, and put the version of each one into versions.
+// If measure is true, the heap is collected before each load, to measure the
+// peak heap of the load. Returns the sources opened.
+static int boot(const char *mode, char *versions, double *elapsed, int measure) {
+	char name[64];
+	lua_State *L;
+	double start;
+	size_t base;
+	int i, status;
+
+	sources = 0;
+	read_bytes = 0;
+	heap = peak = 0;
+	load_peak = 0;
+
+	start = now();
+
+	L = lua_newstate(alloc, NULL);
+	luaL_openlibs(L);
+
+	for(i = 0; i < MODULES; i++) {
+		module_name(i, name);
+
+		if (measure) {
+			lua_gc(L, LUA_GCCOLLECT, 0);
+		}
+
+		base = peak = heap;
+		status = luaL_loadfilex(L, name, mode);
+		if (peak - base > load_peak) {
+			load_peak = peak - base;
+		}
+
+		if ((status != LUA_OK) || (lua_pcall(L, 0, 2, 0) != LUA_OK)) {
+			printf("FAIL: %s: %s\n", name, lua_tostring(L, -1));
+			exit(1);
+		}
+
+		versions[i] = *lua_tostring(L, -2);
+		lua_pop(L, 2);
+	}
+
+	lua_close(L);
+
+	if (elapsed) {
+		*elapsed = now() - start;
+	}
+
+	versions[MODULES] = '\0';
+
+	return sources;
+}
+
+static int check(int ok, const char *what, int opened, const char *versions) {
+	if (!ok) {
+		printf("FAIL: %s (%d sources opened, versions %s)\n", what, opened, versions);
+	}
+
+	return !ok;
+}
+
+// Best time of BOOTS boots, and peak heap of a load
+static void bench(const char *name, const char *mode) {
+	char versions[MODULES + 1];
+	double elapsed, best = 0;
+	int i;
+
+	for(i = 0; i < BOOTS; i++) {
+		boot(mode, versions, &elapsed, 0);
+		if ((i == 0) || (elapsed < best)) {
+			best = elapsed;
+		}
+	}
+
+	boot(mode, versions, NULL, 1);
+
+	printf("%-16s %5.2f ms per boot, %6u source bytes read, %6u bytes of peak heap per load\n",
+		name, best * 1e3, (unsigned)read_bytes, (unsigned)load_peak);
+}
+
+int main(int argc, char **argv) {
+	char versions[MODULES + 1];
+	struct stat st;
+	int i, opened, failed = 0;
+
+	mkdir(SRC_DIR, 0755);
+	clean(SRC_DIR);
+	clean(LUA_BYTECODE_CACHE_DIR);
+
+	for(i = 0; i < MODULES; i++) {
+		module_write(i, 'a');
+	}
+
+	stat(SRC_DIR "/mod0.lua", &st);
+	printf("%d modules of %u bytes\n", MODULES, (unsigned)st.st_size);
+
+	// First boot, the sources are parsed, and hashed for the caches
+	opened = boot(NULL, versions, NULL, 0);
+	failed |= check((opened == 2 * MODULES) && (strcmp(versions, "aaaaaaaa") == 0), "first boot", opened, versions);
+
+	// The sources were just written, so the caches are verified
+	opened = boot(NULL, versions, NULL, 0);
+	failed |= check((opened == MODULES) && (strcmp(versions, "aaaaaaaa") == 0), "verified boot", opened, versions);
+
+	// A source changed in the same second, with the same size
+	stat(SRC_DIR "/mod3.lua", &st);
+	module_write(3, 'b');
+	set_mtime(3, st.st_mtime);
+	opened = boot(NULL, versions, NULL, 0);
+	failed |= check(strcmp(versions, "aaabaaaa") == 0, "source changed with the same size and time", opened, versions);
+
+	// Later, the caches that match are trusted, and sources are not read
+	skew = 10;
+	boot(NULL, versions, NULL, 0);
+	opened = boot(NULL, versions, NULL, 0);
+	failed |= check((opened == 0) && (strcmp(versions, "aaabaaaa") == 0), "trusted boot", opened, versions);
+
+	// A source with another size is parsed again
+	module_write(5, 'c');
+	stat(SRC_DIR "/mod5.lua", &st);
+	set_mtime(5, st.st_mtime - 10);
+	boot(NULL, versions, NULL, 0);
+	opened = boot(NULL, versions, NULL, 0);
+	failed |= check((opened == 0) && (strcmp(versions, "aaabacaa") == 0), "source changed", opened, versions);
+
+	// Without modification times, the source is always hashed
+	module_write(6, 'd');
+	set_mtime(6, 0);
+	boot(NULL, versions, NULL, 0);
+	opened = boot(NULL, versions, NULL, 0);
+	failed |= check((opened == 1) && (strcmp(versions, "aaabacda") == 0), "source without modification time", opened, versions);
+
+	if (failed) {
+		return 1;
+	}
+
+	// Boot time and peak heap, with new caches of sources just written
+	for(i = 0; i < MODULES; i++) {
+		set_mtime(i, time(NULL));
+	}
+	clean(LUA_BYTECODE_CACHE_DIR);
+	skew = 0;
+
+	bench("from sources", "t");
+	boot(NULL, versions, NULL, 0);
+	bench("cache, verified", NULL);
+	skew = 10;
+	boot(NULL, versions, NULL, 0);
+	bench("cache, trusted", NULL);
+
+	return 0;
+}
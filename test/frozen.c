@@ -0,0 +1,310 @@
+/*
+ * Lua RTOS, host test and benchmark of frozen Lua modules
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * frozen/stats.lua is frozen by Lua/frozen/mkfrozen.sh, as in a firmware
+ * build, and linked with Lua/common/lfrozen.c. First, it's checked that the
+ * frozen module is found, that the code and line info of all its functions
+ * point into the frozen chunk, that it works after a full collection, and
+ * that closing the state frees everything but the frozen chunk.
+ *
+ * Then the time to load and run the module, and the heap that it keeps
+ * after a full collection, are reported, loaded from its source, from a
+ * copy of its bytecode, and in place.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "lobject.h"
+#include "lfunc.h"
+#include "lfrozen.h"
+
+#define LOADS 2000
+
+#define SOURCE "frozen/stats.lua"
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+static size_t heap = 0, peak = 0;
+
+// Allocator that records the heap in use, and its peak
+static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	size_t old = ptr ? osize : 0;
+
+	if (nsize == 0) {
+		free(ptr);
+		heap -= old;
+		return NULL;
+	}
+
+	ptr = realloc(ptr, nsize);
+	if (ptr) {
+		heap += nsize - old;
+		if (heap > peak) {
+			peak = heap;
+		}
+	}
+
+	return ptr;
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *source;
+static size_t source_size;
+
+static void read_source() {
+	FILE *f = fopen(SOURCE, "rb");
+
+	if (!f) {
+		printf("FAIL: can't open " SOURCE "\n");
+		exit(1);
+	}
+
+	fseek(f, 0, SEEK_END);
+	source_size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	source = malloc(source_size);
+	if (fread(source, 1, source_size, f) != source_size) {
+		printf("FAIL: can't read " SOURCE "\n");
+		exit(1);
+	}
+
+	fclose(f);
+}
+
+enum { FROM_SOURCE, FROM_BYTECODE, IN_PLACE };
+
+static const char *how_name[] = {"from source", "from bytecode", "in place"};
+
+// Load the module, and put its main function on the stack
+static int load(lua_State *L, int how) {
+	const luaR_frozen *module = luaR_findfrozen("stats");
+
+	switch (how) {
+	case FROM_SOURCE:
+		return luaL_loadbufferx(L, source, source_size, "@stats.lua", "t");
+
+	case FROM_BYTECODE:
+		return luaL_loadbufferx(L, module->code, module->size, "=stats", "b");
+
+	default:
+		return luaR_loadfrozen(L, module);
+	}
+}
+
+// Load and run the module, and set it as the global stats
+static void require(lua_State *L, int how) {
+	if ((load(L, how) != LUA_OK) || (lua_pcall(L, 0, 1, 0) != LUA_OK)) {
+		printf("FAIL: %s: %s\n", how_name[how], lua_tostring(L, -1));
+		exit(1);
+	}
+
+	lua_setglobal(L, "stats");
+}
+
+// Functions of f, and nested ones, that don't have their code and line info
+// in the frozen module
+static int not_in_place(const Proto *f, const luaR_frozen *module) {
+	const char *code = (const char *)f->code;
+	const char *lineinfo = (const char *)f->lineinfo;
+	const char *end = module->code + module->size;
+	int i, n = 0;
+
+	if (!(f->frozen & FROZEN_CODE) || (code < module->code) || (code >= end) ||
+		!(f->frozen & FROZEN_LINEINFO) || (lineinfo < module->code) || (lineinfo >= end)) {
+		n++;
+	}
+
+	for(i = 0; i < f->sizep; i++) {
+		n += not_in_place(f->p[i], module);
+	}
+
+	return n;
+}
+
+static const char *checks =
+	"local s = stats\n"
+	"local t = {4, 8, 15, 16, 23, 42}\n"
+	"local w, e = s.window(3), s.ema(0.5)\n"
+	"for i = 1, 5 do w(i); e(i) end\n"
+	"collectgarbage()\n"
+	"local slope, b = s.trend({1, 3, 5, 7})\n"
+	"local ok, err = pcall(s.sum, {1, 'x'})\n"
+	"return s.sum(t) == 108 and s.mean(t) == 18 and s.min(t) == 4 and\n"
+	"  s.max(t) == 42 and s.median(t) == 15.5 and s.percentile(t, 50) == 15 and\n"
+	"  w(6) == 5 and e(6) == 5.03125 and slope == 2 and b == -1 and\n"
+	"  #s.outliers({1, 1, 1, 1, 1, 1, 1, 1, 1, 100}, 2) == 1 and\n"
+	"  s.histogram(t, 0, 50, 5)[1] == 2 and\n"
+	"  s.summary({1, 2, 3}) == 'n=3 min=1 max=3 mean=2.00 sd=1.00' and\n"
+	"  not ok and string.find(err, 'stats.lua:7:', 1, true) ~= nil\n";
+
+static int check(int ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+	}
+
+	return !ok;
+}
+
+static int check_module(int how) {
+	lua_State *L = luaL_newstate();
+	int ok;
+
+	luaL_openlibs(L);
+	require(L, how);
+	lua_gc(L, LUA_GCCOLLECT, 0);
+
+	ok = (luaL_loadstring(L, checks) == LUA_OK) && (lua_pcall(L, 0, 1, 0) == LUA_OK) && lua_toboolean(L, -1);
+	if (!ok) {
+		printf("FAIL: module loaded %s (%s)\n", how_name[how], lua_tostring(L, -1));
+	}
+
+	lua_close(L);
+
+	return !ok;
+}
+
+static int check_in_place() {
+	const luaR_frozen *module = luaR_findfrozen("stats");
+	lua_State *L;
+	int failed = 0;
+
+	failed |= check(module != NULL, "frozen module is found");
+	failed |= check(luaR_findfrozen("stat") == NULL, "unknown module is not found");
+	if (failed) {
+		return 1;
+	}
+
+	failed |= check(((uintptr_t)module->code % sizeof(Instruction)) == 0, "frozen chunk is aligned");
+
+	heap = 0;
+	L = lua_newstate(alloc, NULL);
+	luaL_openlibs(L);
+
+	failed |= check(load(L, IN_PLACE) == LUA_OK, "frozen module is loaded");
+	failed |= check(not_in_place(((const LClosure *)lua_topointer(L, -1))->p, module) == 0,
+		"code and line info of all functions are in place");
+	lua_pop(L, 1);
+
+	failed |= check(load(L, FROM_BYTECODE) == LUA_OK, "frozen chunk is loaded as bytecode");
+	failed |= check(!(((const LClosure *)lua_topointer(L, -1))->p->frozen), "bytecode is copied");
+	lua_pop(L, 1);
+
+	// In place loading is only for frozen modules
+	failed |= check(luaL_loadbufferx(L, module->code, module->size, "=stats", "bf") != LUA_OK,
+		"mode f is rejected");
+	lua_pop(L, 1);
+
+	// Frozen vectors are not freed
+	require(L, IN_PLACE);
+	lua_close(L);
+	failed |= check(heap == 0, "state closed");
+
+	return failed;
+}
+
+// Best time of LOADS loads, and heap kept by the module after a collection
+static void bench(int how) {
+	double start, elapsed, best = 0;
+	size_t base, load_peak;
+	lua_State *L;
+	int i;
+
+	heap = 0;
+	L = lua_newstate(alloc, NULL);
+	luaL_openlibs(L);
+
+	for(i = 0; i < LOADS; i++) {
+		start = now();
+		require(L, how);
+		elapsed = now() - start;
+		if ((i == 0) || (elapsed < best)) {
+			best = elapsed;
+		}
+	}
+
+	lua_pushnil(L);
+	lua_setglobal(L, "stats");
+	lua_gc(L, LUA_GCCOLLECT, 0);
+
+	base = peak = heap;
+	require(L, how);
+	load_peak = peak - base;
+	lua_gc(L, LUA_GCCOLLECT, 0);
+
+	printf("%-14s %6.1f us per load, %6u bytes of heap kept, %6u bytes of peak heap\n",
+		how_name[how], best * 1e6, (unsigned)(heap - base), (unsigned)load_peak);
+
+	lua_close(L);
+}
+
+int main(int argc, char **argv) {
+	int failed = 0;
+
+	read_source();
+
+	failed |= check_in_place();
+	failed |= check_module(FROM_SOURCE);
+	failed |= check_module(FROM_BYTECODE);
+	failed |= check_module(IN_PLACE);
+
+	if (failed) {
+		return 1;
+	}
+
+	printf("module of %u bytes of source, %u bytes frozen\n",
+		(unsigned)source_size, (unsigned)luaR_findfrozen("stats")->size);
+
+	bench(FROM_SOURCE);
+	bench(FROM_BYTECODE);
+	bench(IN_PLACE);
+
+	return 0;
+}
@@ -0,0 +1,130 @@
+-- Statistics of sensor readings, frozen by the frozen test
+
+local M = {}
+
+function M.sum(t)
+  local s = 0
+  for i = 1, #t do s = s + t[i] end
+  return s
+end
+
+function M.mean(t)
+  if #t == 0 then return nil end
+  return M.sum(t) / #t
+end
+
+function M.min(t)
+  local m = t[1]
+  for i = 2, #t do if t[i] < m then m = t[i] end end
+  return m
+end
+
+function M.max(t)
+  local m = t[1]
+  for i = 2, #t do if t[i] > m then m = t[i] end end
+  return m
+end
+
+function M.variance(t)
+  local n = #t
+  if n < 2 then return 0 end
+  local m = M.mean(t)
+  local s = 0
+  for i = 1, n do
+    local d = t[i] - m
+    s = s + d * d
+  end
+  return s / (n - 1)
+end
+
+function M.stddev(t)
+  return math.sqrt(M.variance(t))
+end
+
+function M.sorted(t)
+  local c = {}
+  for i = 1, #t do c[i] = t[i] end
+  table.sort(c)
+  return c
+end
+
+function M.median(t)
+  local c = M.sorted(t)
+  local n = #c
+  if n == 0 then return nil end
+  if n % 2 == 1 then return c[(n + 1) // 2] end
+  return (c[n // 2] + c[n // 2 + 1]) / 2
+end
+
+function M.percentile(t, p)
+  local c = M.sorted(t)
+  if #c == 0 then return nil end
+  local k = math.max(1, math.min(#c, math.ceil(p / 100 * #c)))
+  return c[k]
+end
+
+function M.histogram(t, lo, hi, bins)
+  local h = {}
+  local w = (hi - lo) / bins
+  for i = 1, bins do h[i] = 0 end
+  for i = 1, #t do
+    local b = math.floor((t[i] - lo) / w) + 1
+    if b < 1 then b = 1 elseif b > bins then b = bins end
+    h[b] = h[b] + 1
+  end
+  return h
+end
+
+-- Moving average of the last n readings
+function M.window(n)
+  local buf, pos, count, sum = {}, 0, 0, 0
+  return function(v)
+    pos = pos % n + 1
+    if count == n then sum = sum - buf[pos] else count = count + 1 end
+    buf[pos] = v
+    sum = sum + v
+    return sum / count
+  end
+end
+
+-- Exponential moving average
+function M.ema(alpha)
+  local avg
+  return function(v)
+    if avg == nil then avg = v else avg = avg + alpha * (v - avg) end
+    return avg
+  end
+end
+
+-- Readings out of mean +/- k standard deviations
+function M.outliers(t, k)
+  local m, sd = M.mean(t), M.stddev(t)
+  local r = {}
+  for i = 1, #t do
+    if math.abs(t[i] - m) > k * sd then r[#r + 1] = i end
+  end
+  return r
+end
+
+-- Least squares line through the readings, as a function of their index
+function M.trend(t)
+  local n = #t
+  local sx, sy, sxx, sxy = 0, 0, 0, 0
+  for i = 1, n do
+    sx = sx + i
+    sy = sy + t[i]
+    sxx = sxx + i * i
+    sxy = sxy + i * t[i]
+  end
+  local d = n * sxx - sx * sx
+  if d == 0 then return 0, sy / n end
+  local slope = (n * sxy - sx * sy) / d
+  return slope, (sy - slope * sx) / n
+end
+
+function M.summary(t)
+  return string.format("n=%d min=%g max=%g mean=%.2f sd=%.2f",
+    #t, M.min(t), M.max(t), M.mean(t), M.stddev(t))
+end
+
+return M
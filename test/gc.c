@@ -0,0 +1,174 @@
+/*
+ * Lua RTOS, host test of rotable metatables in the collector
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * A rotable is not a collectable object, and lives in read only memory, so
+ * the collector must not mark a rotable that is used as a metatable, as
+ * the metatable of the *.ins userdata of the modules are. Marking it writes
+ * its mark bits into .rodata, and crashes the test.
+ *
+ * Userdata, tables and numbers get a rotable metatable, and full and
+ * incremental collections are run while they are alive, and after they
+ * are garbage. The metatables must still work after the collections.
+ *
+ */
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "lrotable.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OBJECTS "2000"
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+static const LUA_REG_TYPE meta_map[] = {
+	{ LSTRKEY( "value"   ),	 LINTVAL( 42        ) },
+	{ LSTRKEY( "__index" ),	 LROVAL ( meta_map  ) },
+	{ LNILKEY, LNILVAL }
+};
+
+static int failed = 0;
+
+static void check(int ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failed = 1;
+	}
+}
+
+// Run a script that gets the objects, and must return true
+static void check_script(lua_State *L, const char *script, const char *what) {
+	if ((luaL_dostring(L, script) != LUA_OK) || !lua_toboolean(L, -1)) {
+		printf("FAIL: %s: %s\n", what, lua_isstring(L, -1) ? lua_tostring(L, -1) : "false");
+		failed = 1;
+	}
+
+	lua_settop(L, 0);
+}
+
+// New userdata with the rotable metatable
+static int new_userdata(lua_State *L) {
+	lua_newuserdata(L, 16);
+	lua_pushrotable(L, (void *)meta_map);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+// New table with the rotable metatable
+static int new_table(lua_State *L) {
+	lua_newtable(L);
+	lua_pushrotable(L, (void *)meta_map);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+static void collect(lua_State *L) {
+	int i;
+
+	// Incremental steps, while garbage is made
+	for(i = 0; i < 200; i++) {
+		lua_newtable(L);
+		lua_pop(L, 1);
+		lua_gc(L, LUA_GCSTEP, 1);
+	}
+
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	lua_gc(L, LUA_GCCOLLECT, 0);
+}
+
+int main() {
+	lua_State *L = luaL_newstate();
+
+	luaL_openlibs(L);
+	check(luaR_isrotable(meta_map), "the metatable is a rotable");
+
+	lua_register(L, "new_userdata", new_userdata);
+	lua_register(L, "new_table", new_table);
+
+	// Userdata, alive and garbage
+	check_script(L,
+		"objects = {} "
+		"for i = 1, " OBJECTS " do objects[i] = new_userdata() end "
+		"for i = 1, " OBJECTS " do new_userdata() end "
+		"return objects[1].value == 42", "userdata");
+
+	collect(L);
+	check_script(L,
+		"local ok = true "
+		"for i = 1, #objects do ok = ok and (objects[i].value == 42) end "
+		"objects = nil "
+		"return ok", "userdata after a collection");
+	collect(L);
+
+	// Tables, alive and garbage
+	check_script(L,
+		"objects = {} "
+		"for i = 1, " OBJECTS " do objects[i] = new_table() end "
+		"for i = 1, " OBJECTS " do new_table() end "
+		"return objects[1].value == 42", "tables");
+
+	collect(L);
+	check_script(L,
+		"local ok = true "
+		"for i = 1, #objects do ok = ok and (objects[i].value == 42) end "
+		"objects = nil "
+		"return ok", "tables after a collection");
+	collect(L);
+
+	// Metatable of a basic type (markmt)
+	lua_pushinteger(L, 1);
+	lua_pushrotable(L, (void *)meta_map);
+	lua_setmetatable(L, -2);
+	lua_pop(L, 1);
+
+	collect(L);
+	check_script(L, "return getmetatable(1) ~= nil", "metatable of numbers after a collection");
+
+	lua_pushinteger(L, 1);
+	lua_pushnil(L);
+	lua_setmetatable(L, -2);
+	lua_pop(L, 1);
+
+	lua_close(L);
+
+	return failed;
+}
@@ -0,0 +1 @@
+// The ESP-IDF GPIO driver is not used by the parts built on the host
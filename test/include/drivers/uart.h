@@ -0,0 +1,29 @@
+// Host counterpart of the UART driver, see rtos_host.c. The UART units only
+// receive the bytes given to rtos_host_uart_rx, and the functions that are
+// not used on the host are left to the tests.
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <sys/driver.h>
+
+#define NUART 3
+
+driver_error_t *uart_init(int8_t unit, uint32_t brg, uint8_t databits, uint8_t parity, uint8_t stop_bits, uint32_t qs);
+driver_error_t *uart_setup_interrupts(int8_t unit);
+void     uart_write(int8_t unit, char byte);
+void     uart_writes(int8_t unit, char *s);
+void     uart_writeb(int8_t unit, const uint8_t *data, size_t len);
+uint8_t  uart_read(int8_t unit, char *c, uint32_t timeout);
+uint8_t  uart_reads(int8_t unit, char *buff, uint8_t crlf, uint32_t timeout);
+void     uart_consume(int8_t unit);
+int      uart_get_br(int unit);
+int      uart_bytes_available(int8_t unit);
+void     uart_wait_rx(uint32_t timeout);
+int      uart_is_setup(int unit);
+void     uart_pins(int8_t unit, uint8_t *rx, uint8_t *tx);
+void     uart_lock(int unit);
+void     uart_unlock(int unit);
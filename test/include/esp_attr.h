@@ -0,0 +1,3 @@
+// Code is not placed in IRAM on the host
+
+#define IRAM_ATTR
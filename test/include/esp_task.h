@@ -0,0 +1,4 @@
+// Host counterpart of the ESP-IDF task priorities
+
+#define ESP_TASK_PRIO_MIN 0
+#define ESP_TASK_PRIO_MAX 24
@@ -0,0 +1 @@
+// FreeRTOS event groups are not used by the parts built on the host
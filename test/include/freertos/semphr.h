@@ -0,0 +1,3 @@
+// FreeRTOS semaphores are not used by the parts built on the host
+
+typedef void *SemaphoreHandle_t;
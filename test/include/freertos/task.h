@@ -0,0 +1,39 @@
+// Host counterparts of the FreeRTOS task functions used by the parts built
+// on the host
+
+#ifndef TASK_H
+#define TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef TaskHandle_t xTaskHandle;
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index);
+
+// Tasks are not created on the host, these are declared for pthread/pthread.c
+#define tskNO_AFFINITY 0x7fffffff
+#define errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY (-1)
+
+typedef void (*TaskFunction_t)(void *);
+typedef void (*TlsDeleteCallbackFunction_t)(int, void *);
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *task);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *task, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskSuspend(TaskHandle_t task);
+void vTaskResume(TaskHandle_t task);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+void vTaskSetThreadLocalStoragePointerAndDelCallback(TaskHandle_t task, BaseType_t index, void *value, TlsDeleteCallbackFunction_t callback);
+BaseType_t xPortGetCoreID(void);
+
+// Tasks created by xTaskCreate run in a host thread (see rtos_host.c)
+#define tskIDLE_PRIORITY 0
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+#endif
@@ -0,0 +1,41 @@
+// Host counterpart of the Lua RTOS pthread API, on top of the host pthreads
+// (see rtos_host.c)
+
+#ifndef _PTHREAD_HOST_H
+#define _PTHREAD_HOST_H
+
+#include <pthread.h>
+
+// Lua RTOS minimal stack size, host threads get a larger one
+#undef PTHREAD_STACK_MIN
+#define PTHREAD_STACK_MIN (1024 * 2)
+
+// Lua RTOS takes a CPU number as the affinity mask
+#define cpu_set_t int
+#define pthread_attr_setaffinity_np(attr, size, set) ((void)(attr), (void)(set), 0)
+
+#define PTHREAD_INITIAL_STATE_RUN     1
+#define PTHREAD_INITIAL_STATE_SUSPEND 2
+
+// Threads and stacks are accounted
+#define pthread_create(thread, attr, routine, arg) _pthread_create_host(thread, attr, routine, arg)
+#define pthread_attr_setstacksize(attr, size) _pthread_attr_setstacksize_host(attr, size)
+
+// Cleanup handlers don't need to be popped in the same scope
+#undef pthread_cleanup_push
+#define pthread_cleanup_push(routine, arg) _pthread_cleanup_push(routine, arg)
+
+int _pthread_create_host(pthread_t *thread, const pthread_attr_t *attr, void *(*routine)(void *), void *arg);
+int _pthread_attr_setstacksize_host(pthread_attr_t *attr, size_t size);
+void _pthread_cleanup_push(void (*routine)(void *), void *arg);
+int pthread_attr_setinitialstate(pthread_attr_t *attr, int initial_state);
+
+int _pthread_free(pthread_t id);
+int _pthread_stop(pthread_t id);
+int _pthread_suspend(pthread_t id);
+int _pthread_resume(pthread_t id);
+int _pthread_core(pthread_t id);
+int _pthread_stack_free(pthread_t id);
+int _pthread_stack(pthread_t id);
+
+#endif
@@ -0,0 +1,5 @@
+// Host counterpart of the newlib reentrancy structure, only errno is used
+
+struct _reent {
+    int _errno;
+};
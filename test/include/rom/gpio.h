@@ -0,0 +1 @@
+// The ESP32 ROM GPIO functions are not used by the parts built on the host
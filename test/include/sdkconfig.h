@@ -0,0 +1,26 @@
+/*
+ * Configuration for the host tests, the Kconfig defaults of the parts
+ * that are built on the host
+ *
+ */
+
+#define CONFIG_LUA_RTOS_LUA_USE__G 1
+#define CONFIG_LUA_RTOS_LUA_USE_MATH 1
+#define CONFIG_LUA_RTOS_LUA_USE_TABLE 1
+#define CONFIG_LUA_RTOS_LUA_USE_STRING 1
+#define CONFIG_LUA_RTOS_LUA_USE_COROUTINE 1
+#define CONFIG_LUA_RTOS_LUA_USE_UTF8 1
+#define CONFIG_LUA_RTOS_LUA_USE_DEBUG 1
+#define CONFIG_LUA_RTOS_LUA_USE_IO 0
+#define CONFIG_LUA_RTOS_LUA_USE_OS 0
+#define CONFIG_LUA_RTOS_LUA_USE_PACKAGE 0
+#define CONFIG_LUA_RTOS_LUA_TASK_PRIORITY 3
+
+#define CONFIG_LUA_RTOS_LUA_SAFE_SIGNAL 1
+
+#define CONFIG_LUA_RTOS_USE_SPIFFS 1
+#define CONFIG_LUA_RTOS_USE_FAT 1
+
+#define CONFIG_LUA_RTOS_CONSOLE_UART0 1
+
+#define CONFIG_MAX_FD_BITS 12
@@ -0,0 +1,308 @@
+/*
+ * Lua RTOS, host test and benchmark of the JSON module
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * First, json.encode / json.decode round trips, chunked parsers, and
+ * parsers that fail are checked. A parser that raised an error, because
+ * of bad input or because of its callback, must keep failing, and a new
+ * one must work.
+ *
+ * Then a MQTT-like document is decoded and encoded with the JSON module,
+ * and with a reference JSON library in Lua, that uses string concatenation
+ * and patterns. The time, and the bytes allocated per document are
+ * reported.
+ *
+ */
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DOCS 2000
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+// A document like the ones published by the sensors, and a deep compare
+#define DOC \
+	"local function doc() " \
+	"  local t = {device = 'wcb-0042', ts = 1508316000, online = true, readings = {}} " \
+	"  for i = 1, 40 do " \
+	"    t.readings[i] = {id = i, name = 'sensor \"' .. i .. '\"', temp = 20 + i / 4, hum = 40 + i % 7, ok = i % 3 ~= 0} " \
+	"  end " \
+	"  return t " \
+	"end " \
+	"local function same(a, b) " \
+	"  if type(a) ~= 'table' or type(b) ~= 'table' then return a == b end " \
+	"  for k, v in pairs(a) do if not same(v, b[k]) then return false end end " \
+	"  for k in pairs(b) do if a[k] == nil then return false end end " \
+	"  return true " \
+	"end "
+
+// Reference JSON library in Lua, that only escapes quotes and backslashes
+#define REFERENCE \
+	"local function ref_encode(v) " \
+	"  local t = type(v) " \
+	"  if t == 'table' then " \
+	"    local r = {} " \
+	"    if #v > 0 then " \
+	"      for i = 1, #v do r[i] = ref_encode(v[i]) end " \
+	"      return '[' .. table.concat(r, ',') .. ']' " \
+	"    end " \
+	"    for k, x in pairs(v) do r[#r + 1] = ref_encode(tostring(k)) .. ':' .. ref_encode(x) end " \
+	"    return '{' .. table.concat(r, ',') .. '}' " \
+	"  elseif t == 'string' then " \
+	"    return '\"' .. string.gsub(v, '[\"\\\\]', '\\\\%0') .. '\"' " \
+	"  elseif math.type(v) == 'float' then " \
+	"    return string.format('%.14g', v) " \
+	"  end " \
+	"  return tostring(v) " \
+	"end " \
+	"local function ref_decode(s) " \
+	"  local pos, value = 1 " \
+	"  local function ws() pos = string.find(s, '[^ \\t\\r\\n]', pos) or #s + 1 end " \
+	"  local function list(close, item) " \
+	"    pos = pos + 1 ws() " \
+	"    if string.sub(s, pos, pos) == close then pos = pos + 1 return end " \
+	"    while true do " \
+	"      item() ws() " \
+	"      local c = string.sub(s, pos, pos) pos = pos + 1 " \
+	"      if c == close then return end " \
+	"      assert(c == ',', 'invalid json at byte ' .. pos - 1) " \
+	"    end " \
+	"  end " \
+	"  function value() " \
+	"    ws() " \
+	"    local c = string.sub(s, pos, pos) " \
+	"    if c == '{' then " \
+	"      local t = {} " \
+	"      list('}', function() " \
+	"        local k = value() ws() " \
+	"        assert(string.sub(s, pos, pos) == ':', 'invalid json at byte ' .. pos) " \
+	"        pos = pos + 1 t[k] = value() " \
+	"      end) " \
+	"      return t " \
+	"    elseif c == '[' then " \
+	"      local t = {} " \
+	"      list(']', function() t[#t + 1] = value() end) " \
+	"      return t " \
+	"    elseif c == '\"' then " \
+	"      local e = pos + 1 " \
+	"      while true do " \
+	"        e = assert(string.find(s, '[\"\\\\]', e), 'unterminated string') " \
+	"        if string.sub(s, e, e) == '\"' then break end " \
+	"        e = e + 2 " \
+	"      end " \
+	"      local str = string.gsub(string.sub(s, pos + 1, e - 1), '\\\\(.)', '%1') " \
+	"      pos = e + 1 " \
+	"      return str " \
+	"    end " \
+	"    local n = string.match(s, '^-?[%d.eE+-]+', pos) " \
+	"    if n then pos = pos + #n return tonumber(n) end " \
+	"    for _, w in ipairs({'true', 'false', 'null'}) do " \
+	"      if string.sub(s, pos, pos + #w - 1) == w then pos = pos + #w return ({true, false, json.null})[_] end " \
+	"    end " \
+	"    error('invalid json at byte ' .. pos) " \
+	"  end " \
+	"  return value() " \
+	"end "
+
+// Each script returns true on success
+static const char *checks[] = {
+	// Round trips, and both libraries read what the other one writes
+	DOC REFERENCE
+	"local d = doc() "
+	"return same(json.decode(json.encode(d)), d) and same(ref_decode(json.encode(d)), d) and "
+	"same(json.decode(ref_encode(d)), d)",
+
+	// Scalars, escapes, null and nesting
+	"local t = json.decode('{\"a\":[1,-2.5,1e3,true,false,null],\"b\":\"x\\\\n\\\\u00e9\\\\\"\",\"c\":{\"d\":[[]]}}') "
+	"return t.a[1] == 1 and t.a[2] == -2.5 and t.a[3] == 1000 and t.a[4] == true and t.a[5] == false and "
+	"t.a[6] == json.null and t.b == 'x\\n\\xc3\\xa9\"' and #t.c.d == 1 and #t.c.d[1] == 0 and "
+	"json.encode({1, 'a', true}) == '[1,\"a\",true]'",
+
+	// A document fed in chunks of every size builds the same tables
+	DOC
+	"local s = json.encode(doc()) "
+	"for size = 1, 17 do "
+	"  local p, r = json.parser() "
+	"  for i = 1, #s, size do r = p:feed(string.sub(s, i, i + size - 1)) end "
+	"  if not same(r, doc()) then return false end "
+	"end "
+	"return true",
+
+	// Callback events, split between chunks
+	"local ev = {} "
+	"local p = json.parser(function(e, v) ev[#ev + 1] = e .. (v ~= nil and ('=' .. tostring(v)) or '') end) "
+	"p:feed('{\"ke') p:feed('y\": [1') p:feed('2, tr') p:feed('ue]}') "
+	"return table.concat(ev, ' ') == 'object key=key array value=12 value=true endarray endobject'",
+
+	// Bad input raises with the byte offset, and the parser keeps failing,
+	// even with input that would complete the document
+	"local p = json.parser() "
+	"assert(p:feed('{\"a\":[1,2') == nil) "
+	"local ok, e = pcall(p.feed, p, ',]}') "
+	"assert(not ok and string.find(e, 'invalid json at byte 11', 1, true), e) "
+	"ok, e = pcall(p.feed, p, '3]}') "
+	"assert(not ok and string.find(e, 'parser failed', 1, true), e) "
+	"ok, e = pcall(p.finish, p) "
+	"assert(not ok and string.find(e, 'parser failed', 1, true), e) "
+	"p = json.parser() "
+	"return p:feed('{\"a\":[1,2,3]}').a[3] == 3",
+
+	// An error raised by the callback fails the parser too
+	"local n = 0 "
+	"local p = json.parser(function(e) n = n + 1 if e == 'value' then error('stop') end end) "
+	"local ok, e = pcall(p.feed, p, '[1,2]') "
+	"assert(not ok and string.find(e, 'stop', 1, true), e) "
+	"ok, e = pcall(p.feed, p, ']') "
+	"assert(not ok and string.find(e, 'parser failed', 1, true), e) "
+	"return n == 2",
+
+	// An incomplete document can be completed after finish
+	"local p = json.parser() "
+	"p:feed('[1,') "
+	"local ok, e = pcall(p.finish, p) "
+	"assert(not ok and string.find(e, 'incomplete json', 1, true), e) "
+	"p:feed('2]') "
+	"return p:finish()[2] == 2",
+
+	NULL
+};
+
+static const struct {
+	const char *name;
+	const char *script;
+} benchs[] = {
+	{"decode, json", "local s = ... for i = 1, n do json.decode(s) end"},
+	{"decode, Lua", "local s = ... for i = 1, n do ref_decode(s) end"},
+	{"encode, json", "local s, d = ... for i = 1, n do json.encode(d) end"},
+	{"encode, Lua", "local s, d = ... for i = 1, n do ref_encode(d) end"},
+	{"parser, 64 byte chunks",
+	 "local s = ... "
+	 "local chunks = {} for i = 1, #s, 64 do chunks[#chunks + 1] = string.sub(s, i, i + 63) end "
+	 "for i = 1, n do local p = json.parser() for j = 1, #chunks do p:feed(chunks[j]) end end"},
+	{NULL, NULL}
+};
+
+static size_t allocated = 0;
+
+// Allocator that counts the bytes allocated
+static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	if (nsize > (ptr ? osize : 0)) {
+		allocated += nsize - (ptr ? osize : 0);
+	}
+
+	return realloc(ptr, nsize);
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+	double start, elapsed;
+	const char **check;
+	lua_State *L;
+	size_t len, bytes;
+	char script[8192];
+	int i, failed = 0;
+
+	for(check = checks; *check; check++) {
+		L = luaL_newstate();
+		luaL_openlibs(L);
+
+		if ((luaL_dostring(L, *check) != LUA_OK) || !lua_toboolean(L, -1)) {
+			printf("FAIL: %s\n      %s\n", *check, lua_isstring(L, -1) ? lua_tostring(L, -1) : "false");
+			failed = 1;
+		}
+
+		lua_close(L);
+	}
+
+	if (failed) {
+		return 1;
+	}
+
+	for(i = 0; benchs[i].name; i++) {
+		L = lua_newstate(alloc, NULL);
+		luaL_openlibs(L);
+
+		// The document, and its encoding, are made before the benchmark,
+		// that is a function of them
+		snprintf(script, sizeof(script),
+			"%s local n = %d local d = doc() return json.encode(d), d, function(...) %s end",
+			DOC REFERENCE, DOCS, benchs[i].script);
+
+		if (luaL_dostring(L, script) != LUA_OK) {
+			printf("FAIL: %s: %s\n", benchs[i].name, lua_tostring(L, -1));
+			return 1;
+		}
+
+		lua_tolstring(L, -3, &len);
+		lua_pushvalue(L, -3);
+		lua_pushvalue(L, -3);
+
+		allocated = 0;
+		start = now();
+		if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+			printf("FAIL: %s: %s\n", benchs[i].name, lua_tostring(L, -1));
+			return 1;
+		}
+		elapsed = now() - start;
+		bytes = allocated;
+
+		printf("%-22s %6.1f us, %6.1f MB/s, %6u bytes allocated per %u byte document\n",
+			benchs[i].name, elapsed * 1e6 / DOCS, (double)len * DOCS / elapsed / 1e6,
+			(unsigned)(bytes / DOCS), (unsigned)len);
+
+		lua_close(L);
+	}
+
+	return 0;
+}
@@ -0,0 +1,270 @@
+/*
+ * Lua RTOS, host test and benchmark of pthread keys
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * pthread/key.c is included, with freertos/adds.c and sys/list.c, on top of
+ * tasks simulated in a single host thread: the current task is switched by
+ * the test, and each task has its Lua RTOS specific TCB parts. The Lua RTOS
+ * pthread types and key functions are renamed, as they have the names of
+ * the host ones.
+ *
+ * Mutexes record if they are held, so a mutex locked twice (a deadlock on
+ * the target) fails, and it's checked that the values of a deleted key are
+ * cleared in the other threads with the thread list locked, as a thread that
+ * ends frees its TCB after removing itself from the list.
+ *
+ * Then the time of pthread_getspecific and pthread_setspecific is reported.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+
+#define pthread_t rtos_pthread_t
+#define pthread_key_t rtos_pthread_key_t
+#define pthread_attr_t rtos_pthread_attr_t
+#define pthread_mutex_t rtos_pthread_mutex_t
+#define pthread_mutexattr_t rtos_pthread_mutexattr_t
+#define pthread_cond_t rtos_pthread_cond_t
+#define pthread_condattr_t rtos_pthread_condattr_t
+#define pthread_once_t rtos_pthread_once_t
+#define pthread_key_create rtos_pthread_key_create
+#define pthread_setspecific rtos_pthread_setspecific
+#define pthread_getspecific rtos_pthread_getspecific
+#define pthread_key_delete rtos_pthread_key_delete
+
+#include "pthread/key.c"
+
+#define TASKS 4
+#define CALLS 10000000
+
+struct list thread_list;
+struct mtx key_mtx;
+
+// Simulated tasks, task 0 is not a thread (it has no TCB parts)
+static lua_rtos_tcb_t tcbs[TASKS];
+static struct pthread threads[TASKS];
+static int current = 1;
+
+static int failed = 0;
+
+static int check(int ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failed = 1;
+	}
+
+	return !ok;
+}
+
+void mtx_init(struct mtx *mutex, const char *name, const char *type, int opts) {
+	mutex->sem = NULL;
+}
+
+void mtx_lock(struct mtx *mutex) {
+	check(mutex->sem == NULL, "mutex locked twice");
+	mutex->sem = (SemaphoreHandle_t)1;
+}
+
+void mtx_unlock(struct mtx *mutex) {
+	check(mutex->sem != NULL, "mutex unlocked twice");
+	mutex->sem = NULL;
+}
+
+void mtx_destroy(struct mtx *mutex) {
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+	return (TaskHandle_t)&tcbs[current];
+}
+
+// The TCB parts of another task are only used with the thread list locked
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index) {
+	lua_rtos_tcb_t *tcb = task ? (lua_rtos_tcb_t *)task : &tcbs[current];
+
+	if ((tcb != &tcbs[current]) && !thread_list.mutex.sem) {
+		check(0, "TCB of another task used without the thread list locked");
+	}
+
+	return (tcb == &tcbs[0]) ? NULL : tcb;
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int destructed[TASKS];
+
+static void destructor(void *value) {
+	destructed[(int *)value - destructed]++;
+}
+
+// A destructor that sets a new value, that is destructed in a new iteration
+static rtos_pthread_key_t again_key;
+
+static void destructor_again(void *value) {
+	destructor(value);
+	if (destructed[2] < 2) {
+		rtos_pthread_setspecific(again_key, &destructed[2]);
+	}
+}
+
+static void check_keys() {
+	rtos_pthread_key_t keys[PTHREAD_NKEYS], k, k2;
+	int i;
+
+	// All the slots are used
+	for(i = 0; i < PTHREAD_NKEYS; i++) {
+		check(rtos_pthread_key_create(&keys[i], NULL) == 0, "key created");
+	}
+	check(rtos_pthread_key_create(&k, NULL) == EAGAIN, "no more keys");
+
+	for(i = 0; i < PTHREAD_NKEYS; i++) {
+		rtos_pthread_key_delete(keys[i]);
+	}
+	check(rtos_pthread_key_delete(keys[0]) == EINVAL, "key deleted twice");
+	check(rtos_pthread_key_delete(PTHREAD_NKEYS) == EINVAL, "invalid key deleted");
+
+	// Each thread has its own value
+	rtos_pthread_key_create(&k, NULL);
+	for(current = 1; current < TASKS; current++) {
+		check(rtos_pthread_getspecific(k) == NULL, "new key is NULL");
+		rtos_pthread_setspecific(k, &threads[current]);
+	}
+	for(current = 1; current < TASKS; current++) {
+		check(rtos_pthread_getspecific(k) == &threads[current], "value of the thread");
+	}
+
+	// A task that is not a thread has no values
+	current = 0;
+	check(rtos_pthread_setspecific(k, &threads[0]) == EINVAL, "set in a task that is not a thread");
+	check(rtos_pthread_getspecific(k) == NULL, "get in a task that is not a thread");
+	current = 1;
+
+	check(rtos_pthread_setspecific(PTHREAD_NKEYS, &threads[1]) == EINVAL, "set of an invalid key");
+	check(rtos_pthread_getspecific(-1) == NULL, "get of an invalid key");
+
+	// A deleted key is cleared in all threads, so a new key that reuses its
+	// slot starts as NULL
+	rtos_pthread_key_delete(k);
+	check(rtos_pthread_setspecific(k, &threads[1]) == EINVAL, "set of a deleted key");
+	rtos_pthread_key_create(&k2, NULL);
+	check(k2 == k, "slot reused");
+	for(current = 1; current < TASKS; current++) {
+		check(rtos_pthread_getspecific(k2) == NULL, "new key in a reused slot is NULL");
+	}
+	current = 1;
+	rtos_pthread_key_delete(k2);
+
+	// Destructors are called at thread exit, for the values that are not
+	// NULL, until there are no values
+	rtos_pthread_key_create(&k, destructor);
+	rtos_pthread_key_create(&k2, destructor);
+	rtos_pthread_key_create(&again_key, destructor_again);
+	memset(destructed, 0, sizeof(destructed));
+
+	current = 1;
+	rtos_pthread_setspecific(k, &destructed[0]);
+	rtos_pthread_setspecific(k2, &destructed[1]);
+	rtos_pthread_setspecific(again_key, &destructed[2]);
+	current = 2;
+	rtos_pthread_setspecific(k, &destructed[3]);
+
+	current = 1;
+	_pthread_key_exit();
+	check((destructed[0] == 1) && (destructed[1] == 1) && (destructed[2] == 2) && (destructed[3] == 0),
+		"destructors of the thread called");
+	check((rtos_pthread_getspecific(k) == NULL) && (rtos_pthread_getspecific(again_key) == NULL),
+		"values cleared at thread exit");
+
+	rtos_pthread_key_delete(k);
+	rtos_pthread_key_delete(k2);
+	rtos_pthread_key_delete(again_key);
+
+	// No mutex is left held
+	check(!key_mtx.sem && !thread_list.mutex.sem, "mutexes released");
+}
+
+static void bench() {
+	rtos_pthread_key_t k;
+	double start, get, set;
+	volatile uintptr_t sum = 0;
+	int i;
+
+	current = 1;
+	rtos_pthread_key_create(&k, NULL);
+
+	start = now();
+	for(i = 0; i < CALLS; i++) {
+		rtos_pthread_setspecific(k, (void *)(uintptr_t)i);
+	}
+	set = now() - start;
+
+	start = now();
+	for(i = 0; i < CALLS; i++) {
+		sum += (uintptr_t)rtos_pthread_getspecific(k);
+	}
+	get = now() - start;
+
+	rtos_pthread_key_delete(k);
+
+	printf("pthread_getspecific %5.1f ns per call\n", get * 1e9 / CALLS);
+	printf("pthread_setspecific %5.1f ns per call\n", set * 1e9 / CALLS);
+}
+
+int main(int argc, char **argv) {
+	int i, id;
+
+	mtx_init(&key_mtx, NULL, NULL, 0);
+	list_init(&thread_list, 1);
+
+	for(i = 1; i < TASKS; i++) {
+		threads[i].task = (TaskHandle_t)&tcbs[i];
+		list_add(&thread_list, &threads[i], &id);
+	}
+
+	check_keys();
+
+	if (failed) {
+		return 1;
+	}
+
+	bench();
+
+	return 0;
+}
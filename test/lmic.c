@@ -0,0 +1,174 @@
+/*
+ * Lua RTOS, LMIC on the simulated radio, host test
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * The device joins the simulated network, and then sends confirmed uplinks
+ * back to back. Every uplink must be acked, and no downlink may be missed,
+ * so the rx windows open in time. Uplinks per second of host time are
+ * reported.
+ *
+ * With "late", the LMIC task wakes up 5 ms after each deadline, and the
+ * join must fail, as the rx windows are scheduled only 2 ms (RX_RAMPUP)
+ * before they open, and miss the join accept.
+ *
+ * With "lossy", the network server answers one of every 3 downlinks in RX2,
+ * and loses one of every 7 uplinks and one of every 5 downlinks. Every
+ * uplink must still be acked, after retransmissions that the network server
+ * recognizes by the frame counter it tracks.
+ *
+ */
+
+#include "lmic_host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define UPLINKS 1000
+
+static osjob_t txjob;
+static int joined = 0;
+static int failed = 0;
+static int uplinks = 0;
+static int acked = 0;
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void send(osjob_t *job) {
+	u1_t payload[10] = {0};
+
+	LMIC_setTxData2(1, payload, sizeof(payload), 1);
+}
+
+void onEvent(ev_t ev) {
+	switch (ev) {
+		case EV_JOINED:
+			joined = 1;
+			LMIC_setLinkCheckMode(0);
+			os_setCallback(&txjob, send);
+			break;
+
+		case EV_JOIN_FAILED:
+		case EV_REJOIN_FAILED:
+			failed = 1;
+			lmic_host_stop();
+			break;
+
+		case EV_TXCOMPLETE:
+			uplinks++;
+			if (LMIC.txrxFlags & TXRX_ACK) {
+				acked++;
+			}
+
+			if (uplinks == UPLINKS) {
+				lmic_host_stop();
+			}
+
+			os_setCallback(&txjob, send);
+			break;
+
+		default:
+			break;
+	}
+}
+
+int main(int argc, char **argv) {
+	lmic_sim_stats_t stats;
+	double t0, t1;
+	lmic_sim_config_t config = {0, 0, 0};
+	int late = (argc > 1) && (strcmp(argv[1], "late") == 0);
+	int lossy = (argc > 1) && (strcmp(argv[1], "lossy") == 0);
+
+	if (late) {
+		lmic_host_wakeup = 5000;
+	}
+
+	if (lossy) {
+		config.rx2 = 3;
+		config.ulloss = 7;
+		config.dnloss = 5;
+	}
+
+	lmic_host_init();
+	lmic_sim_config(&config);
+
+	t0 = now();
+	LMIC_startJoining();
+	lmic_host_run();
+	t1 = now();
+
+	lmic_sim_get_stats(&stats);
+
+	if (late) {
+		if (joined || !failed) {
+			printf("FAIL: joined with a 5 ms wake up latency\n");
+			return 1;
+		}
+
+		printf("join failed with a 5 ms wake up latency\n");
+
+		return 0;
+	}
+
+	if (!joined) {
+		printf("FAIL: not joined\n");
+		return 1;
+	}
+
+	if ((uplinks != UPLINKS) || (acked != UPLINKS) || stats.missed || stats.badmic || stats.badfcnt) {
+		printf("FAIL: %d uplinks, %d acked, %u downlinks missed, %u bad MIC, %u bad FCnt\n",
+			uplinks, acked, stats.missed, stats.badmic, stats.badfcnt);
+		return 1;
+	}
+
+	if (lossy && (!stats.rx2 || !stats.retries)) {
+		printf("FAIL: %u downlinks in RX2, %u retransmissions\n", stats.rx2, stats.retries);
+		return 1;
+	}
+
+	printf("%d confirmed uplinks acked, %.0f s of virtual time\n", uplinks, lmic_host_time());
+	if (lossy) {
+		printf("%u downlinks in RX2, %u frames lost, %u retransmissions\n", stats.rx2, stats.lost, stats.retries);
+	}
+
+	printf("rx window offset to the downlink start, from %d to %d ticks\n", stats.rxminoffset, stats.rxmaxoffset);
+	printf("%.1f SPI transactions, %.1f bytes per uplink\n",
+		(double)lmic_host_spi_transactions / (uplinks + 1), (double)lmic_host_spi_bytes / (uplinks + 1));
+	printf("%.0f uplinks/s of host time\n", uplinks / (t1 - t0));
+
+	return 0;
+}
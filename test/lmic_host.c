@@ -0,0 +1,223 @@
+/*
+ * Lua RTOS, host HAL for LMIC, on a virtual clock
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * The transceiver is the simulated one (drivers/lmic_sim.c), so the real
+ * LMIC MAC, radio driver and run loop (lmic.c, radio.c, oslmic.c) run
+ * unchanged, and hours of LoRa WAN traffic take milliseconds.
+ *
+ * Waits and sleeps advance the virtual clock instead of waiting. Each
+ * timer check takes 1 us, and each wake up of the run loop takes
+ * lmic_host_wakeup us. With lmic_host_polling, the run loop checks the
+ * timer until the next deadline instead of sleeping, as it did before it
+ * had a wake up timer.
+ *
+ */
+
+#include "lmic_host.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Virtual time, and time slept, in us
+static double now;
+static double slept;
+
+static jmp_buf run_exit;
+
+unsigned int lmic_host_wakeup = 30;
+int lmic_host_polling = 0;
+
+unsigned long lmic_host_spi_transactions = 0;
+unsigned long lmic_host_spi_bytes = 0;
+
+// Device keys, the simulated network server takes the same
+static const u1_t deveui[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+static const u1_t appeui[8] = {8, 7, 6, 5, 4, 3, 2, 1};
+static const u1_t appkey[16] = {
+	0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+	0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+
+void os_getArtEui(u1_t *buf) {
+	memcpy(buf, appeui, sizeof(appeui));
+}
+
+void os_getDevEui(u1_t *buf) {
+	memcpy(buf, deveui, sizeof(deveui));
+}
+
+void os_getDevKey(u1_t *buf) {
+	memcpy(buf, appkey, sizeof(appkey));
+}
+
+// os_init is not used, the run loop is called by lmic_host_run
+driver_error_t *driver_setup_error(const driver_t *driver, unsigned int code, const char *msg) {
+	return NULL;
+}
+
+const driver_t *driver_get_by_name(const char *name) {
+	return NULL;
+}
+
+driver_error_t *hal_init(void) {
+	return NULL;
+}
+
+u8_t hal_ticks(void) {
+	return (u8_t)(now / US_PER_OSTICK);
+}
+
+u1_t hal_checkTimer(u8_t time) {
+	now += 1;
+
+	return hal_ticks() >= time;
+}
+
+void hal_waitUntil(u8_t time) {
+	if (time * US_PER_OSTICK > now) {
+		now = time * US_PER_OSTICK;
+	}
+}
+
+void hal_sleepUntil(u8_t time) {
+	double start = now;
+
+	if (lmic_host_polling) {
+		while (!hal_checkTimer(time));
+		return;
+	}
+
+	hal_waitUntil(time);
+	slept += now - start;
+	now += lmic_host_wakeup;
+}
+
+void hal_sleep(void) {
+	// Nothing scheduled, the run loop would sleep forever
+	longjmp(run_exit, 1);
+}
+
+void hal_disableIRQs(void) {
+}
+
+void hal_enableIRQs(void) {
+}
+
+void hal_resume(void) {
+}
+
+// Irqs of the simulated radio are delivered as LMIC jobs
+void hal_io_check(void) {
+}
+
+void hal_failed(char *file, int line) {
+	printf("FAIL: LMIC failed at %s:%d\n", file, line);
+	exit(1);
+}
+
+void hal_pin_nss(u1_t val) {
+	if (!val) {
+		lmic_host_spi_transactions++;
+	}
+
+	lmic_sim_nss(val);
+}
+
+void hal_pin_rxtx(u1_t val) {
+}
+
+void hal_pin_rst(u1_t val) {
+}
+
+u1_t hal_spi(u1_t outval) {
+	lmic_host_spi_bytes++;
+
+	return lmic_sim_spi(outval);
+}
+
+void hal_spi_write(u1_t addr, const u1_t *buf, u1_t len) {
+	hal_pin_nss(0);
+	hal_spi(addr);
+	while (len--) {
+		hal_spi(*buf++);
+	}
+	hal_pin_nss(1);
+}
+
+void hal_spi_read(u1_t addr, u1_t *buf, u1_t len) {
+	hal_pin_nss(0);
+	hal_spi(addr);
+	while (len--) {
+		*buf++ = hal_spi(0x00);
+	}
+	hal_pin_nss(1);
+}
+
+void lmic_host_init(void) {
+	lmic_sim_init();
+
+	if (radio_init() != 0) {
+		printf("FAIL: radio not detected\n");
+		exit(1);
+	}
+
+	LMIC_init();
+	LMIC_reset();
+	LMIC_setClockError(0);
+}
+
+int lmic_host_run(void) {
+	int stopped;
+
+	if ((stopped = setjmp(run_exit)) == 0) {
+		os_runloop(NULL);
+	}
+
+	return stopped == 2;
+}
+
+void lmic_host_stop(void) {
+	longjmp(run_exit, 2);
+}
+
+double lmic_host_time(void) {
+	return now / 1e6;
+}
+
+double lmic_host_cpu(void) {
+	return now ? (now - slept) / now : 0;
+}
+
+void lmic_host_busy(unsigned int us) {
+	now += us;
+}
@@ -0,0 +1,63 @@
+/*
+ * Lua RTOS, host HAL for LMIC, on a virtual clock
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef LMIC_HOST_H
+#define	LMIC_HOST_H
+
+#include "lmic.h"
+#include "lmic_sim.h"
+
+// Wake up latency of the LMIC task, in us
+extern unsigned int lmic_host_wakeup;
+
+// Poll the timer instead of sleeping until the next deadline
+extern int lmic_host_polling;
+
+// SPI transactions, and bytes moved through them
+extern unsigned long lmic_host_spi_transactions;
+extern unsigned long lmic_host_spi_bytes;
+
+// Init the simulated radio and LMIC
+void lmic_host_init(void);
+
+// Run the LMIC run loop until lmic_host_stop is called, or until there is
+// nothing scheduled. Returns 1 if it was stopped.
+int lmic_host_run(void);
+void lmic_host_stop(void);
+
+// Virtual time, in seconds
+double lmic_host_time(void);
+
+// Fraction of the virtual time that the run loop was not sleeping
+double lmic_host_cpu(void);
+
+// Spend us of virtual time, as a job that runs for that time
+void lmic_host_busy(unsigned int us);
+
+#endif	/* LMIC_HOST_H */
@@ -0,0 +1,261 @@
+/*
+ * Lua RTOS, LoRa WAN message packing, host test
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * A sensor reads every 10 s for one hour, and sends the readings as
+ * unconfirmed uplinks on the simulated radio, with a fixed data rate:
+ *
+ * - naive: each reading is sent on its own as soon as the radio is free.
+ *   Readings are lost when the queue is full, waiting for the duty cycle.
+ *
+ * - plan: readings are sent once a minute, packed by lora_plan into frames
+ *   of LMIC_maxPayload bytes.
+ *
+ * With packing no fewer readings may be sent, with less time on air per
+ * reading, and none may be lost when the duty cycle allows to send them all.
+ * Frames must be sent at the time predicted by LMIC_nextTxTime, give or
+ * take the radio ramp up (TX_RAMPUP), as LMIC sends when the tx job runs.
+ *
+ * Each scenario runs in a child process, as the LMIC state can't be reset.
+ *
+ */
+
+#include "lmic_host.h"
+#include "lora_plan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PERIOD   10    // seconds between readings
+#define DURATION 3600  // seconds of readings
+#define FLUSH    6     // plan: readings between sends
+
+typedef struct {
+	int readings;      // readings taken
+	int queued;        // readings queued, the rest were lost
+	int delivered;     // readings sent
+	int frames;        // frames sent
+	ostime_t airtime;  // time on air
+	ostime_t budget;   // time on air left in the last hour
+	s8_t maxerr;       // max error of the predicted tx time
+} result_t;
+
+static result_t res;
+static int plan;
+static int busy = 0;
+static int sending = 0;
+static int predicted = 0;
+static ostime_t txtime;
+static ostime_t airtime;
+static osjob_t readjob, txjob;
+
+static int done() {
+	return lmic_host_time() >= DURATION;
+}
+
+static void send(osjob_t *job) {
+	u1_t frame[MAX_LEN_PAYLOAD];
+	u1_t port;
+	int pending = lora_plan_pending();
+	int len;
+
+	if (busy || !pending) {
+		return;
+	}
+
+	// Naive sends one reading per frame
+	len = lora_plan_next(plan ? LMIC_maxPayload() : 1 + 16, &port, frame);
+	if (!len) {
+		printf("FAIL: no reading fits in a frame\n");
+		exit(1);
+	}
+
+	sending = pending - lora_plan_pending();
+	predicted = LMIC_nextTxTime(&txtime);
+	airtime = LMIC_txAirtime(len);
+	busy = 1;
+
+	LMIC_setTxData2(port, frame, len, 0);
+}
+
+static void reading(osjob_t *job) {
+	u1_t data[16];
+	int len = 4 + (res.readings * 7) % 13;
+
+	memset(data, res.readings, len);
+
+	res.readings++;
+	if (lora_plan_add(1, data, len) == 0) {
+		res.queued++;
+	}
+
+	if (!done()) {
+		os_setTimedCallback(&readjob, os_getTime() + sec2osticks(PERIOD), reading);
+	}
+
+	if (!plan || (res.readings % FLUSH == 0) || done()) {
+		send(NULL);
+	}
+}
+
+void onEvent(ev_t ev) {
+	s8_t err;
+
+	if (ev != EV_TXCOMPLETE) {
+		return;
+	}
+
+	if (predicted) {
+		err = (s8_t)(LMIC.txend - airtime - txtime);
+		if (err < 0) {
+			err = -err;
+		}
+
+		if (err > res.maxerr) {
+			res.maxerr = err;
+		}
+	}
+
+	busy = 0;
+	res.frames++;
+	res.delivered += sending;
+
+	if (done() && !lora_plan_pending()) {
+		lmic_host_stop();
+	}
+
+	os_setCallback(&txjob, send);
+}
+
+static void run(u1_t dr) {
+	static u1_t key[16];
+	lmic_sim_stats_t stats;
+
+	lmic_host_init();
+
+	LMIC_setSession(1, 0x26011234, key, key);
+	LMIC_setAdrMode(0);
+	LMIC_setLinkCheckMode(0);
+	LMIC_setDrTxpow(dr, 14);
+
+	os_setCallback(&readjob, reading);
+
+	if (!lmic_host_run()) {
+		printf("FAIL: readings not sent\n");
+		exit(1);
+	}
+
+	lmic_sim_get_stats(&stats);
+
+	res.airtime = stats.airtime;
+	res.budget = LMIC_airtimeBudget(sec2osticks(3600));
+}
+
+static result_t scenario(int packed, u1_t dr) {
+	result_t r;
+	int fd[2];
+	int status;
+
+	if (pipe(fd) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	fflush(stdout);
+
+	if (fork() == 0) {
+		plan = packed;
+		run(dr);
+		write(fd[1], &res, sizeof(res));
+		exit(0);
+	}
+
+	wait(&status);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) || (read(fd[0], &r, sizeof(r)) != sizeof(r))) {
+		exit(1);
+	}
+
+	close(fd[0]);
+	close(fd[1]);
+
+	return r;
+}
+
+static void print(const char *dr, const char *mode, result_t *r) {
+	printf("%-5s %-5s %3d of %3d readings in %3d frames, %6.1f s on air, %6.1f s left, tx time error %d ticks\n",
+		dr, mode, r->delivered, r->readings, r->frames, osticks2ms(r->airtime) / 1000.0,
+		osticks2ms(r->budget) / 1000.0, (int)r->maxerr);
+}
+
+int main(int argc, char **argv) {
+	static const struct {
+		const char *name;
+		u1_t dr;
+		int all;  // all the readings fit in the duty cycle
+	} drs[] = {
+#if defined(CFG_eu868)
+		{"SF12", DR_SF12, 0}, {"SF9", DR_SF9, 1},
+#elif defined(CFG_us915)
+		{"SF9", DR_SF9, 1}, {"SF7", DR_SF7, 1},
+#endif
+	};
+	result_t naive, packed;
+	int failed = 0;
+	int i;
+
+	for(i = 0; i < sizeof(drs) / sizeof(drs[0]); i++) {
+		naive = scenario(0, drs[i].dr);
+		packed = scenario(1, drs[i].dr);
+
+		print(drs[i].name, "naive", &naive);
+		print(drs[i].name, "plan", &packed);
+
+		if (drs[i].all && ((packed.delivered != packed.readings) || (packed.queued != packed.readings))) {
+			printf("FAIL: %s: readings lost with packing\n", drs[i].name);
+			failed = 1;
+		}
+
+		if ((packed.delivered < naive.delivered) ||
+			((double)packed.airtime / packed.delivered >= (double)naive.airtime / naive.delivered)) {
+			printf("FAIL: %s: packing doesn't save time on air\n", drs[i].name);
+			failed = 1;
+		}
+
+		if ((naive.maxerr > TX_RAMPUP + ms2osticks(2)) || (packed.maxerr > TX_RAMPUP + ms2osticks(2))) {
+			printf("FAIL: %s: tx time mispredicted\n", drs[i].name);
+			failed = 1;
+		}
+	}
+
+	return failed;
+}
@@ -0,0 +1,174 @@
+/*
+ * Lua RTOS, host test for the logical to physical path resolution
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * Paths are opened through the open wrapper (syscalls/__wrap__open_r.c),
+ * with a __real__open_r that records the physical path it receives. First
+ * the resolved paths are checked, both on a cache miss and on a cache hit,
+ * and then the number of opens per second is measured.
+ *
+ */
+
+#include <reent.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/mount.h>
+
+// Measure time for each kind of path, in seconds
+#define BENCH_TIME 1
+
+// Host counterpart of the current working directory (see syscalls/chdir.c)
+char currdir[PATH_MAX + 1] = "";
+
+int __wrap__open_r(struct _reent *r, const char *path, int flags, int mode);
+
+static char opened[PATH_MAX + 1];
+
+int __real__open_r(struct _reent *r, const char *path, int flags, int mode) {
+	strcpy(opened, path);
+
+	return 3;
+}
+
+static const struct {
+	const char *cwd;
+	const char *path;
+	const char *ppath;
+} cases[] = {
+	{"/",          "/autorun.lua",          "/spiffs/autorun.lua"},
+	{"/",          "/sd/examples/lua/..",   "/fat/examples"},
+	{"/",          "/sd",                   "/fat/"},
+	{"/",          "/sd/",                  "/fat/"},
+	{"/",          "/sdcard/x.lua",         "/spiffs/sdcard/x.lua"},
+	{"/",          "/./autorun.lua",        "/spiffs/autorun.lua"},
+	{"/",          "/lib/../autorun.lua",   "/spiffs/autorun.lua"},
+	{"/examples",  "blink.lua",             "/spiffs/examples/blink.lua"},
+	{"/examples",  "../autorun.lua",        "/spiffs/autorun.lua"},
+	{"/sd/lua",    "a.lua",                 "/fat/lua/a.lua"},
+	{"/sd/lua",    "../a.lua",              "/fat/a.lua"},
+	{"/sd/lua",    "..",                    "/fat/"},
+	{"/",          "/a-very-long-first-element/x.lua", "/spiffs/a-very-long-first-element/x.lua"},
+	{"/",          "/dev/tty/0",            "/dev/tty/0"},
+	{NULL, NULL, NULL}
+};
+
+static int check(const char *cwd, const char *path, const char *ppath) {
+	struct _reent r;
+
+	strcpy(currdir, cwd);
+	*opened = '\0';
+
+	if ((__wrap__open_r(&r, path, 0, 0) < 0) || (strcmp(opened, ppath) != 0)) {
+		printf("FAIL %s (cwd %s): got %s, expected %s\n", path, cwd, opened, ppath);
+		return 1;
+	}
+
+	return 0;
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char *name, const char *cwd, const char *path) {
+	struct _reent r;
+	double start, elapsed;
+	long opens = 0;
+	int i;
+
+	strcpy(currdir, cwd);
+
+	start = now();
+	do {
+		for(i = 0;i < 10000;i++) {
+			__wrap__open_r(&r, path, 0, 0);
+		}
+		opens += 10000;
+		elapsed = now() - start;
+	} while (elapsed < BENCH_TIME);
+
+	printf("%-10s %-28s %10.0f opens/s\n", name, path, opens / elapsed);
+}
+
+int main() {
+	char path[PATH_MAX + 16];
+	struct _reent r;
+	int failed = 0;
+	int i;
+
+	mount_set_mounted("spiffs", 1);
+	mount_set_mounted("fat", 1);
+
+	// Twice, the second time from the cache
+	for(i = 0;cases[i].path;i++) {
+		failed += check(cases[i].cwd, cases[i].path, cases[i].ppath);
+		failed += check(cases[i].cwd, cases[i].path, cases[i].ppath);
+	}
+
+	// Same absolute path, reached from different working directories
+	failed += check("/", "/sd/lua/a.lua", "/fat/lua/a.lua");
+	failed += check("/sd", "lua/a.lua", "/fat/lua/a.lua");
+	failed += check("/sd/lua", "a.lua", "/fat/lua/a.lua");
+
+	// Default device changes, and cache must be invalidated
+	failed += check("/", "/autorun.lua", "/spiffs/autorun.lua");
+	mount_set_mounted("spiffs", 0);
+	failed += check("/", "/autorun.lua", "/fat/autorun.lua");
+	mount_set_mounted("spiffs", 1);
+	failed += check("/", "/autorun.lua", "/spiffs/autorun.lua");
+
+	// Too long paths
+	memset(path, 'a', sizeof(path) - 1);
+	path[0] = '/';
+	path[sizeof(path) - 1] = '\0';
+	strcpy(currdir, "/");
+	r._errno = 0;
+	if ((__wrap__open_r(&r, path, 0, 0) >= 0) || (r._errno != ENAMETOOLONG)) {
+		printf("FAIL too long path: expected ENAMETOOLONG\n");
+		failed++;
+	}
+
+	if (failed) {
+		return 1;
+	}
+
+	bench("absolute", "/", "/sd/examples/blink.lua");
+	bench("relative", "/sd/examples", "blink.lua");
+	bench("dot-dot", "/sd/examples", "../lib/blink.lua");
+
+	return 0;
+}
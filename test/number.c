@@ -0,0 +1,558 @@
+/*
+ * Lua RTOS, host test and benchmark of the number to string conversions
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * lobject.c is included, so its fast paths (fastflt2str, l_str2dfast,
+ * luaO_fmtflt) are checked directly against snprintf / strtod:
+ *
+ * - the fast range ends where LUA_NUMBER_FMT switches to the exponent
+ *   notation
+ * - short decimals in that range are always written by the fast path,
+ *   and every fast result reads back as the same number (with doubles,
+ *   it is also what "%.14g" writes)
+ * - decimal numerals are read bit-identical to lua_str2number
+ * - with single floats, luaO_fmtflt writes what snprintf writes
+ * - with single floats, the numbers out of the fast range are written as
+ *   the shortest of "%.7g", "%.8g" and "%.9g" that reads back, with a
+ *   single snprintf
+ *
+ * Then the fast and snprintf / strtod conversions are timed, and Lua
+ * scripts with float arithmetic, math functions and conversions are
+ * timed, to compare the two number modes. On the host both are done in
+ * hardware, on the ESP32 only single floats are.
+ *
+ * The Makefile builds this test twice, with single floats (LUA_32BITS) and
+ * with doubles.
+ *
+ */
+
+#include "lobject.c"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <time.h>
+
+#define RANDOM 200000
+#define RUNS   5
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+#define SHORTDIG 6  // decimal digits that always survive a round trip
+#define l_nextafter nextafterf
+#else
+#define SHORTDIG 14 // as LUA_NUMBER_FMT
+#define l_nextafter nextafter
+#endif
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+static int failed = 0;
+
+// Numerals timed by the benchmark
+static char numerals[RANDOM][LUAI_MAXNUMBER2STR];
+
+static uint64_t seed = 88172645463325252ULL;
+
+static uint64_t xrand() {
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return seed;
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fail(const char *what, const char *in, const char *got, const char *expected) {
+	if (failed++ < 20) {
+		printf("FAIL: %s: %s: got %s, expected %s\n", what, in, got, expected);
+	}
+}
+
+// Random number with a magnitude between 10^lo and 10^hi
+static lua_Number random_number(int lo, int hi) {
+	double m = (double)(xrand() >> 11) / 9007199254740992.0;
+	int x = lo + (int)(xrand() % (hi - lo));
+	lua_Number n = (lua_Number)((1 + 9 * m) * pow(10, x));
+
+	return (xrand() & 1) ? -n : n;
+}
+
+// Random decimal numeral with up to 'digits' significant digits
+static void random_decimal(char *buff, int digits, int lo, int hi) {
+	uint64_t r = 1 + xrand() % (uint64_t)pow(10, 1 + xrand() % digits);
+	int k = lo + (int)(xrand() % (hi - lo + 1));
+
+	if (k >= 0) {
+		sprintf(buff, "%s%" PRIu64 "e-%d", (xrand() & 1) ? "-" : "", r, k);
+	} else {
+		sprintf(buff, "%s%" PRIu64 "e%d", (xrand() & 1) ? "-" : "", r, -k);
+	}
+}
+
+static void check_range() {
+	char buff[LUAI_MAXNUMBER2STR];
+	lua_Number min = (lua_Number)FLTFAST_MIN;
+
+	// With single floats, 1e-4 is rounded below FLTFAST_MIN
+	if (min < FLTFAST_MIN) min = l_nextafter(min, 1);
+
+	// Inside the range LUA_NUMBER_FMT uses the fixed notation
+	snprintf(buff, sizeof(buff), LUA_NUMBER_FMT, (LUAI_UACNUMBER)min);
+	if (strchr(buff, 'e')) fail("range", "FLTFAST_MIN", buff, "fixed notation");
+
+	snprintf(buff, sizeof(buff), LUA_NUMBER_FMT, (LUAI_UACNUMBER)(FLTFAST_MAX - 1));
+	if (strchr(buff, 'e')) fail("range", "FLTFAST_MAX - 1", buff, "fixed notation");
+
+	// and outside, the exponent notation
+	snprintf(buff, sizeof(buff), LUA_NUMBER_FMT, (LUAI_UACNUMBER)FLTFAST_MAX);
+	if (!strchr(buff, 'e')) fail("range", "FLTFAST_MAX", buff, "exponent notation");
+
+	snprintf(buff, sizeof(buff), LUA_NUMBER_FMT, (LUAI_UACNUMBER)(min * 0.99));
+	if (!strchr(buff, 'e')) fail("range", "below FLTFAST_MIN", buff, "exponent notation");
+
+	// The ends of the range are written by the fast path
+	if (fastflt2str(buff, min) == 0) fail("range", "FLTFAST_MIN", "snprintf", "fast path");
+	if (fastflt2str(buff, (lua_Number)(FLTFAST_MAX - 1)) == 0) fail("range", "FLTFAST_MAX - 1", "snprintf", "fast path");
+	if (fastflt2str(buff, (lua_Number)FLTFAST_MAX) != 0) fail("range", "FLTFAST_MAX", buff, "snprintf");
+}
+
+// Check a result of fastflt2str against snprintf
+static void check_tostring(lua_Number n, const char *buff) {
+	char ref[LUAI_MAXNUMBER2STR];
+	char in[LUAI_MAXNUMBER2STR];
+
+	l_number2str(ref, sizeof(ref), n);
+	snprintf(in, sizeof(in), "%.17g", (double)n);
+
+	if (lua_str2number(buff, NULL) != n) {
+		fail("tostring round trip", in, buff, ref);
+	}
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+	// The shortest numeral, never longer than snprintf's
+	if (strlen(buff) > strlen(ref)) fail("tostring length", in, buff, ref);
+#else
+	if (strcmp(buff, ref) != 0) fail("tostring", in, buff, ref);
+#endif
+}
+
+static void check_tostrings() {
+	char buff[LUAI_MAXNUMBER2STR];
+	char dec[LUAI_MAXNUMBER2STR];
+	lua_Number n;
+	int i;
+
+	// Any number in the range that is written, is written right
+	for(i = 0; i < RANDOM; i++) {
+		n = random_number(-4, LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT ? 7 : 14);
+		if (fastflt2str(buff, n) > 0) {
+			check_tostring(n, buff);
+		}
+	}
+
+	// Short decimals in the range are always written by the fast path
+	for(i = 0; i < RANDOM; i++) {
+		random_decimal(dec, SHORTDIG, 0, SHORTDIG + 4);
+		n = lua_str2number(dec, NULL);
+		if ((fabs(n) < FLTFAST_MIN) || (fabs(n) >= FLTFAST_MAX)) continue;
+
+		if (fastflt2str(buff, n) == 0) {
+			fail("tostring fast path", dec, "snprintf", "fast path");
+		} else {
+			check_tostring(n, buff);
+		}
+	}
+
+	// Zeros and integers
+	if ((luaO_flt2str(buff, sizeof(buff), 0.0) == 0) || strcmp(buff, "0")) fail("tostring", "0.0", buff, "0");
+	if ((luaO_flt2str(buff, sizeof(buff), -0.0) == 0) || strcmp(buff, "-0")) fail("tostring", "-0.0", buff, "-0");
+	if ((luaO_flt2str(buff, sizeof(buff), 1e6) == 0) || strcmp(buff, "1000000")) fail("tostring", "1e6", buff, "1000000");
+	if ((luaO_flt2str(buff, sizeof(buff), 0.1) == 0) || strcmp(buff, "0.1")) fail("tostring", "0.1", buff, "0.1");
+}
+
+static void check_tonumber(const char *s) {
+	lua_Number ref = lua_str2number(s, NULL);
+	lua_Number n;
+	char got[LUAI_MAXNUMBER2STR];
+	char expected[LUAI_MAXNUMBER2STR];
+
+	if ((l_str2d(s, &n) == NULL) || (memcmp(&n, &ref, sizeof(n)) != 0)) {
+		snprintf(got, sizeof(got), "%a", (double)n);
+		snprintf(expected, sizeof(expected), "%a", (double)ref);
+		fail("tonumber", s, got, expected);
+	}
+}
+
+static void check_tonumbers() {
+	static const char *edges[] = {
+		// Float midpoints, that the fast path leaves to strtof
+		"16777217", "16777219", "0.50000002980232238769531250",
+		// Subnormals, and out of range
+		"1e-40", "1e-45", "3.5e38", "1e39", "-0", "0.0e5",
+		// More than MAXU64DIG digits, and large exponents
+		"12345678901234567890123", "1e22", "1e23", "1e-22", "1e-23",
+		" 1.5 ", "1.", ".5", "1e+5",
+		NULL
+	};
+	const char **s;
+	char dec[LUAI_MAXNUMBER2STR];
+	lua_Number n;
+	int i, fast = 0;
+
+	for(s = edges; *s; s++) {
+		check_tonumber(*s);
+	}
+
+	for(i = 0; i < RANDOM; i++) {
+		random_decimal(dec, MAXU64DIG, -MAXPOW10 - 3, MAXPOW10 + 3);
+		check_tonumber(dec);
+		fast += (l_str2dfast(dec, &n) != NULL);
+	}
+
+	// Most of these are within Clinger's fast path
+	if (fast < RANDOM / 2) {
+		fail("tonumber fast path", "random decimals", "snprintf", "fast path");
+	}
+}
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+// tostringflt as it was, with a snprintf for each precision
+static int tostringflt_ref(char *buff, size_t sz, lua_Number n) {
+	static const char *const fmts[] = {"%.7g", "%.8g", "%.9g"};
+	int i, len = 0;
+
+	for(i = 0; i < 3; i++) {
+		len = snprintf(buff, sz, fmts[i], (double)n);
+		if ((n != n) || (lua_str2number(buff, NULL) == n)) break;
+	}
+
+	return len;
+}
+
+static void check_tostringflt(lua_Number n) {
+	char buff[LUAI_MAXNUMBER2STR];
+	char ref[LUAI_MAXNUMBER2STR];
+	char in[LUAI_MAXNUMBER2STR];
+	int len;
+
+	len = tostringflt(buff, sizeof(buff), n);
+	tostringflt_ref(ref, sizeof(ref), n);
+
+	if ((len != strlen(buff)) || (strcmp(buff, ref) != 0)) {
+		snprintf(in, sizeof(in), "%a", (double)n);
+		fail("tostringflt", in, buff, ref);
+	}
+}
+
+static void check_tostringflts() {
+	static const float edges[] = {
+		0.0f, -0.0f, 1e-4f, 9.9999999e-5f, 1e7f, 16777216.0f, 99999999.0f,
+		999999999.0f, 1e38f, FLT_MAX, -FLT_MAX, FLT_MIN, 1e-45f, 1.4e-45f,
+		5e-38f, 0.1f, 1.0f / 3, 2.5e-5f, 123456789.0f, 4294967296.0f,
+		INFINITY, -INFINITY, NAN
+	};
+	uint32_t bits;
+	lua_Number n;
+	int i;
+
+	for(i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+		check_tostringflt(edges[i]);
+	}
+
+	// Any float, and floats with short decimal expansions, where the
+	// digits beyond the 17th may be needed to round
+	for(i = 0; i < RANDOM; i++) {
+		bits = (uint32_t)xrand();
+		memcpy(&n, &bits, sizeof(n));
+		check_tostringflt(n);
+
+		n = random_number(-45, 38);
+		check_tostringflt(n);
+
+		n = (lua_Number)((xrand() % 100000) * 5) * l_mathop(pow)(2, (int)(xrand() % 40) - 20);
+		check_tostringflt(n);
+	}
+}
+
+static void check_fmtflt() {
+	char fmt[10];
+	char buff[LUAI_MAXNUMBER2STR + MAXPOW10];
+	char ref[LUAI_MAXNUMBER2STR + MAXPOW10];
+	char in[LUAI_MAXNUMBER2STR];
+	lua_Number n;
+	int i, len, prec, conv;
+
+	for(i = 0; i < RANDOM; i++) {
+		n = random_number(-6, 10);
+		prec = xrand() % 10;
+		conv = (xrand() & 1) ? 'f' : 'g';
+
+		len = luaO_fmtflt(buff, conv, prec, n);
+		if (len < 0) continue;
+		buff[len] = '\0';
+
+		snprintf(fmt, sizeof(fmt), "%%.%d%c", prec, conv);
+		snprintf(ref, sizeof(ref), fmt, (double)n);
+
+		if (strcmp(buff, ref) != 0) {
+			snprintf(in, sizeof(in), "%s %.9g", fmt, (double)n);
+			fail("fmtflt", in, buff, ref);
+		}
+	}
+}
+#endif
+
+// Float arithmetic as the sensor and control scripts do it
+static const struct {
+	const char *name;
+	const char *script;
+} luabenchs[] = {
+	{"arith",
+	 "local x, s = 1.5, 0 "
+	 "for i = 1, 2000000 do x = x * 1.000001 + 0.25 s = s + x / i end "
+	 "return s"},
+
+	{"math",
+	 "local s = 0 "
+	 "for i = 1, 500000 do s = s + math.sqrt(i) + math.sin(i * 0.001) + math.floor(i / 3) + (i * 0.5) ^ 2 end "
+	 "return s"},
+
+	{"adc",
+	 "local s = 0 "
+	 "for i = 1, 1000000 do local mv = (i % 4096) * 3300 / 4095 s = s + (mv - 500) / 10 end "
+	 "return s"},
+
+	{"tostring",
+	 "local n = 0 "
+	 "for i = 1, 200000 do n = n + #tostring(i / 7) + #tostring(i * 1e10) end "
+	 "return n"},
+
+	{"format",
+	 "local n = 0 "
+	 "for i = 1, 200000 do n = n + #string.format('%.2f %g', i / 7, i * 0.5) end "
+	 "return n"},
+
+	{NULL, NULL}
+};
+
+static void check_pow() {
+	lua_State *L = luaL_newstate();
+
+	luaL_openlibs(L);
+
+	// x^2 is x * x, as pow gives it
+	if ((luaL_dostring(L,
+		"local nan = 0 / 0 "
+		"return 2.5 ^ 2 == 6.25 and (-3) ^ 2 == 9 and 1e20 ^ 2 == 1e40 and "
+		"math.huge ^ 2 == math.huge and (-math.huge) ^ 2 == math.huge and "
+		"(nan ^ 2 ~= nan ^ 2) and 1 / (-0.0) ^ 2 == math.huge and "
+		"2 ^ 0.5 == math.sqrt(2) and 2 ^ 3 == 8") != LUA_OK) || !lua_toboolean(L, -1)) {
+		fail("pow", "x ^ 2", lua_isstring(L, -1) ? lua_tostring(L, -1) : "false", "true");
+	}
+
+	lua_close(L);
+}
+
+static void bench_lua() {
+	double start, elapsed, best;
+	lua_State *L;
+	int i, j;
+
+	for(i = 0; luabenchs[i].name; i++) {
+		best = 0;
+
+		for(j = 0; j < RUNS; j++) {
+			L = luaL_newstate();
+			luaL_openlibs(L);
+
+			start = now();
+			if (luaL_dostring(L, luabenchs[i].script) != LUA_OK) {
+				fail("lua", luabenchs[i].name, lua_tostring(L, -1), "a number");
+				lua_close(L);
+				return;
+			}
+			elapsed = now() - start;
+
+			lua_close(L);
+
+			if ((j == 0) || (elapsed < best)) {
+				best = elapsed;
+			}
+		}
+
+		printf("lua %-8s %6.3f s\n", luabenchs[i].name, best);
+	}
+}
+
+static void bench(const char *name, int (*fast)(lua_Number *, int), int (*slow)(lua_Number *, int), lua_Number *nums, int count) {
+	double start, elapsed, best_fast = 0, best_slow = 0;
+	int j;
+
+	for(j = 0; j < RUNS; j++) {
+		start = now();
+		fast(nums, count);
+		elapsed = now() - start;
+		if ((j == 0) || (elapsed < best_fast)) best_fast = elapsed;
+
+		start = now();
+		slow(nums, count);
+		elapsed = now() - start;
+		if ((j == 0) || (elapsed < best_slow)) best_slow = elapsed;
+	}
+
+	printf("%-10s %6.2f M/s (snprintf/strtod %6.2f M/s)\n", name, count / best_fast / 1e6, count / best_slow / 1e6);
+}
+
+static int tostring_fast(lua_Number *nums, int count) {
+	char buff[LUAI_MAXNUMBER2STR];
+	int i, len = 0;
+
+	for(i = 0; i < count; i++) {
+		len += luaO_flt2str(buff, sizeof(buff), nums[i]);
+	}
+
+	return len;
+}
+
+static int tostring_slow(lua_Number *nums, int count) {
+	char buff[LUAI_MAXNUMBER2STR];
+	int i, len = 0;
+
+	for(i = 0; i < count; i++) {
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+		len += tostringflt_ref(buff, sizeof(buff), nums[i]);
+#else
+		len += l_number2str(buff, sizeof(buff), nums[i]);
+#endif
+	}
+
+	return len;
+}
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+static int tostringflt_fast(lua_Number *nums, int count) {
+	char buff[LUAI_MAXNUMBER2STR];
+	int i, len = 0;
+
+	for(i = 0; i < count; i++) {
+		len += tostringflt(buff, sizeof(buff), nums[i]);
+	}
+
+	return len;
+}
+
+static int tostringflt_slow(lua_Number *nums, int count) {
+	char buff[LUAI_MAXNUMBER2STR];
+	int i, len = 0;
+
+	for(i = 0; i < count; i++) {
+		len += tostringflt_ref(buff, sizeof(buff), nums[i]);
+	}
+
+	return len;
+}
+#endif
+
+static int tonumber_fast(lua_Number *nums, int count) {
+	lua_Number n;
+	int i, ok = 0;
+
+	for(i = 0; i < count; i++) {
+		ok += (l_str2d(numerals[i], &n) != NULL);
+	}
+
+	return ok;
+}
+
+static int tonumber_slow(lua_Number *nums, int count) {
+	volatile lua_Number n;
+	int i, ok = 0;
+
+	for(i = 0; i < count; i++) {
+		n = lua_str2number(numerals[i], NULL);
+		ok += (n == n);
+	}
+
+	return ok;
+}
+
+int main() {
+	static lua_Number nums[RANDOM];
+	int i;
+
+	check_range();
+	check_tostrings();
+	check_tonumbers();
+	check_pow();
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+	check_tostringflts();
+	check_fmtflt();
+#endif
+
+	if (failed) {
+		printf("%d checks failed\n", failed);
+		return 1;
+	}
+
+	// Numbers as sensors and counters give them
+	for(i = 0; i < RANDOM; i++) {
+		random_decimal(numerals[i], 5, 0, 3);
+		nums[i] = lua_str2number(numerals[i], NULL);
+	}
+
+	bench("tostring", tostring_fast, tostring_slow, nums, RANDOM);
+	bench("tonumber", tonumber_fast, tonumber_slow, nums, RANDOM);
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FLOAT
+	// Numbers out of the fast range, and the snprintf for each precision
+	for(i = 0; i < RANDOM; i++) {
+		nums[i] = random_number(-20, -4);
+	}
+
+	bench("tostring e", tostringflt_fast, tostringflt_slow, nums, RANDOM);
+#endif
+
+	bench_lua();
+
+	return (failed != 0);
+}
@@ -0,0 +1,227 @@
+/*
+ * Lua RTOS, host simulation of the LMIC run loop
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * Timed jobs on the real LMIC scheduler (lmic/oslmic.c), on the virtual
+ * clock of the host HAL, with a wake up latency of WAKEUP us, and jobs
+ * that run for JOB us:
+ *
+ * - periodic jobs for DURATION s, with the tickless run loop, that sleeps
+ *   until the next deadline, and with a run loop that polls the timer. The
+ *   lateness of the jobs (jitter), and the CPU used are reported. Every
+ *   job must run at each period, and the tickless run loop must use less
+ *   CPU.
+ *
+ * - a burst of BURST one-shot jobs, more than fit in the initial heap, at
+ *   random deadlines, with some of them cleared. The others must run once,
+ *   in deadline order.
+ *
+ * Each scenario runs in a child process, as the LMIC state can't be reset.
+ *
+ */
+
+#include "lmic_host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define WAKEUP   30    // us
+#define JOB      50    // us
+#define DURATION 60    // seconds
+#define BURST    200   // jobs
+
+typedef struct {
+	int runs;
+	int missed;        // periods without a run
+	double cpu;
+	ostime_t maxlate;
+	ostime_t sumlate;
+} result_t;
+
+typedef struct {
+	osjob_t job;
+	ostime_t period;
+} periodic_t;
+
+static result_t res;
+static osjob_t stopjob;
+static periodic_t periodics[4];
+
+void onEvent(ev_t ev) {
+}
+
+static void stop(osjob_t *job) {
+	lmic_host_stop();
+}
+
+static void periodic(osjob_t *job) {
+	periodic_t *p = (periodic_t *)job;
+	ostime_t late = os_getTime() - job->deadline;
+
+	res.runs++;
+	res.sumlate += late;
+	if (late > res.maxlate) {
+		res.maxlate = late;
+	}
+
+	lmic_host_busy(JOB);
+
+	os_setTimedCallback(job, job->deadline + p->period, periodic);
+}
+
+static void run_periodic(int jobs) {
+	static const int periods[] = {100, 130, 170, 230};  // ms
+	ostime_t start = os_getTime();
+	int i;
+
+	for(i = 0; i < jobs; i++) {
+		periodics[i].period = ms2osticks(periods[i]);
+		os_setTimedCallback(&periodics[i].job, start + periodics[i].period, periodic);
+		res.missed += (DURATION * 1000) / periods[i];
+	}
+
+	os_setTimedCallback(&stopjob, start + sec2osticks(DURATION) + ms2osticks(1), stop);
+	lmic_host_run();
+
+	res.missed -= res.runs;
+	res.cpu = lmic_host_cpu();
+}
+
+static osjob_t burst[BURST];
+static ostime_t lastrun;
+static int outoforder;
+
+static void oneshot(osjob_t *job) {
+	res.runs++;
+	if (job->deadline < lastrun) {
+		outoforder++;
+	}
+	lastrun = job->deadline;
+}
+
+static void run_burst(void) {
+	ostime_t start = os_getTime();
+	unsigned int seed = 1;
+	int i;
+
+	for(i = 0; i < BURST; i++) {
+		seed = seed * 1103515245 + 12345;
+		os_setTimedCallback(&burst[i], start + ms2osticks(10) + (seed >> 8) % sec2osticks(1), oneshot);
+	}
+
+	// Clear one of every 4 jobs
+	for(i = 0; i < BURST; i += 4) {
+		os_clearCallback(&burst[i]);
+	}
+
+	// Nothing scheduled after the burst, the run loop ends
+	lmic_host_run();
+
+	res.missed = (BURST - BURST / 4) - res.runs + outoforder;
+}
+
+static result_t scenario(int jobs, int polling) {
+	result_t r;
+	int fd[2];
+	int status;
+
+	if (pipe(fd) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	fflush(stdout);
+
+	if (fork() == 0) {
+		lmic_host_wakeup = WAKEUP;
+		lmic_host_polling = polling;
+
+		if (jobs) {
+			run_periodic(jobs);
+		} else {
+			run_burst();
+		}
+
+		write(fd[1], &res, sizeof(res));
+		exit(0);
+	}
+
+	wait(&status);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) || (read(fd[0], &r, sizeof(r)) != sizeof(r))) {
+		exit(1);
+	}
+
+	close(fd[0]);
+	close(fd[1]);
+
+	return r;
+}
+
+static void print(int jobs, const char *mode, result_t *r) {
+	printf("%d periodic jobs, %-8s %5d runs, lateness %4d us mean, %4d us max, %5.1f%% CPU\n",
+		jobs, mode, r->runs, (int)osticks2us(r->sumlate / r->runs), (int)osticks2us(r->maxlate), r->cpu * 100);
+}
+
+int main(int argc, char **argv) {
+	result_t tickless, polling, b;
+	int failed = 0;
+	int jobs;
+
+	for(jobs = 1; jobs <= 4; jobs += 3) {
+		tickless = scenario(jobs, 0);
+		polling = scenario(jobs, 1);
+
+		print(jobs, "tickless", &tickless);
+		print(jobs, "polling", &polling);
+
+		if (tickless.missed || polling.missed) {
+			printf("FAIL: %d periodic jobs: %d periods without a run (tickless), %d (polling)\n",
+				jobs, tickless.missed, polling.missed);
+			failed = 1;
+		}
+
+		if (tickless.cpu >= polling.cpu) {
+			printf("FAIL: %d periodic jobs: the tickless run loop doesn't save CPU\n", jobs);
+			failed = 1;
+		}
+	}
+
+	b = scenario(0, 0);
+	printf("%d one-shot jobs, %d cleared: %d runs\n", BURST, BURST / 4, b.runs);
+	if (b.missed) {
+		printf("FAIL: one-shot jobs lost, run twice, or out of order\n");
+		failed = 1;
+	}
+
+	return failed;
+}
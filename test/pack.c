@@ -0,0 +1,369 @@
+/*
+ * Lua RTOS, host test and benchmark of the MessagePack codec
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * First, pack.encode / pack.decode round trips are checked: integers and
+ * strings at each width boundary, floats, bin values from buffers (that
+ * are decoded as slices of the source buffer), nested tables, the
+ * detection of sequences, and messages that must fail.
+ *
+ * Then telemetry records are encoded and decoded with the MessagePack codec
+ * and with the legacy hex format of pack.pack / pack.unpack. The bytes on
+ * the wire, and the best time of a few runs, are reported.
+ *
+ * The Makefile builds this test twice, with 32-bit integers and single
+ * floats (the default of Lua RTOS), and with 64-bit integers and doubles,
+ * where the 64-bit and float 64 types are used by the encoder.
+ *
+ */
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define RECORDS 2000
+#define RUNS    5
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+// Helpers of the checks: encoding of a value with its type byte and length,
+// deep compare, and tables nested n levels. wide is true in the build with
+// 64-bit integers and doubles.
+#define PRELUDE \
+	"local wide = math.maxinteger > 2^31 " \
+	"local function same(a, b) " \
+	"  if type(a) ~= 'table' or type(b) ~= 'table' then " \
+	"    return (a == b) and (math.type(a) == math.type(b)) " \
+	"  end " \
+	"  for k, v in pairs(a) do if not same(v, b[k]) then return false end end " \
+	"  for k in pairs(b) do if a[k] == nil then return false end end " \
+	"  return true " \
+	"end " \
+	"local function encodes(v, type, len) " \
+	"  local m = pack.encode(v) " \
+	"  if string.byte(m, 1) ~= type or #m ~= len or not same(pack.decode(m), v) then " \
+	"    error(string.format('%s: type 0x%02x, %d bytes', tostring(v), string.byte(m, 1), #m)) " \
+	"  end " \
+	"  return true " \
+	"end " \
+	"local function nest(n) " \
+	"  local t = {} for i = 2, n do t = {t} end return t " \
+	"end " \
+	"local function fails(msg, f, ...) " \
+	"  local ok, err = pcall(f, ...) " \
+	"  if ok or not string.find(err, msg, 1, true) then error(tostring(err)) end " \
+	"  return true " \
+	"end "
+
+// Each script returns true on success
+static const char *checks[] = {
+	// Integers at each width boundary, big endian
+	"for _, c in ipairs({ "
+	"  {0, 0x00, 1}, {127, 0x7f, 1}, {128, 0xcc, 2}, {255, 0xcc, 2}, "
+	"  {256, 0xcd, 3}, {65535, 0xcd, 3}, {65536, 0xce, 5}, "
+	"  {-1, 0xff, 1}, {-32, 0xe0, 1}, {-33, 0xd0, 2}, {-128, 0xd0, 2}, "
+	"  {-129, 0xd1, 3}, {-32768, 0xd1, 3}, {-32769, 0xd2, 5}, "
+	"  {math.maxinteger, wide and 0xcf or 0xce, wide and 9 or 5}, "
+	"  {math.mininteger, wide and 0xd3 or 0xd2, wide and 9 or 5}, "
+	"}) do encodes(c[1], c[2], c[3]) end "
+	"if wide then "
+	"  encodes((1 << 31) - 1, 0xce, 5) encodes((1 << 32) - 1, 0xce, 5) "
+	"  encodes(1 << 32, 0xcf, 9) encodes(-(1 << 31), 0xd2, 5) "
+	"  encodes(-(1 << 31) - 1, 0xd3, 9) "
+	"end "
+	"return pack.encode(0x1234) == '\\xcd\\x12\\x34' and "
+	"  pack.encode(-129) == '\\xd1\\xff\\x7f' and "
+	"  pack.encode(65536) == '\\xce\\x00\\x01\\x00\\x00' and "
+	"  pack.encode(-32769) == '\\xd2\\xff\\xff\\x7f\\xff'",
+
+	// Integers that don't fit in lua_Integer are decoded as floats
+	"local t = wide and 'integer' or 'float' "
+	"local a = pack.decode('\\xce\\xff\\xff\\xff\\xff') "
+	"local b = pack.decode('\\xcf\\x00\\x00\\x00\\x01\\x00\\x00\\x00\\x00') "
+	"local c = pack.decode('\\xd3\\xff\\xff\\xff\\xff\\x7f\\xff\\xff\\xff') "
+	"local d = pack.decode('\\xcf\\xff\\xff\\xff\\xff\\xff\\xff\\xff\\xff') "
+	"return a == 2^32 - 1 and b == 2^32 and c == -2^31 - 1 and "
+	"  math.type(a) == t and math.type(b) == t and math.type(c) == t and "
+	"  math.type(d) == 'float' and d > 1.8e19 and "
+	"  pack.decode('\\xcc\\x80') == 128 and pack.decode('\\xd0\\x80') == -128 and "
+	"  pack.decode('\\xd1\\x80\\x00') == -32768",
+
+	// Floats: float 32 if it's exact, float 64 otherwise (only with doubles)
+	"encodes(1.5, 0xca, 5) encodes(-0.25, 0xca, 5) encodes(2.0, 0xca, 5) "
+	"encodes(2^127, 0xca, 5) encodes(1/0, 0xca, 5) encodes(-1/0, 0xca, 5) "
+	"encodes(0.1, wide and 0xcb or 0xca, wide and 9 or 5) "
+	"if wide then encodes(1e300, 0xcb, 9) encodes(math.pi, 0xcb, 9) end "
+	"local nan = pack.decode(pack.encode(0/0)) "
+	"return pack.encode(1.5) == '\\xca\\x3f\\xc0\\x00\\x00' and "
+	"  string.byte(pack.encode(0/0), 1) == 0xca and nan ~= nan and "
+	"  pack.decode('\\xcb\\x3f\\xf8\\x00\\x00\\x00\\x00\\x00\\x00') == 1.5 and "
+	"  pack.decode('\\xcb\\x3f\\xb9\\x99\\x99\\x99\\x99\\x99\\x9a') == 0.1",
+
+	// Strings at each width boundary
+	"for _, c in ipairs({ "
+	"  {0, 0xa0, 1}, {31, 0xbf, 1}, {32, 0xd9, 2}, {255, 0xd9, 2}, "
+	"  {256, 0xda, 3}, {65535, 0xda, 3}, {65536, 0xdb, 5}, "
+	"}) do encodes(string.rep('x', c[1]), c[2], c[3] + c[1]) end "
+	"return string.sub(pack.encode(string.rep('x', 256)), 1, 3) == '\\xda\\x01\\x00' and "
+	"  string.sub(pack.encode(string.rep('x', 65536)), 1, 5) == '\\xdb\\x00\\x01\\x00\\x00' and "
+	"  pack.decode(pack.encode('a\\0b')) == 'a\\0b'",
+
+	// Buffers are encoded as bin. From a string, bin is decoded as a string.
+	"for _, c in ipairs({ "
+	"  {0, 0xc4, 2}, {255, 0xc4, 2}, {256, 0xc5, 3}, {65535, 0xc5, 3}, {65536, 0xc6, 5}, "
+	"}) do "
+	"  local b = buffer.new(c[1], 0x5a) "
+	"  local m = pack.encode(b) "
+	"  if string.byte(m, 1) ~= c[2] or #m ~= c[3] + c[1] then error(c[1] .. ' bytes') end "
+	"  if pack.decode(m) ~= b:tostring() then error(c[1] .. ' bytes') end "
+	"end "
+	"local b = buffer.new(3) b:put('u8', 1, 1) b:put('u8', 2, 2) b:put('u8', 3, 3) "
+	"return pack.encode(b) == '\\xc4\\x03\\x01\\x02\\x03'",
+
+	// From a buffer, bin is decoded as a slice of it, that shares its memory
+	// and keeps it alive
+	"local src = buffer.new(300, 7) "
+	"local m = buffer.new(pack.encode('head', src, 42)) "
+	"local s, slice, n = pack.decode(m) "
+	"if s ~= 'head' or n ~= 42 or type(slice) ~= 'userdata' or #slice ~= 300 then return false end "
+	"if slice:tostring() ~= src:tostring() then return false end "
+	"m:put('u8', 5 + 3 + 1, 0x55) m:put('u8', 5 + 3 + 300, 0x66) "
+	"if slice:get('u8', 1) ~= 0x55 or slice:get('u8', 300) ~= 0x66 then return false end "
+	"m = nil collectgarbage() collectgarbage() "
+	"return slice:get('u8', 1) == 0x55 and slice:get('u8', 2) == 7 and "
+	"  select('#', pack.decode(buffer.new(pack.encode(buffer.new(0))))) == 1",
+
+	// encodeinto a reused buffer, decoded from a slice of the bytes used
+	"local buf = buffer.new(64) "
+	"for i = 1, 100 do "
+	"  local n = pack.encodeinto(buf, i, 'v' .. i, {i, i * 2}) "
+	"  local a, b, c = pack.decode(buf:slice(1, n)) "
+	"  if a ~= i or b ~= 'v' .. i or not same(c, {i, i * 2}) then return false end "
+	"  if n ~= #pack.encode(i, 'v' .. i, {i, i * 2}) then return false end "
+	"end "
+	"return pack.encodeinto(buf) == 0 and "
+	"  fails('buffer too small', pack.encodeinto, buffer.new(4), 'hello') and "
+	"  fails('buffer too small', pack.encodeinto, buf, string.rep('x', 64))",
+
+	// Nested maps and arrays, and the width of their headers
+	"local t = { "
+	"  name = 'wcb', on = true, off = false, "
+	"  list = {1, -2, 3.5, 'four', {a = {b = {c = {1, 2, 3}}}}}, "
+	"  keys = {[1.5] = 'f', [10] = 'ten', [-1] = 'neg', [true] = 'yes'}, "
+	"  empty = {}, big = {}, "
+	"} "
+	"for i = 1, 300 do t.big[i] = {id = i, v = i / 2} end "
+	"if not same(pack.decode(pack.encode(t)), t) then return false end "
+	"local a15, a16, m15, m16, m65536 = {}, {}, {}, {}, {} "
+	"for i = 1, 15 do a15[i] = i m15['k' .. i] = i end "
+	"for i = 1, 16 do a16[i] = i m16['k' .. i] = i end "
+	"for i = 1, 65536 do m65536[-i] = 0 end "
+	"local e = pack.encode(m65536) "
+	"return string.byte(pack.encode(a15), 1) == 0x9f and "
+	"  string.sub(pack.encode(a16), 1, 3) == '\\xdc\\x00\\x10' and "
+	"  string.byte(pack.encode(m15), 1) == 0x8f and "
+	"  string.sub(pack.encode(m16), 1, 3) == '\\xde\\x00\\x10' and "
+	"  string.sub(e, 1, 5) == '\\xdf\\x00\\x01\\x00\\x00' and same(pack.decode(e), m65536) and "
+	"  same(pack.decode(pack.encode(a16)), a16) and same(pack.decode(pack.encode(m16)), m16)",
+
+	// Only tables with keys 1..n are arrays
+	"local t = {1, 2, nil, 4} "
+	"return pack.encode({}) == '\\x90' and "
+	"  pack.encode({1, 2, 3}) == '\\x93\\x01\\x02\\x03' and "
+	"  pack.encode({[1] = 1, [2] = 2, [3] = 3}) == '\\x93\\x01\\x02\\x03' and "
+	"  pack.encode({[1] = 1, [2.0] = 2}) == '\\x92\\x01\\x02' and "
+	"  string.byte(pack.encode(t), 1) == 0x83 and same(pack.decode(pack.encode(t)), t) and "
+	"  pack.encode({[2] = 1}) == '\\x81\\x02\\x01' and "
+	"  string.byte(pack.encode({[0] = 1, 2}), 1) == 0x82 and "
+	"  string.byte(pack.encode({1, x = 2}), 1) == 0x82 and "
+	"  string.byte(pack.encode({[1.5] = 1}), 1) == 0x81 and "
+	"  same(pack.decode(pack.encode({[0] = 1, 2})), {[0] = 1, 2})",
+
+	// Multiple values, nil and booleans
+	"local m = pack.encode(1, 'a', nil, true, false) "
+	"local a, b, c, d, e = pack.decode(m) "
+	"return m == '\\x01\\xa1a\\xc0\\xc3\\xc2' and a == 1 and b == 'a' and c == nil and "
+	"  d == true and e == false and select('#', pack.decode(m)) == 5 and "
+	"  pack.encode() == '' and select('#', pack.decode('')) == 0",
+
+	// Nesting limit, while encoding and while decoding
+	"return same(pack.decode(pack.encode(nest(33))), nest(33)) and "
+	"  fails('table nested too deep', pack.encode, nest(34)) and "
+	"  fails('table nested too deep', pack.decode, string.rep('\\x91', 40) .. '\\x01') and "
+	"  fails('table nested too deep', pack.encode, (function() local t = {} t[1] = t return t end)())",
+
+	// Messages that must fail
+	"return fails('truncated message', pack.decode, '\\xcd\\x01') and "
+	"  fails('truncated message', pack.decode, '\\x92\\x01') and "
+	"  fails('truncated message', pack.decode, '\\xa5ab') and "
+	"  fails('truncated message', pack.decode, '\\xdc\\xff\\xff\\x01') and "
+	"  fails('truncated message', pack.decode, '\\xdb\\xff\\xff\\xff\\xff') and "
+	"  fails('truncated message', pack.decode, buffer.new('\\xc6\\x00\\x01\\x00\\x00')) and "
+	"  fails('invalid map key', pack.decode, '\\x81\\xc0\\x01') and "
+	"  fails('unsupported type 193', pack.decode, '\\xc1') and "
+	"  fails('unsupported type function', pack.encode, print) and "
+	"  fails('unsupported type thread', pack.encode, {coroutine.create(print)})",
+
+	NULL
+};
+
+// Telemetry records, like the ones sent by the sensors
+#define RECORD \
+	"local function record(i) " \
+	"  return {id = i, ts = 1508316000 + i * 60, temp = 20 + i % 50 / 4, " \
+	"          hum = 40 + i % 7, bat = 3.3 + i % 10 / 20, ok = i % 3 ~= 0} " \
+	"end "
+
+// Each benchmark defines enc(r), that encodes a record, and dec(m), that
+// decodes a message made by msg(r), or by enc(r) if there is no msg
+static const struct {
+	const char *name;
+	const char *script;
+} benchs[] = {
+	{"hex pack / unpack",
+	 "local function enc(r) return pack.pack(r.id, r.ts, r.temp, r.hum, r.bat, r.ok) end "
+	 "local dec, msg = pack.unpack "},
+
+	{"encode / decode",
+	 "local function enc(r) return pack.encode(r.id, r.ts, r.temp, r.hum, r.bat, r.ok) end "
+	 "local dec, msg = pack.decode "},
+
+	{"encode table",
+	 "local function enc(r) return pack.encode(r) end "
+	 "local dec, msg = pack.decode "},
+
+	{"encodeinto buffer",
+	 "local buf = buffer.new(64) "
+	 "local function enc(r) return pack.encodeinto(buf, r.id, r.ts, r.temp, r.hum, r.bat, r.ok) end "
+	 "local function msg(r) return buffer.new(pack.encode(r.id, r.ts, r.temp, r.hum, r.bat, r.ok)) end "
+	 "local dec = pack.decode "},
+
+	{NULL, NULL}
+};
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Best time of a few runs of the function at the top of the stack
+static double best(lua_State *L) {
+	double start, elapsed, min = 0;
+	int j;
+
+	for(j = 0; j < RUNS; j++) {
+		lua_pushvalue(L, -1);
+
+		start = now();
+		if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+			printf("FAIL: %s\n", lua_tostring(L, -1));
+			return -1;
+		}
+		elapsed = now() - start;
+
+		if ((j == 0) || (elapsed < min)) {
+			min = elapsed;
+		}
+	}
+
+	lua_pop(L, 1);
+
+	return min;
+}
+
+int main(int argc, char **argv) {
+	double encode, decode;
+	const char **check;
+	lua_State *L;
+	char script[8192];
+	int i, failed = 0;
+
+	for(check = checks; *check; check++) {
+		L = luaL_newstate();
+		luaL_openlibs(L);
+
+		snprintf(script, sizeof(script), "%s %s", PRELUDE, *check);
+
+		if ((luaL_dostring(L, script) != LUA_OK) || !lua_toboolean(L, -1)) {
+			printf("FAIL: %s\n      %s\n", *check, lua_isstring(L, -1) ? lua_tostring(L, -1) : "false");
+			failed = 1;
+		}
+
+		lua_close(L);
+	}
+
+	if (failed) {
+		return 1;
+	}
+
+	for(i = 0; benchs[i].name; i++) {
+		L = luaL_newstate();
+		luaL_openlibs(L);
+
+		// The records, and the messages to decode, are made before the
+		// benchmark
+		snprintf(script, sizeof(script),
+			"%s %s local n = %d local recs, msgs, bytes = {}, {}, 0 "
+			"for i = 1, n do recs[i] = record(i) msgs[i] = (msg or enc)(recs[i]) bytes = bytes + #msgs[i] end "
+			"return bytes / n, "
+			"  function() for i = 1, n do enc(recs[i]) end end, "
+			"  function() for i = 1, n do dec(msgs[i]) end end",
+			RECORD, benchs[i].script, RECORDS);
+
+		if (luaL_dostring(L, script) != LUA_OK) {
+			printf("FAIL: %s: %s\n", benchs[i].name, lua_tostring(L, -1));
+			return 1;
+		}
+
+		if (((decode = best(L)) < 0) || ((encode = best(L)) < 0)) {
+			return 1;
+		}
+
+		printf("%-18s %5.1f bytes, encode %5.2f us, decode %5.2f us per record\n",
+			benchs[i].name, lua_tonumber(L, -1),
+			encode * 1e6 / RECORDS, decode * 1e6 / RECORDS);
+
+		lua_close(L);
+	}
+
+	return 0;
+}
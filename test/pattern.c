@@ -0,0 +1,358 @@
+/*
+ * Lua RTOS, host test and benchmark of the compiled pattern cache
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * The string library is included here (see the Makefile) with the compiled
+ * pattern cache disabled, and its pattern functions are exposed as ref.find,
+ * ref.match, ref.gmatch and ref.gsub. They are the uncached path, that
+ * string.find, string.match, string.gmatch and string.gsub must agree with.
+ *
+ * First, both are run over a corpus of patterns and subjects, including
+ * malformed patterns, and over random patterns, comparing results and
+ * errors. Then the eviction of the cache is checked, also while a program
+ * is in use by a gsub or a gmatch iterator. Last, log lines are parsed with
+ * both, and the best time of a few runs is reported.
+ *
+ */
+
+#include "modules.h"
+
+// Only one string library can be registered
+#undef MODULE_REGISTER_MAPPED
+#define MODULE_REGISTER_MAPPED(fname, lname, map, func)
+
+#define LUA_PATCACHE_SIZE 0
+#define luaopen_string luaopen_string_ref
+
+#include "lstrlib.c"
+
+#include <stdint.h>
+#include <time.h>
+
+#define RUNS 5
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+static const luaL_Reg ref[] = {
+	{"find",   str_find},
+	{"match",  str_match},
+	{"gmatch", gmatch},
+	{"gsub",   str_gsub},
+	{NULL, NULL}
+};
+
+// Compare of string.x and ref.x, with results and errors, and the
+// compiled pattern cache, found in the registry
+#define PRELUDE \
+	"local function results(ok, ...) return {n = select('#', ...), ok = ok, ...} end " \
+	"local function gmatchall(lib, s, p) " \
+	"  local t = {} " \
+	"  for a, b, c in lib.gmatch(s, p) do " \
+	"    t[#t + 1] = tostring(a) .. '|' .. tostring(b) .. '|' .. tostring(c) " \
+	"  end " \
+	"  return table.concat(t, ',') " \
+	"end " \
+	"local function cmp(name, ...) " \
+	"  local a, b " \
+	"  if name == 'gmatch' then " \
+	"    a, b = results(pcall(gmatchall, string, ...)), results(pcall(gmatchall, ref, ...)) " \
+	"  else " \
+	"    a, b = results(pcall(string[name], ...)), results(pcall(ref[name], ...)) " \
+	"  end " \
+	"  local same = (a.n == b.n) and (a.ok == b.ok) " \
+	"  for i = 1, a.n do same = same and (a[i] == b[i]) end " \
+	"  if not same then " \
+	"    local args = {} " \
+	"    for i = 1, select('#', ...) do args[i] = string.format('%q', tostring((select(i, ...)))) end " \
+	"    error(string.format('%s(%s): %s %s, uncached %s %s', name, table.concat(args, ', '), " \
+	"      tostring(a.ok), tostring(a[1]), tostring(b.ok), tostring(b[1]))) " \
+	"  end " \
+	"end " \
+	"local repl = { " \
+	"  '<%0>', '%1-%1', '%%', {hello = 'HELLO', a = false, key = 1}, " \
+	"  function(...) if select('#', ...) > 1 then return table.concat({...}, '+') end return nil end, " \
+	"} " \
+	"local function check(s, p) " \
+	"  for _, init in ipairs({1, 3, -2, 0, 100}) do " \
+	"    cmp('find', s, p, init) cmp('match', s, p, init) " \
+	"  end " \
+	"  cmp('gmatch', s, p) " \
+	"  for _, r in ipairs(repl) do cmp('gsub', s, p, r) cmp('gsub', s, p, r, 1) end " \
+	"end " \
+	"local function cache() " \
+	"  for k, v in pairs(debug.getregistry()) do " \
+	"    if type(k) == 'userdata' and type(v) == 'table' and next(v) ~= nil then " \
+	"      local ok = true " \
+	"      for p, prog in pairs(v) do ok = ok and type(p) == 'string' and type(prog) == 'userdata' end " \
+	"      if ok then return v end " \
+	"    end " \
+	"  end " \
+	"  return {} " \
+	"end " \
+	"local function count() local n = 0 for _ in pairs(cache()) do n = n + 1 end return n end "
+
+#define SUBJECTS \
+	"local subjects = { " \
+	"  '', 'hello', 'hello world', 'key = value; x=1', 'THE (quick) (brown (fox))', " \
+	"  'a,b,,c', 'aaa', '  indented\\ttab\\n', 'abc\\0def\\0', 'f(a(b)c)d', " \
+	"  '123 abc 4.5e6 0x1F', ']]^$', 'la la land', " \
+	"} "
+
+// Each script returns true on success
+static const char *checks[] = {
+	// Corpus of patterns, valid and malformed
+	SUBJECTS
+	"local patterns = { "
+	"  '', 'a', 'hello', 'o w', '^h', '^hello$', 'd$', '$', '^$', 'a$b', '^', "
+	"  '.', '.-', '.*', 'l+', 'l*', 'l?', 'l-o', 'a-$', '^a*', "
+	"  '%a+', '%d+', '%s', '%w+', '%p', '%x+', '%u', '%l+', '%c', '%g+', "
+	"  '%A+', '%D', '%S+', '%W', '%.', '%%', '%(', '%]', '%^', '%$', "
+	"  '[aeiou]', '[^aeiou]+', '[a-f%d]+', '[%a_][%w_]*', '[%]]', '[^%]]', "
+	"  '[]]', '[^]]', '[a-]', '[-a]', '[%a-z]', '[a-%%]', '[^%s]+$', "
+	"  '(%w+)=(%w+)', '(%w+)%s*=%s*(%w+)', '()ll()', '(h)(e)(l)', '(l)%1', "
+	"  '(a)(.)%2', '((l)(a))', '%b()', '%b((', '%b)(', '^%b()', "
+	"  '%f[%w]%w+', '%f[%W]', '%f[%a]%a+%f[%A]', '%f[%z]', '%f[^%s]', "
+	"  'a\\0b', '[\\0]', '%z', '\\0', '[^\\0]+', 'x*y', '^(%w+)', "
+	"  '[a', '[', '%', '(', ')', '(()', '%b', '%ba', '%f', '%fa', '%f[a', "
+	"  '%1', '(%1)', 'a%', '[a-', '[%', '(a', 'a)', '%g', '[^', "
+	"  string.rep('(', 33) .. 'a' .. string.rep(')', 33), "
+	"  '(%w+)%s*=%s*(%w+)%s*;%s*(%w+)%s*=%s*(%w+)%s*', "
+	"  string.rep('a?', 20) .. string.rep('a', 20), "
+	"} "
+	"for _, p in ipairs(patterns) do "
+	"  for _, s in ipairs(subjects) do check(s, p) end "
+	"end "
+	"return true",
+
+	// Random patterns, each used a few times while others are compiled
+	SUBJECTS
+	"local tokens = { "
+	"  'a', 'b', 'l', 'o', ' ', '.', '%a', '%d', '%s', '%w', '[ab]', '[^l]', "
+	"  '[a-m]', '*', '+', '-', '?', '(', ')', '()', '^', '$', '%b()', '%f[%w]', "
+	"  '%1', '%', '[', ']', "
+	"} "
+	"math.randomseed(42) "
+	"for i = 1, 3000 do "
+	"  local t = {} "
+	"  for j = 1, math.random(1, 8) do t[j] = tokens[math.random(#tokens)] end "
+	"  local p = table.concat(t) "
+	"  local s = subjects[math.random(#subjects)] "
+	"  cmp('find', s, p) cmp('match', s, p, math.random(-3, 5)) cmp('gmatch', s, p) "
+	"  cmp('gsub', s, p, repl[math.random(#repl)]) cmp('find', s, p, 2) "
+	"end "
+	"return true",
+
+	// Least recently used programs are evicted
+	"for i = 1, 8 do string.find('x', 'p' .. i .. '%d') end "
+	"for i = 1, 8 do if not cache()['p' .. i .. '%d'] then return false end end "
+	"if count() ~= 8 then return false end "
+	"string.find('x', 'p9%d') "
+	"if count() ~= 8 or cache()['p1%d'] or not cache()['p9%d'] then return false end "
+	"string.match('x', 'p2%d') "
+	"string.gsub('x', 'p10%d', '') "
+	"if count() ~= 8 or cache()['p3%d'] or not cache()['p2%d'] or not cache()['p10%d'] then return false end "
+	"for i = 1, 1000 do "
+	"  local p = '(%d+)' .. i "
+	"  if string.match('x123' .. i, p) ~= '123' then return false end "
+	"end "
+	"return count() == 8 and cache()['(%d+)1000'] ~= nil",
+
+	// Plain patterns, and patterns longer than LUA_PATCACHE_MAXLEN, are not
+	// cached
+	"local long = string.rep('a', 40) .. '%d' "
+	"string.find('x', 'plain') string.find('x', '%d', 1, true) string.find('x', long) "
+	"local c = cache() "
+	"return c['plain'] == nil and c['%d'] == nil and c[long] == nil and "
+	"  string.find(string.rep('a', 40) .. '7', long) == 1",
+
+	// The same pattern with and without an anchor (gmatch doesn't anchor)
+	"for i = 1, 3 do "
+	"  cmp('find', 'a^a^a', '^a') cmp('gmatch', 'a^a^a', '^a') cmp('gsub', 'a^a^a', '^a', 'x') "
+	"end "
+	"return string.find('xa', '^a') == nil and gmatchall(string, 'a^a', '^a') == '^a|nil|nil'",
+
+	// Programs in use by a gsub or a gmatch iterator are not collected when
+	// they are evicted
+	"local r = string.gsub('a1 b2 c3', '(%a)(%d)', function(a, d) "
+	"  for i = 1, 20 do string.find(a, 'n' .. i .. '%a') end "
+	"  collectgarbage() "
+	"  return d .. a "
+	"end) "
+	"local t = {} "
+	"for k, v in string.gmatch('k1=v1, k2=v2, k3=v3', '(%w+)=(%w+)') do "
+	"  for i = 1, 20 do string.match(k, 'm' .. i .. '.') end "
+	"  collectgarbage() "
+	"  t[#t + 1] = k .. v "
+	"end "
+	"return r == '1a 2b 3c' and table.concat(t, ' ') == 'k1v1 k2v2 k3v3'",
+
+	NULL
+};
+
+// Log lines, parsed by each benchmark with lib (string or ref). Each
+// benchmark returns a checksum, that must be the same with both.
+#define LINES \
+	"local lines = {} " \
+	"for i = 1, 200 do " \
+	"  lines[i] = string.format('2017-10-18 12:%02d:%02d [%s] sensor%d temp=%d.%d hum=%d', " \
+	"    i % 60, (i * 7) % 60, i % 3 == 0 and 'WARN' or 'INFO', i % 8, 20 + i % 10, i % 10, 40 + i % 20) " \
+	"end "
+
+static const struct {
+	const char *name;
+	const char *script;
+} benchs[] = {
+	{"find",
+	 "local n = 0 "
+	 "for r = 1, 200 do for _, l in ipairs(lines) do "
+	 "  n = n + (lib.find(l, '%[%u+%]') or 0) + (lib.find(l, 'temp=%d') or 0) + (lib.find(l, 'WARN', 1, true) or 0) "
+	 "end end "
+	 "return n"},
+
+	{"match",
+	 "local n = 0 "
+	 "for r = 1, 100 do for _, l in ipairs(lines) do "
+	 "  local y, m, d, h, min, s = lib.match(l, '^(%d+)-(%d+)-(%d+) (%d+):(%d+):(%d+)') "
+	 "  n = n + tonumber(s) + tonumber(lib.match(l, 'temp=([%d%.]+)')) + #lib.match(l, '%[(%u+)%]') "
+	 "end end "
+	 "return n"},
+
+	{"gmatch",
+	 "local n = 0 "
+	 "for r = 1, 100 do for _, l in ipairs(lines) do "
+	 "  for k, v in lib.gmatch(l, '(%a+)=([%d%.]+)') do n = n + #k + tonumber(v) end "
+	 "end end "
+	 "return n"},
+
+	{"gsub",
+	 "local n = 0 "
+	 "for r = 1, 100 do for _, l in ipairs(lines) do "
+	 "  local s, c = lib.gsub(l, '(%a+)=', '%1: ') "
+	 "  local t, d = lib.gsub(s, '%s+', '_') "
+	 "  n = n + #t + c + d "
+	 "end end "
+	 "return n"},
+
+	{NULL, NULL}
+};
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static lua_State *newstate() {
+	lua_State *L = luaL_newstate();
+
+	luaL_openlibs(L);
+	luaL_newlib(L, ref);
+	lua_setglobal(L, "ref");
+
+	return L;
+}
+
+int main(int argc, char **argv) {
+	double start, elapsed, best[2];
+	const char *result[2];
+	const char **check;
+	char script[8192];
+	lua_State *L;
+	int i, j, k, failed = 0;
+
+	for(check = checks; *check; check++) {
+		L = newstate();
+
+		snprintf(script, sizeof(script), "%s %s", PRELUDE, *check);
+
+		if ((luaL_dostring(L, script) != LUA_OK) || !lua_toboolean(L, -1)) {
+			printf("FAIL: %s\n      %s\n", *check, lua_isstring(L, -1) ? lua_tostring(L, -1) : "false");
+			failed = 1;
+		}
+
+		lua_close(L);
+	}
+
+	if (failed) {
+		return 1;
+	}
+
+	for(i = 0; benchs[i].name; i++) {
+		snprintf(script, sizeof(script), "%s return function(lib) %s end", LINES, benchs[i].script);
+
+		L = newstate();
+
+		if (luaL_dostring(L, script) != LUA_OK) {
+			printf("FAIL: %s: %s\n", benchs[i].name, lua_tostring(L, -1));
+			return 1;
+		}
+
+		// Slots for the results. First without the cache (ref), then with
+		// it (string).
+		lua_settop(L, 3);
+		for(k = 0; k < 2; k++) {
+			for(j = 0; j < RUNS; j++) {
+				lua_pushvalue(L, 1);
+				lua_getglobal(L, k ? "string" : "ref");
+
+				start = now();
+				if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+					printf("FAIL: %s: %s\n", benchs[i].name, lua_tostring(L, -1));
+					return 1;
+				}
+				elapsed = now() - start;
+
+				if ((j == 0) || (elapsed < best[k])) {
+					best[k] = elapsed;
+				}
+
+				result[k] = lua_tostring(L, -1);
+				lua_replace(L, 2 + k);
+			}
+		}
+
+		if (strcmp(result[0], result[1]) != 0) {
+			printf("FAIL: %s: got %s, expected %s\n", benchs[i].name, result[1], result[0]);
+			return 1;
+		}
+
+		printf("%-8s %7.3f s uncached, %7.3f s cached\n", benchs[i].name, best[0], best[1]);
+
+		lua_close(L);
+	}
+
+	return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ * Lua RTOS, sched event loop, host test
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * The sched event loop, with vfs_poll on the host sockets (see rtos_host.c):
+ *
+ * - SOCKETS loopback TCP connections, each one served by an echo task, and
+ *   used by a client task for ROUNDS round trips, all in the same thread
+ * - a socket read timeout, and a timer, while the sockets are served
+ * - uart.read of a line, a buffer and a character that arrive in chunks,
+ *   with a task that counts the ticks while the UART is read, and a read
+ *   timeout (Lua/modules/uart.c is included, as the UART driver is replaced
+ *   by the host one)
+ *
+ * The round trips per second, and the polls and switches of the scheduler
+ * are reported.
+ *
+ */
+
+#include "Lua/modules/uart.c"
+
+#include "lualib.h"
+#include "rtos_host.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SOCKETS 300
+#define ROUNDS  50
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+// Host counterparts of the UART driver functions that are not used
+driver_error_t *uart_init(int8_t unit, uint32_t brg, uint8_t databits, uint8_t parity, uint8_t stop_bits, uint32_t qs) {
+	return NULL;
+}
+
+driver_error_t *uart_setup_interrupts(int8_t unit) {
+	return NULL;
+}
+
+void uart_pins(int8_t unit, uint8_t *rx, uint8_t *tx) {
+}
+
+int uart_get_br(int unit) {
+	return 115200;
+}
+
+void uart_lock(int unit) {
+}
+
+void uart_unlock(int unit) {
+}
+
+void uart_write(int8_t unit, char byte) {
+}
+
+void uart_writes(int8_t unit, char *s) {
+}
+
+void uart_writeb(int8_t unit, const uint8_t *data, size_t len) {
+}
+
+void uart_consume(int8_t unit) {
+}
+
+uint8_t uart_reads(int8_t unit, char *buff, uint8_t crlf, uint32_t timeout) {
+	return 0;
+}
+
+static const char *sockets =
+	"local pair, close, n, rounds, now = ... "
+	"local conns = {} "
+	"for i = 1, n do conns[i] = {pair()} end "
+
+	// Echo servers
+	"for i = 1, n do "
+	"  sched.spawn(function(fd) "
+	"    while true do "
+	"      local d = sched.read(fd, 256) "
+	"      if not d then break end "
+	"      assert(sched.write(fd, d) == #d) "
+	"    end "
+	"    close(fd) "
+	"  end, conns[i][2]) "
+	"end "
+
+	// Clients
+	"local done, t0 = 0, now() "
+	"for i = 1, n do "
+	"  sched.spawn(function(fd) "
+	"    for r = 1, rounds do "
+	"      local msg = 'ping ' .. i .. ' ' .. r "
+	"      sched.write(fd, msg) "
+	"      local got = '' "
+	"      while #got < #msg do got = got .. assert(sched.read(fd, 256)) end "
+	"      assert(got == msg, got) "
+	"    end "
+	"    done = done + 1 "
+	"    close(fd) "
+	"  end, conns[i][1]) "
+	"end "
+
+	// A read timeout, and a timer, in the middle of the traffic
+	"local timeout "
+	"sched.spawn(function() "
+	"  local c, s = pair() "
+	"  local d, err = sched.read(c, 10, 50) "
+	"  timeout = (d == nil) and (err == 'timeout') "
+	"  close(c) close(s) "
+	"end) "
+	"local ticks = 0 "
+	"sched.spawn(function() for i = 1, 5 do sched.sleepms(5) ticks = ticks + 1 end end) "
+
+	"local p0, s0 = sched.stats().polls, sched.stats().switches "
+	"assert(sched.run() == 0) "
+	"local t = now() - t0 "
+	"assert(done == n, 'clients done') "
+	"assert(timeout, 'read timeout') "
+	"assert(ticks == 5, 'timer ticks') "
+	"return n * rounds / t, sched.stats().polls - p0, sched.stats().switches - s0";
+
+static const char *uarts =
+	"local rx = ... "
+	"local long = string.rep('0123456789', 10) "
+	"local line, long_line, buf_len, buf_data, c, timeout "
+	"local ticks, reading = 0, true "
+
+	"sched.spawn(function() "
+	"  line = uart.read(1, '*l', false, 1000) "
+	"  long_line = uart.read(1, '*l', true, 1000) "
+	"  local b = buffer.new(12) "
+	"  buf_len = uart.read(1, b, 1000) "
+	"  buf_data = b:tostring() "
+	"  c = uart.read(1, '*c', 1000) "
+	"  timeout = uart.read(2, '*l', false, 20) "
+	"  reading = false "
+	"end) "
+
+	"sched.spawn(function() "
+	"  for _, chunk in ipairs({'hel', 'lo wor', 'ld\\n', long, '\\r\\n', 'abcd', 'efghijkl', 'x'}) do "
+	"    sched.sleepms(5) "
+	"    rx(1, chunk) "
+	"  end "
+	"end) "
+
+	"sched.spawn(function() while reading do ticks = ticks + 1 sched.sleepms(1) end end) "
+
+	"assert(sched.run() == 0) "
+	"assert(line == 'hello world', line) "
+	"assert(long_line == long, long_line) "
+	"assert(buf_len == 12 and buf_data == 'abcdefghijkl', buf_data) "
+	"assert(c == string.byte('x'), c) "
+	"assert(timeout == nil, timeout) "
+	"assert(ticks >= 20, 'other tasks blocked while reading, ' .. ticks .. ' ticks') "
+	"return true";
+
+// Seconds since the first call, as lua_Number is a float
+static int now(lua_State *L) {
+	static double base = 0;
+	struct timespec ts;
+	double t;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	t = ts.tv_sec + ts.tv_nsec / 1e9;
+	if (!base) {
+		base = t;
+	}
+
+	lua_pushnumber(L, t - base);
+
+	return 1;
+}
+
+// A loopback TCP connection, returns the client and the server descriptors
+static int pair(lua_State *L) {
+	static int listener = -1;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int client, server;
+
+	memset(&addr, 0, sizeof(addr));
+
+	if (listener < 0) {
+		listener = socket(AF_INET, SOCK_STREAM, 0);
+
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if ((bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(listener, 64) < 0)) {
+			return luaL_error(L, "can't listen on the loopback interface");
+		}
+	}
+
+	getsockname(listener, (struct sockaddr *)&addr, &len);
+
+	client = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(client, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		return luaL_error(L, "can't connect");
+	}
+
+	server = accept(listener, NULL, NULL);
+	if (server < 0) {
+		return luaL_error(L, "can't accept");
+	}
+
+	lua_pushinteger(L, client);
+	lua_pushinteger(L, server);
+
+	return 2;
+}
+
+static int fdclose(lua_State *L) {
+	close(luaL_checkinteger(L, 1));
+
+	return 0;
+}
+
+static int rx(lua_State *L) {
+	size_t len;
+	const char *data = luaL_checklstring(L, 2, &len);
+
+	rtos_host_uart_rx(luaL_checkinteger(L, 1), data, len);
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int failed = 0;
+
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+
+	luaL_loadstring(L, sockets);
+	lua_pushcfunction(L, pair);
+	lua_pushcfunction(L, fdclose);
+	lua_pushinteger(L, SOCKETS);
+	lua_pushinteger(L, ROUNDS);
+	lua_pushcfunction(L, now);
+	if (lua_pcall(L, 5, 3, 0) != LUA_OK) {
+		printf("FAIL: sockets, %s\n", lua_tostring(L, -1));
+		failed = 1;
+	} else {
+		printf("%d sockets: %.0f round trips/s, %d polls, %d switches\n", SOCKETS,
+			lua_tonumber(L, -3), (int)lua_tointeger(L, -2), (int)lua_tointeger(L, -1));
+	}
+
+	lua_settop(L, 0);
+
+	luaL_loadstring(L, uarts);
+	lua_pushcfunction(L, rx);
+	if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+		printf("FAIL: uart, %s\n", lua_isstring(L, -1) ? lua_tostring(L, -1) : "assertion failed");
+		failed = 1;
+	}
+
+	return failed;
+}
@@ -0,0 +1,658 @@
+/*
+ * Lua RTOS, host counterparts of the FreeRTOS and Lua RTOS primitives
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * FreeRTOS queues and tasks, Lua RTOS mutexes and pthreads run on top of the host
+ * pthreads, so that the parts that start threads can be tested on the host.
+ *
+ * Threads are accounted with the stack size requested by Lua RTOS (see
+ * rtos_host.h), but get a host stack of HOST_STACK bytes, as the host code
+ * needs more stack. The stack free is unknown on the host.
+ *
+ * The Lua state is shared by the threads, so Lua is built with
+ * LUA_USE_LUA_LOCK, and the lock is a global mutex.
+ *
+ * lwip sockets are the host sockets, waited with select, and the UART units
+ * receive the bytes given to rtos_host_uart_rx.
+ *
+ */
+
+#include "rtos_host.h"
+
+#include "lua.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include <sys/mutex.h>
+#include <sys/select.h>
+#include <pthread/pthread.h>
+#include <drivers/uart.h>
+#include <vfs/vfs.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#undef pthread_create
+#undef pthread_attr_setstacksize
+
+#define HOST_STACK (256 * 1024)
+#define HOST_THREADS 512
+#define UART_RX 1024
+
+struct QueueDefinition {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	UBaseType_t length;
+	UBaseType_t size;
+	UBaseType_t count;
+	UBaseType_t head;
+	uint8_t *items;
+};
+
+typedef struct {
+	void *(*routine)(void *);
+	void *arg;
+	int stack;
+} host_start_t;
+
+typedef struct {
+	pthread_t id;
+	int stack;
+	int used;
+} host_thread_t;
+
+// A FreeRTOS task, and its notification value
+typedef struct {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	uint32_t notified;
+	TaskFunction_t code;
+	void *arg;
+} host_task_t;
+
+// Bytes received by a UART unit, head and tail are free running
+struct host_uart {
+	char data[UART_RX];
+	unsigned int head;
+	unsigned int tail;
+};
+
+unsigned int rtos_host_threads = 0;
+unsigned long rtos_host_stack = 0;
+unsigned long rtos_host_stack_max = 0;
+
+static pthread_mutex_t lua_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t threads_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static host_thread_t threads[HOST_THREADS];
+static unsigned long stack_live = 0;
+
+// Stack size set by the last pthread_attr_setstacksize of the calling thread,
+// used by the next pthread_create
+static __thread int stack_requested = 0;
+
+// Task of the calling thread, if it was created by xTaskCreate
+static __thread host_task_t *current_task = NULL;
+
+// Cleanup handler of the calling thread
+static __thread void (*cleanup_routine)(void *) = NULL;
+static __thread void *cleanup_arg = NULL;
+
+static struct host_uart uart[NUART];
+static pthread_mutex_t uart_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t uart_cond = PTHREAD_COND_INITIALIZER;
+
+// Absolute time for pthread_cond_timedwait, timeout milliseconds from now
+static void host_deadline(struct timespec *ts, uint32_t timeout) {
+	clock_gettime(CLOCK_REALTIME, ts);
+
+	ts->tv_sec += timeout / 1000;
+	ts->tv_nsec += (timeout % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+void LuaLock(lua_State *L) {
+	pthread_mutex_lock(&lua_mtx);
+}
+
+void LuaUnlock(lua_State *L) {
+	pthread_mutex_unlock(&lua_mtx);
+}
+
+void mtx_init(struct mtx *mutex, const char *name, const char *type, int opts) {
+	mutex->sem = malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init((pthread_mutex_t *)mutex->sem, NULL);
+}
+
+void mtx_lock(struct mtx *mutex) {
+	pthread_mutex_lock((pthread_mutex_t *)mutex->sem);
+}
+
+int mtx_trylock(struct mtx *mutex) {
+	return pthread_mutex_trylock((pthread_mutex_t *)mutex->sem) == 0;
+}
+
+void mtx_unlock(struct mtx *mutex) {
+	pthread_mutex_unlock((pthread_mutex_t *)mutex->sem);
+}
+
+void mtx_destroy(struct mtx *mutex) {
+	pthread_mutex_destroy((pthread_mutex_t *)mutex->sem);
+	free(mutex->sem);
+	mutex->sem = NULL;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t size) {
+	QueueHandle_t queue = calloc(1, sizeof(struct QueueDefinition));
+
+	if (!queue) {
+		return NULL;
+	}
+
+	queue->items = malloc(length * size);
+	if (!queue->items) {
+		free(queue);
+		return NULL;
+	}
+
+	pthread_mutex_init(&queue->mtx, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	queue->length = length;
+	queue->size = size;
+
+	return queue;
+}
+
+// Only waits forever, or don't wait, are used by the parts built on the host
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) {
+	pthread_mutex_lock(&queue->mtx);
+
+	while (queue->count == queue->length) {
+		if (!wait) {
+			pthread_mutex_unlock(&queue->mtx);
+			return pdFALSE;
+		}
+
+		pthread_cond_wait(&queue->cond, &queue->mtx);
+	}
+
+	memcpy(queue->items + ((queue->head + queue->count) % queue->length) * queue->size, item, queue->size);
+	queue->count++;
+
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mtx);
+
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) {
+	pthread_mutex_lock(&queue->mtx);
+
+	while (queue->count == 0) {
+		if (!wait) {
+			pthread_mutex_unlock(&queue->mtx);
+			return pdFALSE;
+		}
+
+		pthread_cond_wait(&queue->cond, &queue->mtx);
+	}
+
+	memcpy(item, queue->items + queue->head * queue->size, queue->size);
+	queue->head = (queue->head + 1) % queue->length;
+	queue->count--;
+
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mtx);
+
+	return pdTRUE;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+	pthread_mutex_destroy(&queue->mtx);
+	pthread_cond_destroy(&queue->cond);
+	free(queue->items);
+	free(queue);
+}
+
+void vTaskDelay(TickType_t ticks) {
+	usleep(ticks * portTICK_PERIOD_MS * 1000);
+}
+
+// Ticks since the first call, from the monotonic clock
+TickType_t xTaskGetTickCount(void) {
+	static struct timespec base;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (!base.tv_sec && !base.tv_nsec) {
+		base = ts;
+	}
+
+	return (TickType_t)((ts.tv_sec - base.tv_sec) * 1000 + (ts.tv_nsec - base.tv_nsec) / 1000000) / portTICK_PERIOD_MS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+	return (TaskHandle_t)pthread_self();
+}
+
+void uxSetLuaState(lua_State *L) {
+}
+
+static void *task_start(void *arg) {
+	current_task = (host_task_t *)arg;
+	current_task->code(current_task->arg);
+
+	return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *task) {
+	host_task_t *t = calloc(1, sizeof(host_task_t));
+	pthread_attr_t attr;
+	pthread_t id;
+
+	if (!t) {
+		return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+	}
+
+	pthread_mutex_init(&t->mtx, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	t->code = code;
+	t->arg = arg;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, HOST_STACK);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	if (pthread_create(&id, &attr, task_start, t)) {
+		free(t);
+		return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+	}
+
+	if (task) {
+		*task = (TaskHandle_t)t;
+	}
+
+	return pdPASS;
+}
+
+// Task notifications, only as a counting semaphore
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+	host_task_t *t = current_task;
+	struct timespec ts;
+	uint32_t value;
+
+	host_deadline(&ts, wait * portTICK_PERIOD_MS);
+
+	pthread_mutex_lock(&t->mtx);
+
+	while (!t->notified && wait) {
+		if (pthread_cond_timedwait(&t->cond, &t->mtx, &ts) == ETIMEDOUT) {
+			break;
+		}
+	}
+
+	value = t->notified;
+	if (value) {
+		t->notified = clear ? 0 : value - 1;
+	}
+
+	pthread_mutex_unlock(&t->mtx);
+
+	return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+	host_task_t *t = (host_task_t *)task;
+
+	pthread_mutex_lock(&t->mtx);
+	t->notified++;
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->mtx);
+
+	return pdPASS;
+}
+
+static host_thread_t *thread_get(pthread_t id) {
+	int i;
+
+	for(i = 0; i < HOST_THREADS; i++) {
+		if (threads[i].used && pthread_equal(threads[i].id, id)) {
+			return &threads[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void *thread_start(void *arg) {
+	host_start_t start = *(host_start_t *)arg;
+	host_thread_t *thread;
+	void *res;
+
+	free(arg);
+
+	res = start.routine(start.arg);
+
+	if (cleanup_routine) {
+		cleanup_routine(cleanup_arg);
+	}
+
+	pthread_mutex_lock(&threads_mtx);
+	if ((thread = thread_get(pthread_self()))) {
+		thread->used = 0;
+	}
+	stack_live -= start.stack;
+	pthread_mutex_unlock(&threads_mtx);
+
+	return res;
+}
+
+int _pthread_attr_setstacksize_host(pthread_attr_t *attr, size_t size) {
+	stack_requested = size;
+
+	return pthread_attr_setstacksize(attr, HOST_STACK);
+}
+
+int _pthread_create_host(pthread_t *thread, const pthread_attr_t *attr, void *(*routine)(void *), void *arg) {
+	host_start_t *start;
+	host_thread_t *slot = NULL;
+	int res, i;
+
+	start = malloc(sizeof(host_start_t));
+	if (!start) {
+		return ENOMEM;
+	}
+
+	start->routine = routine;
+	start->arg = arg;
+	start->stack = stack_requested;
+
+	// The thread is registered before it runs, so it can get it's own stack
+	pthread_mutex_lock(&threads_mtx);
+
+	for(i = 0; i < HOST_THREADS; i++) {
+		if (!threads[i].used) {
+			slot = &threads[i];
+			break;
+		}
+	}
+
+	if (!slot) {
+		pthread_mutex_unlock(&threads_mtx);
+		free(start);
+		return EAGAIN;
+	}
+
+	res = pthread_create(thread, attr, thread_start, start);
+	if (res) {
+		pthread_mutex_unlock(&threads_mtx);
+		free(start);
+		return res;
+	}
+
+	pthread_detach(*thread);
+
+	slot->id = *thread;
+	slot->stack = stack_requested;
+	slot->used = 1;
+
+	rtos_host_threads++;
+	rtos_host_stack += slot->stack;
+	stack_live += slot->stack;
+	if (stack_live > rtos_host_stack_max) {
+		rtos_host_stack_max = stack_live;
+	}
+
+	pthread_mutex_unlock(&threads_mtx);
+
+	return 0;
+}
+
+void _pthread_cleanup_push(void (*routine)(void *), void *arg) {
+	cleanup_routine = routine;
+	cleanup_arg = arg;
+}
+
+// Threads always start running on the host
+int pthread_attr_setinitialstate(pthread_attr_t *attr, int initial_state) {
+	return 0;
+}
+
+int _pthread_stack(pthread_t id) {
+	host_thread_t *thread;
+	int stack = 0;
+
+	pthread_mutex_lock(&threads_mtx);
+	if ((thread = thread_get(id))) {
+		stack = thread->stack;
+	}
+	pthread_mutex_unlock(&threads_mtx);
+
+	return stack;
+}
+
+int _pthread_stack_free(pthread_t id) {
+	return -1;
+}
+
+int _pthread_core(pthread_t id) {
+	return 0;
+}
+
+int _pthread_free(pthread_t id) {
+	return 0;
+}
+
+int _pthread_stop(pthread_t id) {
+	return pthread_cancel(id);
+}
+
+int _pthread_suspend(pthread_t id) {
+	return 0;
+}
+
+int _pthread_resume(pthread_t id) {
+	return 0;
+}
+
+const char *driver_get_err_msg_by_exception(int exception) {
+	return "error";
+}
+
+uint8_t uart_read(int8_t unit, char *c, uint32_t timeout) {
+	struct timespec deadline;
+	struct host_uart *u = &uart[unit];
+	int res = 0;
+
+	host_deadline(&deadline, timeout);
+
+	pthread_mutex_lock(&uart_mtx);
+
+	while (u->head == u->tail) {
+		if ((timeout == 0) ||
+			((timeout == portMAX_DELAY) ? pthread_cond_wait(&uart_cond, &uart_mtx) : pthread_cond_timedwait(&uart_cond, &uart_mtx, &deadline))) {
+			break;
+		}
+	}
+
+	if (u->head != u->tail) {
+		*c = u->data[u->tail++ % UART_RX];
+		res = 1;
+	}
+
+	pthread_mutex_unlock(&uart_mtx);
+
+	return res;
+}
+
+int uart_bytes_available(int8_t unit) {
+	int res;
+
+	pthread_mutex_lock(&uart_mtx);
+	res = uart[unit].head - uart[unit].tail;
+	pthread_mutex_unlock(&uart_mtx);
+
+	return res;
+}
+
+void uart_wait_rx(uint32_t timeout) {
+	struct timespec deadline;
+	int unit, ready = 0;
+
+	host_deadline(&deadline, timeout);
+
+	pthread_mutex_lock(&uart_mtx);
+
+	for(;;) {
+		for(unit = 0; unit < NUART; unit++) {
+			ready |= (uart[unit].head != uart[unit].tail);
+		}
+
+		if (ready || (timeout == 0) ||
+			((timeout == portMAX_DELAY) ? pthread_cond_wait(&uart_cond, &uart_mtx) : pthread_cond_timedwait(&uart_cond, &uart_mtx, &deadline))) {
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&uart_mtx);
+}
+
+int uart_is_setup(int unit) {
+	return ((unit >= 0) && (unit < NUART));
+}
+
+void rtos_host_uart_rx(int unit, const char *data, int len) {
+	struct host_uart *u = &uart[unit];
+
+	pthread_mutex_lock(&uart_mtx);
+
+	while ((len-- > 0) && (u->head - u->tail < UART_RX)) {
+		u->data[u->head++ % UART_RX] = *data++;
+	}
+
+	pthread_cond_broadcast(&uart_cond);
+	pthread_mutex_unlock(&uart_mtx);
+}
+
+int lwip_poll_sockets(struct vfs_pollfd *fds, int nfds, int timeout) {
+	fd_set rfds, wfds, efds;
+	struct timeval tv;
+	int i, res, maxfd = -1;
+	int ready = 0;
+
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	FD_ZERO(&efds);
+
+	for(i = 0; i < nfds; i++) {
+		if (!(fds[i].revents & VFS_POLLSOCKET)) {
+			continue;
+		}
+
+		if (fds[i].fd >= FD_SETSIZE) {
+			fds[i].revents = VFS_POLLERR;
+			ready++;
+			continue;
+		}
+
+		if (fds[i].events & VFS_POLLIN) {
+			FD_SET(fds[i].fd, &rfds);
+		}
+
+		if (fds[i].events & VFS_POLLOUT) {
+			FD_SET(fds[i].fd, &wfds);
+		}
+
+		FD_SET(fds[i].fd, &efds);
+
+		if (fds[i].fd > maxfd) {
+			maxfd = fds[i].fd;
+		}
+	}
+
+	if (maxfd < 0) {
+		return ready;
+	}
+
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	res = select(maxfd + 1, &rfds, &wfds, &efds, (timeout >= 0)?&tv:NULL);
+
+	for(i = 0; i < nfds; i++) {
+		if (!(fds[i].revents & VFS_POLLSOCKET) || (fds[i].fd >= FD_SETSIZE)) {
+			continue;
+		}
+
+		fds[i].revents = 0;
+
+		if (res < 0) {
+			fds[i].revents = VFS_POLLERR;
+		} else if (res > 0) {
+			if (FD_ISSET(fds[i].fd, &rfds)) {
+				fds[i].revents |= VFS_POLLIN;
+			}
+
+			if (FD_ISSET(fds[i].fd, &wfds)) {
+				fds[i].revents |= VFS_POLLOUT;
+			}
+
+			if (FD_ISSET(fds[i].fd, &efds)) {
+				fds[i].revents |= VFS_POLLERR;
+			}
+		}
+
+		if (fds[i].revents) {
+			ready++;
+		}
+	}
+
+	return ready;
+}
+
+void console_clear() {
+}
+
+void console_gotoxy(int col, int line) {
+}
+
+void console_hide_cursor() {
+}
+
+void console_show_cursor() {
+}
@@ -0,0 +1,44 @@
+/*
+ * Lua RTOS, host counterparts of the FreeRTOS and Lua RTOS primitives
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef RTOS_HOST_H
+#define	RTOS_HOST_H
+
+// Threads created, with the stack size requested by Lua RTOS
+extern unsigned int rtos_host_threads;
+
+// Stack bytes allocated for the threads created, and the max allocated at
+// the same time
+extern unsigned long rtos_host_stack;
+extern unsigned long rtos_host_stack_max;
+
+// Bytes received by a UART unit, for uart_read and vfs_poll
+void rtos_host_uart_rx(int unit, const char *data, int len);
+
+#endif	/* RTOS_HOST_H */
@@ -0,0 +1,291 @@
+/*
+ * Lua RTOS, Lua sched module, host test
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * Lua/modules/sched.c is included, so the scheduler of the thread is checked
+ * directly:
+ *
+ * - tasks blocked forever on an event or a channel, sleeping on a timer, or
+ *   not run yet, are freed by sched_release, and the Lua memory used by them
+ *   is collected
+ * - the scheduler of a pthread is freed by the pthread key destructor when
+ *   the pthread ends
+ * - sleeping tasks wake up on time while the wall clock is moved a day
+ *   forward and two days back, as sntp or an RTC set do (the test is ended
+ *   by an alarm if they sleep for the day)
+ *
+ * Then the yield and channel switches per second, the memory used by a task,
+ * and the preemptions of spinning tasks are reported.
+ *
+ */
+
+#include "Lua/modules/sched.c"
+
+#include "rtos_host.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+// Seconds the wall clock of the test is moved
+static time_t wall_offset = 0;
+
+int gettimeofday(struct timeval *restrict tv, void *restrict tz) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	tv->tv_sec = ts.tv_sec + wall_offset;
+	tv->tv_usec = ts.tv_nsec / 1000;
+
+	return 0;
+}
+
+// Leave tasks blocked in all the ways a task can be alive when its thread ends
+static const char *blocked =
+	"local n = ... "
+	"local ev, rx, tx = sched.event(), sched.channel(), sched.channel() "
+	"for i = 1, n do "
+	"  sched.spawn(function() ev:wait() end) "
+	"  sched.spawn(function() rx:receive() end) "
+	"  sched.spawn(function() tx:send(i) end) "
+	"end "
+	"assert(sched.run() == 3 * n) "
+	"for i = 1, n do sched.spawn(function() sched.sleep(3600) end) end "
+	"for i = 1, n do sched.spawn(function() end) end ";
+
+// Each task returns the time it slept, in seconds
+static const char *wall =
+	"local now, jump = ... "
+	"local slept = {} "
+	"for i = 1, 10 do "
+	"  sched.spawn(function() local t0 = now() sched.sleepms(100) slept[i] = now() - t0 end) "
+	"end "
+	"sched.spawn(function() sched.sleepms(20) jump(86400) sched.sleepms(20) jump(-2 * 86400) end) "
+	"assert(sched.run() == 0) "
+	"for i = 1, 10 do "
+	"  assert(slept[i] >= 0.09 and slept[i] < 0.5, 'task ' .. i .. ' slept ' .. slept[i] .. ' s') "
+	"end "
+	"return true";
+
+static const char *bench =
+	"local now, n, k, m = ... "
+	"collectgarbage() collectgarbage() "
+	"local m0 = collectgarbage('count') "
+	"local done = 0 "
+	"for i = 1, n do sched.spawn(function() for j = 1, k do sched.yield() end done = done + 1 end) end "
+	"collectgarbage() collectgarbage() "
+	"local m1 = collectgarbage('count') "
+	"local t0 = now() "
+	"sched.run() "
+	"local yield = n * k / (now() - t0) "
+	"assert(done == n) "
+	"local a, b = sched.channel(), sched.channel() "
+	"sched.spawn(function() for i = 1, m do a:send(i) b:receive() end end) "
+	"sched.spawn(function() for i = 1, m do a:receive() b:send(i) end end) "
+	"t0 = now() "
+	"sched.run() "
+	"local channel = 2 * m / (now() - t0) "
+	"local stop = false "
+	"for i = 1, 100 do sched.spawn(function() while not stop do end end) end "
+	"sched.spawn(function() sched.sleepms(200) stop = true end) "
+	"local p0 = sched.stats().preemptions "
+	"t0 = now() "
+	"sched.run() "
+	"local preempt = (sched.stats().preemptions - p0) / (now() - t0) "
+	"return yield, channel, (m1 - m0) * 1024 / n, preempt";
+
+// Seconds since the first call, as lua_Number is a float
+static int now(lua_State *L) {
+	static double base = 0;
+	struct timespec ts;
+	double t;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	t = ts.tv_sec + ts.tv_nsec / 1e9;
+	if (!base) {
+		base = t;
+	}
+
+	lua_pushnumber(L, t - base);
+
+	return 1;
+}
+
+static int jump(lua_State *L) {
+	wall_offset += luaL_checkinteger(L, 1);
+
+	return 0;
+}
+
+static size_t heap() {
+	return mallinfo2().uordblks;
+}
+
+static size_t lua_heap(lua_State *L) {
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	lua_gc(L, LUA_GCCOLLECT, 0);
+
+	return (size_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+// Run the blocked script, and leave the tasks in the scheduler of the thread.
+// The sleeping tasks are resumed once here, as sched.run would wait for them.
+static int run_blocked(lua_State *L, int n) {
+	sched_task_t *t;
+	sched_t *s;
+	int i;
+
+	luaL_loadstring(L, blocked);
+	lua_pushinteger(L, n);
+	if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+		printf("FAIL: %s\n", lua_tostring(L, -1));
+		lua_pop(L, 1);
+
+		return 0;
+	}
+
+	s = sched_get(0);
+	for(i = 0; i < n; i++) {
+		t = TAILQ_FIRST(&s->ready);
+		TAILQ_REMOVE(&s->ready, t, link);
+
+		sched_resume(L, s, t);
+	}
+
+	if ((s->tasks != 5 * n) || (s->ntimers != n)) {
+		printf("FAIL: %d tasks alive and %d timers, expected %d and %d\n", s->tasks, s->ntimers, 5 * n, n);
+
+		return 0;
+	}
+
+	return 1;
+}
+
+static void *blocked_thread(void *arg) {
+	lua_State *L = (lua_State *)arg;
+
+	return (void *)(intptr_t)run_blocked(L, 100);
+}
+
+// Check that the memory is back to the base, with a few bytes of slack for
+// the registry free list, and the strings interned by the first run
+static int check_freed(const char *what, size_t base, size_t now, size_t slack) {
+	if (now > base + slack) {
+		printf("FAIL: %s, %lu bytes not freed\n", what, (unsigned long)(now - base));
+
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	size_t heap0, lua0;
+	pthread_t thread;
+	void *ok;
+	int failed = 0;
+
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+
+	// Warm up, so the strings and the registry are grown before the base
+	run_blocked(L, 100);
+	sched_release();
+
+	heap0 = heap();
+	lua0 = lua_heap(L);
+
+	if (!run_blocked(L, 100)) {
+		return 1;
+	}
+
+	sched_release();
+
+	if (sched_get(0)) {
+		printf("FAIL: the scheduler is not released\n");
+		failed = 1;
+	}
+
+	failed |= check_freed("sched_release, Lua heap", lua0, lua_heap(L), 256);
+	failed |= check_freed("sched_release, C heap", heap0, heap(), 256);
+
+	// The same from a pthread, that ends with the tasks alive
+	pthread_create(&thread, NULL, blocked_thread, L);
+	pthread_join(thread, &ok);
+	if (!ok) {
+		return 1;
+	}
+
+	failed |= check_freed("pthread exit, Lua heap", lua0, lua_heap(L), 256);
+	failed |= check_freed("pthread exit, C heap", heap0, heap(), 256);
+
+	// Sleeps while the wall clock is moved
+	alarm(10);
+
+	luaL_loadstring(L, wall);
+	lua_pushcfunction(L, now);
+	lua_pushcfunction(L, jump);
+	if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+		printf("FAIL: %s\n", lua_isstring(L, -1) ? lua_tostring(L, -1) : "assertion failed");
+		failed = 1;
+	}
+
+	lua_pop(L, 1);
+	alarm(0);
+
+	// Benchmark
+	luaL_loadstring(L, bench);
+	lua_pushcfunction(L, now);
+	lua_pushinteger(L, 1000);
+	lua_pushinteger(L, 1000);
+	lua_pushinteger(L, 200000);
+	if (lua_pcall(L, 4, 4, 0) != LUA_OK) {
+		printf("FAIL: %s\n", lua_tostring(L, -1));
+		return 1;
+	}
+
+	printf("yield: %.0f switches/s with 1000 tasks\n", lua_tonumber(L, -4));
+	printf("channel ping-pong: %.0f switches/s\n", lua_tonumber(L, -3));
+	printf("task: %.0f bytes of Lua heap, and %lu bytes of task\n", lua_tonumber(L, -2), (unsigned long)sizeof(sched_task_t));
+	printf("preemption: %.0f/s with 100 spinning tasks\n", lua_tonumber(L, -1));
+
+	return failed;
+}
@@ -0,0 +1,351 @@
+/*
+ * Lua RTOS, host test for signals processed at VM safe points
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * pthread/pthread.c is included, and signals take the path that they take
+ * on the target: a handler is set with _pthread_signal by the Lua thread
+ * (thread 1, the only thread that receives signals), the signal is posted
+ * with _pthread_queue_signal from an asynchronous context (a host SIGALRM,
+ * as the UART interrupt does on the target), and the VM calls
+ * _pthread_process_signal at the next safe point (a call or a backward
+ * jump), that runs the handler. The Lua RTOS pthread types have the names
+ * of the host ones, so they are renamed.
+ *
+ * For busy scripts, the handler raises an error, as laction does in lua.c,
+ * and the time from posting the signal to running the handler is measured.
+ * Then it's checked that the Lua state of the task is restored after the
+ * handlers run, and that signals left by a handler that raised an error
+ * are processed at the next safe point.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define pthread_t rtos_pthread_t
+#define pthread_key_t rtos_pthread_key_t
+#define pthread_attr_t rtos_pthread_attr_t
+#define pthread_mutex_t rtos_pthread_mutex_t
+#define pthread_mutexattr_t rtos_pthread_mutexattr_t
+#define pthread_cond_t rtos_pthread_cond_t
+#define pthread_condattr_t rtos_pthread_condattr_t
+#define pthread_once_t rtos_pthread_once_t
+#define pthread_self rtos_pthread_self
+
+#undef PTHREAD_STACK_MIN
+#undef PTHREAD_DESTRUCTOR_ITERATIONS
+
+#include "pthread/pthread.c"
+#include "pthread/self.c"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+#define RUNS 20
+
+// Maximum accepted latency, in microseconds
+#define MAX_LATENCY 10000
+
+// Lua RTOS specific TCB parts of the Lua thread, the only task
+static lua_rtos_tcb_t tcb;
+static struct pthread lua_thread;
+
+static volatile int posts[PTHREAD_NSIG];
+static volatile int handled[PTHREAD_NSIG];
+static struct timespec posted_at, handled_at;
+
+void mtx_init(struct mtx *mutex, const char *name, const char *type, int opts) {
+}
+
+void mtx_lock(struct mtx *mutex) {
+}
+
+void mtx_unlock(struct mtx *mutex) {
+}
+
+void mtx_destroy(struct mtx *mutex) {
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+	return (TaskHandle_t)&tcb;
+}
+
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index) {
+	return task ? task : &tcb;
+}
+
+// Threads are not created by this test
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *task) {
+	return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *task, BaseType_t core) {
+	return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+	abort();
+}
+
+void vTaskSuspend(TaskHandle_t task) {
+}
+
+void vTaskResume(TaskHandle_t task) {
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+	return 0;
+}
+
+void vTaskSetThreadLocalStoragePointerAndDelCallback(TaskHandle_t task, BaseType_t index, void *value, TlsDeleteCallbackFunction_t callback) {
+}
+
+BaseType_t xPortGetCoreID(void) {
+	return 0;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t size) {
+	return NULL;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) {
+	return pdFALSE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) {
+	return pdFALSE;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+}
+
+void _pthread_mutex_free() {
+}
+
+void _pthread_key_exit() {
+}
+
+// Post the signals in posts, as an interrupt does
+static void alarm_handler(int sig) {
+	int s;
+
+	clock_gettime(CLOCK_MONOTONIC, &posted_at);
+
+	for(s = 0; s < PTHREAD_NSIG; s++) {
+		while (posts[s] > 0) {
+			posts[s]--;
+			_pthread_queue_signal(s);
+		}
+	}
+}
+
+static void post(int s, int us) {
+	struct itimerval it = {{0, 0}, {0, us}};
+
+	posts[s]++;
+	setitimer(ITIMER_REAL, &it, NULL);
+}
+
+// As laction in lua.c
+static void laction(int s) {
+	clock_gettime(CLOCK_MONOTONIC, &handled_at);
+
+	_pthread_signal(s, SIG_DFL);
+
+	luaL_error(pvGetLuaState(), "interrupted!");
+}
+
+static void count(int s) {
+	handled[s]++;
+}
+
+static int handled_count(lua_State *L) {
+	lua_pushinteger(L, handled[luaL_checkinteger(L, 1)]);
+	return 1;
+}
+
+static long elapsed_us(struct timespec *a, struct timespec *b) {
+	return (b->tv_sec - a->tv_sec) * 1000000L + (b->tv_nsec - a->tv_nsec) / 1000L;
+}
+
+static const char *scripts[] = {
+	"while true do end",
+	"local i = 0 while true do i = i + 1 end",
+	"for i = 1, math.maxinteger do end",
+	"local function f() end while true do f() end",
+	"repeat local t = {} until false",
+	"local i = 0 repeat i = i + 1 until i < 0",
+	"local co = coroutine.wrap(function() while true do end end) co()",
+	NULL
+};
+
+static int check(int ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+	}
+
+	return !ok;
+}
+
+static lua_State *new_state() {
+	lua_State *L = luaL_newstate();
+
+	luaL_openlibs(L);
+	lua_register(L, "handled", handled_count);
+
+	// The Lua state of the task, as set by the thread module
+	uxSetLuaState(L);
+
+	return L;
+}
+
+// Run a script, that returns true if the signals were handled
+static int run(lua_State *L, const char *script, const char *what) {
+	int ok = (luaL_dostring(L, script) == LUA_OK) && lua_toboolean(L, -1);
+
+	if (!ok) {
+		printf("FAIL: %s (%s)\n", what, lua_tostring(L, -1));
+	}
+
+	return !ok;
+}
+
+static int check_delivery() {
+	lua_State *L;
+	int failed = 0;
+
+	memset((void *)handled, 0, sizeof(handled));
+
+	// A handler that doesn't raise an error, the script continues
+	L = new_state();
+	_pthread_signal(SIGHUP, count);
+	post(SIGHUP, 20000);
+	failed |= run(L, "while handled(1) == 0 do end return true", "handler without error");
+	failed |= check(pvGetLuaState() == L, "Lua state of the task restored");
+
+	// In a coroutine, the error is raised in the coroutine, and the Lua state
+	// of the task is restored after
+	_pthread_signal(SIGINT, laction);
+	post(SIGINT, 20000);
+	failed |= run(L,
+		"local co = coroutine.create(function() while true do end end)\n"
+		"local ok, err = coroutine.resume(co)\n"
+		"return not ok and string.find(err, 'interrupted!', 1, true) ~= nil and coroutine.status(co) == 'dead'",
+		"error raised in the coroutine");
+	failed |= check(pvGetLuaState() == L, "Lua state of the task restored after an error");
+
+	// A signal left by a handler that raised an error is processed later
+	_pthread_signal(SIGHUP, laction);
+	_pthread_signal(SIGINT, count);
+	post(SIGHUP, 20000);
+	posts[SIGINT]++;
+	failed |= check(luaL_dostring(L, "while true do end") != LUA_OK, "first handler raised an error");
+	failed |= run(L, "for i = 1, 10000000 do if handled(2) > 0 then return true end end return false",
+		"signal left by a handler that raised an error");
+
+	// A signal without handler is not posted
+	_pthread_signal(SIGINT, SIG_DFL);
+	_pthread_queue_signal(SIGINT);
+	failed |= check(_pthread_signal_pending == 0, "signal without handler not posted");
+
+	lua_close(L);
+
+	return failed;
+}
+
+int main(int argc, char **argv) {
+	struct sigaction sa;
+	long lat, max, total;
+	const char **script;
+	lua_State *L;
+	int i, id, failed = 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = alarm_handler;
+	sigaction(SIGALRM, &sa, NULL);
+
+	// The Lua thread, as set by pthreadTask
+	_pthread_init();
+	list_add(&thread_list, &lua_thread, &id);
+	lua_thread.thread = id;
+	lua_thread.task = (TaskHandle_t)&tcb;
+	uxSetThreadId(id);
+
+	if (check_delivery()) {
+		return 1;
+	}
+
+	for(script = scripts; *script; script++) {
+		max = 0;
+		total = 0;
+
+		for(i = 0; i < RUNS; i++) {
+			L = new_state();
+
+			_pthread_signal(SIGINT, laction);
+			post(SIGINT, 20000);
+
+			if ((luaL_dostring(L, *script) == LUA_OK) || !strstr(lua_tostring(L, -1), "interrupted!")) {
+				printf("FAIL: '%s' was not interrupted\n", *script);
+				return 1;
+			}
+
+			if (pvGetLuaState() != L) {
+				printf("FAIL: '%s' Lua state of the task not restored\n", *script);
+				return 1;
+			}
+
+			lua_close(L);
+
+			lat = elapsed_us(&posted_at, &handled_at);
+			total += lat;
+			if (lat > max) {
+				max = lat;
+			}
+		}
+
+		printf("%-66s avg %4ld us, max %4ld us\n", *script, total / RUNS, max);
+
+		if (max > MAX_LATENCY) {
+			failed = 1;
+		}
+	}
+
+	if (failed) {
+		printf("FAIL: latency greater than %d us\n", MAX_LATENCY);
+	}
+
+	return failed;
+}
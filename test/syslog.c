@@ -0,0 +1,443 @@
+/*
+ * Lua RTOS, host test and benchmark of syslog
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * unix/syslog.c is included, with the file and console functions replaced,
+ * so the log file is a host file in LOG_DIR, and every line written to the
+ * log file or to the console is checked by the test. The flusher is a host
+ * thread (see rtos_host.c).
+ *
+ * First, before openlog, messages are only kept in the ring, and read back
+ * with syslog_dmesg, to check that each format is captured and formatted
+ * as snprintf does, and that only the last SYSLOG_RING_SLOTS are kept.
+ *
+ * Then WRITERS threads log MESSAGES each, with a string argument that is
+ * changed after each call, while the flusher writes them. Each line must be
+ * whole, the messages of a writer must keep their order, and the messages
+ * written plus the messages reported as dropped must be the messages sent.
+ * First the writers wait for the flusher after each BURST messages, so no
+ * message can be dropped, and then they log as fast as they can. The log
+ * file is small, so it's rotated many times.
+ *
+ * Last, the cost of a syslog call is measured, in bursts that fit in the
+ * ring, and compared with formatting and writing each message to a file
+ * in the call, as syslog did before the ring.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define LOG_DIR "build/syslog-log"
+
+#define WRITERS     4
+#define MESSAGES    5000
+#define BURST       8
+#define BENCH_BURST 32
+#define BURSTS      300
+
+static FILE *log_fopen(const char *name, const char *mode);
+static int log_rename(const char *from, const char *to);
+static int log_unlink(const char *name);
+static size_t log_fwrite(const void *ptr, size_t size, size_t n, FILE *fp);
+static ssize_t log_write(int fd, const void *buf, size_t n);
+
+// The console of newlib
+static struct {
+	FILE *_stdout;
+} host_reent;
+
+#define _GLOBAL_REENT (&host_reent)
+
+// Messages are written to 2 Kb files, so the file is rotated many times
+#define SYSLOG_MAX_FILE 2048
+
+#define fopen log_fopen
+#define rename log_rename
+#define unlink log_unlink
+#define fwrite log_fwrite
+#define write log_write
+#include "unix/syslog.c"
+#undef fopen
+#undef rename
+#undef unlink
+#undef fwrite
+#undef write
+
+static int failed = 0;
+
+static int file_lines = 0;      // Lines written to the log file
+static int console_lines = 0;   // Lines written to the console
+static int dropped_lines = 0;   // Messages reported as dropped
+static int received[WRITERS];   // Messages of each writer written
+static int last[WRITERS];       // Last message of each writer written
+
+static void check(int ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failed = 1;
+	}
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Only the log file of the FAT file system is used
+int mount_is_mounted(const char *device) {
+	return (strcmp(device, "fat") == 0);
+}
+
+// Host path of a log file path
+static const char *log_path(const char *name, char *buf, size_t size) {
+	if (strncmp(name, "/log/", 5) == 0) {
+		snprintf(buf, size, "%s/%s", LOG_DIR, name + 5);
+		return buf;
+	}
+
+	return name;
+}
+
+static FILE *log_fopen(const char *name, const char *mode) {
+	char path[64];
+
+	return fopen(log_path(name, path, sizeof(path)), mode);
+}
+
+static int log_rename(const char *from, const char *to) {
+	char pfrom[64], pto[64];
+
+	return rename(log_path(from, pfrom, sizeof(pfrom)), log_path(to, pto, sizeof(pto)));
+}
+
+static int log_unlink(const char *name) {
+	char path[64];
+
+	return unlink(log_path(name, path, sizeof(path)));
+}
+
+// Check a line written to the log file
+static void check_line(const char *line, int len) {
+	char text[MAX_BUFF + 1];
+	char payload[32];
+	unsigned n;
+	int w, m;
+
+	check((len > 0) && (len <= MAX_BUFF), "line length");
+	if ((len <= 0) || (len > MAX_BUFF)) return;
+
+	memcpy(text, line, len);
+	text[len] = '\0';
+
+	if (sscanf(text, "writer %d message %d payload-%31s", &w, &m, payload) == 3) {
+		char expected[32];
+
+		snprintf(expected, sizeof(expected), "%d-%d", w, m);
+		check((w >= 0) && (w < WRITERS), "writer of a message");
+		if ((w < 0) || (w >= WRITERS)) return;
+
+		check(strcmp(payload, expected) == 0, "string argument of a message");
+		check(m > last[w], "order of the messages of a writer");
+		last[w] = m;
+		received[w]++;
+	} else if (sscanf(text, "syslog: %u messages dropped", &n) == 1) {
+		dropped_lines += n;
+	} else if (strncmp(text, "bench ", 6) != 0) {
+		printf("FAIL: line \"%s\"\n", text);
+		failed = 1;
+	}
+}
+
+// Lines written by the flusher are whole, and end with \n
+static size_t log_fwrite(const void *ptr, size_t size, size_t n, FILE *fp) {
+	const char *line = (const char *)ptr;
+	int len = size * n;
+
+	check((len > 0) && (line[len - 1] == '\n'), "line written to the log file");
+	check(memchr(line, '\n', len - 1) == NULL, "a line per write to the log file");
+	check_line(line, len - 1);
+	file_lines++;
+
+	return fwrite(ptr, size, n, fp);
+}
+
+// Lines written to the console end with \r\n
+static ssize_t log_write(int fd, const void *buf, size_t n) {
+	const char *line = (const char *)buf;
+
+	check((n >= 2) && (line[n - 2] == '\r') && (line[n - 1] == '\n'), "line written to the console");
+	console_lines++;
+
+	return n;
+}
+
+// Log a message, and check that dmesg formats it as snprintf
+static uint32_t dmesg_seq = 0;
+
+#define check_format(fmt, ...) \
+	do { \
+		char expected[MAX_BUFF], buf[MAX_BUFF + 20]; \
+		int len; \
+		syslog(LOG_INFO, fmt, __VA_ARGS__); \
+		snprintf(expected, sizeof(expected), fmt, __VA_ARGS__); \
+		len = syslog_dmesg(&dmesg_seq, buf, sizeof(buf)); \
+		check((len > 0) && (strchr(buf, ']') != NULL), "dmesg of " fmt); \
+		if ((len > 0) && strchr(buf, ']')) { \
+			if (strcmp(strchr(buf, ']') + 2, expected) != 0) { \
+				printf("FAIL: format \"%s\", got \"%s\", expected \"%s\"\n", fmt, strchr(buf, ']') + 2, expected); \
+				failed = 1; \
+			} \
+		} \
+	} while (0)
+
+static void test_formats() {
+	char long1[61], long2[61], expected[MAX_BUFF], buf[MAX_BUFF + 20];
+	uint32_t seq;
+	int i, n;
+
+	check_format("int %d unsigned %u hex %x char %c", -5, 7u, 255, 'z');
+	check_format("short %hd char %hhu", (short)-300, (unsigned char)200);
+	check_format("long %ld long long %lld %llx", -123456L, 1234567890123LL, 0xfedcba9876543LL);
+	check_format("size %zu", (size_t)4096);
+	check_format("float %5.2f %e %g %Lf", 3.14159, 1e-10, 2.5, (long double)1.5);
+	check_format("string %s and %.3s and %-6s|", "hello", "abcdef", "ab");
+	check_format("star %*d|%.*s|%-*d|", 6, 42, 2, "xyz", 4, 1);
+	check_format("negative precision %.*s|", -1, "whole");
+	check_format("pointer %p", (void *)0x1234);
+	check_format("null %s", (char *)NULL);
+	check_format("percent %d%% done", 100);
+
+	// End of line is removed
+	syslog(LOG_INFO, "trailing newline\r\n");
+	n = syslog_dmesg(&dmesg_seq, buf, sizeof(buf));
+	check((n > 0) && (strcmp(strchr(buf, ']') + 2, "trailing newline") == 0), "end of line removed");
+
+	// Arguments that don't fit are truncated
+	memset(long1, 'a', 60);
+	long1[60] = '\0';
+	memset(long2, 'b', 60);
+	long2[60] = '\0';
+
+	syslog(LOG_INFO, "%s %s", long1, long2);
+	snprintf(expected, sizeof(expected), "%s %.*s ...", long1, SYSLOG_RECORD_ARGS - 61 - 1, long2);
+	n = syslog_dmesg(&dmesg_seq, buf, sizeof(buf));
+	check((n > 0) && (strcmp(strchr(buf, ']') + 2, expected) == 0), "truncated arguments");
+
+	// Messages over the mask are not logged
+	setlogmask(LOG_UPTO(LOG_NOTICE));
+	syslog(LOG_DEBUG, "masked");
+	check(syslog_dmesg(&dmesg_seq, buf, sizeof(buf)) == -1, "masked message");
+	setlogmask(0xff);
+
+	// Only the last SYSLOG_RING_SLOTS messages are kept
+	for(i = 0; i < 3 * SYSLOG_RING_SLOTS; i++) {
+		syslog(LOG_INFO, "kept %d", i);
+	}
+
+	seq = 0;
+	for(i = 2 * SYSLOG_RING_SLOTS; i < 3 * SYSLOG_RING_SLOTS; i++) {
+		snprintf(expected, sizeof(expected), "kept %d", i);
+		n = syslog_dmesg(&seq, buf, sizeof(buf));
+		check((n > 0) && (strcmp(strchr(buf, ']') + 2, expected) == 0), "messages kept for dmesg");
+	}
+	check(syslog_dmesg(&seq, buf, sizeof(buf)) == -1, "last message of dmesg");
+}
+
+static void *writer(void *arg) {
+	int w = (int)(intptr_t)arg & 0xff;
+	int paced = (int)(intptr_t)arg >> 8;
+	char payload[32];
+	uint32_t head;
+	int i;
+
+	for(i = 0; i < MESSAGES; i++) {
+		snprintf(payload, sizeof(payload), "payload-%d-%d", w, i);
+		syslog(LOG_INFO, "writer %d message %d %s", w, i, payload);
+
+		// The argument is copied, it can be changed once syslog returns
+		memset(payload, 'x', sizeof(payload) - 1);
+
+		if (paced && ((i % BURST) == BURST - 1)) {
+			// Wait until the burst is flushed, so the ring is never full
+			head = ring_head;
+			while ((int32_t)(ring_flushed - head) < 0) {
+				usleep(50);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+// Run the writers, and flush the messages not written yet
+static int writers(int paced, const char *what) {
+	pthread_t threads[WRITERS];
+	char msg[80];
+	int total = 0;
+	int i;
+
+	dropped_lines = 0;
+	for(i = 0; i < WRITERS; i++) {
+		received[i] = 0;
+		last[i] = -1;
+		pthread_create(&threads[i], NULL, writer, (void *)(intptr_t)(i | (paced << 8)));
+	}
+
+	for(i = 0; i < WRITERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	syslog_flush();
+
+	for(i = 0; i < WRITERS; i++) {
+		total += received[i];
+	}
+
+	snprintf(msg, sizeof(msg), "%s: messages written or reported as dropped", what);
+	check(total + dropped_lines == WRITERS * MESSAGES, msg);
+
+	printf("%s, %d writers, %d messages: %d written, %d dropped (ring of %d)\n",
+		what, WRITERS, WRITERS * MESSAGES, total, dropped_lines, SYSLOG_RING_SLOTS);
+
+	return total;
+}
+
+static void test_writers() {
+	struct stat st;
+
+	openlog("test", LOG_CONS, LOG_USER);
+	check(flusher != NULL, "flusher started");
+	check(connected, "log file opened");
+
+	// With at most WRITERS * BURST messages pending, no message is dropped
+	check(writers(1, "paced") == WRITERS * MESSAGES, "paced: all the messages written");
+
+	// As fast as possible, the ring gets full
+	writers(0, "flood");
+
+	closelog();
+
+	check(console_lines == file_lines, "same lines on the console and on the log file");
+
+	check(stat(LOG_DIR "/messages.log.1", &st) == 0, "log file rotated");
+	check(st.st_size >= SYSLOG_MAX_FILE, "size of the rotated log file");
+	check(stat(LOG_DIR "/messages.log", &st) == 0, "log file");
+	check(st.st_size < SYSLOG_MAX_FILE, "size of the log file");
+}
+
+// Format and write a message in the call
+static void sync_syslog(FILE *fp, const char *fmt, ...) {
+	char buf[MAX_BUFF];
+	va_list ap;
+	int cnt;
+
+	va_start(ap, fmt);
+	cnt = vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+	va_end(ap);
+
+	buf[cnt] = '\n';
+	fwrite(buf, cnt + 1, 1, fp);
+	fflush(fp);
+}
+
+static void bench() {
+	double t, ring_time = 0, sync_time = 0;
+	int lines = file_lines;
+	int dropped = dropped_lines;
+	FILE *fp;
+	int i, j;
+
+	openlog("test", 0, LOG_USER);
+
+	for(i = 0; i < BURSTS; i++) {
+		t = now();
+		for(j = 0; j < BENCH_BURST; j++) {
+			syslog(LOG_INFO, "bench %d message %d %s %f", i, j, "payload", 1.5);
+		}
+		ring_time += now() - t;
+
+		// Wait for the flusher
+		while (ring_flushed != ring_head) {
+			usleep(100);
+		}
+	}
+
+	closelog();
+
+	check(file_lines - lines == BURSTS * BENCH_BURST, "messages of the bench written");
+	check(dropped_lines == dropped, "messages of the bench dropped");
+
+	fp = fopen(LOG_DIR "/sync.log", "w");
+	check(fp != NULL, "synchronous log file");
+	if (!fp) return;
+
+	for(i = 0; i < BURSTS; i++) {
+		t = now();
+		for(j = 0; j < BENCH_BURST; j++) {
+			sync_syslog(fp, "bench %d message %d %s %f", i, j, "payload", 1.5);
+		}
+		sync_time += now() - t;
+	}
+
+	fclose(fp);
+
+	printf("syslog call: %.3f us into the ring, %.3f us formatted and written in the call\n",
+		ring_time * 1e6 / (BURSTS * BENCH_BURST), sync_time * 1e6 / (BURSTS * BENCH_BURST));
+}
+
+int main() {
+	host_reent._stdout = stdout;
+
+	mkdir(LOG_DIR, 0755);
+	unlink(LOG_DIR "/messages.log");
+	unlink(LOG_DIR "/messages.log.1");
+
+	test_formats();
+	test_writers();
+
+	if (failed) {
+		return 1;
+	}
+
+	bench();
+
+	return failed;
+}
@@ -0,0 +1,422 @@
+/*
+ * Lua RTOS, host test and benchmark of table preallocation and reuse
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * First, table.create, table.clear, lua_setarray and lua_cleartable are
+ * checked: contents, metatables, the hash part after a clear, collection of
+ * cleared values, and the bytes allocated while filling a preallocated or
+ * cleared table, that must be none. All run with an allocator that counts
+ * the bytes and the number of allocations.
+ *
+ * Then tables of samples are filled from Lua (a new table, a preallocated
+ * one, or a cleared one) and from C (lua_rawseti, lua_setarray, or
+ * lua_cleartable and lua_setarray). The best time of a few runs, and the
+ * bytes allocated per sample, are reported.
+ *
+ */
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLES 100000
+#define RUNS    5
+
+// Max number of elements of setarray
+#define MAX_ELEMENTS 4096
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+static size_t allocated = 0;
+static size_t allocs = 0;
+
+// Allocator that counts the bytes allocated, and the allocations
+static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	if (nsize > (ptr ? osize : 0)) {
+		allocated += nsize - (ptr ? osize : 0);
+		allocs++;
+	}
+
+	return realloc(ptr, nsize);
+}
+
+static int lallocated(lua_State *L) {
+	lua_pushinteger(L, (lua_Integer)allocated);
+	lua_pushinteger(L, (lua_Integer)allocs);
+
+	return 2;
+}
+
+// setarray(t, first, type, n [, base]), stores base, base + 1, ... into
+// t[first], t[first + 1], ... with lua_setarray, as bytes (truncated),
+// integers, or numbers (halved). Returns t.
+static int lsetarray(lua_State *L) {
+	static const char *const types[] = {"byte", "integer", "number", NULL};
+	static unsigned char bytes[MAX_ELEMENTS];
+	static lua_Integer integers[MAX_ELEMENTS];
+	static lua_Number numbers[MAX_ELEMENTS];
+	static const void *const arrays[] = {bytes, integers, numbers};
+	static const int kinds[] = {LUA_ARRAY_BYTE, LUA_ARRAY_INTEGER, LUA_ARRAY_NUMBER};
+	lua_Integer first = luaL_checkinteger(L, 2);
+	int type = luaL_checkoption(L, 3, NULL, types);
+	lua_Integer n = luaL_checkinteger(L, 4);
+	lua_Integer base = luaL_optinteger(L, 5, 0);
+	int i;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_argcheck(L, (n >= 0) && (n <= MAX_ELEMENTS), 4, "out of range");
+
+	for(i = 0; i < n; i++) {
+		bytes[i] = (unsigned char)(base + i);
+		integers[i] = base + i;
+		numbers[i] = (lua_Number)(base + i) / 2;
+	}
+
+	lua_setarray(L, 1, first, arrays[type], (int)n, kinds[type]);
+	lua_settop(L, 1);
+
+	return 1;
+}
+
+// rawseti(t, first, n [, base]), the same as setarray(t, first, 'byte', n,
+// base), with lua_rawseti. Returns t.
+static int lrawseti(lua_State *L) {
+	lua_Integer first = luaL_checkinteger(L, 2);
+	lua_Integer n = luaL_checkinteger(L, 3);
+	lua_Integer base = luaL_optinteger(L, 4, 0);
+	int i;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	for(i = 0; i < n; i++) {
+		lua_pushinteger(L, (unsigned char)(base + i));
+		lua_rawseti(L, 1, first + i);
+	}
+
+	lua_settop(L, 1);
+
+	return 1;
+}
+
+// cleartable(t), lua_cleartable. Returns t.
+static int lcleartable(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_cleartable(L, 1);
+	lua_settop(L, 1);
+
+	return 1;
+}
+
+#define PRELUDE \
+	"local function fails(msg, f, ...) " \
+	"  local ok, err = pcall(f, ...) " \
+	"  if ok or not string.find(err, msg, 1, true) then error(tostring(err)) end " \
+	"  return true " \
+	"end " \
+	"local function count(t) local n = 0 for _ in pairs(t) do n = n + 1 end return n end "
+
+// Each script returns true on success
+static const char *checks[] = {
+	"local keys = {} for i = 1, 8 do keys[i] = 'k' .. i end "
+	"local t = table.create(100, 8) "
+	"if next(t) ~= nil or #t ~= 0 then return false end "
+	"local a, c = allocated() "
+	"for i = 1, 100 do t[i] = i end "
+	"for i = 1, 8 do t[keys[i]] = i end "
+	"local a1, c1 = allocated() "
+	"if a1 ~= a or c1 ~= c or #t ~= 100 or count(t) ~= 108 then return false end "
+	"local u = {} "
+	"for i = 1, 100 do u[i] = i end "
+	"for i = 1, 8 do u[keys[i]] = i end "
+	"local a2, c2 = allocated() "
+	"return c2 - c1 > 8 and a2 > a1 and "
+	"  count(table.create(0)) == 0 and count(table.create(0, 0)) == 0 and "
+	"  fails('out of range', table.create, -1) and "
+	"  fails('out of range', table.create, 1, -1) and "
+	"  fails('number has no integer representation', table.create, 1.5) and "
+	"  fails('number expected', table.create)",
+
+	// table.clear removes all fields, keeps the metatable, and the table can
+	// be refilled with no allocations
+	"local mt = {__index = function(t, k) return 'default' end} "
+	"local keys = {'x', 'y', 'z'} "
+	"local function fill(t, s) "
+	"  for i = 1, 16 do t[i] = s + i end "
+	"  for i, k in ipairs(keys) do t[k] = s * i end "
+	"end "
+	"local t = setmetatable(table.create(16, 3), mt) "
+	"fill(t, 1) "
+	"if table.clear(t) ~= t or next(t) ~= nil or rawlen(t) ~= 0 then return false end "
+	"if getmetatable(t) ~= mt or t.x ~= 'default' or t[1] ~= 'default' then return false end "
+	"local a, c = allocated() "
+	"for s = 1, 100 do table.clear(t) fill(t, s) end "
+	"local a1, c1 = allocated() "
+	"if a1 ~= a or c1 ~= c then return false end "
+	"for i = 1, 16 do if rawget(t, i) ~= 100 + i then return false end end "
+	"return t.x == 100 and t.z == 300 and count(t) == 19 and #t == 16 and "
+	"  next(table.clear({})) == nil and "
+	"  fails('table expected', table.clear, 'x') and fails('table expected', table.clear)",
+
+	// The hash part of a cleared table takes other keys, is refilled with
+	// the same keys with no allocations, and grows
+	"local t = {} "
+	"for i = 1, 1000 do t['a' .. i] = i end "
+	"for r = 1, 5 do "
+	"  table.clear(t) "
+	"  for i = 1000, 1, -1 do t['b' .. r .. '_' .. i] = i end "
+	"  t[true] = r t[0.5] = r t[-r] = r "
+	"  if count(t) ~= 1003 or t.a1 ~= nil or t[true] ~= r or t[0.5] ~= r or t[-r] ~= r then return false end "
+	"  for i = 1, 1000 do if t['b' .. r .. '_' .. i] ~= i then return false end end "
+	"end "
+	"local keys = {} for i = 1, 1000 do keys[i] = 'c' .. i end "
+	"table.clear(t) "
+	"for i = 1, 1000 do t[keys[i]] = i end "
+	"local a, c = allocated() "
+	"for r = 1, 3 do "
+	"  table.clear(t) "
+	"  for i = 1000, 1, -1 do t[keys[i]] = i end "
+	"end "
+	"local a1, c1 = allocated() "
+	"if a1 ~= a or c1 ~= c or count(t) ~= 1000 or t.c1 ~= 1 or t.c1000 ~= 1000 then return false end "
+	"table.clear(t) "
+	"for i = 1, 5000 do t[i * 2.5] = i end "
+	"for i = 1, 5000 do if t[i * 2.5] ~= i then return false end end "
+	"return count(t) == 5000",
+
+	// Cleared values can be collected
+	"local weak = setmetatable({}, {__mode = 'k'}) "
+	"local t = {} "
+	"for i = 1, 10 do local o = {} weak[o] = true t[i] = o t['k' .. i] = o end "
+	"collectgarbage() "
+	"if count(weak) ~= 10 then return false end "
+	"table.clear(t) "
+	"collectgarbage() collectgarbage() "
+	"return next(weak) == nil",
+
+	// lua_setarray of each element type
+	"local t = setarray({}, 1, 'byte', 300, 250) "
+	"if #t ~= 300 or t[1] ~= 250 or t[6] ~= 255 or t[7] ~= 0 or t[300] ~= 37 then return false end "
+	"for i = 1, 300 do if math.type(t[i]) ~= 'integer' then return false end end "
+	"local u = setarray({}, 1, 'integer', 10, -5) "
+	"for i = 1, 10 do if u[i] ~= i - 6 or math.type(u[i]) ~= 'integer' then return false end end "
+	"local v = setarray({}, 1, 'number', 10) "
+	"for i = 1, 10 do if v[i] ~= (i - 1) / 2 or math.type(v[i]) ~= 'float' then return false end end "
+	"return #u == 10 and #v == 10 and count(t) == 300",
+
+	// lua_setarray from index 0 (like spi.readwrite), out of the array part,
+	// over elements in the array and in the hash part, and of nothing
+	"local t = setarray({}, 0, 'byte', 4, 1) "
+	"if t[0] ~= 1 or t[1] ~= 2 or t[3] ~= 4 or count(t) ~= 4 then return false end "
+	"t = setarray({}, 10, 'integer', 3, 7) "
+	"if t[1] ~= nil or t[10] ~= 7 or t[12] ~= 9 or count(t) ~= 3 then return false end "
+	"t = setarray({1, 2, 3, 4, 5}, 4, 'integer', 4, 40) "
+	"if count(t) ~= 7 or #t ~= 7 or t[3] ~= 3 or t[4] ~= 40 or t[7] ~= 43 then return false end "
+	"t = {} t[3] = 'x' t[2] = 'y' t.k = 'z' "
+	"setarray(t, 1, 'integer', 5) "
+	"if count(t) ~= 6 or t[2] ~= 1 or t[3] ~= 2 or t.k ~= 'z' then return false end "
+	"t = setarray({}, -2, 'integer', 5) "
+	"if count(t) ~= 5 or t[-2] ~= 0 or t[0] ~= 2 or t[2] ~= 4 then return false end "
+	"t = setarray({1}, 1, 'integer', 0) "
+	"return count(t) == 1 and t[1] == 1",
+
+	// lua_setarray grows the array part once, and doesn't allocate in a
+	// preallocated or cleared table. From index 0, t[0] goes to the hash
+	// part after the array part is filled.
+	"local t = table.create(1000) "
+	"local a, c = allocated() "
+	"setarray(t, 1, 'integer', 1000) "
+	"local a1, c1 = allocated() "
+	"if a1 ~= a or c1 ~= c then return false end "
+	"local u = {} "
+	"a, c = allocated() "
+	"setarray(u, 1, 'integer', 1000) "
+	"a1, c1 = allocated() "
+	"if c1 - c ~= 1 or #u ~= 1000 then return false end "
+	"for r = 1, 10 do cleartable(u) setarray(u, 1, 'number', 1000, r) end "
+	"local a2, c2 = allocated() "
+	"if a2 ~= a1 or c2 ~= c1 then return false end "
+	"local w = {} "
+	"a, c = allocated() "
+	"rawseti(w, 1, 1000) "
+	"a1, c1 = allocated() "
+	"if c1 - c <= 1 or u[1000] ~= (999 + 10) / 2 then return false end "
+	"a, c = allocated() "
+	"local z = setarray({}, 0, 'byte', 64) "
+	"a1, c1 = allocated() "
+	"rawseti({}, 0, 64) "
+	"local a2, c2 = allocated() "
+	"return c1 - c <= 4 and c2 - c1 > 2 * (c1 - c) and count(z) == 64 and z[0] == 0 and z[63] == 63",
+
+	NULL
+};
+
+// Samples of 16 values and 3 fields, filled from Lua, and buffers of 64
+// bytes, filled from C
+#define FILL \
+	"local keys = {'ts', 'id', 'ok'} " \
+	"local function fill(t, s) " \
+	"  for i = 1, 16 do t[i] = s + i end " \
+	"  t.ts = s t.id = 7 t.ok = true " \
+	"  return t " \
+	"end "
+
+static const struct {
+	const char *name;
+	const char *script;
+} benchs[] = {
+	{"{}",
+	 "for s = 1, n do local t = fill({}, s) end"},
+
+	{"table.create",
+	 "for s = 1, n do local t = fill(table.create(16, 3), s) end"},
+
+	{"table.clear",
+	 "local t = {} "
+	 "for s = 1, n do fill(table.clear(t), s) end"},
+
+	{"lua_rawseti",
+	 "for s = 1, n do local t = rawseti({}, 0, 64, s) end"},
+
+	{"lua_setarray",
+	 "for s = 1, n do local t = setarray({}, 0, 'byte', 64, s) end"},
+
+	{"lua_cleartable",
+	 "local t = {} "
+	 "for s = 1, n do setarray(cleartable(t), 0, 'byte', 64, s) end"},
+
+	{NULL, NULL}
+};
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static lua_State *newstate() {
+	lua_State *L = lua_newstate(alloc, NULL);
+
+	luaL_openlibs(L);
+	lua_register(L, "allocated", lallocated);
+	lua_register(L, "setarray", lsetarray);
+	lua_register(L, "rawseti", lrawseti);
+	lua_register(L, "cleartable", lcleartable);
+
+	return L;
+}
+
+// For the checks, the collector is stopped (it only runs if a script calls
+// collectgarbage) and the stack is grown, so that the bytes allocated by a
+// script are only those of its tables
+static lua_State *newcheckstate() {
+	lua_State *L = newstate();
+
+	lua_gc(L, LUA_GCSTOP, 0);
+	lua_checkstack(L, 1000);
+
+	return L;
+}
+
+int main(int argc, char **argv) {
+	double start, elapsed, best = 0;
+	const char **check;
+	char script[8192];
+	lua_State *L;
+	size_t bytes = 0;
+	int i, j, failed = 0;
+
+	for(check = checks; *check; check++) {
+		L = newcheckstate();
+
+		snprintf(script, sizeof(script), "%s %s", PRELUDE, *check);
+
+		if ((luaL_dostring(L, script) != LUA_OK) || !lua_toboolean(L, -1)) {
+			printf("FAIL: %s\n      %s\n", *check, lua_isstring(L, -1) ? lua_tostring(L, -1) : "false");
+			failed = 1;
+		}
+
+		lua_close(L);
+	}
+
+	if (failed) {
+		return 1;
+	}
+
+	for(i = 0; benchs[i].name; i++) {
+		for(j = 0; j < RUNS; j++) {
+			L = newstate();
+
+			snprintf(script, sizeof(script), "%s local n = %d return function() %s end",
+				FILL, SAMPLES, benchs[i].script);
+
+			if (luaL_dostring(L, script) != LUA_OK) {
+				printf("FAIL: %s: %s\n", benchs[i].name, lua_tostring(L, -1));
+				return 1;
+			}
+
+			allocated = 0;
+			start = now();
+			if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+				printf("FAIL: %s: %s\n", benchs[i].name, lua_tostring(L, -1));
+				return 1;
+			}
+			elapsed = now() - start;
+
+			if ((j == 0) || (elapsed < best)) {
+				best = elapsed;
+				bytes = allocated;
+			}
+
+			lua_close(L);
+		}
+
+		printf("%-16s %6.3f s, %7.1f bytes allocated per sample\n",
+			benchs[i].name, best, (double)bytes / SAMPLES);
+	}
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Lua RTOS, Lua threads, host test
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * Lua/modules/thread.c is included, so the keys of the stack profiles
+ * (thread_function_key) are checked directly:
+ *
+ * - closures of the same function share the key
+ * - other functions, and the same code in another chunk, get other keys
+ * - a function loaded again, after the first one is collected, gets the
+ *   same key, so the profile is kept, and can't be taken by another one
+ * - C functions, and functions of the console or of chunks loaded from
+ *   strings, are not profiled, as they can't be told apart by their chunk
+ *   name and lines
+ *
+ * The checks, and the burst, are loaded as files would be ("@name").
+ *
+ * Then a burst of 100 short Lua threads is started, and the time spent in
+ * thread.start, the tasks created, and the stack allocated for them are
+ * reported, with the pool statistics.
+ *
+ * The Makefile builds this test twice, with the default thread pool and
+ * without the pool (CONFIG_LUA_RTOS_LUA_THREAD_POOL_SIZE=0).
+ *
+ */
+
+#include "Lua/modules/thread.c"
+
+#include "lualib.h"
+#include "rtos_host.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define BURST 100
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+// Each script returns true on success. They get the key function as argument.
+static const char *checks[] = {
+	"local key = ... "
+	"local function new() return function() end end "
+	"return key(new()) == key(new()) and key(new()) ~= 0",
+
+	"local key = ... "
+	"local f = function() end\n"
+	"local g = function() return 1 end "
+	"return key(f) ~= key(g)",
+
+	"local key = ... "
+	"local src = 'return function() local a = 1 end' "
+	"local a = key(load(src, '@a.lua')()) "
+	"collectgarbage() "
+	"local b = key(load(src, '@b.lua')()) "
+	"collectgarbage() "
+	"return a ~= b and a == key(load(src, '@a.lua')())",
+
+	"local key = ... "
+	"return key(print) == 0",
+
+	// Console lines of the same size are different functions at line 1
+	"local key = ... "
+	"local shallow = load('return function() return 1 end', '=stdin')() "
+	"local deep = load('return function() return f() end', '=stdin')() "
+	"return key(shallow) == 0 and key(deep) == 0 and "
+	"key(load('return function() end')()) == 0 and key(load('return function() end', 'chunk')()) == 0",
+
+	NULL
+};
+
+static const char *burst =
+	"local now, n = ... "
+	"local done = 0 "
+	"local t0 = now() "
+	"for i = 1, n do "
+	"  thread.start(function() local s = 0 for j = 1, 100 do s = s + j end done = done + 1 end) "
+	"end "
+	"local t1 = now() "
+	"while done < n do thread.sleepms(1) end "
+	"local t2 = now() "
+	"thread.sleepms(100) "
+	"return t1 - t0, t2 - t0";
+
+static int key(lua_State *L) {
+	lua_pushinteger(L, (lua_Integer)thread_function_key(L));
+
+	return 1;
+}
+
+// Seconds since the first call, as lua_Number is a float
+static int now(lua_State *L) {
+	static double base = 0;
+	struct timespec ts;
+	double t;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	t = ts.tv_sec + ts.tv_nsec / 1e9;
+	if (!base) {
+		base = t;
+	}
+
+	lua_pushnumber(L, t - base);
+
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	const char **check;
+	double start, total;
+	int failed = 0;
+
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+
+	for(check = checks; *check; check++) {
+		if ((luaL_loadbuffer(L, *check, strlen(*check), "@check.lua") != LUA_OK) ||
+			(lua_pushcfunction(L, key), lua_pcall(L, 1, 1, 0) != LUA_OK) ||
+			!lua_toboolean(L, -1)) {
+			printf("FAIL: %s\n      %s\n", *check, lua_isstring(L, -1) ? lua_tostring(L, -1) : "false");
+			failed = 1;
+		}
+
+		lua_pop(L, 1);
+	}
+
+	luaL_loadbuffer(L, burst, strlen(burst), "@burst.lua");
+	lua_pushcfunction(L, now);
+	lua_pushinteger(L, BURST);
+	if (lua_pcall(L, 2, 2, 0) != LUA_OK) {
+		printf("FAIL: %s\n", lua_tostring(L, -1));
+		return 1;
+	}
+
+	start = lua_tonumber(L, -2);
+	total = lua_tonumber(L, -1);
+
+	printf("%d threads: %.1f us per thread.start, all done in %.1f ms\n", BURST, start * 1e6 / BURST, total * 1e3);
+	printf("pool: %u workers created, %u reused, %u run in a new task\n", pool_created, pool_reused, pool_fallback);
+	printf("tasks: %u created, %lu stack bytes allocated, %lu at most at the same time\n",
+		rtos_host_threads, rtos_host_stack, rtos_host_stack_max);
+
+	return failed;
+}
@@ -0,0 +1,245 @@
+/*
+ * Lua RTOS, host test and benchmark of the Lua VM
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * First, scripts that run superinstructions through their slow paths
+ * (metamethods, yields, hooks, debug information, dumps) are checked. Then
+ * each benchmark is run a few times, and the best time is reported.
+ *
+ * The Makefile builds this test twice, with and without superinstructions
+ * (LUA_USE_SUPERINSTRUCTIONS), to compare them.
+ *
+ */
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define RUNS 5
+
+// Host counterparts of the pthread signal queue (see pthread/pthread.c)
+volatile uint32_t _pthread_signal_pending = 0;
+
+void _pthread_process_signal(lua_State *L) {
+}
+
+// Each script returns true on success
+static const char *checks[] = {
+	// Module fields, and errors with the name of the missing field
+	"return string.format('%d', 7) == '7' and math.floor(2.5) == 2",
+	"local ok, e = pcall(function() return string.nofield.x end) "
+	"return not ok and string.find(e, \"field 'nofield'\") ~= nil",
+
+	// Addition with metamethods and floats that ends a loop
+	"local mt = {__add = function(a, b) return {v = a.v + b} end} "
+	"local s = setmetatable({v = 0}, mt) "
+	"for i = 1, 10 do s = s + i s = setmetatable(s, mt) end "
+	"local f = 0 for i = 1, 10 do f = f + 0.5 end "
+	"local g = 0 for i = 1.0, 3 do g = g + i end "
+	"return s.v == 55 and f == 5.0 and g == 6.0",
+
+	// Comparisons of every kind, and jumps that close upvalues
+	"local n = 0 "
+	"for i = 1, 10 do if i < 5 then n = n + 1 end if i <= 5 then n = n + 1 end "
+	"if i == 5 then n = n + 1 end if 1.5 < i then n = n + 1 end "
+	"if 'a' < 'b' then n = n + 1 end if i ~= 3 then n = n + 1 end end "
+	"local fs = {} for i = 1, 3 do local j = i if j == 2 then fs[#fs + 1] = function() return j end end end "
+	"return n == 4 + 5 + 1 + 9 + 10 + 9 and fs[1]() == 2",
+
+	// Yields inside metamethods of superinstructions
+	"local mt = {__lt = function(a, b) coroutine.yield() return a.v < b.v end, "
+	"__index = function(t, k) coroutine.yield() return k end, "
+	"__add = function(a, b) coroutine.yield() return a + b.v end} "
+	"local co = coroutine.wrap(function() "
+	"  local a, b, n = setmetatable({v = 1}, mt), setmetatable({v = 2}, mt), 0 "
+	"  if a < b then n = n + 1 end "
+	"  local t = setmetatable({}, mt) "
+	"  _ENV.xt = t "
+	"  if xt.field == 'field' then n = n + 1 end "
+	"  for i = 1, 2 do n = n + a end "
+	"  return n "
+	"end) "
+	"local r repeat r = co() until r "
+	"return r == 2 + 2",
+
+	// Count hook sees every instruction
+	"local function f() local s = 0 for i = 1, 100 do s = s + i end return s end "
+	"local count = 0 debug.sethook(function() count = count + 1 end, '', 1) "
+	"f() debug.sethook() "
+	"local count2 = 0 debug.sethook(function() count2 = count2 + 1 end, '', 1) "
+	"f() debug.sethook() "
+	"return count > 200 and count == count2",
+
+	// Dumps have base opcodes only, and load back
+	"local f = function(n) local s = 0 for i = 1, n do if i < 3 then s = s + i end end return s end "
+	"local g = load(string.dump(f)) "
+	"return g(10) == 3 and load(string.dump(f, true))(10) == 3",
+
+	NULL
+};
+
+static const struct {
+	const char *name;
+	const char *script;
+	const char *result;
+} benchs[] = {
+	{"fib",
+	 "local function fib(n) if n < 2 then return n end return fib(n - 1) + fib(n - 2) end "
+	 "return fib(30)",
+	 "832040"},
+
+	{"loops",
+	 "local s = 0 "
+	 "for r = 1, 10 do for i = 1, 1000000 do s = s + i end end "
+	 "for i = 1, 3000000 do if i % 3 == 0 then s = s - 1 end end "
+	 "local i = 0 while i < 5000000 do i = i + 1 end "
+	 "return s + i",
+	 "667067456"},
+
+	{"tables",
+	 "local t = {} for i = 1, 200000 do t[i] = i end "
+	 "local s = 0 for r = 1, 20 do for i = 1, #t do s = s + t[i] end end "
+	 "local p = {x = 1, y = 2} for i = 1, 3000000 do p.x = p.x + p.y end "
+	 "for i = 1, 1000000 do s = s + math.floor(i / 2) + math.abs(-i) end "
+	 "return s + p.x",
+	 "-1042735327"},
+
+	// Short string, integer and generic keys of RAM tables (OP_GETTABLE and
+	// OP_SETTABLE, luaH_getshortstr, luaH_getint and getgeneric)
+	{"fields",
+	 "local p = {x = 0, y = 1, z = 2, name = 'p'} "
+	 "for i = 1, 2000000 do p.x = p.x + p.y + p.z end "
+	 "local h = {} for i = 1, 1000 do h[i * 7] = i end "
+	 "local s = 0 for r = 1, 1000 do for i = 1, 1000 do s = s + h[i * 7] end end "
+	 "local g = {[true] = 1, [false] = 2, [0.5] = 3, [1.5] = 4} "
+	 "for i = 1, 1000000 do s = s + g[true] + g[0.5] + g[i % 2 == 0] + g[1.5] end "
+	 "return s + p.x",
+	 "516000000"},
+
+	// Method calls on objects with a class metatable (OP_SELF, with the
+	// method found through __index)
+	{"methods",
+	 "local Point = {} Point.__index = Point "
+	 "function Point.new(x, y) return setmetatable({x = x, y = y}, Point) end "
+	 "function Point:add(o) self.x = self.x + o.x self.y = self.y + o.y return self end "
+	 "function Point:len2() return self.x * self.x + self.y * self.y end "
+	 "local a, b, s = Point.new(0, 0), Point.new(1, 2), 0 "
+	 "for i = 1, 1000000 do a:add(b) s = s + a:len2() % 7 end "
+	 "return s + a.x + a.y",
+	 "6022597"},
+
+	// Fields of library rotables (OP_GETTABUP and OP_GETTABLE on rotables),
+	// and iteration of RAM tables and rotables (luaH_next)
+	{"rotables",
+	 "local s = 0 "
+	 "for i = 1, 1000000 do s = s + math.abs(-i) + math.max(i, 3) + string.byte('a') end "
+	 "local m = math for i = 1, 1000000 do s = s + m.floor(i / 3) + m.fmod(i, 2) end "
+	 "local t = {} for i = 1, 100 do t['k' .. i] = i end "
+	 "for r = 1, 10000 do for k, v in pairs(t) do s = s + v end end "
+	 "for r = 1, 10000 do for k, v in pairs(string) do s = s + 1 end end "
+	 "return s",
+	 "-1415424509"},
+
+	{"strings",
+	 "local n = 0 "
+	 "for i = 1, 300000 do local s = 'item' .. i "
+	 "  n = n + #s + string.len(s) "
+	 "  if string.sub(s, 1, 4) == 'item' then n = n + 1 end "
+	 "  n = n + string.byte(s, 1) end "
+	 "local parts = {} "
+	 "for i = 1, 100000 do parts[#parts + 1] = string.format('%d:%s', i, 'x') end "
+	 "return n + #table.concat(parts, ',')",
+	 "38366684"},
+
+	{NULL, NULL, NULL}
+};
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+	double start, elapsed, best;
+	const char **check;
+	lua_State *L;
+	int i, j, failed = 0;
+
+	for(check = checks; *check; check++) {
+		L = luaL_newstate();
+		luaL_openlibs(L);
+
+		if ((luaL_dostring(L, *check) != LUA_OK) || !lua_toboolean(L, -1)) {
+			printf("FAIL: %s\n      %s\n", *check, lua_isstring(L, -1) ? lua_tostring(L, -1) : "false");
+			failed = 1;
+		}
+
+		lua_close(L);
+	}
+
+	for(i = 0; benchs[i].name; i++) {
+		best = 0;
+
+		for(j = 0; j < RUNS; j++) {
+			L = luaL_newstate();
+			luaL_openlibs(L);
+
+			start = now();
+			if (luaL_dostring(L, benchs[i].script) != LUA_OK) {
+				printf("FAIL: %s: %s\n", benchs[i].name, lua_tostring(L, -1));
+				return 1;
+			}
+			elapsed = now() - start;
+
+			if (strcmp(lua_tostring(L, -1), benchs[i].result) != 0) {
+				printf("FAIL: %s: got %s, expected %s\n", benchs[i].name, lua_tostring(L, -1), benchs[i].result);
+				return 1;
+			}
+
+			lua_close(L);
+
+			if ((j == 0) || (elapsed < best)) {
+				best = elapsed;
+			}
+		}
+
+		printf("%-10s %7.3f s\n", benchs[i].name, best);
+	}
+
+	return failed;
+}
@@ -40,6 +40,13 @@
 extern char currdir[];
 
 char *getcwd(char *pt, size_t size) {
+	size_t len = strlen(currdir) + (*currdir != '/');
+
+	if (len + 1 > size) {
+		errno = ERANGE;
+		return NULL;
+	}
+
 	*pt = '\0';
 
 	if (*currdir != '/') {
@@ -52,13 +59,9 @@ char *getcwd(char *pt, size_t size) {
 }
 
 char *realpath(const char *path, char *resolved) {
-	char *fpath; // Full path
-
-	fpath = mount_resolve_to_physical(path);
-
-	strcpy(resolved,fpath);
-
-	free(fpath);
+	if (mount_resolve_to_physical_r(path, resolved, PATH_MAX + 1) < 0) {
+		return NULL;
+	}
 
 	return resolved;
 }
@@ -47,9 +47,13 @@
 static char sccsid[] = "@(#)syslog.c	8.5 (Berkeley) 4/29/95";
 #endif /* LIBC_SCCS and not lint */
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
 #include <sys/types.h>
 #include <sys/syslog.h>
 #include <sys/mount.h>
+#include <sys/mutex.h>
 
 #include <stdlib.h>
 #include <errno.h>
@@ -66,6 +70,60 @@ static char sccsid[] = "@(#)syslog.c	8.5 (Berkeley) 4/29/95";
 #include <varargs.h>
 #endif
 
+/*
+ * Messages are not formatted nor written by the caller. Instead, syslog
+ * stores a compact binary record (timestamp, priority, format pointer and
+ * the raw arguments) into an in-RAM ring, and a low priority task formats
+ * the pending records and writes them to the console / log file in batches.
+ *
+ * The format string is not copied, so it must be a string literal (or, in
+ * general, must live until the message is flushed). String arguments are
+ * copied into the record.
+ *
+ * Slots are reserved with a compare-and-swap on the ring head, so producers
+ * never take a lock, and a slot is published by writing its sequence number
+ * after the payload. A slot is only reused when it has been flushed, if the
+ * ring is full the message is dropped and counted.
+ */
+#ifndef SYSLOG_RING_SLOTS
+#define SYSLOG_RING_SLOTS 64            /* must be a power of 2 */
+#endif
+
+#define SYSLOG_RECORD_ARGS  76          /* bytes available for arguments, records are 96 bytes */
+#define SYSLOG_FLUSH_PERIOD 500         /* max ms between flushes */
+#ifndef SYSLOG_MAX_FILE
+#define SYSLOG_MAX_FILE     (32 * 1024) /* rotate log file at this size */
+#endif
+
+/*
+ * The flusher formats records with snprintf, and writes, renames and opens
+ * the log file (syslog_rotate) through the vfs and the file system, so it
+ * needs the stack of a task that does file I/O.
+ */
+#define SYSLOG_TASK_STACK   6144
+#define SYSLOG_TASK_PRIO    (tskIDLE_PRIORITY + 1)
+
+#define MAX_BUFF 128
+
+struct syslog_record {
+	volatile uint32_t seq;   /* sequence number + 1, 0 if not published */
+	uint32_t ticks;          /* ms since boot */
+	const char *fmt;
+	uint16_t pri;
+	int16_t  pid;
+	uint8_t  len;            /* used bytes in args */
+	uint8_t  truncated;      /* args don't fit */
+	uint8_t  args[SYSLOG_RECORD_ARGS];
+};
+
+static struct syslog_record ring[SYSLOG_RING_SLOTS];
+static volatile uint32_t ring_head = 0;    /* next sequence to reserve */
+static volatile uint32_t ring_flushed = 0; /* next sequence to flush */
+static volatile uint32_t ring_dropped = 0; /* dropped due to a full ring */
+
+static TaskHandle_t flusher = NULL;
+static struct mtx LogMtx;                  /* protects LogFile */
+
 static FILE *LogFile;
 static int 	 connected;		/* have done connect */
 static int	 LogStat = 0;		/* status bits, set by openlog() */
@@ -75,7 +133,388 @@ static int	LogMask = 0b11111111;		/* mask of priorities to be logged */
 extern char	*__progname;		/* Program name, from crt0. */
 
 void vsyslog(int pri, register const char *fmt, va_list app);
-	
+
+/*
+ * Walk a printf conversion specification starting after the '%'. Returns a
+ * pointer to the conversion character, and the length modifier in *lmod
+ * ('H' for hh, 'h', 'l', 'q' for ll, 'L', or 0). The precision is returned
+ * in *prec: -1 if there is no precision, or SYSLOG_PREC_ARG if it is given
+ * by the last '*' argument.
+ */
+#define SYSLOG_PREC_ARG -2
+
+static const char *syslog_spec(const char *p, int *lmod, int *stars, int *prec) {
+	*lmod = 0;
+	*stars = 0;
+	*prec = -1;
+
+	while (*p && strchr("-+ #0", *p)) p++;
+	if (*p == '*') {(*stars)++; p++;} else while ((*p >= '0') && (*p <= '9')) p++;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			(*stars)++;
+			*prec = SYSLOG_PREC_ARG;
+			p++;
+		} else {
+			*prec = 0;
+			while ((*p >= '0') && (*p <= '9')) {
+				*prec = *prec * 10 + (*p - '0');
+				p++;
+			}
+		}
+	}
+
+	switch (*p) {
+		case 'h': p++; if (*p == 'h') {*lmod = 'H'; p++;} else *lmod = 'h'; break;
+		case 'l': p++; if (*p == 'l') {*lmod = 'q'; p++;} else *lmod = 'l'; break;
+		case 'j': case 'q': p++; *lmod = 'q'; break;
+		case 'z': case 't': p++; *lmod = 'l'; break;
+		case 'L': p++; *lmod = 'L'; break;
+	}
+
+	return p;
+}
+
+#define syslog_put(rec, v) \
+	do { \
+		if ((rec)->len + sizeof(v) > SYSLOG_RECORD_ARGS) goto full; \
+		memcpy(&(rec)->args[(rec)->len], &(v), sizeof(v)); \
+		(rec)->len += sizeof(v); \
+	} while (0)
+
+#define syslog_get(rec, pos, v) \
+	do { \
+		if ((pos) + sizeof(v) > (rec)->len) goto full; \
+		memcpy(&(v), &(rec)->args[pos], sizeof(v)); \
+		(pos) += sizeof(v); \
+	} while (0)
+
+/* Capture the arguments required by fmt into the record */
+static void syslog_capture(struct syslog_record *rec, const char *fmt, va_list ap) {
+	const char *p = fmt;
+	int lmod, stars, prec;
+
+	rec->len = 0;
+	rec->truncated = 0;
+
+	while ((p = strchr(p, '%'))) {
+		p = syslog_spec(p + 1, &lmod, &stars, &prec);
+		if (!*p) break;
+
+		while (stars--) {
+			int i = va_arg(ap, int);
+			syslog_put(rec, i);
+
+			if ((stars == 0) && (prec == SYSLOG_PREC_ARG)) {
+				// A negative precision is taken as if it was omitted
+				prec = (i < 0)?-1:i;
+			}
+		}
+
+		switch (*p) {
+			case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+				if (lmod == 'q') {
+					long long ll = va_arg(ap, long long);
+					syslog_put(rec, ll);
+				} else if (lmod == 'l') {
+					long l = va_arg(ap, long);
+					syslog_put(rec, l);
+				} else {
+					int i = va_arg(ap, int);
+					syslog_put(rec, i);
+				}
+				break;
+
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+				double d = (lmod == 'L')?(double)va_arg(ap, long double):va_arg(ap, double);
+				syslog_put(rec, d);
+				break;
+			}
+
+			case 'p': {
+				void *ptr = va_arg(ap, void *);
+				syslog_put(rec, ptr);
+				break;
+			}
+
+			case 's': {
+				const char *s = va_arg(ap, const char *);
+				int len;
+
+				if (!s) s = "(null)";
+
+				// Don't read beyond the precision, s may be not terminated
+				len = (prec >= 0)?strnlen(s, prec):strlen(s);
+				if (rec->len + len + 1 > SYSLOG_RECORD_ARGS) {
+					len = SYSLOG_RECORD_ARGS - rec->len - 1;
+					rec->truncated = 1;
+				}
+				if (len < 0) goto full;
+
+				memcpy(&rec->args[rec->len], s, len);
+				rec->args[rec->len + len] = '\0';
+				rec->len += len + 1;
+				break;
+			}
+
+			case '%':
+			default:
+				break;
+		}
+
+		p++;
+	}
+
+	return;
+
+full:
+	rec->truncated = 1;
+}
+
+/*
+ * Format a record into buf, using the same rules than the capture. Each
+ * conversion is formatted separately with snprintf, replacing '*' by the
+ * captured value, so there is no need to rebuild a va_list.
+ */
+static int syslog_format(struct syslog_record *rec, char *buf, int size) {
+	const char *p = rec->fmt;
+	const char *spec;
+	char cspec[24];
+	char *out = buf;
+	int pos = 0;
+	int lmod, stars, prec;
+	int n;
+
+	#define room() (size - (out - buf))
+	#define advance(n) do {if ((n) > 0) out += ((n) < room())?(n):(room() - 1);} while (0)
+
+	if (LogStat & LOG_PID) {
+		n = snprintf(out, room(), "[%d]", rec->pid);
+		advance(n);
+	}
+
+	while (*p && (room() > 1)) {
+		if (*p != '%') {
+			*out++ = *p++;
+			continue;
+		}
+
+		spec = p;
+		p = syslog_spec(p + 1, &lmod, &stars, &prec);
+		if (!*p) break;
+
+		if (*p == '%') {
+			*out++ = '%';
+			p++;
+			continue;
+		}
+
+		// Copy the conversion specification, expanding '*'
+		char *c = cspec;
+		while ((spec <= p) && (c < cspec + sizeof(cspec) - 12)) {
+			if (*spec == '*') {
+				int i;
+				syslog_get(rec, pos, i);
+				if ((i < 0) && (c > cspec) && (*(c - 1) == '.')) {
+					// A negative precision is taken as if it was omitted
+					c--;
+				} else {
+					c += sprintf(c, "%d", i);
+				}
+			} else {
+				*c++ = *spec;
+			}
+			spec++;
+		}
+		*c = '\0';
+
+		switch (*p) {
+			case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+				if (lmod == 'q') {
+					long long ll;
+					syslog_get(rec, pos, ll);
+					n = snprintf(out, room(), cspec, ll);
+				} else if (lmod == 'l') {
+					long l;
+					syslog_get(rec, pos, l);
+					n = snprintf(out, room(), cspec, l);
+				} else {
+					int i;
+					syslog_get(rec, pos, i);
+					n = snprintf(out, room(), cspec, i);
+				}
+				break;
+
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+				double d;
+
+				if (lmod == 'L') {
+					// Captured as double
+					c = strchr(cspec, 'L');
+					memmove(c, c + 1, strlen(c));
+				}
+
+				syslog_get(rec, pos, d);
+				n = snprintf(out, room(), cspec, d);
+				break;
+			}
+
+			case 'p': {
+				void *ptr;
+				syslog_get(rec, pos, ptr);
+				n = snprintf(out, room(), cspec, ptr);
+				break;
+			}
+
+			case 's': {
+				const char *s = (const char *)&rec->args[pos];
+
+				if (pos >= rec->len) goto full;
+				pos += strlen(s) + 1;
+				n = snprintf(out, room(), cspec, s);
+				break;
+			}
+
+			default:
+				n = 0;
+				break;
+		}
+
+		advance(n);
+		p++;
+	}
+
+full:
+	*out = '\0';
+
+	// Remove end \r | \n
+	while ((out > buf) && ((*(out - 1) == '\r') || (*(out - 1) == '\n'))) {
+		*--out = '\0';
+	}
+
+	if (rec->truncated) {
+		n = snprintf(out, room(), " ...");
+		advance(n);
+	}
+
+	return out - buf;
+
+	#undef room
+	#undef advance
+}
+
+/*
+ * Copy the record with sequence number seq into rec, if it is still in the
+ * ring. Returns 0 if the record was overwritten, or is not published yet.
+ */
+static int syslog_read(uint32_t seq, struct syslog_record *rec) {
+	struct syslog_record *slot = &ring[seq & (SYSLOG_RING_SLOTS - 1)];
+
+	if (slot->seq != seq + 1) return 0;
+	memcpy(rec, slot, sizeof(struct syslog_record));
+	__sync_synchronize();
+
+	return ((rec->seq == seq + 1) && (slot->seq == seq + 1));
+}
+
+/* Rename the log file to messages.log.1 when it grows too much */
+static void syslog_rotate() {
+	const char *fname, *oname;
+
+	if (!connected || (ftell(LogFile) < SYSLOG_MAX_FILE)) return;
+
+	if (mount_is_mounted("spiffs")) {
+		fname = "/sd/log/messages.log";
+		oname = "/sd/log/messages.log.1";
+	} else {
+		fname = "/log/messages.log";
+		oname = "/log/messages.log.1";
+	}
+
+	fclose(LogFile);
+	unlink(oname);
+	rename(fname, oname);
+
+	LogFile = fopen(fname, "a+");
+	connected = (LogFile != NULL);
+}
+
+/* Format and write all the published records */
+static void syslog_flush() {
+	struct syslog_record rec;
+	uint32_t dropped;
+	int written = 0;
+	char *tbuf;
+	int fd;
+	int cnt;
+
+	tbuf = (char *)malloc(MAX_BUFF + 20);
+	if (!tbuf) return;
+
+	fd = fileno(_GLOBAL_REENT->_stdout);
+
+	mtx_lock(&LogMtx);
+
+	while (ring_flushed != ring_head) {
+		if (!syslog_read(ring_flushed, &rec)) {
+			// Reserved but not published yet
+			break;
+		}
+
+		cnt = syslog_format(&rec, tbuf, MAX_BUFF);
+
+		if (LogStat & LOG_CONS) {
+			tbuf[cnt] = '\r';
+			tbuf[cnt + 1] = '\n';
+			(void)write(fd, tbuf, cnt + 2);
+		}
+
+		if (connected) {
+			tbuf[cnt] = '\n';
+			fwrite(tbuf, cnt + 1, 1, LogFile);
+			written = 1;
+		}
+
+		// Slot can be reused from now
+		__sync_synchronize();
+		ring_flushed++;
+	}
+
+	dropped = __sync_fetch_and_and(&ring_dropped, 0);
+	if (dropped) {
+		cnt = snprintf(tbuf, MAX_BUFF, "syslog: %u messages dropped", (unsigned)dropped);
+
+		if (LogStat & LOG_CONS) {
+			tbuf[cnt] = '\r';
+			tbuf[cnt + 1] = '\n';
+			(void)write(fd, tbuf, cnt + 2);
+		}
+
+		if (connected) {
+			tbuf[cnt] = '\n';
+			fwrite(tbuf, cnt + 1, 1, LogFile);
+			written = 1;
+		}
+	}
+
+	if (written) {
+		fflush(LogFile);
+		syslog_rotate();
+	}
+
+	mtx_unlock(&LogMtx);
+
+	free(tbuf);
+}
+
+static void syslog_task(void *arg) {
+	for(;;) {
+		ulTaskNotifyTake(pdTRUE, SYSLOG_FLUSH_PERIOD / portTICK_PERIOD_MS);
+		syslog_flush();
+	}
+}
+
 /*
  * syslog, vsyslog --
  *	print message on log file; output is intended for syslogd(8).
@@ -109,90 +548,82 @@ vsyslog(pri, fmt, ap)
 	register const char *fmt;
 	va_list ap;
 {
-	register int cnt;
-	register char *p;
-	char *tbuf;
+	struct syslog_record *rec;
+	uint32_t seq;
 
 	if (!fmt) return;
 
-	time_t now;
-	int fd;
-        int has_cr_lf = 0;
-        
-        #define MAX_BUFF 128
-        register int size;
-        
-        cnt = strlen(fmt) - 1;
-        has_cr_lf = ((fmt[cnt] == '\n') || (fmt[cnt - 1] == '\r'));
-        
-        #define	INTERNALLOG LOG_ERR|LOG_CONS|LOG_PERROR|LOG_PID
-        
 	/* Check for invalid bits. */
 	if (pri & ~(LOG_PRIMASK|LOG_FACMASK)) {
-            pri &= LOG_PRIMASK|LOG_FACMASK;
+		pri &= LOG_PRIMASK|LOG_FACMASK;
 	}
 
 	/* Check priority against setlogmask values. */
 	if (!(LOG_MASK(LOG_PRI(pri)) & LogMask))
-            return;
+		return;
 
-	// Allocate space
-	tbuf = (char *)malloc(MAX_BUFF + 20);
-	if (!tbuf) return;
-	
 	/* Set default facility if none specified. */
 	if ((pri & LOG_FACMASK) == 0)
-            pri |= LogFacility;
-
-	/* Build the message. */
-        size = MAX_BUFF;
-        
-	(void)time(&now);
-	p = tbuf + snprintf(tbuf, size, "<%d>", pri);
-	if ((size = MAX_BUFF - (p - tbuf)) < 0) size = 0;
-        
-	if (LogStat & LOG_PID) {
-            p += snprintf(p, size, "[%d]", getpid());
-            if ((size = MAX_BUFF - (p - tbuf)) < 0) size = 0;
-        }
-        
-	p += vsnprintf(p, size, fmt, ap);
-        if ((size = MAX_BUFF - (p - tbuf)) < 0) size = 0;
-        
-	cnt = p - tbuf;
-        
-	if (LogStat & LOG_CONS) {
-            fd = fileno(_GLOBAL_REENT->_stdout);
-            if (!has_cr_lf) {
-                (void)strcat(tbuf, "\r\n");
-                cnt += 2;
-                
-                has_cr_lf = 1;
-            }
-            
-            p = index(tbuf, '>') + 1;
-            (void)write(fd, p, cnt - (p - tbuf));            
-	}
-        
-        if (connected) {
-            char *t = tbuf + strlen(tbuf) - 1;
-            
-            // Remove end \r | \n
-            while ((*t == '\r') || (*t == '\n')) {
-                *t = '\0';
-                t--;
-            }
-            
-            (void)strcat(tbuf, "\n");
-            cnt += 1;
-            
-            p = index(tbuf, '>') + 1;
-            
-            fwrite(p, cnt - (p - tbuf), 1, LogFile);
-            fflush(LogFile);
-        }
-        
-        free(tbuf);
+		pri |= LogFacility;
+
+	/*
+	 * Reserve a slot. Until the flusher is running old records are
+	 * overwritten, so they are only kept for dmesg.
+	 */
+	do {
+		seq = ring_head;
+		if (flusher && (seq - ring_flushed >= SYSLOG_RING_SLOTS)) {
+			__sync_fetch_and_add(&ring_dropped, 1);
+			return;
+		}
+	} while (!__sync_bool_compare_and_swap(&ring_head, seq, seq + 1));
+
+	rec = &ring[seq & (SYSLOG_RING_SLOTS - 1)];
+
+	rec->seq = 0;
+	__sync_synchronize();
+
+	rec->ticks = xTaskGetTickCount() * portTICK_PERIOD_MS;
+	rec->fmt = fmt;
+	rec->pri = pri;
+	rec->pid = (LogStat & LOG_PID)?getpid():0;
+
+	syslog_capture(rec, fmt, ap);
+
+	/* Publish */
+	__sync_synchronize();
+	rec->seq = seq + 1;
+
+	if (flusher) {
+		xTaskNotifyGive(flusher);
+	} else {
+		ring_flushed = ring_head;
+	}
+}
+
+/*
+ * Format the record next to *seq that is still in the ring into buf, used
+ * by dmesg. Returns the message length, or -1 if there are no more records.
+ */
+int syslog_dmesg(uint32_t *seq, char *buf, int size) {
+	struct syslog_record rec;
+	uint32_t head = ring_head;
+	int cnt;
+
+	if (head - *seq > SYSLOG_RING_SLOTS) {
+		*seq = head - SYSLOG_RING_SLOTS;
+	}
+
+	while (*seq != head) {
+		if (syslog_read((*seq)++, &rec)) {
+			cnt = snprintf(buf, size, "[%5u.%03u] ", (unsigned)(rec.ticks / 1000), (unsigned)(rec.ticks % 1000));
+			if (cnt >= size) cnt = size - 1;
+
+			return cnt + syslog_format(&rec, buf + cnt, size - cnt);
+		}
+	}
+
+	return -1;
 }
 
 void openlog(ident, logstat, logfac)
@@ -202,6 +633,15 @@ void openlog(ident, logstat, logfac)
     if (ident != NULL)
         LogTag = ident;
 
+    if (!flusher) {
+        mtx_init(&LogMtx, NULL, NULL, 0);
+    } else {
+        // Flush pending messages with the current settings
+        syslog_flush();
+    }
+
+    mtx_lock(&LogMtx);
+
     LogStat = logstat;
     if (logfac != 0 && (logfac &~ LOG_FACMASK) == 0)
         LogFacility = logfac;
@@ -222,16 +662,31 @@ void openlog(ident, logstat, logfac)
     
     connected = (LogFile != NULL);	
     if (connected) {
-        fflush(LogFile);
+        fseek(LogFile, 0, SEEK_END);
+    }
+
+    mtx_unlock(&LogMtx);
+
+    if (!flusher) {
+        xTaskCreate(syslog_task, "syslog", SYSLOG_TASK_STACK, NULL, SYSLOG_TASK_PRIO, &flusher);
     }
 }
 
 void closelog() {
+    if (flusher) {
+        syslog_flush();
+        mtx_lock(&LogMtx);
+    }
+
     if (connected) {
         fclose(LogFile);
     }
     
     connected = 0;
+
+    if (flusher) {
+        mtx_unlock(&LogMtx);
+    }
 }
 
 /* setlogmask -- set the log mask level */
@@ -264,7 +264,8 @@ static int IRAM_ATTR vfs_fat_fstat(int fd, struct stat * st) {
     	tm_info.tm_hour = fno.ftime >> 11;
     	tm_info.tm_min = fno.ftime >> 5 & 63;
     	tm_info.tm_sec = (fno.ftime & 31) << 1;		// second * 2
-    	st->st_atime = mktime(&tm_info);
+    	tm_info.tm_isdst = -1;
+    	st->st_mtime = st->st_atime = mktime(&tm_info);
     } else {
         st->st_size = 0;
 
@@ -41,9 +41,12 @@
 #include <string.h>
 #include <stdio.h>
 
+#include <sys/stat.h>
+
 static int IRAM_ATTR vfs_net_open(const char *path, int flags, int mode);
 static size_t IRAM_ATTR vfs_net_write(int fd, const void *data, size_t size);
 static ssize_t IRAM_ATTR vfs_net_read(int fd, void * dst, size_t size);
+static int IRAM_ATTR vfs_net_fstat(int fd, struct stat * st);
 static int IRAM_ATTR vfs_net_close(int fd);
 
 static int IRAM_ATTR vfs_net_open(const char *path, int flags, int mode) {
@@ -63,6 +66,13 @@ static ssize_t IRAM_ATTR vfs_net_read(int fd, void * dst, size_t size) {
     return (ssize_t)lwip_recv(fd, dst, size, 0);
 }
 
+// Sockets are identified by vfs_poll with S_IFSOCK
+static int IRAM_ATTR vfs_net_fstat(int fd, struct stat * st) {
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = S_IFSOCK;
+    return 0;
+}
+
 static int IRAM_ATTR vfs_net_close(int fd) {
 	return closesocket(fd);
 }
@@ -73,7 +83,7 @@ void vfs_net_register() {
         .flags = ESP_VFS_FLAG_DEFAULT,
         .write = &vfs_net_write,
         .open = &vfs_net_open,
-        .fstat = NULL,
+        .fstat = &vfs_net_fstat,
         .close = &vfs_net_close,
         .read = &vfs_net_read,
         .lseek = NULL,
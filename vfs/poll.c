@@ -0,0 +1,166 @@
+/*
+ * Lua RTOS, readiness of file descriptors across vfs
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * vfs_poll waits until some of a set of file descriptors are ready for read or
+ * write, like poll does, but across the vfs registered by Lua RTOS:
+ *
+ * - Sockets (/dev/socket vfs) are waited with a single lwip select.
+ * - ttys (/dev/tty vfs), and UART units given as VFS_POLL_UART(unit), are ready
+ *   for read when the UART queue has data. The UART driver signals received bytes,
+ *   so a wait only for UART units doesn't need to poll the queues.
+ * - Other files (spiffs, fat) never block, so they are always ready.
+ *
+ * When sockets and UART units are waited at the same time, the lwip select is done
+ * in slices of VFS_POLL_SLICE milliseconds, checking the UART queues between them.
+ *
+ */
+
+#include "luartos.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <drivers/uart.h>
+
+#include <vfs.h>
+
+// Milliseconds since boot. The wall clock is not used, as it's moved by
+// sntp, or when the RTC is set, and tv_sec * 1000 overflows a 32 bit time_t.
+static uint32_t vfs_poll_now() {
+	return (uint32_t)xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+// Get the UART unit for a file descriptor, or -1 if it's not a tty / UART.
+// Sockets are marked with VFS_POLLSOCKET, and files and errors are resolved.
+static int vfs_poll_classify(struct vfs_pollfd *pfd) {
+	struct stat st;
+
+	if (VFS_POLL_IS_UART(pfd->fd)) {
+		return -1 - pfd->fd;
+	}
+
+	if (fstat(pfd->fd, &st) < 0) {
+		pfd->revents = VFS_POLLERR;
+	} else if (S_ISSOCK(st.st_mode)) {
+		pfd->revents = VFS_POLLSOCKET;
+	} else if (S_ISCHR(st.st_mode)) {
+		// In the tty vfs the local file descriptor is the UART unit
+		return pfd->fd & ((1 << CONFIG_MAX_FD_BITS) - 1);
+	} else {
+		pfd->revents = pfd->events & (VFS_POLLIN | VFS_POLLOUT);
+	}
+
+	return -1;
+}
+
+int vfs_poll(struct vfs_pollfd *fds, int nfds, int timeout) {
+	uint32_t start = vfs_poll_now();
+	int ready, sockets, uarts;
+	int unit, wait, elapsed;
+	int i;
+
+	for(;;) {
+		ready = 0;
+		sockets = 0;
+		uarts = 0;
+
+		for(i=0;i < nfds;i++) {
+			fds[i].revents = 0;
+
+			unit = vfs_poll_classify(&fds[i]);
+			if (unit >= 0) {
+				if ((unit >= NUART) || !uart_is_setup(unit)) {
+					fds[i].revents = VFS_POLLERR;
+				} else {
+					uarts++;
+
+					if ((fds[i].events & VFS_POLLIN) && uart_bytes_available(unit)) {
+						fds[i].revents |= VFS_POLLIN;
+					}
+
+					// Writes to the UART only wait for room in the TX FIFO
+					if (fds[i].events & VFS_POLLOUT) {
+						fds[i].revents |= VFS_POLLOUT;
+					}
+				}
+			}
+
+			if (fds[i].revents & VFS_POLLSOCKET) {
+				sockets++;
+			} else if (fds[i].revents) {
+				ready++;
+			}
+		}
+
+		// Get how much time we can wait
+		elapsed = (int32_t)(vfs_poll_now() - start);
+
+		if (ready || (timeout == 0)) {
+			wait = 0;
+		} else if (timeout < 0) {
+			wait = -1;
+		} else {
+			wait = timeout - elapsed;
+			if (wait < 0) {
+				wait = 0;
+			}
+		}
+
+		// The UART signal is shared by all the waiters, so UART waits are done in slices
+		if (uarts && ((wait < 0) || (wait > VFS_POLL_SLICE))) {
+			wait = VFS_POLL_SLICE;
+		}
+
+		if (sockets) {
+			ready += lwip_poll_sockets(fds, nfds, wait);
+		} else if (uarts && wait) {
+			uart_wait_rx(wait);
+		} else if (wait > 0) {
+			usleep(wait * 1000);
+		} else if (wait < 0) {
+			// Nothing to wait for
+			return 0;
+		}
+
+		if (ready) {
+			return ready;
+		}
+
+		if ((timeout >= 0) && ((int32_t)(vfs_poll_now() - start) >= timeout)) {
+			return 0;
+		}
+	}
+}
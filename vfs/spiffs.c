@@ -295,6 +295,9 @@ static int IRAM_ATTR vfs_spiffs_fstat(int fd, struct stat * st) {
 	// Set block size for this file system
     st->st_blksize = SPIFFS_LOG_PAGE_SIZE;
 
+    // SPIFFS doesn't keep modification times
+    st->st_mtime = 0;
+
     // First test if it's a directory entry
     if (file->is_dir) {
         st->st_mode = S_IFDIR;
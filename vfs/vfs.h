@@ -27,7 +27,43 @@
  * this software.
  */
 
+#ifndef _VFS_H_
+#define _VFS_H_
+
 void vfs_fat_register();
 void vfs_net_register();
 void vfs_spiffs_register();
 void vfs_tty_register();
+
+/*
+ * Readiness of file descriptors, across the registered vfs (see vfs/poll.c)
+ *
+ */
+
+// Events
+#define VFS_POLLIN     (1 << 0)  // Data can be read without blocking
+#define VFS_POLLOUT    (1 << 1)  // Data can be written without blocking
+#define VFS_POLLERR    (1 << 2)  // Invalid descriptor, or error
+
+// Set by vfs_poll in revents for socket entries, before calling
+// lwip_poll_sockets. Not returned to the caller.
+#define VFS_POLLSOCKET (1 << 7)
+
+// Descriptor for a UART unit that is not opened through the tty vfs
+#define VFS_POLL_UART(unit) (-1 - (unit))
+#define VFS_POLL_IS_UART(fd) (((fd) < 0) && ((fd) >= VFS_POLL_UART(2)))
+
+// Maximum time, in milliseconds, that vfs_poll blocks in a single wait
+// when it must wait for sockets and UART units at the same time
+#define VFS_POLL_SLICE 10
+
+struct vfs_pollfd {
+	int   fd;        // File descriptor, or VFS_POLL_UART(unit)
+	short events;    // Requested events
+	short revents;   // Returned events
+};
+
+int vfs_poll(struct vfs_pollfd *fds, int nfds, int timeout);
+int lwip_poll_sockets(struct vfs_pollfd *fds, int nfds, int timeout);
+
+#endif